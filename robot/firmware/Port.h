@@ -1,48 +1,75 @@
+#include "TeensyFrame.h"
+
 //Object to control the I/O functions of the robot
+//Incoming bytes are assembled into frames (see TeensyFrame.h), and outgoing responses
+//are collected in the write buffer and sent as one frame per host request
 class Port {
   private:
-    static const int packet_size_ = 128;
-  
-    void EmptyReadBuffer() {
-      for(int i = 0; i < packet_size_; ++i){
-          read_buffer_[i] = 0x00;
-        }
-    }
+    TeensyFrameParser parser_;
 
-    void EmptyWriteBuffer() {
-      for(int i = 0; i < packet_size_; ++i){
-          write_buffer_[i] = 0x00;
-        }
-    }
-    
   public:
-    byte read_buffer_[packet_size_] = {0x00};
-    byte write_buffer_[packet_size_] = {0x00};
+    //Payload of the last frame received, and the request sequence number it carried
+    byte read_buffer_[TEENSY_MAX_PAYLOAD] = {0x00};
+    unsigned int read_length_ = 0;
+    byte read_seq_ = 0;
+
+    //Payload of the frame being built, and the request it answers
+    byte write_buffer_[TEENSY_MAX_PAYLOAD] = {0x00};
     unsigned int first_empty_ = 0;
+    byte write_seq_ = 0;
+
     unsigned int read_timer_ = 0;
     unsigned int write_timer_ = 0;
 
+    //Frames rejected because of a bad checksum or length
+    unsigned int frame_errors_ = 0;
+
     void WriteMessage(){
-      unsigned int timer_start = micros();
-      for(int j = 0; j < packet_size_; j++){
-        Serial.write(write_buffer_[j]);
+      if(first_empty_ == 0){
+        return;
       }
+      unsigned int timer_start = micros();
+      byte frame[TEENSY_MAX_FRAME];
+      int frame_len = TeensyEncodeFrame(write_seq_, write_buffer_, first_empty_, frame);
+      Serial.write(frame, frame_len);
       Serial.send_now();
-      EmptyWriteBuffer();
       first_empty_ = 0;
       unsigned int timer_end = micros();
       write_timer_ = timer_end-timer_start; // Measure the time that writing of the message took in microseconds
     }
 
-    void ReadMessage(){
-      EmptyReadBuffer();
-      int j = 0;
+    //Start (or continue) the response frame for request seq. Responses to different
+    //requests never share a frame, so the host can tell which request they answer.
+    //Returns the first free index of the write buffer once bytes more will fit.
+    unsigned int Reserve(byte seq, unsigned int bytes){
+      if(first_empty_ > 0 && (seq != write_seq_ || first_empty_ + bytes > TEENSY_MAX_PAYLOAD)){
+        WriteMessage();
+      }
+      write_seq_ = seq;
+      return first_empty_;
+    }
+
+    //Read the available bytes until a complete frame has arrived. Returns true if
+    //a frame is in read_buffer_ (any bytes after it are kept for the next call).
+    bool ReadMessage(){
       unsigned int timer_start = micros();
-      while(Serial.available()>0){
-        read_buffer_[j] = Serial.read();
-        j += 1;
+      bool ready = parser_.Next();
+      while(!ready && Serial.available()>0){
+        ready = parser_.Feed(Serial.read());
+      }
+      if(parser_.checksum_errors != frame_errors_){
+        frame_errors_ = parser_.checksum_errors;
+        unsigned int i = Reserve(0, 1);
+        write_buffer_[i] = 0xFF; //PackFail
+        first_empty_ = i+1;
+      }
+      if(ready){
+        memcpy(read_buffer_, parser_.payload, parser_.len);
+        read_length_ = parser_.len;
+        read_seq_ = parser_.seq;
       }
       unsigned int timer_end = micros();
       read_timer_ = timer_end-timer_start; // Measure the time that reading of the message took in microseconds
+      return ready;
     }
 };
@@ -4,14 +4,16 @@
 #include "Decode.h"
 #include "MotorDriver.h"
 #include "AccelerometerReader.h"
+#include "TeensyFrame.h"
 #include "Port.h"
 #include "Commands.h"
+#include "CommandTable.h"
 #include "ErrorCodes.h"
 
 //This integer notes that the device is the motion control teensy and the second value 
 //is the firmware version for motion control
 unsigned short int DeviceID  = 128;
-unsigned short int FirmwareV = 2;
+unsigned short int FirmwareV = 5;
 
 unsigned int scheduler_time_longest = 0;
 
@@ -20,6 +22,7 @@ class Controller {
     static const int sched_length_ = 50;
     int sched_state_ = 0;
     int sched_[sched_length_] = {0x00}; //Since variable length arrays are not allowed in C++ we just define an array which is too big
+                                        //Tasks requested by the host hold the request sequence number in bits 8-15
   
     
     short int v_int_ [7] = {0}; 
@@ -27,6 +30,13 @@ class Controller {
     AccelerometerReader accelerometer_reader;
     struct Triple accel_buffer_[6];
 
+    //The last ROBOT_STREAM_SAMPLES samples of the snapshot accelerometers for AccStream, laid
+    //out as in the response. A sample is taken once per pass of the schedule, when the last
+    //axis of the last of them has been read, and stamped with micros() at that point.
+    byte stream_buffer_[ROBOT_STREAM_SAMPLES][ROBOT_STREAM_SAMPLE_BYTES];
+    unsigned int stream_taken_ = 0; //Samples taken since startup
+    unsigned int stream_sent_ = 0;  //Samples taken before the last AccStream response
+
     Port port;
     unsigned int temp_ = 0; //This will be used to temporarily store the next available memory write buffer location
 
@@ -62,395 +72,127 @@ class Controller {
 
     //Reads the incoming packet and sets the schedule in accordance with the commands in the packet
     void DecodePacket(){
-      if(port.read_buffer_[0] == 0xFF){
-      //We loop over the message portion of the packet
-        for(int i = 1; i < 125; i = i+3){
-        switch(port.read_buffer_[i]){
-          case SetRaw0:
-            //Read the input velocity and write it into the motor driver
-            v_int_[0] = (port.read_buffer_[i+1] << 8) | (port.read_buffer_[i+2] << 0);
-            motor_driver.SetRawVelocity(0,v_int_[0]);
-            break;
-          case SetRaw1:
-            //Read the input velocity and write it into the motor driver
-            v_int_[1] = (port.read_buffer_[i+1] << 8) | (port.read_buffer_[i+2] << 0);
-            motor_driver.SetRawVelocity(1,v_int_[1]);
-            break;
-          case SetRaw2:
-            //Read the input velocity and write it into the motor driver
-            v_int_[2] = (port.read_buffer_[i+1] << 8) | (port.read_buffer_[i+2] << 0);
-            motor_driver.SetRawVelocity(2,v_int_[2]);
-            break;
-          case SetRaw3:
-            //Read the input velocity and write it into the motor driver
-            v_int_[3] = (port.read_buffer_[i+1] << 8) | (port.read_buffer_[i+2] << 0);
-            motor_driver.SetRawVelocity(3,v_int_[3]);
-            break;
-          case SetRaw4:
-            //Read the input velocity and write it into the motor driver
-            v_int_[4] = (port.read_buffer_[i+1] << 8) | (port.read_buffer_[i+2] << 0);
-            motor_driver.SetRawVelocity(4,v_int_[4]);
-            break;
-          case SetRaw5:
-            //Read the input velocity and write it into the motor driver
-            v_int_[5] = (port.read_buffer_[i+1] << 8) | (port.read_buffer_[i+2] << 0);
-            motor_driver.SetRawVelocity(5,v_int_[5]);
-            break;
-          case SetRaw6:
-            //Read the input velocity and write it into the motor driver
-            v_int_[6] = (port.read_buffer_[i+1] << 8) | (port.read_buffer_[i+2] << 0);
-            motor_driver.SetRawVelocity(6,v_int_[6]);
-            break;
-          case Acc0Wr:
-            if(ScheduleToNextFree(Acc0Wr) == 0){ //We check if the task was scheduled and if it was then we move on
-              break;
-            } else {
-              ReportError(SchedFull); //We send back an error code if the task couldn't be scheduled
-              break;
-            }
-          case Acc1Wr:
-            if(ScheduleToNextFree(Acc1Wr) == 0){ 
-              break;
-            } else {
-              ReportError(SchedFull);
-              break;
-            }
-          case Acc2Wr:
-            if(ScheduleToNextFree(Acc2Wr) == 0){ 
-              break;
-            } else {
-              ReportError(SchedFull);
-              break;
-            }
-          case Acc3Wr:
-            if(ScheduleToNextFree(Acc3Wr) == 0){ 
-              break;
-            } else {
-              ReportError(SchedFull);
-              break;
-            }
-          case Acc4Wr:
-            if(ScheduleToNextFree(Acc4Wr) == 0){ 
-              break;
-            } else {
-              ReportError(SchedFull);
-              break;
-            }
-          case Acc5Wr:
-            if(ScheduleToNextFree(Acc5Wr) == 0){ 
-              break;
-            } else {
-              ReportError(SchedFull);
-              break;
-            }
-          
-          case Raw0Wr:
-            if(ScheduleToNextFree(Raw0Wr) == 0){ 
-              break;
-            } else {
-              ReportError(SchedFull);
-              break;
-            }
-          case Raw1Wr:
-            if(ScheduleToNextFree(Raw1Wr) == 0){ 
-              break;
-            } else {
-              ReportError(SchedFull);
-              break;
-            }
-          case Raw2Wr:
-            if(ScheduleToNextFree(Raw2Wr) == 0){ 
-              break;
-            } else {
-              ReportError(SchedFull);
-              break;
-            }
-          case Raw3Wr:
-            if(ScheduleToNextFree(Raw3Wr) == 0){ 
-              break;
-            } else {
-              ReportError(SchedFull);
-              break;
-            }
-          case Raw4Wr:
-            if(ScheduleToNextFree(Raw4Wr) == 0){ 
-              break;
-            } else {
-              ReportError(SchedFull);
-              break;
-            }
-          case Raw5Wr:
-            if(ScheduleToNextFree(Raw5Wr) == 0){ 
-              break;
-            } else {
-              ReportError(SchedFull);
-              break;
-            }
-          case Raw6Wr:
-            if(ScheduleToNextFree(Raw6Wr) == 0){ 
-              break;
-            } else {
-              ReportError(SchedFull);
-              break;
-            }
-          case Step0Wr:
-            if(ScheduleToNextFree(Step0Wr) == 0){ 
-              break;
-            } else {
-              ReportError(SchedFull);
-              break;
-            }
-          case Step1Wr:
-            if(ScheduleToNextFree(Step1Wr) == 0){ 
-              break;
-            } else {
-              ReportError(SchedFull);
-              break;
-            }
-          case Step2Wr:
-            if(ScheduleToNextFree(Step2Wr) == 0){ 
-              break;
-            } else {
-              ReportError(SchedFull);
-              break;
-            }
-          case Step3Wr:
-            if(ScheduleToNextFree(Step3Wr) == 0){ 
-              break;
-            } else {
-              ReportError(SchedFull);
-              break;
-            }
-          case Step4Wr:
-            if(ScheduleToNextFree(Step4Wr) == 0){ 
-              break;
-            } else {
-              ReportError(SchedFull);
-              break;
-            }
-          case Step5Wr:
-            if(ScheduleToNextFree(Step5Wr) == 0){ 
-              break;
-            } else {
-              ReportError(SchedFull);
-              break;
-            }
-          case Step6Wr:
-            if(ScheduleToNextFree(Step6Wr) == 0){ 
-              break;
-            } else {
-              ReportError(SchedFull);
-              break;
-            }
-          
-          case RUNTIME:
-            if(ScheduleToNextFree(RUNTIME) == 0){ 
-              break;
-            } else {
-              ReportError(SchedFull);
-              break;
-            }
-          case STOP: //When we receive a STOP command we set all motor velocities to zero
-            motor_driver.SetRawVelocity(0,0);
-            motor_driver.SetRawVelocity(1,0);
-            motor_driver.SetRawVelocity(2,0);
-            motor_driver.SetRawVelocity(3,0);
-            motor_driver.SetRawVelocity(4,0);
-            motor_driver.SetRawVelocity(5,0);
-            motor_driver.SetRawVelocity(6,0);
-            break;
-
-          case ResetSteps: //When we receive a ResetStepCount command we set all step count varibles to zero
-            motor_driver.ResetStepCount();
-            break;
-
-          case ID: //We we receive an ID request we send back the DeviceID
-            if(ScheduleToNextFree(ID) == 0){ 
-              break;
-            } else {
-              ReportError(SchedFull);
-              break;
-            }
-          
-          case EMPTY:
-            break;
-            
-          default:
-            //If we receive a value we don't recognise, we report an error to the host
-            ReportError(UnrecVal);
-            break;
+      //We loop over the commands in the payload, whose sizes are given by CommandTable.h
+      for(unsigned int i = 0; i < port.read_length_; i += RobotRequestSize(port.read_buffer_[i])){
+        byte code = port.read_buffer_[i];
+        const RobotCommand *command = FindRobotCommand(code);
+        if(code == EMPTY || i + RobotRequestSize(code) > port.read_length_){
+          continue;
+        } else if(command == nullptr){
+          //If we receive a value we don't recognise, we report an error to the host
+          ReportError(UnrecVal);
+        } else if(command->kind == KIND_SET_VEL){
+          //Read the input velocity and write it into the motor driver
+          v_int_[command->index] = (port.read_buffer_[i+1] << 8) | (port.read_buffer_[i+2] << 0);
+          motor_driver.SetRawVelocity(command->index, v_int_[command->index]);
+        } else if(command->kind == KIND_SET_VEL_ALL){
+          for(int j = 0; j < ROBOT_NUM_MOTORS; ++j){
+            v_int_[j] = (port.read_buffer_[i+1+2*j] << 8) | (port.read_buffer_[i+2+2*j] << 0);
+            motor_driver.SetRawVelocity(j, v_int_[j]);
+          }
+        } else if(command->response_bytes >= 0){
+          //Responses are written from the scheduler; if the task couldn't be scheduled we send back an error code
+          if(ScheduleToNextFree(code) != 0){
+            ReportError(SchedFull);
+          }
+        } else if(code == STOP){ //When we receive a STOP command we set all motor velocities to zero
+          for(int j = 0; j < ROBOT_NUM_MOTORS; ++j){
+            motor_driver.SetRawVelocity(j,0);
           }
+        } else if(code == ResetSteps){ //When we receive a ResetStepCount command we set all step count varibles to zero
+          motor_driver.ResetStepCount();
         }
       }
-      else{
-        //If the packet doesn't begin correctly we report an error to the host
-        ReportError(PackFail);
-      }
     }
 
     int ScheduleToNextFree(byte task){
+      //Tag the task with the request it came from, so that its response goes in that request's frame
+      int tagged_task = task | (port.read_seq_ << 8);
       for(int j = sched_state_+1; j < sched_length_; ++j){
         if(sched_[j] == EMPTY){
-          sched_[j] = task;
+          sched_[j] = tagged_task;
           return 0;
           }
       }
       for(int j = 0; j < sched_state_; ++j){
         if(sched_[j] == EMPTY){
-          sched_[j] = task;
+          sched_[j] = tagged_task;
           return 0;
         }
        }
        return -1;//In the event that it fails to find a spot in the schedule we return a -1
     }
 
-    void WriteAcc(int index){
-      //Decode and push the values from an accelerometer into the Port's write_buffer
-
-      //Check if the write buffer is full, and if so send the message (recall that we want our packets to end in three 0x00s hence we 
-       //only fill up to index 61)
-      temp_ = port.first_empty_;
-      if(port.first_empty_ + 7 > 125){
-        port.WriteMessage();
-      }
-      
-      temp_ = port.first_empty_;
-      switch(index){
-        case 0:
-          port.write_buffer_[temp_] = Acc0Wr;
+    //Write the response to a command into the Port's write_buffer (sending the current frame
+    //first if it is full or answers another request). The layout is given by CommandTable.h
+    void WriteResponse(const RobotCommand &command, byte seq){
+      temp_ = port.Reserve(seq, 1 + command.response_bytes);
+      byte *out = &port.write_buffer_[temp_];
+      out[0] = command.code; //We repeat the command call as an acknowledgement and to indicate the value follows
+      switch(command.kind){
+        case KIND_ACCEL:
+          out[1] = accel_buffer_[command.index].x[0];
+          out[2] = accel_buffer_[command.index].x[1];
+          out[3] = accel_buffer_[command.index].y[0];
+          out[4] = accel_buffer_[command.index].y[1];
+          out[5] = accel_buffer_[command.index].z[0];
+          out[6] = accel_buffer_[command.index].z[1];
           break;
-        case 1:
-          port.write_buffer_[temp_] = Acc1Wr;
+        case KIND_VEL:
+          //The raw velocity, in the same units as SetRaw
+          ShortIntToBytes(motor_driver.motor_vels_[command.index], &out[1], &out[2]);
           break;
-        case 2:
-          port.write_buffer_[temp_] = Acc2Wr;
+        case KIND_STEPS:
+          IntToBytes(motor_driver.step_count_[command.index], &out[1], &out[2], &out[3], &out[4]);
           break;
-        case 3:
-          port.write_buffer_[temp_] = Acc3Wr;
-          break;
-        case 4:
-          port.write_buffer_[temp_] = Acc4Wr;
-          break;
-        case 5:
-          port.write_buffer_[temp_] = Acc5Wr;
-          break;
-      }
-      port.write_buffer_[temp_+1] = accel_buffer_[index].x[0];
-      port.write_buffer_[temp_+2] = accel_buffer_[index].x[1];
-      port.write_buffer_[temp_+3] = accel_buffer_[index].y[0];
-      port.write_buffer_[temp_+4] = accel_buffer_[index].y[1];
-      port.write_buffer_[temp_+5] = accel_buffer_[index].z[0];
-      port.write_buffer_[temp_+6] = accel_buffer_[index].z[1];
-      port.first_empty_ = temp_ + 7;
-    }
-
-    void WriteVel(int index){
-      //write one of the velocities of the robot into the Port's write_buffer
-      //For convenience we send it as an int which represents the velocity in microm/s
-
-       //Check if the write buffer is full, and if so send the message (recall that we want our packets to end in three 0x00s hence we 
-       //only fill up to index 61)
-      temp_ = port.first_empty_;
-      if(temp_ + 3 > 125){
-        port.WriteMessage();
-      }
-
-      //Write into the write buffer
-      temp_ = port.first_empty_;
-      switch(index){
-        case 0:
-          port.write_buffer_[temp_] = Raw0Wr;
+        case KIND_RUNTIME:
+          IntToBytes(scheduler_time_longest, &out[1], &out[2], &out[3], &out[4]);
           break;
-        case 1:
-          port.write_buffer_[temp_] = Raw1Wr;
+        case KIND_ID:
+          out[1] = DeviceID;
+          out[2] = FirmwareV;
           break;
-        case 2:
-          port.write_buffer_[temp_] = Raw2Wr;
-          break;
-        case 3:
-          port.write_buffer_[temp_] = Raw3Wr;
-          break;
-        case 4:
-          port.write_buffer_[temp_] = Raw4Wr;
-          break;
-        case 5:
-          port.write_buffer_[temp_] = Raw5Wr;
+        case KIND_SNAPSHOT:
+          IntToBytes(micros(), &out[1+ROBOT_SNAPSHOT_TIME], &out[2+ROBOT_SNAPSHOT_TIME], &out[3+ROBOT_SNAPSHOT_TIME], &out[4+ROBOT_SNAPSHOT_TIME]);
+          for(int j = 0; j < ROBOT_SNAPSHOT_ACCELEROMETERS; ++j){
+            memcpy(&out[1+ROBOT_SNAPSHOT_ACCEL+6*j], &accel_buffer_[j], 6);
+          }
+          for(int j = 0; j < ROBOT_NUM_MOTORS; ++j){
+            byte *steps = &out[1+ROBOT_SNAPSHOT_STEPS+4*j];
+            IntToBytes(motor_driver.step_count_[j], &steps[0], &steps[1], &steps[2], &steps[3]);
+          }
           break;
-        case 6:
-          port.write_buffer_[temp_] = Raw6Wr;
+        case KIND_ACC_STREAM: {
+          //Samples the host was too slow to collect are overwritten; it sees the gap in the times
+          if(stream_taken_ - stream_sent_ > ROBOT_STREAM_SAMPLES){
+            stream_sent_ = stream_taken_ - ROBOT_STREAM_SAMPLES;
+          }
+          byte count = stream_taken_ - stream_sent_;
+          out[1] = count;
+          memset(&out[2], 0, ROBOT_STREAM_SAMPLES*ROBOT_STREAM_SAMPLE_BYTES);
+          for(int k = 0; k < count; ++k){
+            memcpy(&out[2+k*ROBOT_STREAM_SAMPLE_BYTES], stream_buffer_[(stream_sent_+k) % ROBOT_STREAM_SAMPLES], ROBOT_STREAM_SAMPLE_BYTES);
+          }
+          stream_sent_ = stream_taken_;
           break;
-      }
-      short int v_temp = 1000000*motor_driver.motor_vels_[index];
-      ShortIntToBytes(v_temp, &port.write_buffer_[temp_+1], &port.write_buffer_[temp_+2]);
-      port.first_empty_ = temp_ + 3;
-    }
-
-        //Write the runtime value into the message buffer.
-    void WriteRuntime(){;
-        //Check if the write buffer is full, and if so send the message (recall that we want our packets to end in three 0x00s hence we 
-        //only fill up to index 61)
-        temp_ = port.first_empty_;
-        if(temp_ + 5 > 125){
-          port.WriteMessage();
-        }
-      
-        temp_ = port.first_empty_;
-        port.write_buffer_[temp_] = RUNTIME; //We repeat the command call as an acknowledgement and to indicate the next 4 bytes are the value
-        IntToBytes(scheduler_time_longest, &port.write_buffer_[temp_+1], &port.write_buffer_[temp_+2], &port.write_buffer_[temp_+3], &port.write_buffer_[temp_+4]);
-        port.first_empty_ = temp_+5; //update the first empty value in the write buffer
-    }
-
-    //Write a steps value into the message buffer.
-    void WriteSteps(int index){;
-        //Check if the write buffer is full, and if so send the message (recall that we want our packets to end in three 0x00s hence we 
-        //only fill up to index 61)
-        temp_ = port.first_empty_;
-        if(temp_ + 5 > 125){
-          port.WriteMessage();
         }
-      
-        temp_ = port.first_empty_;
-        //We repeat the command call as an acknowledgement and to indicate the next 4 bytes are the value
-        switch(index){
-        case 0:
-          port.write_buffer_[temp_] = Step0Wr;
-          break;
-        case 1:
-          port.write_buffer_[temp_] = Step1Wr;
-          break;
-        case 2:
-          port.write_buffer_[temp_] = Step2Wr;
-          break;
-        case 3:
-          port.write_buffer_[temp_] = Step3Wr;
-          break;
-        case 4:
-          port.write_buffer_[temp_] = Step4Wr;
-          break;
-        case 5:
-          port.write_buffer_[temp_] = Step5Wr;
-          break;
-        case 6:
-          port.write_buffer_[temp_] = Step6Wr;
-          break;  
       }
-      
-        IntToBytes(motor_driver.step_count_[index], &port.write_buffer_[temp_+1], &port.write_buffer_[temp_+2], &port.write_buffer_[temp_+3], &port.write_buffer_[temp_+4]);
-        port.first_empty_ = temp_+5; //update the first empty value in the write buffer
+      port.first_empty_ = temp_ + 1 + command.response_bytes; //update the first empty value in the write buffer
     }
 
-    //Function to grab the Teensy's firmware device ID and push it in a packet
-    void WriteID() {
-      temp_ = port.first_empty_;
-      port.write_buffer_[temp_] = ID;
-      port.write_buffer_[temp_+1] = DeviceID;
-      port.write_buffer_[temp_+2] = FirmwareV;
-      port.first_empty_ = temp_+3;
+    //Store the latest reading of the snapshot accelerometers as a stream sample
+    void TakeStreamSample(){
+      byte *sample = stream_buffer_[stream_taken_ % ROBOT_STREAM_SAMPLES];
+      IntToBytes(micros(), &sample[0], &sample[1], &sample[2], &sample[3]);
+      for(int j = 0; j < ROBOT_SNAPSHOT_ACCELEROMETERS; ++j){
+        memcpy(&sample[4+6*j], &accel_buffer_[j], 6);
+      }
+      stream_taken_ += 1;
     }
 
     //Subroutine to write an error message back to the host.
     void ReportError(byte error_code){
-      temp_ = port.first_empty_;
+      temp_ = port.Reserve(port.read_seq_, 1);
       port.write_buffer_[temp_] = error_code;
       port.first_empty_ = temp_+1;
     }
@@ -475,7 +217,8 @@ class Controller {
      UpdatePositions();
 
      //the following checks which command code is referenced at this point in the schedule and runs that command
-     switch(sched_[sched_state_]){
+     byte seq = sched_[sched_state_] >> 8;
+     switch(sched_[sched_state_] & 0xFF){
 
       //Read the 2 bytes of an accelerometer axis and store it in the acceleration buffer
       case Acc0ReX:
@@ -504,6 +247,7 @@ class Controller {
         break;
       case Acc2ReZ:
         accelerometer_reader.GetZ(2,accel_buffer_[2].z);
+        TakeStreamSample();
         break;
       case Acc3ReX:
         accelerometer_reader.GetX(3,accel_buffer_[3].x);
@@ -533,104 +277,21 @@ class Controller {
         accelerometer_reader.GetZ(5,accel_buffer_[5].z);
         break;
 
-      //Push the values from the acceleration buffer to the write buffer
-      case Acc0Wr:
-        WriteAcc(0);
-        sched_[sched_state_] = EMPTY;
-        break;
-      case Acc1Wr:
-        WriteAcc(1);
-        sched_[sched_state_] = EMPTY;
-        break;
-      case Acc2Wr:
-        WriteAcc(2);
-        sched_[sched_state_] = EMPTY;
-        break;
-      case Acc3Wr:
-        WriteAcc(3);
-        sched_[sched_state_] = EMPTY;
-        break;
-      case Acc4Wr:
-        WriteAcc(4);
-        sched_[sched_state_] = EMPTY;
-        break;
-      case Acc5Wr:
-        WriteAcc(5);
-        sched_[sched_state_] = EMPTY;
-        break;
-
-      case Raw0Wr:
-        WriteVel(0);
-        sched_[sched_state_] = EMPTY;
-        break;
-      case Raw1Wr:
-        WriteVel(1);
-        sched_[sched_state_] = EMPTY;
-        break;
-      case Raw2Wr:
-        WriteVel(2);
-        sched_[sched_state_] = EMPTY;
-        break;
-      case Raw3Wr:
-        WriteVel(3);
-        sched_[sched_state_] = EMPTY;
-        break;
-      case Raw4Wr:
-        WriteVel(4);
-        sched_[sched_state_] = EMPTY;
-        break;
-      case Raw5Wr:
-        WriteVel(5);
-        sched_[sched_state_] = EMPTY;
-        break;
-      case Raw6Wr:
-        WriteVel(6);
-        sched_[sched_state_] = EMPTY;
-        break;
-      case Step0Wr:
-        WriteSteps(0);
-        sched_[sched_state_] = EMPTY;
-        break;
-      case Step1Wr:
-        WriteSteps(1);
-        sched_[sched_state_] = EMPTY;
-        break;
-      case Step2Wr:
-        WriteSteps(2);
-        sched_[sched_state_] = EMPTY;
-        break;
-      case Step3Wr:
-        WriteSteps(3);
-        sched_[sched_state_] = EMPTY;
-        break;
-      case Step4Wr:
-        WriteSteps(4);
-        sched_[sched_state_] = EMPTY;
-        break;
-      case Step5Wr:
-        WriteSteps(5);
-        sched_[sched_state_] = EMPTY;
-        break;
-      case Step6Wr:
-        WriteSteps(6);
-        sched_[sched_state_] = EMPTY;
-        break;
-      case RUNTIME:
-        WriteRuntime();
-        sched_[sched_state_] = EMPTY;
-        break;
-      case ID:
-        WriteID();
-        sched_[sched_state_] = EMPTY;
-        break;
-        
       default:
-        //If there is a message we read it
-        if(Serial.available() > 0){
-          port.ReadMessage();
+        //Push the response to a host request into the write buffer
+        if(sched_[sched_state_] != EMPTY){
+          const RobotCommand *command = FindRobotCommand(sched_[sched_state_] & 0xFF);
+          if(command != nullptr && command->response_bytes >= 0){
+            WriteResponse(*command, seq);
+          }
+          sched_[sched_state_] = EMPTY;
+          break;
+        }
+        //If a complete frame has arrived we decode it
+        if(port.ReadMessage()){
           DecodePacket();
           break;
-        } else if(port.write_buffer_[0] != 0x00){//If there is a message to send we send it
+        } else if(port.first_empty_ != 0){//If there is a message to send we send it
           port.WriteMessage();
           break;
         }
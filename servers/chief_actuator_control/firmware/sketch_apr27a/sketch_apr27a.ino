@@ -11,6 +11,7 @@
 //#define DEBUG
 
 #include <Wire.h>
+#include "TeensyFrame.h"
 #include "DFRobot_INA219.h"
 #include "MMC5883.h"
 
@@ -27,12 +28,14 @@ volatile int prev = 0;
 
 
 byte latest_message = 0x00;
-byte read_buffer_[128] = {0x00};
-byte write_buffer_[128] = {0x00};
+TeensyFrameParser parser;
+byte read_buffer_[TEENSY_MAX_PAYLOAD] = {0x00};
+byte write_buffer_[TEENSY_MAX_PAYLOAD] = {0x00};
 volatile int write_index = 0;
+byte write_seq = 0;
 
 unsigned short int DeviceID  = 130;
-unsigned short int FirmwareV = 2;
+unsigned short int FirmwareV = 3;
 
 DFRobot_INA219_IIC     ina2193(&Wire1, INA219_I2C_ADDRESS3);
 DFRobot_INA219_IIC     ina2194(&Wire1, INA219_I2C_ADDRESS4);
@@ -72,27 +75,29 @@ int16_t PC_Current = 0;
 int16_t Motor_Voltage = 0;
 int16_t Motor_Current = 0;
 
+// Send the responses in the write buffer as one frame, tagged with the request they answer
 void writeMessage() {
-  Serial.write(write_buffer_, 64);
+  byte frame[TEENSY_MAX_FRAME];
+  int frame_len = TeensyEncodeFrame(write_seq, write_buffer_, write_index, frame);
+  Serial.write(frame, frame_len);
   Serial.send_now();
-  for (int i = 0; i < 128; i++) {
-    write_buffer_[i] = 0x00;
-  }
+  write_index = 0;
 }
 
+// Read the available bytes, and once a complete frame (see TeensyFrame.h) has arrived
+// run its commands and send back the responses
 void readMessage() {
-  if (Serial.available()) {
+  bool ready = parser.Next();
+  while (!ready && Serial.available()) {
+    ready = parser.Feed(Serial.read());
+  }
+  if (ready) {
+    int len = parser.len;
+    memcpy(read_buffer_, parser.payload, len);
+    write_seq = parser.seq;
     int i = 0;
-    while (Serial.available()) {
-      read_buffer_[i] = Serial.read();
-      i += 1;
-    }
-    i = 0;
-    while (i < 128) {
+    while (i < len) {
       switch(read_buffer_[i]) {
-        case START:
-          i += 1;
-          break;
         case TID:
           //digitalWrite(ledPin, HIGH);
           write_buffer_[write_index] = TID;
@@ -137,7 +142,7 @@ void readMessage() {
           write_buffer_[write_index + 5] = duty_cycles[4];
           write_index += 6;
           //writeMessage();
-          i += 1;
+          i += 3; // Commands from the host are padded to 3 bytes
           break;
         case SETSDC:
           period = ((uint16_t)read_buffer_[i+6] << 8) | (uint32_t)read_buffer_[i+5];
@@ -155,10 +160,10 @@ void readMessage() {
           write_buffer_[write_index + 6] = (period >> 8) & 0xFF;
           write_index += 7;
           //writeMessage();
-          i += 1;
+          i += 3;
           break;
         case EMPTY:
-          i = 128;
+          i = len;
           break;
         default:
           i += 1;
@@ -167,10 +172,6 @@ void readMessage() {
     }
     if (write_index != 0) {
       writeMessage();
-      write_index = 0;
-    }
-    for (int i = 0; i < 128; i++) {
-      read_buffer_[i] = 0x00;
     }
   }
 }
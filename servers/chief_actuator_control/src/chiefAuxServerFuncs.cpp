@@ -4,6 +4,7 @@
 #include <commander/commander.h>
 #include <time.h>
 #include <cstdlib>
+#include <unistd.h>
 #include "SerialPort.h"
 #include "chiefAuxGlobals.hpp"
 
@@ -151,7 +152,6 @@ struct ChiefAuxServer {
             // Request current position
             teensy_port.Request(GETSDC);
             teensy_port.SendAllRequests();
-            usleep(150);
             teensy_port.ReadMessage();
             // Check if done, exit if it iss
             if (teensy_port.current_step == 0){
@@ -342,7 +342,6 @@ struct ChiefAuxServer {
     int32_t getSDCpos(){
         teensy_port.Request(GETSDC);
         teensy_port.SendAllRequests();
-        usleep(150);
         teensy_port.ReadMessage();
         // Recall that negative values are towards the centre of the injection system from home
         SDC_step_count = -teensy_port.current_step; 
@@ -356,7 +355,6 @@ struct ChiefAuxServer {
         teensy_port.Request(WATTMETER);
         teensy_port.Request(GETSDC);
         teensy_port.SendAllRequests();
-        usleep(150);
         teensy_port.ReadMessage();
         
         // Update values
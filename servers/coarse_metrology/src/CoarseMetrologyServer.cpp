@@ -9,6 +9,7 @@
 #include <pthread.h>
 #include "globals.h"
 #include "image.hpp"
+#include "telemetry.hpp"
 #include <opencv2/opencv.hpp>
 
 
@@ -37,6 +38,10 @@ std::string GLOB_DA_TCP = "NOFILESAVED"; //Dep Aux TCP address
 commander::client::Socket* RB_SOCKET; //Robot commander socket
 commander::client::Socket* DA_SOCKET; //Dep Aux commander socket
 
+//Binary log of the measured LED positions (read with libs/telemetry/read_telemetry.py)
+telemetry::Logger GLOB_CM_LED_LOG("led_positions", {{"LED1_x", telemetry::F64}, {"LED1_y", telemetry::F64},
+                                                   {"LED2_x", telemetry::F64}, {"LED2_y", telemetry::F64}});
+
 //Serialiser for commander
 namespace nlohmann {
     template <>
@@ -133,17 +138,8 @@ int CM_Callback (unsigned short* data){
             cout << "LED1: (" << positions.LED1_x << ", " << positions.LED1_y << ")" << endl;
             cout << "LED2: (" << positions.LED2_x << ", " << positions.LED2_y << ")" << endl;
 
-            // Log LED positions to file
-            auto t = std::time(nullptr);
-            auto tm = *std::localtime(&t);
-            std::ofstream logfile("/home/pyxisuser/pyxis/servers/coarse_metrology/data/led_positions.log", std::ios::app);
-            if (logfile.is_open()) {
-                logfile << std::fixed << std::setprecision(2)
-                        << "LED1: " << positions.LED1_x << "," << positions.LED1_y << ","
-                        << "LED2: " << positions.LED2_x << "," << positions.LED2_y << ","
-                        << "Timestamp: " << std::put_time(&tm, "%Y-%m-%d %H:%M:%S") << std::endl; // Add timestamp
-                logfile.close();
-    }
+            // Log LED positions to the telemetry file
+            GLOB_CM_LED_LOG.log(positions.LED1_x, positions.LED1_y, positions.LED2_x, positions.LED2_y);
 
             //ZMQ CLIENT SEND TO DEPUTY ROBOT positions
             //RB_SOCKET->send<int>("RC.receive_LED_positions", positions);
@@ -189,6 +185,7 @@ struct CoarseMet: FLIRCameraServer{
         std::string RB_port = config["CoarseMet"]["RB_port"].value_or("4000");
         std::string DA_port = config["CoarseMet"]["DA_port"].value_or("4000");
         std::string IP = config["CoarseMet"]["IP"].value_or("192.168.1.4");
+        std::string log_prefix = config["CoarseMet"]["log_prefix"].value_or("/home/pyxisuser/pyxis/servers/coarse_metrology/data/led_positions");
 
         // Turn into a TCPString
         GLOB_RB_TCP = "tcp://" + IP + ":" + RB_port;
@@ -196,6 +193,9 @@ struct CoarseMet: FLIRCameraServer{
         
         RB_SOCKET = new commander::client::Socket(GLOB_RB_TCP);
         DA_SOCKET = new commander::client::Socket(GLOB_DA_TCP);
+
+        // LED position telemetry, one file per server run
+        GLOB_CM_LED_LOG.open(telemetry::timestampedFilename(log_prefix));
     
     }
     
@@ -3,9 +3,14 @@
 #include <iostream>
 #include <fstream>
 #include <commander/commander.h>
+#include "toml.hpp"
 #include "FLIRcamServerFuncs.h"
+#include "FrameSolver.h"
+#include "PlateSolutionJson.h"
+#include "AttitudeLink.h"
 
-//PLATE SOLVER SENDS ZMQ REQUEST OF GET LATEST FILENAME TO PLATESOLVE. THAT'S ABOUT ALL THE INTERACTIONS!
+//PLATE SOLVER SENDS ZMQ REQUEST OF GET LATEST FILENAME TO PLATESOLVE, OR (WITH [PlateSolver] solve_frames)
+//ASKS THIS SERVER TO SOLVE THE LATEST FRAME. THAT'S ABOUT ALL THE INTERACTIONS!
 
 /*
 Callback function to do nothing!
@@ -21,7 +26,67 @@ int NoCallback (unsigned short* data){
 // FLIR Camera Server
 struct CoarseStarTracker: FLIRCameraServer{
 
+    // Solves the latest frame in memory, if solve_frames is set
+    FrameSolver frame_solver;
+
+    // Converts the solutions to offsets from the target, and sends them to the robot controller
+    AttitudeLink attitude_link;
+
     CoarseStarTracker() : FLIRCameraServer(NoCallback){
+
+        toml::table config = toml::parse_file(GLOB_CONFIGFILE);
+        if (config["PlateSolver"]["solve_frames"].value_or(false)){
+            std::string solver_config = config["PlateSolver"]["config"].value_or("../plate_solver/astrometry_coarse.toml");
+            std::string debug_output = config["PlateSolver"]["debug_output"].value_or("");
+            frame_solver.Init(solver_config, debug_output);
+            attitude_link.Init(solver_config);
+        }
+    }
+
+    /*
+    Function to plate solve the latest frame, without saving it
+    Inputs:
+        offset_x, offset_y - offset of the WCS reference pixel (tip/tilt correction)
+        est_flag - 1 to search only around the estimated position
+        ra, dec - estimated position (deg)
+    Output:
+        The WCS solution (solved = 0 if the frame did not solve)
+    */
+    PlateSolution solve(double offset_x, double offset_y, int est_flag, double ra, double dec){
+        PlateSolution solution;
+        if (!frame_solver.ready()){
+            std::cout << "Frame solving is off (solve_frames in the config)" << std::endl;
+            return solution;
+        }
+        std::vector<unsigned short> frame;
+        int width, height;
+        if (CopyLatestFrame(&frame, &width, &height)){
+            std::cout << "Camera Not Running!" << std::endl;
+            return solution;
+        }
+        FrameRequest request;
+        request.ref_offset_x = offset_x;
+        request.ref_offset_y = offset_y;
+        request.use_estimate = est_flag;
+        request.est_ra = ra;
+        request.est_dec = dec;
+        frame_solver.Solve(frame.data(), width, height, request, &solution);
+        return solution;
+    }
+
+    /*
+    Function to plate solve the latest frame as solve does, and convert the solution to the
+    azimuth, altitude and position angle offsets to a target. If send_angles is set in the
+    plate solver config, the offsets are sent straight to the robot controller
+    Inputs:
+        offset_x, offset_y, est_flag, ra, dec - as solve
+        target_ra, target_dec - target position (deg)
+    Output:
+        The WCS solution, with the offsets (radians) and whether they were sent
+    */
+    AttitudeSolution solve_attitude(double offset_x, double offset_y, int est_flag, double ra, double dec,
+                                    double target_ra, double target_dec){
+        return attitude_link.Convert(solve(offset_x, offset_y, est_flag, ra, dec), target_ra, target_dec);
     }
 
 };
@@ -48,6 +113,8 @@ COMMANDER_REGISTER(m)
         .def("reconfigure_buffersize", &CoarseStarTracker::reconfigure_buffersize, "Reconfigure the buffer size [buffer size in frames]")
         .def("reconfigure_savedir", &CoarseStarTracker::reconfigure_savedir, "Reconfigure the save directory [save directory as a string]")
         .def("getparams", &CoarseStarTracker::getparams, "Get all parameters")
-        .def("resetUSBPort", &CoarseStarTracker::resetUSBPort, "Reset the USB port on the HUB [string HUB name, string port number]");
+        .def("resetUSBPort", &CoarseStarTracker::resetUSBPort, "Reset the USB port on the HUB [string HUB name, string port number]")
+        .def("solve", &CoarseStarTracker::solve, "Plate solve the latest frame [ref pixel x offset, y offset, estimate flag, estimated ra, dec]")
+        .def("solve_attitude", &CoarseStarTracker::solve_attitude, "Plate solve the latest frame and send the offsets to a target to the robot [ref pixel x offset, y offset, estimate flag, estimated ra, dec, target ra, dec]");
         
 }
@@ -17,11 +17,12 @@ byte latest_message = 0x00;
 #define LEDOFF 0x32
 
 #include <Wire.h>
+#include "TeensyFrame.h"
 #include "DFRobot_INA219.h"
 
 
 unsigned short int DeviceID  = 128;
-unsigned short int FirmwareV = 2;
+unsigned short int FirmwareV = 3;
 
 DFRobot_INA219_IIC     ina2193(&Wire1, INA219_I2C_ADDRESS3);
 DFRobot_INA219_IIC     ina2194(&Wire1, INA219_I2C_ADDRESS4);
@@ -37,36 +38,41 @@ MMC5883MA MMC5883(Wire);
 
 int ledPin = 15;
 
-byte read_buffer_[64] = {0x00};
-byte write_buffer_[64] = {0x00};
+TeensyFrameParser parser;
+byte read_buffer_[TEENSY_MAX_PAYLOAD] = {0x00};
+byte write_buffer_[TEENSY_MAX_PAYLOAD] = {0x00};
+int write_index = 0;
+byte write_seq = 0;
 
+// Send the responses in the write buffer as one frame, tagged with the request they answer
 void writeMessage() {
-  Serial.write(write_buffer_, 64);
+  byte frame[TEENSY_MAX_FRAME];
+  int frame_len = TeensyEncodeFrame(write_seq, write_buffer_, write_index, frame);
+  Serial.write(frame, frame_len);
   Serial.send_now();
-  for (int i = 0; i < 64; i++) {
-    write_buffer_[i] = 0x00;
-  }
+  write_index = 0;
 }
 
+// Read the available bytes, and once a complete frame (see TeensyFrame.h) has arrived
+// run its commands and send back the responses
 void readMessage() {
-  if (Serial.available()) {
+  bool ready = parser.Next();
+  while (!ready && Serial.available()) {
+    ready = parser.Feed(Serial.read());
+  }
+  if (ready) {
+    int len = parser.len;
+    memcpy(read_buffer_, parser.payload, len);
+    write_seq = parser.seq;
     int i = 0;
-    while (Serial.available()) {
-      read_buffer_[i] = Serial.read();
-      i += 1;
-    }
-    i = 0;
-    while (i < 64) {
+    while (i < len) {
       switch(read_buffer_[i]) {
-        case START:
-          i += 1;
-          break;
         case TID:
           //digitalWrite(ledPin, HIGH);
-          write_buffer_[0] = TID;
-          write_buffer_[1] = DeviceID;
-          write_buffer_[2] = FirmwareV;
-          writeMessage();
+          write_buffer_[write_index] = TID;
+          write_buffer_[write_index + 1] = DeviceID;
+          write_buffer_[write_index + 2] = FirmwareV;
+          write_index += 3;
           i += 3;
           break;
         case VOLTAGE:
@@ -79,24 +85,27 @@ void readMessage() {
           break;
         case LEDON:
           digitalWrite(ledPin, HIGH);
-          write_buffer_[0] = LEDON;
-          writeMessage();
+          write_buffer_[write_index] = LEDON;
+          write_index += 1;
           i += 3;
           break;
         case LEDOFF:
           digitalWrite(ledPin, LOW);
-          write_buffer_[0] = LEDOFF;
-          writeMessage();
+          write_buffer_[write_index] = LEDOFF;
+          write_index += 1;
           i += 3;
           break;
         case EMPTY:
-          i = 64;
+          i = len;
           break;
         default:
           i += 1;
           break;
       }
     }
+    if (write_index != 0) {
+      writeMessage();
+    }
   }
 }
 
@@ -1,295 +1,74 @@
 //SerialPort.cpp
 #include "SerialPort.h"
 #include <iostream>
-#include <iomanip>
 
 using namespace Comms;
 
-// #define DEBUG
+//How long ReadMessage() waits for the responses to the last request
+#define RESPONSE_TIMEOUT_MS 100
 
-int SerialPort::max_packet_size_ = 128; 
-
-//Class constructor to sets up the serial connection to the teensy correctly
-//We also zero all of the input registers
-SerialPort::SerialPort(int device_id_target) {
-    //Open comms with the first teensy we can find
-    init = true;
-    sleep(10);
-    OpenPort();
-
-    //ID the opened teensy
-    //ReadMessage();
-    Request(TID);
-    SendAllRequests();
-	sleep(5);
-	ReadMessage();
-	ReadMessage();
-	printf("Device ID: %u\n",device_id_);
-	printf("Device Firmware Version: %u\n",device_firmware_v_);
-
-    //If it is wrong we close it and search the rest of the device files
-	while((device_id_ != device_id_target) && (device_file_index_ < 16)){
-		//ID the teensy
-		if (close(teensy_) != 0) {
-            printf("Error %i from close: %s\n", errno, strerror(errno));
-            }
-		printf("succeeded closing\n");
-		teensy_ = -1;
-		OpenPort();
-		while (!ReadMessage()) {
-		    usleep(10);
-		}
-		//ReadMessage();
-		Request(TID);
-		SendAllRequests();
-	sleep(5);
-	ReadMessage();
-	ReadMessage();
-		printf("Device ID: %u\n",device_id_);
-		printf("Device Firmware Version: %u\n",device_firmware_v_);
-	}
-
-
-	init = false;
-	//serial_read_thread = std::thread(&SerialPort::ReadMessageAsync, this);
-    //sch_params.sched_priority = 97;
-    //pthread_setschedparam(serial_read_thread.native_handle(), SCHED_RR, &sch_params);
+teensy::ResponseTable SerialPort::ResponseLengths() {
+    teensy::ResponseTable table;
+    table.set(TID, 2).set(WATTMETER, 8).set(COMPASS, 2).set(LEDON, 0).set(LEDOFF, 0);
+    return table;
 }
 
-void SerialPort::OpenPort() {
-    char device_file_buffer [64] = {""};
-    while((teensy_ < 0) && (device_file_index_ < 16)) {
-        printf("/dev/ttyACM%d",device_file_index_);
-        sprintf(device_file_buffer,"/dev/ttyACM%d",device_file_index_);
-        teensy_ = open(device_file_buffer,O_RDWR | O_NOCTTY);
-        //Acquire non-blocking exclusive lock
-        /*
-        if(flock(teensy_, LOCK_EX | LOCK_NB) == -1) {
-        printf("Serial port with file descriptor %d is already locked by another process.",teensy_);
-        }
-        */
-        if(teensy_ < 0) {
-            printf("Error %i from open: %s\n", errno, strerror(errno));
-        }
-
-        // Read in existing settings, and handle any error
-        // NOTE: This is important! POSIX states that the struct passed to tcsetattr()
-        // must have been initialized with a call to tcgetattr() overwise behaviour
-        // is undefined
-        struct termios tty;
-        if(tcgetattr(teensy_, &tty) != 0) {
-            printf("Error %i from tcgetattr: %s\n", errno, strerror(errno));
-        }
-
-        cfmakeraw(&tty);
-        tty.c_cc[VTIME] = 0;    //Return as soon as any data is received.
-        tty.c_cc[VMIN] = 0;
-
-        cfsetispeed(&tty, 480*1000000); //Set the speeds to the maxmium USB2.0 speed
-        cfsetospeed(&tty, 480*1000000);
-
-        //Set the attributes for the port correctly
-        if (tcsetattr(teensy_, TCSANOW, &tty) != 0) {
-            printf("Error %i from tcsetattr: %s\n", errno, strerror(errno));
-            }
-        printf("Comms Opened\n");
-
-        //Zeroing registers and buffers
-        ClearReadBuff();
-        ClearWriteBuff();
-        ClearStructVelBytes(&translational_velocities_in_);
-        ClearStructVelBytes(&actuator_velocities_in_);
-        ClearStructVelBytes(&actuator_velocities_out_);
-        ClearStructVelBytes(&motor_velocities_out_);
-        ClearStructAccelBytes(&accelerometer0_in_);
-        ClearStructAccelBytes(&accelerometer1_in_);
-        ClearStructAccelBytes(&accelerometer2_in_);
-        ClearStructAccelBytes(&accelerometer3_in_);
-        ClearStructAccelBytes(&accelerometer4_in_);
-        ClearStructAccelBytes(&accelerometer5_in_);
-        runtime_in_[0] = 0x00;
-        runtime_in_[1] = 0x00;
-        runtime_in_[2] = 0x00;
-        runtime_in_[3] = 0x00;
-
-        device_file_index_ = device_file_index_ + 1;
-        usleep(10);
-    }
-    if(device_file_index_ == 16) {
-        printf("WARNING: teensy could not be found\n");
-    }
+//Class constructor to find the teensy with the given device ID
+SerialPort::SerialPort(int device_id_target) : port_(ResponseLengths()) {
+    port_.find(device_id_target);
+    device_id_ = port_.device_id;
+    device_firmware_v_ = port_.firmware_version;
 }
 
 //Closes the communication with the teensy
 void SerialPort::ClosePort() {
-    init = true;
-    //serial_read_thread.join();
-    close(teensy_);
-    printf("Comms Closed\n");
-}
-
-void SerialPort::WriteMessage() {
-#ifdef DEBUG
-    std::cout << "write_buffer_ size: " << sizeof(write_buffer_) << "\n";
-    std::cout << "send:";
-            for(int i = 0; i < sizeof(write_buffer_); ++i) {
-                std::cout << std::hex << std::setfill('0') << std::setw(2) << (int)write_buffer_[i] << std::dec << ':';
-            }
-            std::cout << "\n";
-#endif
-    memcpy(last_pack_, write_buffer_, sizeof(write_buffer_));
-    write(teensy_,write_buffer_,sizeof(write_buffer_));
-    ClearWriteBuff();
-}
-
-void SerialPort::ReadMessageAsync() {
-    while (!init) {
-        ReadMessage();
-        usleep(40);
-    }
+    port_.close();
 }
 
+//Wait for the responses to the last SendAllRequests() and decode them.
+//Returns 1 if they did not all arrive in time (the latest values are still decoded)
 int SerialPort::ReadMessage() {
-  
-        ClearReadBuff();
-        read(teensy_,&read_buffer_,sizeof(read_buffer_));
-        if (!read_buffer_[0]){
-            return 1;
-        }
-#ifdef DEBUG
-        std::cout << "receive:";
-        for(int i = 0; i < sizeof(read_buffer_); ++i) {
-            std::cout << std::hex << std::setfill('0') << std::setw(2) << (int)read_buffer_[i] << std::dec << ':';
-        }
-        std::cout << "\n";
-#endif
-      
-        int i = 0;
-        while(i < sizeof(read_buffer_)){
-        switch(read_buffer_[i]){
-            case LEDON:
-                ledOn = true;
-                i += 3;
-                std::cout << "ledon";
-                break;
-            case LEDOFF:
-                ledOn = false;
-                std::cout << "ledoff";
-                i += 3;
-                break;
-            case TID:
-                device_id_ = read_buffer_[i+1];
-                device_firmware_v_ = read_buffer_[i+2];
-                i += 3;
-                break;
-            case WATTMETER:
-            	Motor_Voltage = bytes_to_int16(read_buffer_[i+1], read_buffer_[i+2]);
-                Motor_Current = bytes_to_int16(read_buffer_[i+3], read_buffer_[i+4]);
-                PC_Voltage = bytes_to_int16(read_buffer_[i+5], read_buffer_[i+6]);
-                PC_Current = bytes_to_int16(read_buffer_[i+7], read_buffer_[i+8]);
-                i += 9;
-                break;
-            case COMPASS:
-            	heading = bytes_to_uint16(read_buffer_[i+1], read_buffer_[i+2]);
-                i += 3;
-                break;
-            case 0x00:
-                //if(read_buffer_[i+1]==0x00){if(read_buffer_[i+2]==0x00){
-                //    i = 64;//If we have reached three consecutive nulls, end the loop
-                //    break;
-                //    }}
-                i += 1;
-                break;
-            case UnrecVal:
-                printf("Unrecognised Command\n");
-                i += 1;
-                break;
-            case PackFail:
-                printf("Packet Start Not Present\n");
-                /*
-                std::cout << "sent:";
-                for(int i = 0; i < sizeof(last_pack_); ++i) {
-                    std::cout << std::hex << std::setfill('0') << std::setw(2) << (int)last_pack_[i] << std::dec << ':';
-                }
-                std::cout << "\n";
-                std::cout << "receive:";
-                for(int i = 0; i < sizeof(read_buffer_); ++i) {
-                    std::cout << std::hex << std::setfill('0') << std::setw(2) << (int)read_buffer_[i] << std::dec << ':';
-                }
-                std::cout << "\n";
-                */
-                i = max_packet_size_;
-                break;
-            default:
-                printf("Unknown Code  ");
-                printf("%#X\n",read_buffer_[i]);
-                i += 1;
-                break;
-    }} 
-    return 0;
-}
+    int ret = port_.wait(last_seq_, RESPONSE_TIMEOUT_MS);
 
+    //The LED is in the state of whichever command the teensy acknowledged last
+    ledOn = port_.latest(LEDON).time_ns > port_.latest(LEDOFF).time_ns;
 
-void SerialPort::ClearReadBuff() {
-    for(int i = 0; i < max_packet_size_; ++i){
-        read_buffer_[i] = 0x00;
+    teensy::Register r = port_.latest(WATTMETER);
+    if (r.count > 0) {
+        Motor_Voltage = bytes_to_int16(r.data[0], r.data[1]);
+        Motor_Current = bytes_to_int16(r.data[2], r.data[3]);
+        PC_Voltage = bytes_to_int16(r.data[4], r.data[5]);
+        PC_Current = bytes_to_int16(r.data[6], r.data[7]);
     }
-}
-
-void SerialPort::ClearWriteBuff() {
-    for(int i = 0; i < max_packet_size_; ++i){
-        write_buffer_[i] = 0x00;
+    r = port_.latest(COMPASS);
+    if (r.count > 0) {
+        heading = bytes_to_uint16(r.data[0], r.data[1]);
     }
-    packet_size_ = 0;
+    return ret;
 }
 
-void SerialPort::ClearRequestBuff() {
-    for(int i = 0; i < 1024; ++i){
-        request_buffer_[i] = 0x00;
+//Write a command to the packet, sending the packet first if the command will not fit
+void SerialPort::AddToPacket(unsigned char command) {
+    if(packet_size_ + 3 > TEENSY_MAX_PAYLOAD) {
+        SendPacket();
     }
-    request_buffer_first_empty_ = 0;
-}
-
-void SerialPort::ClearStructAccelBytes(AccelBytes *structure_ptr) {
-    (*structure_ptr).x[0] = 0x00;
-    (*structure_ptr).x[1] = 0x00;
-    (*structure_ptr).y[0] = 0x00;
-    (*structure_ptr).y[1] = 0x00;
-    (*structure_ptr).z[0] = 0x00;
-    (*structure_ptr).z[1] = 0x00;
-}
-
-void SerialPort::ClearStructVelBytes(VelBytes *structure_ptr) {
-    (*structure_ptr).x[0] = 0x00;
-    (*structure_ptr).x[1] = 0x00;
-    (*structure_ptr).y[0] = 0x00;
-    (*structure_ptr).y[1] = 0x00;
-    (*structure_ptr).z[0] = 0x00;
-    (*structure_ptr).z[1] = 0x00;
+    //We write the command into the write buffer followed by two NULL bytes
+    write_buffer_[packet_size_] = command;
+    write_buffer_[packet_size_+1] = 0x00;
+    write_buffer_[packet_size_+2] = 0x00;
+    packet_size_ += 3;
 }
 
-//Write a command to a packet
-//Creating a packet if one does not already exist
-
-void SerialPort::AddToPacket(unsigned char command) {
+void SerialPort::SendPacket() {
     if(packet_size_ == 0) {
-        write_buffer_[0] = 0xFF; //We open all packets with a 0xFF
-        packet_size_ = 1;
-    }
-    switch(command) {
-            //We write the command and then follow it with any needed data
-        default:
-            //We write the command into the write buffer followed by two NULL bytes
-            write_buffer_[packet_size_] = command;
-            write_buffer_[packet_size_+1] = 0x00;
-            write_buffer_[packet_size_+2] = 0x00;
-            packet_size_ = packet_size_ + 3;
-            break;
+        return;
     }
+    int n_responses = port_.expectedResponses(write_buffer_, packet_size_);
+    last_seq_ = port_.send(write_buffer_, packet_size_, n_responses);
+    packet_size_ = 0;
 }
 
-
-//Write the requested command into the request buffer 
+//Write the requested command into the request buffer
 int SerialPort::Request(unsigned char command) {
     if(request_buffer_first_empty_ >= 1024) {
         std::cout << "Request buffer full\n";
@@ -302,68 +81,11 @@ int SerialPort::Request(unsigned char command) {
     }
 }
 
+//Send all of the queued requests (as one frame unless they do not fit)
 void SerialPort::SendAllRequests() {
     for(int i = 0; i < request_buffer_first_empty_; ++i) {
         AddToPacket(request_buffer_[i]);
     }
-    WriteMessage();
-    ClearRequestBuff();
-}
-
-void SerialPort::PacketManager() {
-    int requested_incoming_byte_count = 0;
-    int requested_outgoing_byte_count = 0;
-
-    for(int i = 0; i < request_buffer_first_empty_; ++i) {
-        switch(request_buffer_[i]) {
-          case TID:
-               requested_incoming_byte_count += 3;
-               requested_outgoing_byte_count += 3;
-          default:
-              requested_outgoing_byte_count += 3;
-              break;
-        }
-        AddToPacket(request_buffer_[i]);
-
-        //If either the incoming or outgoing packets are full we send the messages
-        if(requested_outgoing_byte_count > 57 | requested_incoming_byte_count > 53) {
-            /*
-            std::cout << "request:";
-            for(int i = 0; i < request_buffer_first_empty_; ++i) {
-                std::cout << std::hex << std::setfill('0') << std::setw(2) << (int)request_buffer_[i] << std::dec << ':';
-            }*/
-            WriteMessage();
-            usleep(10);
-            if(requested_incoming_byte_count > 0 && init) {
-                usleep(300);
-                ReadMessage();
-            }
-            requested_outgoing_byte_count = 0;
-            requested_incoming_byte_count = 0;
-        }
-    } 
-
-    //If there is a message left to send we send it
-    if(requested_outgoing_byte_count > 0) {
-        /*
-        std::cout << "request:";
-        for(int i = 0; i < request_buffer_first_empty_; ++i) {
-            std::cout << std::hex << std::setfill('0') << std::setw(2) << (int)request_buffer_[i] << std::dec << ':';
-        }*/
-        WriteMessage();
-        usleep(10);
-        if(requested_incoming_byte_count > 0 && init) {
-            usleep(300);
-            ReadMessage();
-        }
-    }
-    //if (max_req_buf < request_buffer_first_empty_) {
-    //    max_req_buf = request_buffer_first_empty_;
-    //}
-    //std::cout << max_req_buf << ';';
-    //for(int i = 0; i < request_buffer_first_empty_; ++i) {
-    //    std::cout << std::hex << std::setfill('0') << std::setw(2) << (int)request_buffer_[i] << std::dec << ':';
-    //}
-    ClearRequestBuff();
+    SendPacket();
+    request_buffer_first_empty_ = 0;
 }
-
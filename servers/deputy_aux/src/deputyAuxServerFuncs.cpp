@@ -53,7 +53,6 @@ struct DeputyAuxServer {
         int ret_msg;
 	    teensy_port.Request(LEDON);
 	    teensy_port.SendAllRequests();
-	    usleep(150);
 	    teensy_port.ReadMessage();
 	    ret_msg = teensy_port.ledOn;
 	    return ret_msg;
@@ -67,7 +66,6 @@ struct DeputyAuxServer {
         int ret_msg;
 	    teensy_port.Request(LEDOFF);
 	    teensy_port.SendAllRequests();
-	    usleep(150);
 	    teensy_port.ReadMessage();
 	    ret_msg = !teensy_port.ledOn;
 	    return ret_msg;
@@ -96,7 +94,6 @@ struct DeputyAuxServer {
     void readWattmeter() {
         teensy_port.Request(WATTMETER);
 	    teensy_port.SendAllRequests();
-	    usleep(150);
 	    teensy_port.ReadMessage();
 	    
         // Store values
@@ -121,7 +118,6 @@ struct DeputyAuxServer {
     uint16_t getHeading() {
         teensy_port.Request(COMPASS);
 	    teensy_port.SendAllRequests();
-	    usleep(150);
 	    teensy_port.ReadMessage();
 	    return teensy_port.heading;
     }
@@ -8,11 +8,17 @@
 #include <fstream>
 #include "globals.h"
 #include "centroid.hpp"
+#include "FrameSolver.h"
+#include "PlateSolutionJson.h"
+#include "AttitudeLink.h"
 
 #include <opencv2/opencv.hpp>
 #include <unistd.h>
 
 #include <cstdlib>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 using json = nlohmann::json;
 
@@ -27,6 +33,9 @@ int GLOB_FST_PLATESOLVE_EXPTIME;
 double GLOB_FST_PLATESCALE;
 
 int GLOB_FST_CENTROID_FLAG = 0;
+// Fused mode: the centroids go to the robot's estimator with their age, alongside the plate
+// solve fixes
+int GLOB_FST_FUSED_FLAG = 0;
 
 pthread_mutex_t GLOB_FST_FLAG_LOCK;
 
@@ -102,10 +111,16 @@ int FST_Callback (unsigned short* data){
         GLOB_FST_CENTROID = diff_angles;
         pthread_mutex_unlock(&GLOB_FST_FLAG_LOCK);
 
-        // Send the differential positions to the robot
-        cout << "Sending diff angles" << endl;
-        cout << diff_angles.x << ", " << diff_angles.y << endl;
-        RB_SOCKET->send<std::string>("RC.receive_ST_angles", diff_angles.x, diff_angles.y, 0.0);
+        // Send the differential positions to the robot. In fused mode they are measured
+        // half an exposure before now
+        if (GLOB_FST_FUSED_FLAG){
+            RB_SOCKET->send<std::string>("RC.receive_ST_centroid", diff_angles.x, diff_angles.y,
+                                         0.5e-6*GLOB_CONFIG_PARAMS.exptime);
+        } else {
+            cout << "Sending diff angles" << endl;
+            cout << diff_angles.x << ", " << diff_angles.y << endl;
+            RB_SOCKET->send<std::string>("RC.receive_ST_angles", diff_angles.x, diff_angles.y, 0.0);
+        }
 
     }
 
@@ -116,6 +131,23 @@ int FST_Callback (unsigned short* data){
 // FLIR Camera Server for the fine star tracker
 struct FineStarTracker: FLIRCameraServer{
 
+    // Solves the latest frame in memory, if solve_frames is set
+    FrameSolver frame_solver;
+
+    // Converts the solutions to offsets from the target, and sends them to the robot controller
+    AttitudeLink attitude_link;
+
+    // One solve at a time, from commands or the fused mode thread
+    std::mutex solve_mutex;
+
+    // Fused mode: a thread solving coadds of the centroid frames every fused_fix_interval_s
+    // (see startFused), and the target it solves for
+    std::thread fused_thread;
+    std::atomic<bool> fused_running{false};
+    int fused_coadd;
+    double fused_fix_interval_s;
+    double fused_target_ra = 0, fused_target_dec = 0;
+
     FineStarTracker() : FLIRCameraServer(FST_Callback){
     
          // Set up client parameters
@@ -138,9 +170,22 @@ struct FineStarTracker: FLIRCameraServer{
         GLOB_FST_CENTROID_EXPTIME = config["FineStarTracker"]["Centroid_exptime"].value_or(1000);
         GLOB_FST_PLATESOLVE_EXPTIME = config["FineStarTracker"]["PlateSolve_exptime"].value_or(1000);
 
+        // Frames coadded for each fused mode solve (0 for PlateSolve_exptime worth), and the
+        // time between solves
+        fused_coadd = config["FineStarTracker"]["fused_coadd"].value_or(0);
+        fused_fix_interval_s = config["FineStarTracker"]["fused_fix_interval_s"].value_or(2.0);
+
+        if (config["PlateSolver"]["solve_frames"].value_or(false)){
+            std::string solver_config = config["PlateSolver"]["config"].value_or("../plate_solver/astrometry_fine.toml");
+            std::string debug_output = config["PlateSolver"]["debug_output"].value_or("");
+            frame_solver.Init(solver_config, debug_output);
+            attitude_link.Init(solver_config);
+        }
+
     }
     
     ~FineStarTracker(){
+        stopFused();
         delete RB_SOCKET;
     }
 
@@ -155,11 +200,159 @@ struct FineStarTracker: FLIRCameraServer{
         return ret_position;
     }
 
+    /*
+    Function to plate solve the latest frame, without saving it
+    Inputs:
+        offset_x, offset_y - offset of the WCS reference pixel (tip/tilt correction)
+        est_flag - 1 to search only around the estimated position
+        ra, dec - estimated position (deg)
+    Output:
+        The WCS solution (solved = 0 if the frame did not solve)
+    */
+    PlateSolution solve(double offset_x, double offset_y, int est_flag, double ra, double dec){
+        PlateSolution solution;
+        if (!frame_solver.ready()){
+            cout << "Frame solving is off (solve_frames in the config)" << endl;
+            return solution;
+        }
+        std::vector<unsigned short> frame;
+        int width, height;
+        if (CopyLatestFrame(&frame, &width, &height)){
+            cout << "Camera Not Running!" << endl;
+            return solution;
+        }
+        FrameRequest request;
+        request.ref_offset_x = offset_x;
+        request.ref_offset_y = offset_y;
+        request.use_estimate = est_flag;
+        request.est_ra = ra;
+        request.est_dec = dec;
+        std::lock_guard<std::mutex> lock(solve_mutex);
+        frame_solver.Solve(frame.data(), width, height, request, &solution);
+        return solution;
+    }
+
+    /*
+    Function to plate solve the latest frame as solve does, and convert the solution to the
+    azimuth, altitude and position angle offsets to a target. If send_angles is set in the
+    plate solver config, the offsets are sent straight to the robot controller
+    Inputs:
+        offset_x, offset_y, est_flag, ra, dec - as solve
+        target_ra, target_dec - target position (deg)
+    Output:
+        The WCS solution, with the offsets (radians) and whether they were sent
+    */
+    AttitudeSolution solve_attitude(double offset_x, double offset_y, int est_flag, double ra, double dec,
+                                    double target_ra, double target_dec){
+        return attitude_link.Convert(solve(offset_x, offset_y, est_flag, ra, dec), target_ra, target_dec);
+    }
+
+    /*
+    Function run by the fused mode thread: every fused_fix_interval_s, coadd the latest
+    centroid frames, solve them, and send the fix with its age to the robot controller
+    (attitude_link), until stopFused
+    */
+    void fusedLoop(){
+        std::vector<unsigned short> frame;
+        int width, height;
+        double frame_time;
+        // As many frames as make up a plate solve exposure, unless set
+        int num_frames = fused_coadd;
+        if (num_frames <= 0){
+            num_frames = std::max(1, GLOB_FST_PLATESOLVE_EXPTIME/std::max(1, GLOB_FST_CENTROID_EXPTIME));
+        }
+        PlateSolution last;
+        while (fused_running){
+            double start = hostTime();
+            int n = CopyLatestFrames(num_frames, &frame, &width, &height, &frame_time);
+            if (n > 0){
+                FrameRequest request;
+                request.use_estimate = last.solved;
+                request.est_ra = last.ra;
+                request.est_dec = last.dec;
+                PlateSolution solution;
+                int ret;
+                {
+                    std::lock_guard<std::mutex> lock(solve_mutex);
+                    ret = frame_solver.Solve(frame.data(), width, height, request, &solution);
+                }
+                if (ret == 0){
+                    last = solution;
+                    attitude_link.Convert(solution, fused_target_ra, fused_target_dec, hostTime() - frame_time);
+                } else {
+                    cout << "Fused mode: " << n << " frame coadd did not solve" << endl;
+                }
+            }
+            // Sleep out the interval, a little at a time so that stopping is quick
+            while (fused_running && hostTime() - start < fused_fix_interval_s){
+                usleep(10000);
+            }
+        }
+    }
+
+    /*
+    Function to switch to FUSED mode: centroid every frame as centroid mode does, and plate
+    solve coadds of the same frames in the background, so that the robot controller can fuse
+    the fixes with the centroids (RC.set_fusion). The camera is only restarted if its
+    exposure time is not the centroid one
+    Inputs:
+        target_ra, target_dec - target position (deg)
+    */
+    string startFused(double target_ra, double target_dec){
+        if (!frame_solver.ready() || !attitude_link.sending()){
+            return "Fused mode needs solve_frames, and send_angles in the plate solver config";
+        }
+        if (GLOB_CAM_STATUS != 2){
+            return "Camera Not Connected or Currently Connecting!";
+        }
+        if (GLOB_RECONFIGURE != 0 || GLOB_STOPPING != 0){
+            return "Camera Busy!";
+        }
+        stopFused();
+        string ret_msg;
+        if (GLOB_RUNNING != 1 || GLOB_CONFIG_PARAMS.exptime != GLOB_FST_CENTROID_EXPTIME){
+            ret_msg = this->stopcam();
+            cout << ret_msg << endl;
+            ret_msg = this->reconfigure_exptime(GLOB_FST_CENTROID_EXPTIME);
+            cout << ret_msg << endl;
+            pthread_mutex_lock(&GLOB_FLAG_LOCK);
+            GLOB_NUMFRAMES = 0;
+            pthread_mutex_unlock(&GLOB_FLAG_LOCK);
+            ret_msg = this->startcam(GLOB_NUMFRAMES,GLOB_COADD);
+            cout << ret_msg << endl;
+        }
+        pthread_mutex_lock(&GLOB_FLAG_LOCK);
+        GLOB_FST_CENTROID_FLAG = 1;
+        GLOB_FST_FUSED_FLAG = 1;
+        pthread_mutex_unlock(&GLOB_FLAG_LOCK);
+
+        fused_target_ra = target_ra;
+        fused_target_dec = target_dec;
+        fused_running = true;
+        fused_thread = std::thread(&FineStarTracker::fusedLoop, this);
+        return "Switched to Fused Mode";
+    }
+
+    /*
+    Function to leave FUSED mode, carrying on centroiding as centroid mode
+    */
+    string stopFused(){
+        fused_running = false;
+        if (fused_thread.joinable()){
+            fused_thread.join();
+        }
+        pthread_mutex_lock(&GLOB_FLAG_LOCK);
+        GLOB_FST_FUSED_FLAG = 0;
+        pthread_mutex_unlock(&GLOB_FLAG_LOCK);
+        return "Fused Mode Stopped";
+    }
+
     /*
     Function to switch the solving mode to CENTROIDING (i.e centroid without saving image)
     */
     string switchToCentroid(){
         string ret_msg;
+        stopFused();
         if(GLOB_CAM_STATUS == 2){
             if(GLOB_RECONFIGURE == 0 and GLOB_STOPPING == 0){
                 
@@ -192,6 +385,7 @@ struct FineStarTracker: FLIRCameraServer{
     */
     string switchToPlatesolve(){
         string ret_msg;
+        stopFused();
         if(GLOB_CAM_STATUS == 2){
             if(GLOB_RECONFIGURE == 0 and GLOB_STOPPING == 0){
                 // First, stop the camera if running
@@ -200,9 +394,9 @@ struct FineStarTracker: FLIRCameraServer{
                 // Reconfigure the exposure time to be higher
                 ret_msg = this->reconfigure_exptime(GLOB_FST_PLATESOLVE_EXPTIME);
                 cout << ret_msg << endl;
-                // Start the camera and save images
+                // Start the camera and save images (unless the frames are solved in memory)
                 pthread_mutex_lock(&GLOB_FLAG_LOCK);
-                GLOB_NUMFRAMES = 1;
+                GLOB_NUMFRAMES = frame_solver.ready() ? 0 : 1;
                 GLOB_FST_CENTROID_FLAG = 0;
                 pthread_mutex_unlock(&GLOB_FLAG_LOCK);
                 ret_msg = this->startcam(GLOB_NUMFRAMES,GLOB_COADD);
@@ -246,6 +440,10 @@ COMMANDER_REGISTER(m)
         .def("resetUSBPort", &FineStarTracker::resetUSBPort, "Reset the USB port on the HUB [string HUB name, string port number]")
         .def("getstar", &FineStarTracker::getstarposition, "Get position of the star")
         .def("switchCentroid", &FineStarTracker::switchToCentroid, "Switch to Centroiding Mode")
-        .def("switchPlateSolve", &FineStarTracker::switchToPlatesolve, "Switch to Plate Solving Mode");
+        .def("switchPlateSolve", &FineStarTracker::switchToPlatesolve, "Switch to Plate Solving Mode")
+        .def("startFused", &FineStarTracker::startFused, "Centroid every frame and plate solve coadds of them for the robot's fused estimate [target ra, dec]")
+        .def("stopFused", &FineStarTracker::stopFused, "Leave Fused Mode, carrying on centroiding")
+        .def("solve", &FineStarTracker::solve, "Plate solve the latest frame [ref pixel x offset, y offset, estimate flag, estimated ra, dec]")
+        .def("solve_attitude", &FineStarTracker::solve_attitude, "Plate solve the latest frame and send the offsets to a target to the robot [ref pixel x offset, y offset, estimate flag, estimated ra, dec, target ra, dec]");
 
 }
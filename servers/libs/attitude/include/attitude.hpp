@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <Eigen/Geometry>
+
+/*
+Celestial to horizontal transforms for the star trackers, as conversion.py does them in
+Python: sidereal time at the site, Ra/Dec to Alt/Az (with refraction), and the attitude
+quaternion of a pointing, from which the offsets to a target are taken.
+
+Angles follow conversion.py. Azimuth is from north, clockwise. The attitude quaternion
+is the rotation by yaw (2*pi - azimuth, i.e. anticlockwise) about z, then pitch
+(altitude) about y, then roll (position angle) about x.
+
+Ra/Dec are taken as they come from the plate solver (J2000). Precession moves a solved
+field and its target together, so it cancels to first order in the offsets.
+*/
+namespace attitude {
+
+// An observing site. The default is Mt Stromlo, as in conversion.py
+struct Site {
+    double latitude = -35.321453; // deg
+    double longitude = 149.006198; // deg, east positive
+    double height = 770.0; // m above sea level
+    double temperature = 10.0; // deg C
+    double pressure = 0.0; // hPa; 0 for the standard atmosphere at the site height
+    double dut1 = 0.0; // UT1 - UTC (s), from IERS Bulletin A
+    bool refraction = true; // Give apparent (refracted) altitudes
+};
+
+// A horizontal position in radians
+struct AltAz {
+    double alt = 0;
+    double az = 0; // From north, clockwise, in [0, 2*pi)
+};
+
+// The offsets the robot controller steers by (RC.receive_ST_angles), in radians
+struct Offsets {
+    double az = 0; // Target minus current azimuth, in [-pi, pi)
+    double alt = 0; // Target minus current altitude
+    double pos = 0; // Position angle of the current pointing, relative to the target's
+};
+
+// Returns the Julian date (UTC) of a time
+double julianDate(std::chrono::system_clock::time_point t);
+
+// Returns the Greenwich mean sidereal time (deg, in [0, 360)) at a Julian date (UT1)
+double greenwichSiderealTime(double jd_ut1);
+
+// Returns the local mean sidereal time (deg, in [0, 360)) at the site at a Julian date (UTC)
+double localSiderealTime(double jd, const Site& site);
+
+/*
+Returns the refraction (radians) to add to a true altitude (radians) at the site, by
+Saemundsson's formula scaled to the site pressure and temperature (good to about 0.1
+arcmin above 15 deg). Altitudes below -1 deg are not refracted.
+*/
+double refraction(double alt, const Site& site);
+
+// Returns the horizontal position of ra, dec (deg) at the site at a Julian date (UTC),
+// refracted if the site says so
+AltAz raDecToAltAz(double ra, double dec, double jd, const Site& site);
+
+// Returns the attitude quaternion of azimuth az, altitude alt and position angle pos (radians)
+Eigen::Quaterniond altAzQuaternion(double az, double alt, double pos);
+
+// Returns the attitude quaternion of a pointing at ra, dec with position angle pos_angle
+// (deg) at the site at a Julian date (UTC). As conversion.RaDec2Quat
+Eigen::Quaterniond raDecQuaternion(double ra, double dec, double pos_angle, double jd, const Site& site);
+
+// Takes the azimuth, altitude and position angle (radians) of an attitude quaternion
+void quaternionAltAz(const Eigen::Quaterniond& q, double* az, double* alt, double* pos);
+
+// Returns the offsets from the current attitude to the target attitude
+Offsets offsets(const Eigen::Quaterniond& current, const Eigen::Quaterniond& target);
+
+/*
+Returns the offsets from a pointing at ra, dec with position angle pos_angle (deg) to a
+target at target_ra, target_dec (deg), at the site at a Julian date (UTC). As
+conversion.diffRaDec2AltAz, with the azimuth offset wrapped to [-pi, pi).
+*/
+Offsets raDecOffsets(double ra, double dec, double pos_angle, double target_ra, double target_dec,
+                     double jd, const Site& site);
+
+} // namespace attitude
@@ -0,0 +1,110 @@
+#include "attitude.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace attitude {
+
+static const double DEG = M_PI/180.0;
+
+// Julian date of the Unix epoch, and of J2000.0
+static const double JD_UNIX_EPOCH = 2440587.5;
+static const double JD_J2000 = 2451545.0;
+
+// Wrap an angle into [0, period)
+static double wrapPositive(double angle, double period) {
+    angle = std::fmod(angle, period);
+    return angle < 0 ? angle + period : angle;
+}
+
+// Wrap an angle (radians) into [-pi, pi)
+static double wrapPi(double angle) {
+    return wrapPositive(angle + M_PI, 2*M_PI) - M_PI;
+}
+
+double julianDate(std::chrono::system_clock::time_point t) {
+    double seconds = std::chrono::duration<double>(t.time_since_epoch()).count();
+    return JD_UNIX_EPOCH + seconds/86400.0;
+}
+
+double greenwichSiderealTime(double jd_ut1) {
+    // Meeus, Astronomical Algorithms, eq. 12.4 (IAU 1982). conversion.GMST is this
+    // without the T^2 and T^3 terms
+    double d = jd_ut1 - JD_J2000;
+    double t = d/36525.0;
+    double gmst = 280.46061837 + 360.98564736629*d + t*t*(0.000387933 - t/38710000.0);
+    return wrapPositive(gmst, 360.0);
+}
+
+double localSiderealTime(double jd, const Site& site) {
+    return wrapPositive(greenwichSiderealTime(jd + site.dut1/86400.0) + site.longitude, 360.0);
+}
+
+double refraction(double alt, const Site& site) {
+    double pressure = site.pressure;
+    if (pressure <= 0) {
+        // Standard atmosphere at the site height
+        pressure = 1013.25*std::pow(1 - 2.25577e-5*site.height, 5.25588);
+    }
+    double h = alt/DEG;
+    if (h < -1.0) {
+        return 0;
+    }
+    double r_arcmin = 1.02/std::tan((h + 10.3/(h + 5.11))*DEG);
+    return r_arcmin*(pressure/1010.0)*(283.0/(273.0 + site.temperature))/60.0*DEG;
+}
+
+AltAz raDecToAltAz(double ra, double dec, double jd, const Site& site) {
+    double ha = (localSiderealTime(jd, site) - ra)*DEG;
+    double lat = site.latitude*DEG;
+    double sin_dec = std::sin(dec*DEG), cos_dec = std::cos(dec*DEG);
+    double sin_lat = std::sin(lat), cos_lat = std::cos(lat);
+
+    AltAz pos;
+    double sin_alt = sin_dec*sin_lat + cos_dec*cos_lat*std::cos(ha);
+    pos.alt = std::asin(std::clamp(sin_alt, -1.0, 1.0));
+    pos.az = wrapPositive(std::atan2(-cos_dec*std::sin(ha), sin_dec*cos_lat - cos_dec*sin_lat*std::cos(ha)), 2*M_PI);
+    if (site.refraction) {
+        pos.alt += refraction(pos.alt, site);
+    }
+    return pos;
+}
+
+Eigen::Quaterniond altAzQuaternion(double az, double alt, double pos) {
+    // Yaw is anticlockwise, where azimuth is clockwise
+    return Eigen::AngleAxisd(2*M_PI - az, Eigen::Vector3d::UnitZ())
+         * Eigen::AngleAxisd(alt, Eigen::Vector3d::UnitY())
+         * Eigen::AngleAxisd(pos, Eigen::Vector3d::UnitX());
+}
+
+Eigen::Quaterniond raDecQuaternion(double ra, double dec, double pos_angle, double jd, const Site& site) {
+    AltAz pos = raDecToAltAz(ra, dec, jd, site);
+    return altAzQuaternion(pos.az, pos.alt, pos_angle*DEG);
+}
+
+void quaternionAltAz(const Eigen::Quaterniond& q, double* az, double* alt, double* pos) {
+    double w = q.w(), x = q.x(), y = q.y(), z = q.z();
+    double yaw = std::atan2(2*(w*z + x*y), 1 - 2*(y*y + z*z));
+    *alt = std::asin(std::clamp(2*(w*y - z*x), -1.0, 1.0));
+    *pos = std::atan2(2*(w*x + y*z), 1 - 2*(x*x + y*y));
+    *az = wrapPositive(-yaw, 2*M_PI);
+}
+
+Offsets offsets(const Eigen::Quaterniond& current, const Eigen::Quaterniond& target) {
+    double az, alt, pos, target_az, target_alt, target_pos;
+    quaternionAltAz(current, &az, &alt, &pos);
+    quaternionAltAz(target, &target_az, &target_alt, &target_pos);
+
+    Offsets result;
+    result.az = wrapPi(target_az - az);
+    result.alt = target_alt - alt;
+    result.pos = wrapPi(pos - target_pos);
+    return result;
+}
+
+Offsets raDecOffsets(double ra, double dec, double pos_angle, double target_ra, double target_dec,
+                     double jd, const Site& site) {
+    return offsets(raDecQuaternion(ra, dec, pos_angle, jd, site),
+                   raDecQuaternion(target_ra, target_dec, 0.0, jd, site));
+}
+
+} // namespace attitude
@@ -0,0 +1,93 @@
+#ifndef _CAMERA_
+#define _CAMERA_
+
+#include <string>
+#include "toml.hpp"
+#include "FITSStream.h"
+
+/* ABSTRACT CAMERA CLASS
+   Interface shared by all camera backends (FLIR, QHY and simulated), so
+   that the camera thread can run any of them. Backends set the attributes
+   below from their config table.
+*/
+class Camera {
+    public:
+
+        // TOML configuration table
+        toml::table config;
+
+        // Buffer size for image data
+        unsigned int buffer_size;
+
+        // Number of saved images
+        unsigned long num_savefiles;
+
+        // Number of pixels in image
+        unsigned int imsize;
+
+        // Total exposure time over all images
+        double total_exposure;
+
+        // Timestamp of first image
+        std::string timestamp;
+
+        //Saving directory; prefix is without frame number and extension
+        std::string savefilename_prefix;
+        std::string savefilename;
+
+        // Number of frames acquired by the last call to GrabFrames
+        unsigned long frames_grabbed = 0;
+
+        // Streaming FITS output, and the number of the next file to roll to
+        FITSStream stream;
+        unsigned long stream_file_no = 0;
+
+        virtual ~Camera() {}
+
+        /* Whether saving appends to a streaming FITS cube ([fits] stream = true)
+           rather than writing one file per SaveFITS call */
+        bool StreamingEnabled();
+
+        /* Append frames from the circular buffer (and their metadata) to the streaming
+           FITS cube, opening a new file when none is open or the current one would grow
+           past [fits] max_file_mb. Outputs 0 on success.
+           INPUTS:
+              num_images - number of images to append
+              start_index - frame number index of where in the circular buffer to start
+        */
+        int StreamFITS(unsigned long num_images, unsigned long start_index);
+
+        /* Close the streaming FITS cube, if open. Outputs 0 on success */
+        int CloseStream();
+
+        /* Function to setup and start the camera. MUST CALL BEFORE USING!!! Outputs 0 on success */
+        virtual int InitCamera() = 0;
+
+        /* Function to reconfigure all parameters. Inputs are explanatory. Outputs 0 on success */
+        virtual int ReconfigureAll(int new_gain, int new_exptime, int new_width, int new_height, int new_offsetX,
+                                   int new_offsetY, float new_blacklevel, int new_buffersize, std::string new_savedir) = 0;
+
+        /* Function to De-initialise camera. MUST CALL AFTER USING!!! */
+        virtual void DeinitCamera() = 0;
+
+        /* Function to take a number of images with a camera and optionally work on them.
+           INPUTS:
+              num_frames - number of images to take
+              start_index - frame number index of where in the circular buffer to start taking images
+              f - a callback function that will be applied to each image in real time.
+                  If f returns 1, it will end acquisition regardless of how long it has to go.
+                  Give NULL for no callback function.
+           OUTPUTS:
+              0 on regular exit, non-zero if acquisition should stop (callback exit or error)
+        */
+        virtual int GrabFrames(unsigned long num_frames, unsigned long start_index, int (*f)(unsigned short*)) = 0;
+
+        /* Write a given array of image data as a FITS file. Outputs 0 on success.
+           INPUTS:
+              num_images - number of images in the array to write
+              start_index - frame number index of where in the circular buffer to start saving images
+        */
+        virtual int SaveFITS(unsigned long num_images, unsigned long start_index) = 0;
+};
+
+#endif // _CAMERA_
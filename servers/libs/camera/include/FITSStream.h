@@ -0,0 +1,54 @@
+#ifndef _FITSSTREAM_
+#define _FITSSTREAM_
+
+#include <string>
+#include <vector>
+#include "fitsio.h"
+#include "globals.h"
+
+/* STREAMING FITS WRITER
+   Appends frames to an open primary HDU cube, growing NAXIS3 as it goes,
+   and keeps the per-frame metadata. On close, NAXIS3 is set to the number of
+   frames written and a "FRAMES" binary table extension is added with columns
+   FRAMEID, HWTIME (camera clock, ns), HOSTTIME (unix s) and EXPTIME (us).
+*/
+class FITSStream {
+    public:
+
+        ~FITSStream();
+
+        /* Create a new file (overwriting any file of the same name)
+           INPUTS:
+              filename - file to create, including the extension
+              width, height - image dimensions
+              bitpix - FITS BITPIX (USHORT_IMG = 20)
+           Returns 0 on success, the cfitsio status otherwise */
+        int open(std::string filename, long width, long height, int bitpix);
+
+        /* Append one frame and its metadata. Returns 0 on success */
+        int append(const unsigned short* frame, const frame_metadata& meta);
+
+        /* Finalise NAXIS3, write the frame table and close. Returns 0 on success */
+        int close();
+
+        bool isOpen() const { return fptr_ != NULL; }
+
+        // Open file handle (e.g. for extra header keys); NULL if not open
+        fitsfile* file() { return fptr_; }
+
+        long numFrames() const { return static_cast<long>(meta_.size()); }
+
+        // Size of the image data written so far
+        size_t bytes() const { return meta_.size()*width_*height_*sizeof(unsigned short); }
+
+        std::string filename;
+
+    private:
+        fitsfile* fptr_ = NULL;
+        long width_ = 0;
+        long height_ = 0;
+        long allocated_ = 0; // Current NAXIS3
+        std::vector<frame_metadata> meta_;
+};
+
+#endif // _FITSSTREAM_
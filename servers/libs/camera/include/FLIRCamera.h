@@ -4,20 +4,18 @@
 
 #include "Spinnaker.h"
 #include "toml.hpp"
+#include "Camera.h"
 
 /* FLIR CAMERA CLASS
    Contains necessary methods and attributes for running
    a FLIR Camera
 */
-class FLIRCamera {
+class FLIRCamera : public Camera {
     public:
 
         // Pointer to camera
         Spinnaker::CameraPtr pCam;
 
-        // TOML configuration table
-        toml::table config;
-
         // Dimensions of image
         int width;
         int height;
@@ -64,25 +62,6 @@ class FLIRCamera {
         double black_level_min;
         double black_level_max;
 
-        // Buffer size for image data
-        unsigned int buffer_size;
-        
-        // Number of saved images
-        unsigned long num_savefiles;
-
-        // Number of pixels in image
-        unsigned int imsize;
-
-        // Total exposure time over all images
-        double total_exposure;
-
-        // Timestamp of first image
-        std::string timestamp;
-        
-        //Saving directory; prefix is without frame number and extension
-        std::string savefilename_prefix;
-        std::string savefilename;
-
 
 		/* Constructor: Takes the camera pointer and config table
            and saves them (and config values) as object attributes
@@ -91,16 +70,16 @@ class FLIRCamera {
               config_init - Parsed TOML table   */
         FLIRCamera(Spinnaker::CameraPtr pCam_init, toml::table config_init);
 
-		/* Function to setup and start the camera. MUST CALL BEFORE USING!!! */
-        void InitCamera();
+		/* Function to setup and start the camera. MUST CALL BEFORE USING!!! Outputs 0 on success */
+        int InitCamera() override;
         
-        /* Function to reconfigure all parameters. Inputs are explanatory */
-        void ReconfigureAll(int new_gain, int new_exptime, int new_width, int new_height, int new_offsetX, 
-                            int new_offsetY, float new_blacklevel, int new_buffersize, std::string new_savedir);
+        /* Function to reconfigure all parameters. Inputs are explanatory. Outputs 0 on success */
+        int ReconfigureAll(int new_gain, int new_exptime, int new_width, int new_height, int new_offsetX, 
+                           int new_offsetY, float new_blacklevel, int new_buffersize, std::string new_savedir) override;
 
 
 		/* Function to De-initialise camera. MUST CALL AFTER USING!!! */
-        void DeinitCamera();
+        void DeinitCamera() override;
 
         /* Function to take a number of images with a camera and optionally work on them.
            INPUTS:
@@ -113,14 +92,14 @@ class FLIRCamera {
                 0 on regular exit
                 1 on callback exit
         */
-        int GrabFrames(unsigned long num_frames, unsigned long start_index, int (*f)(unsigned short*));
+        int GrabFrames(unsigned long num_frames, unsigned long start_index, int (*f)(unsigned short*)) override;
 
         /* Write a given array of image data as a FITS file
            INPUTS:
               num_images - number of images in the array to write
               start_index - frame number index of where in the circular buffer to start saving images
         */
-        int SaveFITS(unsigned long num_images, unsigned long start_index);
+        int SaveFITS(unsigned long num_images, unsigned long start_index) override;
 
 	private:
 	    /* Helper functions for "ReconfigureAll" */
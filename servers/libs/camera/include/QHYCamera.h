@@ -4,6 +4,7 @@
 
 #include "qhyccd.h"
 #include "toml.hpp"
+#include "Camera.h"
 
 /* QHYCCD SDK and Firmware version functions */
 void SDKVersion();
@@ -13,15 +14,12 @@ void FirmWareVersion(qhyccd_handle *h);
    Contains necessary methods and attributes for running
    a QHYCCD Camera
 */
-class QHYCamera {
+class QHYCamera : public Camera {
     public:
 
         // Pointer to camera
         qhyccd_handle *pCamHandle;
 
-        // TOML configuration table
-        toml::table config;
-
         // Dimensions of image
         unsigned int width;
         unsigned int height;
@@ -71,27 +69,11 @@ class QHYCamera {
         // Readout mode of camera (0,1 or 2) [2]
         int readout_mode;
 
-        // Buffer size for image data
-        int buffer_size;
-      
-        // Number of saved images
-        unsigned long num_savefiles;
-
-        // Number of pixels in image
-        int imsize;
-
 		// Bits per pixel
         unsigned int bpp;
 
-        // Total exposure time over all images
-        double total_exposure;
-
-        // Timestamp of first image
-        std::string timestamp;
-        
-        //Saving directory; prefix is without frame number and extension
-        std::string savefilename_prefix;
-        std::string savefilename;
+        // Frame counter since the camera was initialised
+        unsigned long frame_id = 0;
 
 
 	    /* Constructor: Takes the camera pointer and config table
@@ -102,15 +84,15 @@ class QHYCamera {
         QHYCamera(qhyccd_handle *pCam_init, toml::table config_init);
 
 	    /* Function to setup and start the camera. MUST CALL BEFORE USING!!! Outputs 0 on success*/
-        int InitCamera();
+        int InitCamera() override;
 
 	    /* Function to De-initialise camera. MUST CALL AFTER USING!!! */
-        void DeinitCamera();
+        void DeinitCamera() override;
         
         
         /* Function to reconfigure all parameters. Inputs are explanatory. Outputs 0 on success */
         int ReconfigureAll(int new_gain, int new_exptime, int new_width, int new_height, int new_offsetX, int new_offsetY, 
-                           int new_blacklevel, int new_buffersize, std::string new_savedir);
+                           float new_blacklevel, int new_buffersize, std::string new_savedir) override;
 
         /* Function to take a number of images with a camera and optionally work on them.
            INPUTS:
@@ -124,7 +106,7 @@ class QHYCamera {
               1 on error
               2 on callback exit
         */
-        int GrabFrames(unsigned long num_frames, unsigned long start_index, int (*f)(unsigned short*));
+        int GrabFrames(unsigned long num_frames, unsigned long start_index, int (*f)(unsigned short*)) override;
 
 
         /* Write a given array of image data as a FITS file. Outputs 0 on success.
@@ -132,7 +114,7 @@ class QHYCamera {
               num_images - number of images in the array to write
               start_index - frame number index of where in the circular buffer to start saving images
         */
-        int SaveFITS(unsigned long num_images, unsigned long start_index);
+        int SaveFITS(unsigned long num_images, unsigned long start_index) override;
 
 };
 
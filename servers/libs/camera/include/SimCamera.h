@@ -0,0 +1,155 @@
+#ifndef _SIMCAMERA_
+#define _SIMCAMERA_
+
+#include <array>
+#include <random>
+#include <string>
+#include <vector>
+#include "toml.hpp"
+#include "Camera.h"
+
+/* A point source in sensor coordinates (pixels) */
+struct SimSource {
+    double x;
+    double y;
+    double flux; // Total electrons per frame
+};
+
+/* SIMULATED CAMERA CLASS
+   Generates synthetic frames at a target frame rate, so that the camera
+   servers can be run and benchmarked without hardware. Selected with
+   backend = "sim" in the camera config table; the scene is set up in the
+   "sim" sub-table:
+      scene - "stars" (star trackers), "fibre" (fibre injection),
+              "fringes" (science camera tricoupler outputs) or "leds" (metrology)
+      fps - frame rate (default 1e6/exposure_time)
+   Noise is shot noise (gaussian approximation), read noise and a bias,
+   drawn from a pre-computed table so that large frames render quickly.
+*/
+class SimCamera : public Camera {
+    public:
+
+        // Dimensions of image
+        int width;
+        int height;
+
+        // Width bounds
+        int width_min;
+        int width_max;
+
+        // Height bounds
+        int height_min;
+        int height_max;
+
+        // Offset of ROI from top left corner
+        int offset_x;
+        int offset_y;
+
+        // Exposure time of images
+        int exposure_time;
+
+        // Exposure time bounds
+        int exposure_time_min;
+        int exposure_time_max;
+
+        // Gain
+        int gain;
+
+        // Gain bounds
+        int gain_min;
+        int gain_max;
+
+        // Black level (ADU)
+        double black_level;
+
+        // Black level bounds
+        double black_level_min;
+        double black_level_max;
+
+        // Scene to simulate
+        std::string scene;
+
+        // Frame rate (Hz)
+        double fps;
+
+        // Frame counter since the camera was initialised
+        unsigned long frame_id = 0;
+
+        /* Constructor: Takes the config table and saves config values
+           as object attributes
+           INPUTS:
+              config_init - Parsed TOML table   */
+        SimCamera(toml::table config_init);
+
+        /* Function to setup and start the camera. MUST CALL BEFORE USING!!! Outputs 0 on success */
+        int InitCamera() override;
+
+        /* Function to reconfigure all parameters. Inputs are explanatory. Outputs 0 on success */
+        int ReconfigureAll(int new_gain, int new_exptime, int new_width, int new_height, int new_offsetX,
+                           int new_offsetY, float new_blacklevel, int new_buffersize, std::string new_savedir) override;
+
+        /* Function to De-initialise camera. MUST CALL AFTER USING!!! */
+        void DeinitCamera() override;
+
+        /* Function to take a number of images with a camera and optionally work on them.
+           INPUTS:
+              num_frames - number of images to take
+              start_index - frame number index of where in the circular buffer to start taking images
+              f - a callback function that will be applied to each image in real time.
+                  If f returns 1, it will end acquisition regardless of how long it has to go.
+                  Give NULL for no callback function.
+           OUTPUTS:
+              0 on regular exit
+              1 on error
+              2 on callback exit
+        */
+        int GrabFrames(unsigned long num_frames, unsigned long start_index, int (*f)(unsigned short*)) override;
+
+        /* Write a given array of image data as a FITS file. Outputs 0 on success.
+           INPUTS:
+              num_images - number of images in the array to write
+              start_index - frame number index of where in the circular buffer to start saving images
+        */
+        int SaveFITS(unsigned long num_images, unsigned long start_index) override;
+
+        /* Render the next frame into data (width*height pixels) */
+        void RenderFrame(unsigned short* data);
+
+    private:
+        void SetupScene();
+        void UpdateSkyTable();
+        void AddSpot(double x, double y, double flux, double sigma);
+
+        // Noise and detector parameters
+        double bias; // ADU
+        double read_noise; // Electrons
+        double sky; // Electrons per pixel per frame
+        double e_per_adu;
+        double fwhm; // Spot FWHM (pixels)
+        double jitter; // Image motion per frame (pixels rms)
+
+        // Point sources (stars, fibre spot or LEDs)
+        std::vector<SimSource> sources;
+
+        // Fringe parameters
+        int fringe_xref;
+        int fringe_yref;
+        double fringe_flux; // Electrons per wavelength channel per polarisation
+        double visibility;
+        double delay; // Current delay (um)
+        double delay_rms; // Random walk of the delay per frame (um)
+
+        // Offset of the image (jitter) for this frame
+        double dx = 0;
+        double dy = 0;
+
+        std::mt19937 rng;
+        std::normal_distribution<double> gauss{0.0, 1.0};
+        std::vector<float> noise_table; // Pre-drawn unit gaussians
+        std::vector<unsigned short> sky_table; // Sky-only pixel values for each noise_table entry
+        double sky_black_level = -1; // Black level sky_table was computed for
+        std::vector<float> signal; // Source electrons per pixel (zero outside boxes)
+        std::vector<std::array<int, 4>> boxes; // x0, y0, x1, y1 of the pixels with signal this frame
+};
+
+#endif // _SIMCAMERA_
@@ -50,6 +50,15 @@ extern pthread_mutex_t *GLOB_IMG_MUTEX_ARRAY;
 // Array of images (i.e Image buffer)
 extern unsigned short *GLOB_IMG_ARRAY;
 
+// Per-frame metadata, one entry per image buffer slot
+struct frame_metadata{
+    unsigned long frame_id; // Camera frame counter
+    long long hw_timestamp; // Camera clock timestamp (ns), 0 if the camera has none
+    double host_time; // Host UTC time the frame was received (unix seconds)
+    int exptime; // Exposure time (us)
+};
+extern frame_metadata *GLOB_IMG_META;
+
 extern std::function<int(unsigned short*)> GLOB_CALLBACK;
 
 // Latest filename/image
@@ -83,6 +92,9 @@ extern configuration GLOB_CONFIG_PARAMS;
 //Sinc function
 double sinc(double x);
 
+//Host UTC time in unix seconds
+double hostTime();
+
 // Template function to replicate the np.arange function in Python
 template<typename T>
 std::vector<T> arange(T start, T stop, T step = 1) {
@@ -0,0 +1,90 @@
+#ifndef _REPLAY_
+#define _REPLAY_
+
+/* Offline replay of saved FITS cubes through a camera server callback */
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+/*
+Stub commander server, bound to one endpoint (e.g. the chief aux port), that
+answers every request from a table of canned replies instead of talking to
+hardware. CA.moveSDC/CA.SDCpos are stateful so that servo loops see the
+stage move.
+*/
+class StubServer {
+public:
+    /*
+    Inputs:
+        endpoint - zmq address to bind, e.g. tcp://127.0.0.1:4101
+        replies - command name to JSON reply overrides (added to the defaults)
+        delay_us - simulated round trip time of every request
+    */
+    StubServer(std::string endpoint, std::map<std::string, nlohmann::json> replies, int delay_us);
+    ~StubServer();
+
+    // Number of requests received per command name
+    std::map<std::string, int> counts();
+
+    std::string endpoint;
+
+private:
+    void run();
+    nlohmann::json reply(const std::string& name, const nlohmann::json& args);
+
+    std::map<std::string, nlohmann::json> replies_;
+    std::map<std::string, int> counts_;
+    std::mutex counts_lock_;
+    int delay_us_;
+    bool stateful_sdc_; // False if CA.SDCpos has a fixed reply
+    int32_t sdc_pos_ = 0;
+    std::atomic<bool> stopping_{false};
+    std::thread thread_;
+};
+
+// Default replies for every client call made by the camera servers
+std::map<std::string, nlohmann::json> defaultStubReplies();
+
+/*
+Per-frame latency record, with percentiles and a text histogram
+*/
+class LatencyHistogram {
+public:
+    void add(double latency_us) { samples_.push_back(latency_us); }
+
+    size_t count() const { return samples_.size(); }
+
+    // p in [0,1]
+    double percentile(double p) const;
+
+    double mean() const;
+
+    // Print a summary and a log2-binned histogram to stdout
+    void print() const;
+
+    // Write one latency (us) per line
+    int save(const std::string& filename) const;
+
+private:
+    std::vector<double> samples_;
+};
+
+/*
+Read a FITS cube as written by SaveFITS
+Inputs:
+    filename - FITS file
+Outputs:
+    data - all frames, contiguous (width*height*num_frames)
+    width, height, num_frames - cube dimensions
+    exptime_us - FRAMEEXPOSURE keyword (0 if missing)
+    Returns 0 on success, the cfitsio status otherwise
+*/
+int readFITSCube(const std::string& filename, std::vector<unsigned short>& data,
+                 long& width, long& height, long& num_frames, int& exptime_us);
+
+#endif // _REPLAY_
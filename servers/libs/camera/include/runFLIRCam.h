@@ -1,7 +1,7 @@
 #ifndef _RUNFLIRCAM_
 #define _RUNFLIRCAM_
 
-#include "FLIRCamera.h"
+#include "Camera.h"
 #include "globals.h"
 
 /* A function that can be used to perform real time data analysis on a frame (eg Fringe Tracking)
@@ -14,9 +14,17 @@ int CallbackFunc (unsigned short* data);
 /* Function to reconfigure all parameters
     INPUTS:
        c - configuration (json) structure with all the values
-       Qcam - FLIRCamera class 
+       cam - camera class (any backend)
 */
-void reconfigure(configuration c, FLIRCamera& Fcam);
+void reconfigure(configuration c, Camera& cam);
+
+/* Waiting loop of the camera thread: reconfigures and acquires with the given camera
+   until the camera status is no longer CAM_CONNECTED
+    INPUTS:
+       cam - initialised camera (any backend)
+       sleeptime - sleep between checks of the flags (us)
+*/
+void cameraLoop(Camera& cam, int sleeptime);
 
 /* Main pThread function to run the camera with a separate thread */ 
 void *runCam(void*);
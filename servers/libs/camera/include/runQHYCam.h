@@ -1,7 +1,7 @@
 #ifndef _RUNQHYCAM_
 #define _RUNQHYCAM_
 
-#include "QHYCamera.h"
+#include "Camera.h"
 #include "globals.h"
 
 /* A function that can be used to perform real time data analysis on a frame (eg Fringe Tracking)
@@ -14,10 +14,17 @@ int CallbackFunc (unsigned short* data);
 /* Function to reconfigure all parameters
     INPUTS:
        c - configuration (json) structure with all the values
-       Qcam - QHYCamera class 
+       cam - camera class (any backend)
     Returns 0 on success, 1 on error
 */
-int reconfigure(configuration c, QHYCamera& Qcam);
+int reconfigure(configuration c, Camera& cam);
+
+/* Waiting loop of the camera thread: reconfigures and acquires with the given camera
+   until the camera status is no longer CAM_CONNECTED
+    INPUTS:
+       cam - initialised camera (any backend)
+*/
+void cameraLoop(Camera& cam);
 
 /* Main pThread function to run the camera with a separate thread */ 
 void *runCam(void*);
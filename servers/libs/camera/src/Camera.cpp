@@ -0,0 +1,102 @@
+#include <iostream>
+#include <string>
+#include <fmt/core.h>
+#include "Camera.h"
+#include "fitsio.h"
+#include "globals.h"
+
+using namespace std;
+
+
+/* Whether saving appends to a streaming FITS cube ([fits] stream = true)
+   rather than writing one file per SaveFITS call */
+bool Camera::StreamingEnabled(){
+    return config["fits"]["stream"].value_or(false);
+}
+
+
+/* Append frames from the circular buffer (and their metadata) to the streaming
+   FITS cube, opening a new file when none is open or the current one would grow
+   past [fits] max_file_mb. Outputs 0 on success.
+   INPUTS:
+      num_images - number of images to append
+      start_index - frame number index of where in the circular buffer to start
+*/
+int Camera::StreamFITS(unsigned long num_images, unsigned long start_index){
+
+    size_t max_bytes = config["fits"]["max_file_mb"].value_or(2000)*1024UL*1024UL;
+    int bitpix = config["fits"]["bitpix"].value_or(20);
+
+    for (unsigned long i = 0; i < num_images; i++){
+
+        // Roll to a new file by size
+        if (stream.isOpen() && stream.bytes() + imsize*sizeof(unsigned short) > max_bytes){
+            CloseStream();
+        }
+
+        if (!stream.isOpen()){
+            savefilename = savefilename_prefix + "_" + fmt::format("{:04d}", stream_file_no);
+            stream_file_no = (stream_file_no + 1) % num_savefiles;
+
+            pthread_mutex_lock(&GLOB_FLAG_LOCK);
+            configuration c = GLOB_CONFIG_PARAMS;
+            pthread_mutex_unlock(&GLOB_FLAG_LOCK);
+
+            if (stream.open(savefilename + ".fits", c.width, c.height, bitpix)){
+                return 1;
+            }
+
+            // Header keywords that hold for the whole file
+            int status = 0;
+            fitsfile* fptr = stream.file();
+            int exptime = static_cast<int>(c.exptime);
+            int gain = static_cast<int>(c.gain);
+            double black_level = c.blacklevel;
+            fits_write_key(fptr, TINT, "FRAMEEXPOSURE", &exptime, "Individual Exposure Time (us)", &status);
+            fits_write_key(fptr, TINT, "GAIN", &gain, "Gain", &status);
+            fits_write_key(fptr, TDOUBLE, "BLACK LEVEL", &black_level, "Black Level", &status);
+            fits_write_key(fptr, TINT, "WIDTH", &c.width, "Image Width (px)", &status);
+            fits_write_key(fptr, TINT, "HEIGHT", &c.height, "Image Height (px)", &status);
+            fits_write_key(fptr, TINT, "XOFFSET", &c.offsetX, "Image X Offset (px)", &status);
+            fits_write_key(fptr, TINT, "YOFFSET", &c.offsetY, "Image Y Offset (px)", &status);
+            fits_write_key(fptr, TSTRING, "TARGETNAME", &GLOB_TARGET_NAME[0], "Name of Target", &status);
+            fits_write_key(fptr, TDOUBLE, "RA", &GLOB_RA, "Right Ascension (deg)", &status);
+            fits_write_key(fptr, TDOUBLE, "DEC", &GLOB_DEC, "Declination (deg)", &status);
+            fits_write_key(fptr, TDOUBLE, "BASELINE", &GLOB_BASELINE, "Baseline (m)", &status);
+            fits_write_key(fptr, TSTRING, "DATATYPE", &GLOB_DATATYPE[0], "Type of Data", &status);
+            if (status){
+                cout << "ERROR: Could not write FITS header, status " << status << endl;
+            }
+        }
+
+        unsigned long current_index = (start_index + i)%buffer_size;
+        frame_metadata meta = {0, 0, 0.0, 0};
+        pthread_mutex_lock(&GLOB_IMG_MUTEX_ARRAY[current_index]);
+        if (GLOB_IMG_META != NULL){
+            meta = GLOB_IMG_META[current_index];
+        }
+        int status = stream.append(GLOB_IMG_ARRAY+imsize*current_index, meta);
+        pthread_mutex_unlock(&GLOB_IMG_MUTEX_ARRAY[current_index]);
+        if (status){
+            return status;
+        }
+    }
+    return 0;
+}
+
+
+/* Close the streaming FITS cube, if open. Outputs 0 on success */
+int Camera::CloseStream(){
+
+    if (!stream.isOpen()){
+        return 0;
+    }
+    string filename = stream.filename;
+    int status = stream.close();
+
+    pthread_mutex_lock(&GLOB_LATEST_FILE_LOCK);
+    GLOB_LATEST_FILE = filename;
+    pthread_mutex_unlock(&GLOB_LATEST_FILE_LOCK);
+
+    return status;
+}
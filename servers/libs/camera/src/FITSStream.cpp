@@ -0,0 +1,137 @@
+#include <iostream>
+#include <string>
+#include <ctime>
+#include <cmath>
+#include "FITSStream.h"
+
+using namespace std;
+
+// Frames to grow the cube by at a time (the image is the last HDU, so growing is cheap)
+#define FITS_STREAM_CHUNK 256
+
+FITSStream::~FITSStream(){
+    close();
+}
+
+
+/* Create a new file (overwriting any file of the same name)
+   INPUTS:
+      filename - file to create, including the extension
+      width, height - image dimensions
+      bitpix - FITS BITPIX (USHORT_IMG = 20)
+   Returns 0 on success, the cfitsio status otherwise */
+int FITSStream::open(string filename_in, long width, long height, int bitpix){
+
+    if (isOpen()){
+        close();
+    }
+
+    filename = filename_in;
+    width_ = width;
+    height_ = height;
+    allocated_ = FITS_STREAM_CHUNK;
+    meta_.clear();
+    meta_.reserve(FITS_STREAM_CHUNK);
+
+    int status = 0;
+    long naxes[3] = {width_, height_, allocated_};
+    string file_path = "!" + filename;
+    if (fits_create_file(&fptr_, file_path.c_str(), &status)){
+        cout << "ERROR: Could not create FITS file " << filename << endl;
+        fptr_ = NULL;
+        return status;
+    }
+    if (fits_create_img(fptr_, bitpix, 3, naxes, &status)){
+        cout << "ERROR: Could not create FITS image " << filename << endl;
+        fits_close_file(fptr_, &status);
+        fptr_ = NULL;
+    }
+    return status;
+}
+
+
+/* Append one frame and its metadata. Returns 0 on success */
+int FITSStream::append(const unsigned short* frame, const frame_metadata& meta){
+
+    if (!isOpen()){
+        return 1;
+    }
+    int status = 0;
+    long n = numFrames();
+    if (n >= allocated_){
+        allocated_ += FITS_STREAM_CHUNK;
+        long naxes[3] = {width_, height_, allocated_};
+        int bitpix;
+        fits_get_img_type(fptr_, &bitpix, &status);
+        if (fits_resize_img(fptr_, bitpix, 3, naxes, &status)){
+            cout << "ERROR: Could not grow FITS cube " << filename << endl;
+            return status;
+        }
+    }
+    long fpixel[3] = {1, 1, n + 1};
+    if (fits_write_pix(fptr_, TUSHORT, fpixel, width_*height_, (void*)frame, &status)){
+        cout << "ERROR: Could not write frame to " << filename << endl;
+        return status;
+    }
+    meta_.push_back(meta);
+    return 0;
+}
+
+
+/* Finalise NAXIS3, write the frame table and close. Returns 0 on success */
+int FITSStream::close(){
+
+    if (!isOpen()){
+        return 0;
+    }
+    int status = 0;
+    long n = numFrames();
+
+    // Shrink the cube to the frames actually written
+    long naxes[3] = {width_, height_, n};
+    int bitpix;
+    fits_get_img_type(fptr_, &bitpix, &status);
+    fits_resize_img(fptr_, bitpix, 3, naxes, &status);
+
+    // Start time of the first frame, to the millisecond
+    if (n > 0){
+        time_t secs = static_cast<time_t>(floor(meta_[0].host_time));
+        int ms = static_cast<int>((meta_[0].host_time - secs)*1000);
+        char date_obs[32];
+        strftime(date_obs, sizeof(date_obs), "%Y-%m-%dT%H:%M:%S", gmtime(&secs));
+        string date_str = string(date_obs) + "." + to_string(1000 + ms).substr(1);
+        fits_update_key(fptr_, TSTRING, "DATE-OBS", &date_str[0], "UTC of the first frame", &status);
+        double duration = meta_[n - 1].host_time - meta_[0].host_time;
+        fits_update_key(fptr_, TDOUBLE, "DURATION", &duration, "First to last frame (s)", &status);
+    }
+    fits_update_key(fptr_, TLONG, "NFRAMES", &n, "Number of frames", &status);
+
+    // Per-frame table
+    char* ttype[4] = {(char*)"FRAMEID", (char*)"HWTIME", (char*)"HOSTTIME", (char*)"EXPTIME"};
+    char* tform[4] = {(char*)"1K", (char*)"1K", (char*)"1D", (char*)"1J"};
+    char* tunit[4] = {(char*)"", (char*)"ns", (char*)"s", (char*)"us"};
+    fits_create_tbl(fptr_, BINARY_TBL, n, 4, ttype, tform, tunit, "FRAMES", &status);
+    if (n > 0){
+        vector<LONGLONG> frame_id(n), hw_time(n);
+        vector<double> host_time(n);
+        vector<int> exptime(n);
+        for (long i = 0; i < n; i++){
+            frame_id[i] = meta_[i].frame_id;
+            hw_time[i] = meta_[i].hw_timestamp;
+            host_time[i] = meta_[i].host_time;
+            exptime[i] = meta_[i].exptime;
+        }
+        fits_write_col(fptr_, TLONGLONG, 1, 1, 1, n, frame_id.data(), &status);
+        fits_write_col(fptr_, TLONGLONG, 2, 1, 1, n, hw_time.data(), &status);
+        fits_write_col(fptr_, TDOUBLE, 3, 1, 1, n, host_time.data(), &status);
+        fits_write_col(fptr_, TINT, 4, 1, 1, n, exptime.data(), &status);
+    }
+    if (status){
+        cout << "ERROR: Could not finalise FITS file " << filename << ", status " << status << endl;
+    }
+
+    fits_close_file(fptr_, &status);
+    fptr_ = NULL;
+    cout << "Closed " << filename << " (" << n << " frames)" << endl;
+    return status;
+}
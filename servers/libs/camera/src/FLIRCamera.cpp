@@ -65,12 +65,12 @@ FLIRCamera::FLIRCamera(Spinnaker::CameraPtr pCam_init, toml::table config_init){
 }
 
 
-/* Function to setup and start the camera. MUST CALL BEFORE USING!!! */
-void FLIRCamera::InitCamera(){
+/* Function to setup and start the camera. MUST CALL BEFORE USING!!! Outputs 0 on success */
+int FLIRCamera::InitCamera(){
     // Initialize camera
     if (pCam == nullptr){
         cout << "You should never get to here! This block is an extra extra error check." << endl;
-        return;
+        return 1;
     }
     pCam->Init();
     cout << "Camera Initialized" << endl;
@@ -207,6 +207,7 @@ void FLIRCamera::InitCamera(){
     
     pthread_mutex_unlock(&GLOB_FLAG_LOCK);
 
+    return 0;
 }
 
 /* Reconfigure a float parameter for a FLIR Camera*/
@@ -241,9 +242,9 @@ void FLIRCamera::ReconfigureInt(std::string parameter, int value){
     cout << "Setting " << parameter << " to: " << ptr_parameter->GetValue() << endl ;
 }
 
-/* Function to reconfigure all parameters, both in the camera and in the class parameters. Inputs are explanatory */
-void FLIRCamera::ReconfigureAll(int new_gain, int new_exptime, int new_width, int new_height, int new_offsetX, 
-                                int new_offsetY, float new_blacklevel, int new_buffersize, string new_savedir){
+/* Function to reconfigure all parameters, both in the camera and in the class parameters. Inputs are explanatory. Outputs 0 on success */
+int FLIRCamera::ReconfigureAll(int new_gain, int new_exptime, int new_width, int new_height, int new_offsetX, 
+                               int new_offsetY, float new_blacklevel, int new_buffersize, string new_savedir){
 
     ReconfigureFloat("Gain",new_gain);
     gain = new_gain;
@@ -267,6 +268,8 @@ void FLIRCamera::ReconfigureAll(int new_gain, int new_exptime, int new_width, in
     
     GLOB_IMSIZE = imsize;
     GLOB_WIDTH = new_width;
+
+    return 0;
 }
 
 
@@ -308,6 +311,7 @@ int FLIRCamera::GrabFrames(unsigned long num_frames, unsigned long start_index,
         start = std::chrono::steady_clock::now();
 
 		int current_index = 0;
+		frames_grabbed = 0;
         for (unsigned int image_cnt = 0; image_cnt < num_frames; image_cnt++){
 
             // Retrive image
@@ -321,7 +325,12 @@ int FLIRCamera::GrabFrames(unsigned long num_frames, unsigned long start_index,
             // Append data to an allocated memory array
             pthread_mutex_lock(&GLOB_IMG_MUTEX_ARRAY[current_index]);
 			memcpy(GLOB_IMG_ARRAY+imsize*current_index, data, imsize*2);
+			if (GLOB_IMG_META != NULL){
+				GLOB_IMG_META[current_index] = {ptr_result_image->GetFrameID(), (long long)ptr_result_image->GetTimeStamp(),
+				                                hostTime(), exposure_time};
+			}
 			pthread_mutex_unlock(&GLOB_IMG_MUTEX_ARRAY[current_index]);
+			frames_grabbed++;
 
             // Do something with the data in real time if required
             // If 1 is returned by the callback function, end acquisition (regardless of
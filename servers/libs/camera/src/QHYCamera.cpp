@@ -311,7 +311,10 @@ void QHYCamera::DeinitCamera(){
 
 /* Function to reconfigure all parameters, both in the camera and in the class parameters. Inputs are explanatory. Outputs 0 on success */
 int QHYCamera::ReconfigureAll(int new_gain, int new_exptime, int new_width, int new_height, int new_offsetX, 
-                              int new_offsetY, int new_blacklevel, int new_buffersize, string new_savedir){
+                              int new_offsetY, float new_blacklevel_f, int new_buffersize, string new_savedir){
+
+    // Black level is an integer number of ADU on the QHY
+    int new_blacklevel = static_cast<int>(new_blacklevel_f);
 
     unsigned int retVal;
     // Set exposure time
@@ -435,6 +438,7 @@ int QHYCamera::GrabFrames(unsigned long num_frames, unsigned long start_index, i
     start = std::chrono::steady_clock::now();
     
     int current_index = 0;
+    frames_grabbed = 0;
     for (unsigned int image_cnt = 0; image_cnt < num_frames;){
 		
         // Retrieve image
@@ -452,7 +456,13 @@ int QHYCamera::GrabFrames(unsigned long num_frames, unsigned long start_index, i
             // Append data to an circular buffer array
             pthread_mutex_lock(&GLOB_IMG_MUTEX_ARRAY[current_index]);
 			memcpy(GLOB_IMG_ARRAY+imsize*current_index, converted_data, imsize*2);
+			// No hardware timestamp from the QHY SDK: host time only
+			if (GLOB_IMG_META != NULL){
+				GLOB_IMG_META[current_index] = {frame_id, 0, hostTime(), exposure_time};
+			}
 			pthread_mutex_unlock(&GLOB_IMG_MUTEX_ARRAY[current_index]);
+			frame_id++;
+			frames_grabbed++;
 			
           
             // Do something with the data in real time if required
@@ -0,0 +1,512 @@
+#include <iostream>
+#include <string>
+#include <ctime>
+#include <cmath>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include "SimCamera.h"
+#include "toml.hpp"
+#include "fitsio.h"
+#include "globals.h"
+
+using namespace std;
+
+// Size of the pre-drawn gaussian noise table (power of 2)
+#define SIM_NOISE_TABLE_SIZE (1 << 20)
+
+// Tricoupler output rows relative to yref for the A, B and C outputs (polarisation 2 is 8 rows below)
+static const int kFringeRows[3] = {0, 14, 28};
+
+// Central wavelengths of the science camera channels (um), in pixel order from xref - 7
+static const double kFringeWaves[10] = {0.7473, 0.7277, 0.7092, 0.6918, 0.6755, 0.66, 0.6454, 0.6316, 0.6186, 0.6063};
+
+
+/* Constructor: Takes the config table and saves config values
+   as object attributes
+   INPUTS:
+      config_init - Parsed TOML table
+*/
+SimCamera::SimCamera(toml::table config_init){
+
+    config = config_init;
+
+    cout << "Loading Config" << endl;
+    width = config["camera"]["width"].value_or(0);
+    height = config["camera"]["height"].value_or(0);
+    offset_x = config["camera"]["offset_x"].value_or(0);
+    offset_y = config["camera"]["offset_y"].value_or(0);
+    exposure_time = config["camera"]["exposure_time"].value_or(1000);
+    gain = config["camera"]["gain"].value_or(0);
+
+    width_min = config["bounds"]["width"][0].value_or(0);
+    width_max = config["bounds"]["width"][1].value_or(0);
+
+    height_min = config["bounds"]["height"][0].value_or(0);
+    height_max = config["bounds"]["height"][1].value_or(0);
+
+    exposure_time_min = config["bounds"]["exposure_time"][0].value_or(0);
+    exposure_time_max = config["bounds"]["exposure_time"][1].value_or(0);
+
+    gain_min = config["bounds"]["gain"][0].value_or(0);
+    gain_max = config["bounds"]["gain"][1].value_or(0);
+
+    black_level = config["camera"]["black_level"].value_or(0.0);
+    black_level_min = config["bounds"]["black_level"][0].value_or(0.0);
+    black_level_max = config["bounds"]["black_level"][1].value_or(0.0);
+
+    buffer_size = config["camera"]["buffer_size"].value_or(1);
+    num_savefiles = config["camera"]["num_savefiles"].value_or(1);
+    imsize = width*height;
+
+    savefilename_prefix = config["fits"]["filename_prefix"].value_or("");
+    savefilename = savefilename_prefix + ".fits";
+
+    // Simulation parameters
+    scene = config["sim"]["scene"].value_or("stars");
+    fps = config["sim"]["fps"].value_or(0.0);
+    bias = config["sim"]["bias"].value_or(100.0);
+    read_noise = config["sim"]["read_noise"].value_or(3.0);
+    sky = config["sim"]["sky"].value_or(5.0);
+    e_per_adu = config["sim"]["e_per_adu"].value_or(1.0);
+    fwhm = config["sim"]["fwhm"].value_or(3.0);
+    jitter = config["sim"]["jitter"].value_or(0.2);
+    visibility = config["sim"]["visibility"].value_or(0.8);
+    delay = config["sim"]["delay"].value_or(0.0);
+    delay_rms = config["sim"]["delay_rms"].value_or(0.01);
+
+    rng.seed(config["sim"]["seed"].value_or(1));
+}
+
+
+/* Set up the point sources for the scene, in sensor coordinates */
+void SimCamera::SetupScene(){
+
+    sources.clear();
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    if (scene == "stars"){
+        // Random stars over the initial ROI, with magnitudes spread over 5 mag
+        int num_stars = config["sim"]["num_stars"].value_or(20);
+        double star_flux = config["sim"]["star_flux"].value_or(1e5);
+        for (int i = 0; i < num_stars; i++){
+            double x = offset_x + 10 + uniform(rng)*(width - 20);
+            double y = offset_y + 10 + uniform(rng)*(height - 20);
+            double flux = star_flux*pow(10, -0.4*5*uniform(rng));
+            sources.push_back({x, y, flux});
+        }
+    } else if (scene == "fibre"){
+        double x = config["sim"]["spot_x"].value_or(width/2.0);
+        double y = config["sim"]["spot_y"].value_or(height/2.0);
+        double flux = config["sim"]["spot_flux"].value_or(1e5);
+        sources.push_back({offset_x + x, offset_y + y, flux});
+    } else if (scene == "leds"){
+        double flux = config["sim"]["led_flux"].value_or(1e5);
+        for (int i = 0; i < 2; i++){
+            double x = config["sim"]["led_x"][i].value_or(width/2.0 + (2*i - 1)*width/4.0);
+            double y = config["sim"]["led_y"][i].value_or(height/2.0);
+            sources.push_back({offset_x + x, offset_y + y, flux});
+        }
+    } else if (scene == "fringes"){
+        fringe_xref = offset_x + config["sim"]["xref"].value_or(71);
+        fringe_yref = offset_y + config["sim"]["yref"].value_or(45);
+        fringe_flux = config["sim"]["fringe_flux"].value_or(2000.0);
+    } else {
+        cout << "Unknown sim scene " << scene << ", using a blank sky" << endl;
+    }
+}
+
+
+/* Function to setup and start the camera. MUST CALL BEFORE USING!!! Outputs 0 on success */
+int SimCamera::InitCamera(){
+
+    if (imsize == 0){
+        cout << "Sim camera has zero image size" << endl;
+        return 1;
+    }
+    if (fps <= 0){
+        fps = 1e6/exposure_time;
+    }
+
+    noise_table.resize(SIM_NOISE_TABLE_SIZE);
+    for (auto& n : noise_table){
+        n = gauss(rng);
+    }
+    UpdateSkyTable();
+    SetupScene();
+
+    cout << "Camera device information" << endl
+         << "=========================" << endl;
+    cout << Label("Model") << "Simulated (" << scene << ")" << endl;
+    cout << Label("Frame rate") << fps << endl;
+    cout << Label("Sources") << sources.size() << endl;
+    cout << endl;
+
+    cout << "Camera device settings" << endl << "======================" << endl;
+    cout << Label("Exposure time") << exposure_time << endl;
+    cout << Label("Gain") << gain << endl;
+    cout << Label("Width") << width << endl;
+    cout << Label("Height") << height << endl;
+    cout << Label("Offset X") << offset_x << endl;
+    cout << Label("Offset Y") << offset_y << endl;
+    cout << endl;
+
+    // Set global configuration struct
+    pthread_mutex_lock(&GLOB_FLAG_LOCK);
+    GLOB_IMSIZE = imsize;
+    GLOB_WIDTH = width;
+    GLOB_CONFIG_PARAMS.gain = gain;
+    GLOB_CONFIG_PARAMS.exptime = exposure_time;
+    GLOB_CONFIG_PARAMS.width = width;
+    GLOB_CONFIG_PARAMS.height = height;
+    GLOB_CONFIG_PARAMS.offsetX = offset_x;
+    GLOB_CONFIG_PARAMS.offsetY = offset_y;
+    GLOB_CONFIG_PARAMS.blacklevel = black_level;
+    GLOB_CONFIG_PARAMS.buffersize = buffer_size;
+    GLOB_CONFIG_PARAMS.savedir = savefilename_prefix;
+
+    // Set bounds
+    GLOB_WIDTH_MAX = width_max;
+    GLOB_WIDTH_MIN = width_min;
+    GLOB_HEIGHT_MAX = height_max;
+    GLOB_HEIGHT_MIN = height_min;
+    GLOB_GAIN_MAX = gain_max;
+    GLOB_GAIN_MIN = gain_min;
+    GLOB_EXPTIME_MAX = exposure_time_max;
+    GLOB_EXPTIME_MIN = exposure_time_min;
+    GLOB_BLACKLEVEL_MAX = black_level_max;
+    GLOB_BLACKLEVEL_MIN = black_level_min;
+
+    pthread_mutex_unlock(&GLOB_FLAG_LOCK);
+
+    return 0;
+}
+
+
+/* Function to reconfigure all parameters. Inputs are explanatory. Outputs 0 on success.
+   The frame rate follows the exposure time unless fps is set in the config. */
+int SimCamera::ReconfigureAll(int new_gain, int new_exptime, int new_width, int new_height, int new_offsetX,
+                              int new_offsetY, float new_blacklevel, int new_buffersize, string new_savedir){
+
+    if (new_exptime <= 0 || new_width <= 0 || new_height <= 0){
+        cout << "Invalid sim camera configuration" << endl;
+        return 1;
+    }
+    gain = new_gain;
+    exposure_time = new_exptime;
+    width = new_width;
+    height = new_height;
+    offset_x = new_offsetX;
+    offset_y = new_offsetY;
+    black_level = new_blacklevel;
+    buffer_size = new_buffersize;
+    this->imsize = new_width*new_height;
+    savefilename_prefix = new_savedir;
+
+    if (config["sim"]["fps"].value_or(0.0) <= 0){
+        fps = 1e6/exposure_time;
+    }
+
+    cout << "Sim camera reconfigured" << endl;
+
+    GLOB_IMSIZE = imsize;
+    GLOB_WIDTH = new_width;
+
+    return 0;
+}
+
+
+/* Function to De-initialise camera. MUST CALL AFTER USING!!! */
+void SimCamera::DeinitCamera(){
+    noise_table.clear();
+    sky_table.clear();
+    signal.clear();
+}
+
+
+/* Add a gaussian spot of total flux (electrons) to the signal image, at image coordinates x,y */
+void SimCamera::AddSpot(double x, double y, double flux, double sigma){
+
+    int r = static_cast<int>(ceil(4*sigma));
+    int x0 = max(0, static_cast<int>(floor(x)) - r);
+    int x1 = min(width - 1, static_cast<int>(floor(x)) + r);
+    int y0 = max(0, static_cast<int>(floor(y)) - r);
+    int y1 = min(height - 1, static_cast<int>(floor(y)) + r);
+    if (x0 > x1 || y0 > y1){
+        return;
+    }
+    double norm = flux/(2*M_PI*sigma*sigma);
+    double inv_2s2 = 1.0/(2*sigma*sigma);
+
+    for (int j = y0; j <= y1; j++){
+        double ddy = j - y;
+        for (int i = x0; i <= x1; i++){
+            double ddx = i - x;
+            signal[j*width + i] += norm*exp(-(ddx*ddx + ddy*ddy)*inv_2s2);
+        }
+    }
+    boxes.push_back({x0, y0, x1, y1});
+}
+
+
+/* Pre-compute sky-only pixel values (with noise) for the pre-drawn noise table */
+void SimCamera::UpdateSkyTable(){
+    sky_table.resize(SIM_NOISE_TABLE_SIZE);
+    double rn2 = read_noise*read_noise;
+    for (unsigned int i = 0; i < SIM_NOISE_TABLE_SIZE; i++){
+        double val = bias + black_level + (sky + sqrt(sky + rn2)*noise_table[i])/e_per_adu;
+        sky_table[i] = static_cast<unsigned short>(min(65535.0, max(0.0, val)));
+    }
+    sky_black_level = black_level;
+}
+
+
+/* Render the next frame into data (width*height pixels).
+   Sky-only pixels are copied from the pre-computed sky table, starting at a random
+   point each frame; only the pixels around sources are computed. */
+void SimCamera::RenderFrame(unsigned short* data){
+
+    if (sky_black_level != black_level){
+        UpdateSkyTable();
+    }
+    if (signal.size() != imsize){
+        signal.assign(imsize, 0);
+    }
+    boxes.clear();
+
+    // Image motion, common to all sources
+    dx = jitter*gauss(rng);
+    dy = jitter*gauss(rng);
+    double sigma = fwhm/2.3548;
+    for (auto& s : sources){
+        AddSpot(s.x - offset_x + dx, s.y - offset_y + dy, s.flux, sigma);
+    }
+
+    // Tricoupler outputs: 10 wavelength channels per row, each output 2 rows high
+    if (scene == "fringes"){
+        delay += delay_rms*gauss(rng);
+        for (int p = 0; p < 2; p++){
+            for (int k = 0; k < 3; k++){
+                int row = fringe_yref - offset_y + kFringeRows[k] + 8*p;
+                int col0 = fringe_xref - offset_x - 7;
+                if (row < 0 || row + 1 >= height || col0 < 0 || col0 + 9 >= width){
+                    continue;
+                }
+                for (int c = 0; c < 10; c++){
+                    double phase = 2*M_PI*delay/kFringeWaves[c] + 2*M_PI*k/3;
+                    double flux = fringe_flux/3*(1 + visibility*cos(phase));
+                    signal[row*width + col0 + c] += 0.5*flux;
+                    signal[(row + 1)*width + col0 + c] += 0.5*flux;
+                }
+                boxes.push_back({col0, row, col0 + 9, row + 1});
+            }
+        }
+    }
+
+    // Sky, read noise and bias everywhere
+    unsigned int mask = SIM_NOISE_TABLE_SIZE - 1;
+    unsigned int start = rng() & mask;
+    for (unsigned int i = 0; i < imsize;){
+        unsigned int n = min(imsize - i, SIM_NOISE_TABLE_SIZE - ((start + i) & mask));
+        memcpy(data + i, sky_table.data() + ((start + i) & mask), n*sizeof(unsigned short));
+        i += n;
+    }
+
+    // Shot noise around the sources (a pixel in overlapping boxes gets the same value twice)
+    double rn2 = read_noise*read_noise;
+    for (auto& b : boxes){
+        for (int j = b[1]; j <= b[3]; j++){
+            for (int i = b[0]; i <= b[2]; i++){
+                unsigned int ix = j*width + i;
+                double e = sky + signal[ix];
+                double val = bias + black_level + (e + sqrt(e + rn2)*noise_table[(start + ix) & mask])/e_per_adu;
+                data[ix] = static_cast<unsigned short>(min(65535.0, max(0.0, val)));
+            }
+        }
+    }
+    for (auto& b : boxes){
+        for (int j = b[1]; j <= b[3]; j++){
+            std::fill(signal.begin() + j*width + b[0], signal.begin() + j*width + b[2] + 1, 0.0f);
+        }
+    }
+}
+
+
+/* Function to take a number of images with a camera and optionally work on them.
+   INPUTS:
+      num_frames - number of images to take
+      start_index - frame number index of where in the circular buffer to start taking images
+      f - a callback function that will be applied to each image in real time.
+          If f returns 1, it will end acquisition regardless of how long it has to go.
+          Give NULL for no callback function.
+   OUTPUTS:
+      0 on regular exit
+      1 on error
+      2 on callback exit
+*/
+int SimCamera::GrabFrames(unsigned long num_frames, unsigned long start_index, int (*f)(unsigned short*)) {
+
+    if (noise_table.empty()){
+        cout << "Sim camera not initialised" << endl;
+        return 1;
+    }
+
+    int main_result = 0;
+    cout << "Start Acquisition" << endl;
+
+    std::chrono::time_point<std::chrono::steady_clock> start, end;
+
+    //Set timestamp
+    time_t start_time = time(0);
+
+    //Begin timing
+    start = std::chrono::steady_clock::now();
+    auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0/fps));
+    auto next_frame = start;
+
+    unsigned short* data = (unsigned short*)malloc(sizeof(unsigned short)*imsize);
+
+    unsigned long current_index = 0;
+    frames_grabbed = 0;
+    for (unsigned long image_cnt = 0; image_cnt < num_frames; image_cnt++){
+
+        // Wait for the frame to be "read out"
+        next_frame += period;
+        std::this_thread::sleep_until(next_frame);
+
+        RenderFrame(data);
+
+        current_index = (start_index + image_cnt)%buffer_size;
+
+        // Append data to an allocated memory array
+        pthread_mutex_lock(&GLOB_IMG_MUTEX_ARRAY[current_index]);
+        memcpy(GLOB_IMG_ARRAY+imsize*current_index, data, imsize*2);
+        if (GLOB_IMG_META != NULL){
+            long long hw_time = std::chrono::duration_cast<std::chrono::nanoseconds>(next_frame.time_since_epoch()).count();
+            GLOB_IMG_META[current_index] = {frame_id, hw_time, hostTime(), exposure_time};
+        }
+        pthread_mutex_unlock(&GLOB_IMG_MUTEX_ARRAY[current_index]);
+        frame_id++;
+        frames_grabbed++;
+
+        // Do something with the data in real time if required
+        // If 1 is returned by the callback function, end acquisition (regardless of
+        // number of frames to go).
+        if (f != NULL){
+            if ((*f)(data) == 1){
+                main_result = 2;
+                break;
+            }
+        }
+
+        pthread_mutex_lock(&GLOB_LATEST_IMG_INDEX_LOCK);
+        GLOB_LATEST_IMG_INDEX = current_index;
+        pthread_mutex_unlock(&GLOB_LATEST_IMG_INDEX_LOCK);
+    }
+
+    free(data);
+
+    // End Timing
+    end = std::chrono::steady_clock::now();
+
+    cout << "Finished Acquisition" << endl << endl;
+
+    //Set timestamp
+    tm *gmtm = gmtime(&start_time);
+    std::string dt = asctime(gmtm);
+    dt.pop_back();
+
+    timestamp = dt;
+
+    //Calculate duration
+    double duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+
+    total_exposure = duration;
+
+    return main_result;
+}
+
+
+/* Write a given array of image data as a FITS file. Outputs 0 on success.
+   INPUTS:
+      num_images - number of images in the array to write
+      start_index - frame number index of where in the circular buffer to start saving images
+*/
+int SimCamera::SaveFITS(unsigned long num_images, unsigned long start_index)
+{
+    // Pointer to the FITS file; defined in fitsio.h
+    fitsfile *fptr;
+
+    // Take the circular buffer and put the relevant frames in a single, linear array
+    unsigned short *linear_image_array;
+    linear_image_array = (unsigned short*)malloc(sizeof(unsigned short)*imsize*num_images);
+
+    // Fill "saving" array with images
+    unsigned long current_index;
+    for(unsigned long i=0;i<num_images;i++){
+        current_index = (start_index + i)%buffer_size;
+        pthread_mutex_lock(&GLOB_IMG_MUTEX_ARRAY[current_index]);
+        memcpy(linear_image_array+imsize*i,GLOB_IMG_ARRAY+imsize*current_index,imsize*2);
+        pthread_mutex_unlock(&GLOB_IMG_MUTEX_ARRAY[current_index]);
+    }
+
+    // Define filepath and name for the FITS file
+    string file_path = "!" + savefilename + ".fits";
+
+    // Configure FITS file
+    int bitpix = config["fits"]["bitpix"].value_or(20);
+    long naxis = 3; // 2D image over time
+    long naxes[3] = {width, height, static_cast<long>(num_images)};
+
+    //Coadd frames?
+    if(GLOB_COADD){
+        for(unsigned long i=0;i<imsize;i++){
+            for(unsigned long j=1;j<num_images;j++){
+                linear_image_array[i] += linear_image_array[i+j*imsize];
+            }
+        }
+        naxes[2] = 1;
+    }
+
+    // Initialize status before calling fitsio routines
+    int status = 0;
+
+    // Create new FITS file. Will overwrite file with the same name!!
+    if (fits_create_file(&fptr, file_path.c_str(), &status)){
+        cout << "ERROR: Could not create FITS file" << endl;
+        free(linear_image_array);
+        return( status );
+    }
+
+    long fpixel = 1;
+    long nelements = naxes[0] * naxes[1] * naxes[2];
+
+    // Write the image (assuming input of unsigned integers), then the header keywords
+    fits_create_img(fptr, bitpix, naxis, naxes, &status);
+    fits_write_img(fptr, TUSHORT, fpixel, nelements, linear_image_array, &status);
+    fits_write_key(fptr, TSTRING, "STARTTIME", &timestamp[0], "Timestamp of beginning of exposure UTC", &status);
+    fits_write_key(fptr, TSTRING, "SIMSCENE", &scene[0], "Simulated camera scene", &status);
+    fits_write_key(fptr, TINT, "COADD_FLAG", &GLOB_COADD, "Coadded Image Flag", &status);
+    fits_write_key(fptr, TINT, "FRAMEEXPOSURE", &exposure_time, "Individual Exposure Time (us)", &status);
+    fits_write_key(fptr, TDOUBLE, "TOTALEXPOSURE", &total_exposure, "Total Exposure Time (ms)", &status);
+    fits_write_key(fptr, TINT, "GAIN", &gain, "Software Gain", &status);
+    fits_write_key(fptr, TDOUBLE, "BLACK LEVEL", &black_level, "Black Level (ADU)", &status);
+    fits_write_key(fptr, TINT, "HEIGHT", &height, "Image Height (px)", &status);
+    fits_write_key(fptr, TINT, "WIDTH", &width, "Image Width (px)", &status);
+    fits_write_key(fptr, TINT, "XOFFSET", &offset_x, "Image X Offset (px)", &status);
+    fits_write_key(fptr, TINT, "YOFFSET", &offset_y, "Image Y Offset (px)", &status);
+    if (status){
+        cout << "ERROR: Could not write FITS file" << endl;
+        cout << status << endl;
+    }
+
+    // Close file
+    free(linear_image_array);
+    fits_close_file(fptr, &status);
+    pthread_mutex_lock(&GLOB_LATEST_FILE_LOCK);
+    GLOB_LATEST_FILE = savefilename + ".fits";
+    pthread_mutex_unlock(&GLOB_LATEST_FILE_LOCK);
+
+    return( status );
+}
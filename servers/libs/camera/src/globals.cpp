@@ -3,6 +3,7 @@
 #include <pthread.h>
 #include "globals.h"
 #include <functional>
+#include <chrono>
 
 using namespace std;
 
@@ -48,6 +49,9 @@ pthread_mutex_t *GLOB_IMG_MUTEX_ARRAY;
 // Array of images (i.e Image buffer)
 unsigned short *GLOB_IMG_ARRAY;
 
+// Per-frame metadata for the image buffer
+frame_metadata *GLOB_IMG_META = NULL;
+
 // Callback function
 std::function<int(unsigned short*)> GLOB_CALLBACK;
 
@@ -80,6 +84,11 @@ double sinc(double x){
 }
 }
 
+//Host UTC time in unix seconds
+double hostTime(){
+    return std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
 /* Function to pad out strings to print them nicely.
    INPUTS:
       str - string to pad
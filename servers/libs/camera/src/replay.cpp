@@ -0,0 +1,187 @@
+#include "replay.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <fitsio.h>
+#include <zmq.hpp>
+
+using json = nlohmann::json;
+
+/*
+Replies for every client call in the camera servers, with the type the
+caller expects (send<T>)
+*/
+std::map<std::string, json> defaultStubReplies() {
+    return {
+        {"CA.moveSDC", "stub"},
+        {"CA.homeSDC", "stub"},
+        {"CA.SDCpos", 0},
+        {"CA.receiveRelativeTipTiltPos", "stub"},
+        {"RC.receive_ST_angles", "stub"},
+        {"RC.receive_ST_centroid", "stub"},
+        {"RC.receive_ST_fix", "stub"},
+        {"RC.receive_LED_positions", 0},
+        {"DA.LEDOn", 0},
+        {"DA.LEDOff", 0},
+        {"TS.getTargetName", "REPLAY"},
+        {"TS.getBaseline", 0.0},
+        {"TS.getCoordinates", {{"RA", 0.0}, {"DEC", 0.0}}},
+    };
+}
+
+StubServer::StubServer(std::string endpoint_in, std::map<std::string, json> replies, int delay_us)
+    : endpoint(endpoint_in), replies_(defaultStubReplies()), delay_us_(delay_us) {
+    stateful_sdc_ = (replies.count("CA.SDCpos") == 0);
+    for (auto& [name, value] : replies) {
+        replies_[name] = value;
+    }
+    thread_ = std::thread(&StubServer::run, this);
+}
+
+StubServer::~StubServer() {
+    stopping_ = true;
+    thread_.join();
+}
+
+std::map<std::string, int> StubServer::counts() {
+    std::lock_guard<std::mutex> guard(counts_lock_);
+    return counts_;
+}
+
+json StubServer::reply(const std::string& name, const json& args) {
+    // The SDC stage keeps a position: positive moveSDC steps decrease SDCpos
+    if (name == "CA.moveSDC" && args.is_array() && !args.empty() && args[0].is_number()) {
+        sdc_pos_ -= args[0].get<int32_t>();
+    } else if (name == "CA.SDCpos" && stateful_sdc_) {
+        return sdc_pos_;
+    }
+    auto it = replies_.find(name);
+    if (it == replies_.end()) {
+        std::cout << "Stub " << endpoint << ": no reply for " << name << std::endl;
+        return "stub";
+    }
+    return it->second;
+}
+
+void StubServer::run() {
+    zmq::context_t ctx(1);
+    zmq::socket_t sock(ctx, zmq::socket_type::rep);
+    sock.set(zmq::sockopt::rcvtimeo, 100);
+    sock.set(zmq::sockopt::linger, 0);
+    sock.bind(endpoint);
+    std::cout << "Stub server on " << endpoint << std::endl;
+
+    zmq::message_t msg;
+    while (!stopping_) {
+        auto recv_res = sock.recv(msg, zmq::recv_flags::none);
+        if (!recv_res) {
+            continue;
+        }
+        std::string command(static_cast<char*>(msg.data()), msg.size());
+        auto pos = command.find(' ');
+        std::string name = command.substr(0, pos);
+        json args;
+        if (pos != std::string::npos) {
+            args = json::parse(command.substr(pos + 1), nullptr, false);
+        }
+        {
+            std::lock_guard<std::mutex> guard(counts_lock_);
+            counts_[name]++;
+        }
+        if (delay_us_ > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(delay_us_));
+        }
+        std::string res = reply(name, args).dump();
+        sock.send(zmq::message_t(res.c_str(), res.size()), zmq::send_flags::none);
+    }
+}
+
+double LatencyHistogram::percentile(double p) const {
+    if (samples_.empty()) {
+        return 0;
+    }
+    std::vector<double> sorted = samples_;
+    size_t i = static_cast<size_t>(std::lround(p*(sorted.size() - 1)));
+    std::nth_element(sorted.begin(), sorted.begin() + i, sorted.end());
+    return sorted[i];
+}
+
+double LatencyHistogram::mean() const {
+    if (samples_.empty()) {
+        return 0;
+    }
+    return std::accumulate(samples_.begin(), samples_.end(), 0.0)/samples_.size();
+}
+
+void LatencyHistogram::print() const {
+    std::cout << "Frames: " << count() << std::endl;
+    std::cout << "Latency (us): mean " << mean() << ", p50 " << percentile(0.5) << ", p90 " << percentile(0.9)
+              << ", p99 " << percentile(0.99) << ", p99.9 " << percentile(0.999) << ", max " << percentile(1.0)
+              << std::endl;
+
+    // log2 bins from 1us
+    std::vector<size_t> bins(32, 0);
+    for (double s : samples_) {
+        int b = s < 1 ? 0 : std::min(31, static_cast<int>(std::log2(s)) + 1);
+        bins[b]++;
+    }
+    size_t max_count = *std::max_element(bins.begin(), bins.end());
+    int first = 0, last = 31;
+    while (first < 31 && bins[first] == 0) first++;
+    while (last > 0 && bins[last] == 0) last--;
+    for (int b = first; b <= last; b++) {
+        long lo = b == 0 ? 0 : 1L << (b - 1);
+        long hi = 1L << b;
+        int bar = max_count ? static_cast<int>(50.0*bins[b]/max_count) : 0;
+        std::string label = std::to_string(lo) + "-" + std::to_string(hi) + " us";
+        std::cout << std::setw(20) << std::left << label << std::string(bar, '#') << " " << bins[b] << std::endl;
+    }
+}
+
+int LatencyHistogram::save(const std::string& filename) const {
+    std::ofstream file(filename);
+    if (!file.is_open()) {
+        std::cout << "Could not open " << filename << std::endl;
+        return 1;
+    }
+    for (double s : samples_) {
+        file << s << "\n";
+    }
+    return 0;
+}
+
+int readFITSCube(const std::string& filename, std::vector<unsigned short>& data,
+                 long& width, long& height, long& num_frames, int& exptime_us) {
+    fitsfile *fptr;
+    int status = 0;
+    int naxis = 0;
+    long naxes[3] = {1, 1, 1};
+
+    if (fits_open_file(&fptr, filename.c_str(), READONLY, &status)) {
+        std::cout << "ERROR: Could not open FITS file " << filename << std::endl;
+        return status;
+    }
+    if (fits_get_img_dim(fptr, &naxis, &status) || fits_get_img_size(fptr, 3, naxes, &status)) {
+        fits_close_file(fptr, &status);
+        return status;
+    }
+    width = naxes[0];
+    height = naxes[1];
+    num_frames = naxis > 2 ? naxes[2] : 1;
+
+    exptime_us = 0;
+    int key_status = 0;
+    fits_read_key(fptr, TINT, "FRAMEEXPOSURE", &exptime_us, NULL, &key_status);
+
+    data.resize(static_cast<size_t>(width)*height*num_frames);
+    long fpixel[3] = {1, 1, 1};
+    if (fits_read_pix(fptr, TUSHORT, fpixel, data.size(), NULL, data.data(), NULL, &status)) {
+        std::cout << "ERROR: Could not read FITS file " << filename << std::endl;
+    }
+    fits_close_file(fptr, &status);
+    return status;
+}
@@ -0,0 +1,226 @@
+/*
+Offline replay harness for the camera servers.
+
+Links against a camera server's objects in place of main.cpp, constructs the
+server instance in-process (which sets GLOB_CALLBACK), then feeds the frames of
+saved FITS cubes to the callback at full speed, in real time (from the
+FRAMEEXPOSURE keyword) or at a given frame rate. The commander servers the
+callback talks to (chief aux, deputy aux, robot controller, target server) are
+replaced by stub servers with canned replies, so the data processing and the
+control decisions can be profiled and debugged without hardware.
+
+Usage:
+    <Server>Replay config.toml cube1.fits [cube2.fits ...]
+        --stub tcp://127.0.0.1:4101 (repeat for each endpoint the server calls)
+        --reply CA.SDCpos=0 (override a stub reply with a JSON value)
+        --command "SC.enableGDservo 1" (run before the replay, repeatable)
+        --after "SC.getGDestimate" (run after the replay, repeatable)
+        --rate max|realtime|<fps>
+        --latency latency.txt (write the per-frame latency)
+*/
+
+#include <commander/commander.h>
+#include "globals.h"
+#include "replay.h"
+#include <boost/program_options.hpp>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include "toml.hpp"
+
+namespace po = boost::program_options;
+using json = nlohmann::json;
+using namespace std;
+
+/*
+Run one command in the form used by the socket server: "name arg1, arg2"
+*/
+void runCommand(commander::Module& module, const string& command) {
+    auto pos = command.find(' ');
+    string name = command.substr(0, pos);
+    json args;
+    if (pos != string::npos) {
+        args = json::parse("[" + command.substr(pos + 1) + "]");
+    }
+    cout << "> " << command << endl;
+    cout << module.execute(name, args).dump() << endl;
+}
+
+int main(int argc, char* argv[]) {
+
+    cout << "Application build date: " << __DATE__ << " " << __TIME__ << endl << endl;
+
+    string config_file;
+    vector<string> fits_files, stubs, replies, commands, after;
+    string rate, latency_file;
+    int stub_delay;
+
+    po::options_description desc("Replay options");
+    desc.add_options()
+        ("help,h", "Print this message")
+        ("config", po::value<string>(&config_file)->required(), "Server config file (TOML)")
+        ("fits", po::value<vector<string>>(&fits_files)->required(), "FITS cubes to replay")
+        ("stub", po::value<vector<string>>(&stubs), "Endpoint to run a stub commander server on")
+        ("reply", po::value<vector<string>>(&replies), "Stub reply override, NAME=JSON")
+        ("stub-delay", po::value<int>(&stub_delay)->default_value(0), "Stub reply delay (us)")
+        ("command", po::value<vector<string>>(&commands), "Command to run before the replay")
+        ("after", po::value<vector<string>>(&after), "Command to run after the replay")
+        ("rate", po::value<string>(&rate)->default_value("max"), "max, realtime or a frame rate (Hz)")
+        ("latency", po::value<string>(&latency_file), "File to save the per-frame latency (us)");
+    po::positional_options_description pos;
+    pos.add("config", 1).add("fits", -1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(pos).run(), vm);
+        if (vm.count("help")) {
+            cout << desc << endl;
+            return 0;
+        }
+        po::notify(vm);
+    } catch (const std::exception& e) {
+        cerr << e.what() << endl << desc << endl;
+        return 1;
+    }
+
+    // Check whether config file is readable/exists
+    if (access(config_file.c_str(), R_OK) == -1) {
+        cerr << "Config file is not readable" << endl;
+        return 1;
+    }
+    GLOB_CONFIGFILE = (char*)config_file.c_str();
+
+    // Stub servers for everything the callback talks to
+    map<string, json> reply_table;
+    for (auto& r : replies) {
+        auto eq = r.find('=');
+        if (eq == string::npos) {
+            cerr << "Bad reply (expected NAME=JSON): " << r << endl;
+            return 1;
+        }
+        reply_table[r.substr(0, eq)] = json::parse(r.substr(eq + 1));
+    }
+    vector<unique_ptr<StubServer>> stub_servers;
+    for (auto& endpoint : stubs) {
+        stub_servers.emplace_back(new StubServer(endpoint, reply_table, stub_delay));
+    }
+
+    // Load the first cube so that the image size is known before the server starts
+    vector<unsigned short> data;
+    long width, height, num_frames;
+    int exptime_us;
+    if (readFITSCube(fits_files[0], data, width, height, num_frames, exptime_us)) {
+        return 1;
+    }
+    GLOB_WIDTH = width;
+    GLOB_IMSIZE = width*height;
+
+    // The first command constructs the server instance (and sets GLOB_CALLBACK)
+    commander::Module module;
+    if (commands.empty()) {
+        for (auto& name : module.command_names()) {
+            if (name.size() > 7 && name.substr(name.size() - 7) == ".status") {
+                commands.push_back(name);
+                break;
+            }
+        }
+    }
+    for (auto& c : commands) {
+        runCommand(module, c);
+    }
+    if (!GLOB_CALLBACK) {
+        cerr << "No callback set by the server" << endl;
+        return 1;
+    }
+
+    // Ring buffer as set up by the camera thread, for commands that read the latest image
+    if (GLOB_CONFIG_PARAMS.buffersize <= 0) {
+        GLOB_CONFIG_PARAMS.buffersize = 10;
+    }
+    int buffer_size = GLOB_CONFIG_PARAMS.buffersize;
+    GLOB_IMG_ARRAY = (unsigned short*)malloc(sizeof(unsigned short)*GLOB_IMSIZE*buffer_size);
+    GLOB_IMG_MUTEX_ARRAY = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t)*buffer_size);
+    for (int i = 0; i < buffer_size; i++) {
+        GLOB_IMG_MUTEX_ARRAY[i] = PTHREAD_MUTEX_INITIALIZER;
+    }
+    GLOB_IMG_META = (frame_metadata *)calloc(buffer_size, sizeof(frame_metadata));
+    GLOB_CAM_STATUS = CAM_CONNECTED;
+    GLOB_RUNNING = 1;
+
+    LatencyHistogram hist;
+    int num_errors = 0;
+    int current_index = 0;
+    unsigned long frame_id = 0;
+    auto t_start = chrono::steady_clock::now();
+    auto t_next = t_start;
+
+    for (size_t f = 0; f < fits_files.size(); f++) {
+        if (f > 0 && readFITSCube(fits_files[f], data, width, height, num_frames, exptime_us)) {
+            continue;
+        }
+        if (width*height != GLOB_IMSIZE) {
+            cout << "Skipping " << fits_files[f] << ": image size differs from the first cube" << endl;
+            continue;
+        }
+        cout << "Replaying " << fits_files[f] << " (" << num_frames << " frames)" << endl;
+
+        double period_us = 0;
+        if (rate == "realtime") {
+            period_us = exptime_us;
+        } else if (rate != "max") {
+            period_us = 1e6/stod(rate);
+        }
+
+        for (long k = 0; k < num_frames; k++) {
+            unsigned short* frame = data.data() + k*GLOB_IMSIZE;
+            if (period_us > 0) {
+                this_thread::sleep_until(t_next);
+                t_next += chrono::microseconds(static_cast<long>(period_us));
+            }
+
+            pthread_mutex_lock(&GLOB_IMG_MUTEX_ARRAY[current_index]);
+            memcpy(GLOB_IMG_ARRAY + GLOB_IMSIZE*current_index, frame, GLOB_IMSIZE*2);
+            GLOB_IMG_META[current_index] = {frame_id++, 0, hostTime(), exptime_us};
+            pthread_mutex_unlock(&GLOB_IMG_MUTEX_ARRAY[current_index]);
+
+            auto t0 = chrono::steady_clock::now();
+            if (GLOB_CALLBACK(frame)) {
+                num_errors++;
+            }
+            auto t1 = chrono::steady_clock::now();
+            hist.add(chrono::duration<double, micro>(t1 - t0).count());
+
+            pthread_mutex_lock(&GLOB_LATEST_IMG_INDEX_LOCK);
+            GLOB_LATEST_IMG_INDEX = current_index;
+            pthread_mutex_unlock(&GLOB_LATEST_IMG_INDEX_LOCK);
+            current_index = (current_index + 1) % buffer_size;
+        }
+    }
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - t_start).count();
+    GLOB_RUNNING = 0;
+
+    for (auto& c : after) {
+        runCommand(module, c);
+    }
+
+    cout << endl << "Replay time: " << elapsed << " s, callback errors: " << num_errors << endl;
+    hist.print();
+    if (!latency_file.empty()) {
+        hist.save(latency_file);
+    }
+    for (auto& s : stub_servers) {
+        for (auto& [name, count] : s->counts()) {
+            cout << s->endpoint << " " << name << ": " << count << " requests" << endl;
+        }
+    }
+
+    free(GLOB_IMG_ARRAY);
+    free(GLOB_IMG_MUTEX_ARRAY);
+    free(GLOB_IMG_META);
+    GLOB_IMG_META = NULL;
+    return 0;
+}
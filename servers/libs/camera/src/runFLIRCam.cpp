@@ -3,14 +3,20 @@
 #include <fstream>
 #include <fmt/core.h>
 #include <unistd.h>
+// Built with -DNO_CAMERA_SDK (e.g. for the replay tools), only the simulated camera is available
+#ifndef NO_CAMERA_SDK
 #include "FLIRCamera.h"
 #include "Spinnaker.h"
+#endif
 #include "toml.hpp"
 #include <pthread.h>
 #include "runFLIRCam.h"
+#include "SimCamera.h"
 #include "globals.h"
 
+#ifndef NO_CAMERA_SDK
 using namespace Spinnaker;
+#endif
 using namespace std;
 
 /* Program to run the camera based on a configuration file
@@ -54,16 +60,125 @@ int CallbackFunc (unsigned short* data){
 /* Function to reconfigure all parameters
     INPUTS:
        c - configuration (json) structure with all the values
-       Fcam - FLIRCamera class 
+       cam - camera class (any backend)
 */
-void reconfigure(configuration c, FLIRCamera& Fcam){
+void reconfigure(configuration c, Camera& cam){
 
-	Fcam.ReconfigureAll(c.gain, c.exptime, c.width, c.height, c.offsetX, c.offsetY, c.blacklevel, c.buffersize, c.savedir);
+	cam.ReconfigureAll(c.gain, c.exptime, c.width, c.height, c.offsetX, c.offsetY, c.blacklevel, c.buffersize, c.savedir);
 	
 	return;
 }
 
 
+/* Waiting loop of the camera thread: reconfigures and acquires with the given camera
+   until the camera status is no longer CAM_CONNECTED
+    INPUTS:
+       cam - initialised camera (any backend)
+       sleeptime - sleep between checks of the flags (us)
+*/
+void cameraLoop(Camera& cam, int sleeptime){
+
+    // Cam status of 2 indicates camera is waiting   
+    pthread_mutex_lock(&GLOB_FLAG_LOCK);
+    GLOB_CAM_STATUS = CAM_CONNECTED;
+    pthread_mutex_unlock(&GLOB_FLAG_LOCK);
+    
+		cout << "Beginning Loop" << endl;
+    // Run a waiting loop as long as the camera remains "waiting"
+    while (GLOB_CAM_STATUS==CAM_CONNECTED){
+    
+        // Check if camera needs reconfiguring
+    	if(GLOB_RECONFIGURE==1){
+    		reconfigure(GLOB_CONFIG_PARAMS,cam);
+    		
+    		pthread_mutex_lock(&GLOB_FLAG_LOCK);
+    		GLOB_RECONFIGURE=0;
+    		pthread_mutex_unlock(&GLOB_FLAG_LOCK);
+    	}
+    
+        // Check if camera needs to start acquisition
+    	if(GLOB_RUNNING==1){
+
+				int finish = 0;
+				
+				// How many frames to take?
+				pthread_mutex_lock(&GLOB_FLAG_LOCK);
+				unsigned long num_frames = GLOB_NUMFRAMES;
+				pthread_mutex_unlock(&GLOB_FLAG_LOCK);
+				
+				int SAVE_FLAG = 1;
+				
+				// No saving if num_frames = 0; continuous acquisition
+				if(num_frames == 0){
+					SAVE_FLAG = 0;
+					num_frames = 10000000;
+				};
+
+				unsigned long buffer_no = 0;
+				unsigned long save_no = 0;
+
+				// Allocate memory for the image data (given by size of image and buffer size), and mutex array
+				GLOB_IMG_ARRAY = (unsigned short*)malloc(sizeof(unsigned short)*cam.imsize*cam.buffer_size);
+				GLOB_IMG_MUTEX_ARRAY = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t)*cam.buffer_size);
+				for(int i=0; i<cam.buffer_size; i++){
+					GLOB_IMG_MUTEX_ARRAY[i] = PTHREAD_MUTEX_INITIALIZER;
+				}
+				GLOB_IMG_META = (frame_metadata *)calloc(cam.buffer_size, sizeof(frame_metadata));
+
+				// Append to a streaming cube rather than one file per chunk?
+				bool STREAM_FLAG = cam.StreamingEnabled();
+				
+				while (finish == 0){
+				
+			        // Acquire the images, saving them to GLOB_IMG_ARRAY, and call "CallbackFunc"
+			        // after each image is retrieved. CallbackFunc to return 1 when exiting!
+					finish = cam.GrabFrames(num_frames, buffer_no, CallbackFunc);
+
+					if (SAVE_FLAG == 1 && STREAM_FLAG){
+						cam.StreamFITS(cam.frames_grabbed, buffer_no);
+					} else if (SAVE_FLAG == 1){
+						// Save the data as a FITS file
+						cout << "Saving Data" << endl;
+
+						string save_no_str = fmt::format("{:04d}", save_no);
+						cam.savefilename = cam.savefilename_prefix + "_" + save_no_str;
+						
+						cam.SaveFITS(num_frames, buffer_no);
+						
+						save_no = (save_no + 1) % cam.num_savefiles;
+					}
+					
+					// Index of the next available spot in the circular buffer
+					buffer_no = (buffer_no+num_frames)%cam.buffer_size;
+				}
+								
+				if (STREAM_FLAG){
+					cam.CloseStream();
+				}
+
+			   	// Free the memory
+				pthread_mutex_lock(&GLOB_FLAG_LOCK);
+    		GLOB_RUNNING = 0;
+    		pthread_mutex_unlock(&GLOB_FLAG_LOCK);
+    		
+    		free(GLOB_IMG_ARRAY);
+				free(GLOB_IMG_MUTEX_ARRAY);
+				free(GLOB_IMG_META);
+				GLOB_IMG_META = NULL;
+			
+				// Reset latest file for plate solver to stop solving when not running
+				pthread_mutex_lock(&GLOB_LATEST_FILE_LOCK);
+    			GLOB_LATEST_FILE = "CAMERA_NOT_SAVING";
+   				pthread_mutex_unlock(&GLOB_LATEST_FILE_LOCK);
+
+			}
+			
+			usleep(sleeptime); // Sleep to save resources
+
+		}
+}
+
+
 /* Main pThread function to run the camera with a separate thread */ 
 void *runCam(void*) {
 	
@@ -91,6 +206,34 @@ void *runCam(void*) {
 	//toml::table config;
     toml::table config = toml::parse_file(config_file);
 
+    // Get the settings for the particular camera
+    toml::table cam_config = *config.get("FLIRcamera")->as_table();
+    int sleeptime = cam_config["sleep_time"].value_or(1000000);
+
+    // Simulated camera (backend = "sim"): no Spinnaker system needed
+    string backend = cam_config["backend"].value_or("spinnaker");
+    if (backend == "sim"){
+        cout << "Using simulated camera" << endl;
+        SimCamera Scam (cam_config);
+        if (Scam.InitCamera()){
+            pthread_mutex_lock(&GLOB_FLAG_LOCK);
+            GLOB_CAM_STATUS = CAM_DISCONNECTED;
+            pthread_mutex_unlock(&GLOB_FLAG_LOCK);
+            pthread_exit(NULL);
+        }
+        cameraLoop(Scam, sleeptime);
+        Scam.DeinitCamera();
+        pthread_exit(NULL);
+    }
+
+#ifdef NO_CAMERA_SDK
+    cerr << "Built without the Spinnaker SDK: only backend = \"sim\" is available" << endl;
+    pthread_mutex_lock(&GLOB_FLAG_LOCK);
+    GLOB_CAM_STATUS = CAM_DISCONNECTED;
+    pthread_mutex_unlock(&GLOB_FLAG_LOCK);
+    pthread_exit(NULL);
+#else
+
 	cout << "Getting system" << endl;
     // Retrieve singleton reference to system object
     SystemPtr system = System::GetInstance();
@@ -112,10 +255,7 @@ void *runCam(void*) {
     	pthread_mutex_unlock(&GLOB_FLAG_LOCK);
         pthread_exit(NULL);
     } else {
-        // Get the settings for the particular camera
-        toml::table cam_config = *config.get("FLIRcamera")->as_table();
         string serialNum = cam_config["cam_ID"].value_or("00000000");
-        int sleeptime = cam_config["sleep_time"].value_or(1000000);
 
 	    // Initialise FLIRCamera instance from the serial number
 		Spinnaker::CameraPtr pCam = cam_list.GetByDeviceID(serialNum);
@@ -150,92 +290,8 @@ void *runCam(void*) {
 	    // Setup and start the camera
         Fcam.InitCamera();
 
-        // Cam status of 2 indicates camera is waiting   
-        pthread_mutex_lock(&GLOB_FLAG_LOCK);
-        GLOB_CAM_STATUS = CAM_CONNECTED;
-        pthread_mutex_unlock(&GLOB_FLAG_LOCK);
-        
-		cout << "Beginning Loop" << endl;
-        // Run a waiting loop as long as the camera remains "waiting"
-        while (GLOB_CAM_STATUS==CAM_CONNECTED){
-        
-            // Check if camera needs reconfiguring
-        	if(GLOB_RECONFIGURE==1){
-        		reconfigure(GLOB_CONFIG_PARAMS,Fcam);
-        		
-        		pthread_mutex_lock(&GLOB_FLAG_LOCK);
-        		GLOB_RECONFIGURE=0;
-        		pthread_mutex_unlock(&GLOB_FLAG_LOCK);
-        	}
-        
-            // Check if camera needs to start acquisition
-        	if(GLOB_RUNNING==1){
-
-				int finish = 0;
-				
-				// How many frames to take?
-				pthread_mutex_lock(&GLOB_FLAG_LOCK);
-				unsigned long num_frames = GLOB_NUMFRAMES;
-				pthread_mutex_unlock(&GLOB_FLAG_LOCK);
-				
-				int SAVE_FLAG = 1;
-				
-				// No saving if num_frames = 0; continuous acquisition
-				if(num_frames == 0){
-					SAVE_FLAG = 0;
-					num_frames = 10000000;
-				};
-
-				unsigned long buffer_no = 0;
-				unsigned long save_no = 0;
-
-				// Allocate memory for the image data (given by size of image and buffer size), and mutex array
-				GLOB_IMG_ARRAY = (unsigned short*)malloc(sizeof(unsigned short)*Fcam.imsize*Fcam.buffer_size);
-				GLOB_IMG_MUTEX_ARRAY = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t)*Fcam.buffer_size);
-				for(int i=0; i<Fcam.buffer_size; i++){
-					GLOB_IMG_MUTEX_ARRAY[i] = PTHREAD_MUTEX_INITIALIZER;
-				}
-				
-				while (finish == 0){
-				
-			        // Acquire the images, saving them to GLOB_IMG_ARRAY, and call "CallbackFunc"
-			        // after each image is retrieved. CallbackFunc to return 1 when exiting!
-					finish = Fcam.GrabFrames(num_frames, buffer_no, CallbackFunc);
-
-					if (SAVE_FLAG == 1){
-						// Save the data as a FITS file
-						cout << "Saving Data" << endl;
-
-						string save_no_str = fmt::format("{:04d}", save_no);
-						Fcam.savefilename = Fcam.savefilename_prefix + "_" + save_no_str;
-						
-						Fcam.SaveFITS(num_frames, buffer_no);
-						
-						save_no = (save_no + 1) % Fcam.num_savefiles;
-					}
-					
-					// Index of the next available spot in the circular buffer
-					buffer_no = (buffer_no+num_frames)%Fcam.buffer_size;
-				}
-								
-			   	// Free the memory
-				pthread_mutex_lock(&GLOB_FLAG_LOCK);
-        		GLOB_RUNNING = 0;
-        		pthread_mutex_unlock(&GLOB_FLAG_LOCK);
-        		
-        		free(GLOB_IMG_ARRAY);
-				free(GLOB_IMG_MUTEX_ARRAY);
-			
-				// Reset latest file for plate solver to stop solving when not running
-				pthread_mutex_lock(&GLOB_LATEST_FILE_LOCK);
-    			GLOB_LATEST_FILE = "CAMERA_NOT_SAVING";
-   				pthread_mutex_unlock(&GLOB_LATEST_FILE_LOCK);
-
-			}
-			
-			usleep(sleeptime); // Sleep to save resources
-
-		}
+        // Wait for commands until the camera is disconnected
+        cameraLoop(Fcam, sleeptime);
 		
     Fcam.DeinitCamera(); // Deinit camera
 	}
@@ -248,4 +304,5 @@ void *runCam(void*) {
     
 
     pthread_exit(NULL);
+#endif
 }
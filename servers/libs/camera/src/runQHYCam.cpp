@@ -3,11 +3,15 @@
 #include <fstream>
 #include <unistd.h>
 #include <fmt/core.h>
+// Built with -DNO_CAMERA_SDK (e.g. for the replay tools), only the simulated camera is available
+#ifndef NO_CAMERA_SDK
 #include "QHYCamera.h"
 #include "qhyccd.h"
+#endif
 #include "toml.hpp"
 #include <pthread.h>
 #include "runQHYCam.h"
+#include "SimCamera.h"
 #include "globals.h"
 
 using namespace std;
@@ -53,18 +57,127 @@ int CallbackFunc (unsigned short* data){
 /* Function to reconfigure all parameters
     INPUTS:
        c - configuration (json) structure with all the values
-       Qcam - QHYCamera class 
+       cam - camera class (any backend)
     Returns 0 on success, 1 on error
 */
-int reconfigure(configuration c, QHYCamera& Qcam){
+int reconfigure(configuration c, Camera& cam){
 
 	int ret_val = 0;
 
-	ret_val = Qcam.ReconfigureAll(c.gain, c.exptime, c.width, c.height, c.offsetX, c.offsetY, static_cast<int>(c.blacklevel), c.buffersize, c.savedir);
+	ret_val = cam.ReconfigureAll(c.gain, c.exptime, c.width, c.height, c.offsetX, c.offsetY, c.blacklevel, c.buffersize, c.savedir);
 	
 	return ret_val;
 }
 
+/* Waiting loop of the camera thread: reconfigures and acquires with the given camera
+   until the camera status is no longer CAM_CONNECTED
+    INPUTS:
+       cam - initialised camera (any backend)
+*/
+void cameraLoop(Camera& cam){
+
+  	// Cam status of 2 indicates camera is waiting     
+    pthread_mutex_lock(&GLOB_FLAG_LOCK);
+    GLOB_CAM_STATUS = 2;
+    pthread_mutex_unlock(&GLOB_FLAG_LOCK);
+
+    // Run a waiting loop as long as the camera remains "waiting"
+    while (GLOB_CAM_STATUS==2){
+        
+        // Check if camera needs reconfiguring
+    	if(GLOB_RECONFIGURE==1){
+
+    		if (reconfigure(GLOB_CONFIG_PARAMS,cam)){
+    		    printf("Reconfig failed");
+    		}
+    		
+    		pthread_mutex_lock(&GLOB_FLAG_LOCK);
+    		GLOB_RECONFIGURE=0;
+    		pthread_mutex_unlock(&GLOB_FLAG_LOCK);
+    	}
+    
+        // Check if camera needs to start acquisition
+    	if(GLOB_RUNNING==1){
+
+		    int finish = 0;
+		    
+		    // How many frames to take?
+		    pthread_mutex_lock(&GLOB_FLAG_LOCK);
+		    unsigned long num_frames = GLOB_NUMFRAMES;
+		    pthread_mutex_unlock(&GLOB_FLAG_LOCK);
+		    
+		    int SAVE_FLAG = 1;
+		    
+		    // No saving if num_frames = 0; continuous acquisition
+		    if(num_frames == 0){
+			    SAVE_FLAG = 0;
+			    num_frames = 10000000;
+		    };
+
+		    unsigned long buffer_no = 0;
+		    unsigned long save_no = 0;
+
+		    // Allocate memory for the image data (given by size of image and buffer size), and mutex array
+		    GLOB_IMG_ARRAY = (unsigned short*)malloc(sizeof(unsigned short)*cam.imsize*cam.buffer_size);
+		    GLOB_IMG_MUTEX_ARRAY = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t)*cam.buffer_size);
+		    for(int i=0; i<cam.buffer_size; i++){
+			    GLOB_IMG_MUTEX_ARRAY[i] = PTHREAD_MUTEX_INITIALIZER;
+		    }
+		    GLOB_IMG_META = (frame_metadata *)calloc(cam.buffer_size, sizeof(frame_metadata));
+
+		    // Append to a streaming cube rather than one file per chunk?
+		    bool STREAM_FLAG = cam.StreamingEnabled();
+		    
+		    while (finish == 0){
+		    
+			    // Acquire the images, saving them to GLOB_IMG_ARRAY, and call "CallbackFunc"
+			    // after each image is retrieved. CallbackFunc to return 1 when exiting!
+			    finish = cam.GrabFrames(num_frames, buffer_no, CallbackFunc);
+			    
+			    // Check if grabFrames returned an error
+			    if (finish == 1){
+			        printf("Error in Grab Frames");
+    	            break;
+			    }
+
+			    if (SAVE_FLAG == 1 && STREAM_FLAG){
+				    cam.StreamFITS(cam.frames_grabbed, buffer_no);
+			    } else if (SAVE_FLAG == 1){
+				    // Save the data as a FITS file
+				    cout << "Saving Data" << endl;
+
+					string save_no_str = fmt::format("{:04d}", save_no);
+				    cam.savefilename = cam.savefilename_prefix + "_" + save_no_str;
+				    
+				    cam.SaveFITS(num_frames, buffer_no);
+				    
+				    save_no = (save_no + 1) % cam.num_savefiles;
+			    }
+			    
+			    // Index of the next available spot in the circular buffer
+			    buffer_no = (buffer_no+num_frames)%cam.buffer_size;
+		    }
+						    
+		    if (STREAM_FLAG){
+			    cam.CloseStream();
+		    }
+
+	       	// Free the memory
+		    pthread_mutex_lock(&GLOB_FLAG_LOCK);
+    		GLOB_RUNNING = 0;
+    		pthread_mutex_unlock(&GLOB_FLAG_LOCK);
+    		
+    		free(GLOB_IMG_ARRAY);
+		    free(GLOB_IMG_MUTEX_ARRAY);
+		    free(GLOB_IMG_META);
+		    GLOB_IMG_META = NULL;
+	    }
+	    
+	    sleep(1); // Sleep to save resources
+
+	}
+}
+
 /* Main pThread function to run the camera with a separate thread */ 
 void *runCam(void*) {
 	
@@ -94,6 +207,33 @@ void *runCam(void*) {
 	//toml::table config;
     toml::table config = toml::parse_file(config_file);
 
+    // Get the settings for the particular camera
+    toml::table cam_config = *config.get("QHYcamera")->as_table();
+
+    // Simulated camera (backend = "sim"): no QHY SDK needed
+    string backend = cam_config["backend"].value_or("qhy");
+    if (backend == "sim"){
+        cout << "Using simulated camera" << endl;
+        SimCamera Scam (cam_config);
+        if (Scam.InitCamera()){
+            pthread_mutex_lock(&GLOB_FLAG_LOCK);
+            GLOB_CAM_STATUS = CAM_DISCONNECTED;
+            pthread_mutex_unlock(&GLOB_FLAG_LOCK);
+            pthread_exit(NULL);
+        }
+        cameraLoop(Scam);
+        Scam.DeinitCamera();
+        pthread_exit(NULL);
+    }
+
+#ifdef NO_CAMERA_SDK
+    cerr << "Built without the QHY SDK: only backend = \"sim\" is available" << endl;
+    pthread_mutex_lock(&GLOB_FLAG_LOCK);
+    GLOB_CAM_STATUS = CAM_DISCONNECTED;
+    pthread_mutex_unlock(&GLOB_FLAG_LOCK);
+    pthread_exit(NULL);
+#else
+
 	SDKVersion();
 
     // Init SDK
@@ -147,10 +287,6 @@ void *runCam(void*) {
         pthread_exit(NULL);
     }
 
-    // Get the settings for the particular camera
-    toml::table cam_config = *config.get("QHYcamera")->as_table();
-
-
     // Initialise QHYCamera instance from the first available camera
     QHYCamera Qcam (pCamHandle, cam_config);
 
@@ -160,94 +296,8 @@ void *runCam(void*) {
     	pthread_exit(NULL);
     }
 
-  	// Cam status of 2 indicates camera is waiting     
-    pthread_mutex_lock(&GLOB_FLAG_LOCK);
-    GLOB_CAM_STATUS = 2;
-    pthread_mutex_unlock(&GLOB_FLAG_LOCK);
-
-    // Run a waiting loop as long as the camera remains "waiting"
-    while (GLOB_CAM_STATUS==2){
-        
-        // Check if camera needs reconfiguring
-    	if(GLOB_RECONFIGURE==1){
-
-    		if (reconfigure(GLOB_CONFIG_PARAMS,Qcam)){
-    		    printf("Reconfig failed");
-    		}
-    		
-    		pthread_mutex_lock(&GLOB_FLAG_LOCK);
-    		GLOB_RECONFIGURE=0;
-    		pthread_mutex_unlock(&GLOB_FLAG_LOCK);
-    	}
-    
-        // Check if camera needs to start acquisition
-    	if(GLOB_RUNNING==1){
-
-		    int finish = 0;
-		    
-		    // How many frames to take?
-		    pthread_mutex_lock(&GLOB_FLAG_LOCK);
-		    unsigned long num_frames = GLOB_NUMFRAMES;
-		    pthread_mutex_unlock(&GLOB_FLAG_LOCK);
-		    
-		    int SAVE_FLAG = 1;
-		    
-		    // No saving if num_frames = 0; continuous acquisition
-		    if(num_frames == 0){
-			    SAVE_FLAG = 0;
-			    num_frames = 10000000;
-		    };
-
-		    unsigned long buffer_no = 0;
-		    unsigned long save_no = 0;
-
-		    // Allocate memory for the image data (given by size of image and buffer size), and mutex array
-		    GLOB_IMG_ARRAY = (unsigned short*)malloc(sizeof(unsigned short)*Qcam.imsize*Qcam.buffer_size);
-		    GLOB_IMG_MUTEX_ARRAY = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t)*Qcam.buffer_size);
-		    for(int i=0; i<Qcam.buffer_size; i++){
-			    GLOB_IMG_MUTEX_ARRAY[i] = PTHREAD_MUTEX_INITIALIZER;
-		    }
-		    
-		    while (finish == 0){
-		    
-			    // Acquire the images, saving them to GLOB_IMG_ARRAY, and call "CallbackFunc"
-			    // after each image is retrieved. CallbackFunc to return 1 when exiting!
-			    finish = Qcam.GrabFrames(num_frames, buffer_no, CallbackFunc);
-			    
-			    // Check if grabFrames returned an error
-			    if (finish == 1){
-			        printf("Error in Grab Frames");
-    	            break;
-			    }
-
-			    if (SAVE_FLAG == 1){
-				    // Save the data as a FITS file
-				    cout << "Saving Data" << endl;
-
-					string save_no_str = fmt::format("{:04d}", save_no);
-				    Qcam.savefilename = Qcam.savefilename_prefix + "_" + save_no_str;
-				    
-				    Qcam.SaveFITS(num_frames, buffer_no);
-				    
-				    save_no = (save_no + 1) % Qcam.num_savefiles;
-			    }
-			    
-			    // Index of the next available spot in the circular buffer
-			    buffer_no = (buffer_no+num_frames)%Qcam.buffer_size;
-		    }
-						    
-	       	// Free the memory
-		    pthread_mutex_lock(&GLOB_FLAG_LOCK);
-    		GLOB_RUNNING = 0;
-    		pthread_mutex_unlock(&GLOB_FLAG_LOCK);
-    		
-    		free(GLOB_IMG_ARRAY);
-		    free(GLOB_IMG_MUTEX_ARRAY);
-	    }
-	    
-	    sleep(1); // Sleep to save resources
-
-	}
+    // Wait for commands until the camera is disconnected
+    cameraLoop(Qcam);
 
     Qcam.DeinitCamera(); // Deinit camera
 
@@ -261,5 +311,6 @@ void *runCam(void*) {
     }
 
     pthread_exit(NULL);
+#endif
 }
 
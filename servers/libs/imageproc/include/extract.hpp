@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+
+// Star source extraction from a raw camera frame, for plate solving without writing the
+// frame to disk: the steps run_plate_solver.py takes with numpy and SEP (row median
+// subtraction, sep.Background mesh, matched filter threshold, connected pixels, deblending,
+// sorted by flux). The uint16 frame is read where it is, a strip of rows at a time, with
+// the strips shared between threads; it is never copied to a floating point image.
+namespace extract {
+
+// An extracted source
+struct Source {
+    double x; // Flux weighted centroid (pixels, 0 at the centre of the first pixel, as SEP)
+    double y;
+    double flux; // Sum of the background subtracted pixels above the threshold
+    double peak; // Brightest background subtracted pixel
+    int npix; // Number of pixels above the threshold
+};
+
+// Extraction settings, as the [SExtractor] section of the plate solver config
+struct Settings {
+    bool destripe = true; // Subtract the median of each row first
+    int back_size = 64; // Background mesh size (pixels), as sep.Background bw/bh. 0 for one background for the frame
+    int back_filter = 3; // Median filter of the background mesh (meshes), as sep.Background fw/fh
+    double thresh = 2; // Detection threshold, in units of the filtered background RMS
+    int minarea = 6; // Minimum number of pixels above the threshold
+    std::vector<double> filter_kernel = {1, 2, 1, 2, 4, 2, 1, 2, 1}; // Square, row major. Empty for no filtering
+    double deblend_cont = 1; // Minimum flux fraction of each part of a split source, as SEP. 1 to not deblend
+    int deblend_nthresh = 32; // Number of thresholds deblending tries
+    int max_sources = 0; // Keep only the brightest sources (0 for all)
+    int num_threads = 0; // Threads to share the strips of the frame between (0 for one per core)
+};
+
+// What the extraction measured on the frame
+struct FrameStats {
+    double back = 0; // Median of the background mesh, after destriping
+    double rms = 0; // Median of the background RMS mesh (SEP's globalrms)
+    double threshold = 0; // Detection threshold on the filtered frame
+    int num_deblended = 0; // Sources split by deblending
+};
+
+/*
+Function to extract the sources from a frame
+Inputs
+    frame - raw camera frame, row major
+    width - width of the frame in pixels
+    height - height of the frame in pixels
+    settings - extraction settings
+    sources - output sources, brightest first
+    stats - optional output of the background and threshold
+Output
+    0 on success, 1 if the settings are invalid
+*/
+int extractSources(const unsigned short *frame, int width, int height, const Settings &settings,
+                   std::vector<Source> *sources, FrameStats *stats = nullptr);
+
+}
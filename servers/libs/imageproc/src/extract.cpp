@@ -0,0 +1,748 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include <thread>
+#include "extract.hpp"
+
+namespace extract {
+
+/*
+Function to run fn(begin, end) over the range [0, n), split into contiguous blocks
+between threads
+Inputs
+    n - size of the range
+    num_threads - number of threads (at most n are started)
+    fn - function of the block to run
+*/
+template <typename Fn>
+static void parallelFor(int n, int num_threads, Fn fn) {
+    num_threads = std::max(1, std::min(num_threads, n));
+    if (num_threads == 1) {
+        fn(0, n);
+        return;
+    }
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+        threads.emplace_back(fn, (int)((long)n*t/num_threads), (int)((long)n*(t + 1)/num_threads));
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+/*
+Function to find the median of each row, the row to row offsets (stripes) of the sensor
+Inputs
+    frame - raw camera frame
+    width - width of the frame in pixels
+    height - height of the frame in pixels
+    num_threads - number of threads
+Output
+    the median of each row
+*/
+static std::vector<float> rowMedians(const unsigned short *frame, int width, int height, int num_threads) {
+    std::vector<float> medians(height);
+    parallelFor(height, num_threads, [&](int y0, int y1) {
+        std::vector<unsigned short> row(width);
+        for (int y = y0; y < y1; y++) {
+            const unsigned short *p = frame + (size_t)y*width;
+            std::copy(p, p + width, row.begin());
+            std::nth_element(row.begin(), row.begin() + width/2, row.end());
+            medians[y] = row[width/2];
+        }
+    });
+    return medians;
+}
+
+/*
+Function to estimate the background level and RMS of one mesh as SExtractor does: the
+values are clipped at 3 sigma about the median until nothing changes, and the level is
+the mode estimate 2.5*median - 1.5*mean, unless the distribution is too skewed (crowded)
+for it, when it is the median
+Inputs
+    values - pixel values of the mesh (integers, as the frame and row medians are), reordered
+    back - output background level
+    rms - output background RMS
+*/
+static void meshLevel(std::vector<int> &values, float *back, float *rms) {
+    // The values within R of the median, counted in a histogram: the clipping never reaches
+    // further than that on a 16 bit sensor's background, so the values needn't be sorted
+    const int R = 4096;
+    int n = values.size();
+    std::nth_element(values.begin(), values.begin() + n/2, values.end());
+    int m0 = values[n/2];
+    int base = m0, top = m0;
+    double all_sum = 0, all_sum_sq = 0;
+    for (int v : values) {
+        all_sum += v;
+        all_sum_sq += (double)v*v;
+        base = std::min(base, v);
+        top = std::max(top, v);
+    }
+    base = std::max(base, m0 - R);
+    top = std::min(top, m0 + R);
+
+    // Cumulative counts and sums: bin k holds the values below base + k
+    int num_bins = top - base + 2;
+    std::vector<double> count(num_bins, 0), sum(num_bins, 0), sum_sq(num_bins, 0);
+    for (int v : values) {
+        if (v >= base && v <= top) {
+            count[v - base + 1]++;
+        }
+    }
+    for (int k = 1; k < num_bins; k++) {
+        double v = base + k - 1;
+        sum[k] = sum[k - 1] + count[k]*v;
+        sum_sq[k] = sum_sq[k - 1] + count[k]*v*v;
+        count[k] += count[k - 1];
+    }
+
+    double mean = all_sum/n;
+    double sigma = std::sqrt(std::max(0.0, all_sum_sq/n - mean*mean));
+    double med = m0;
+    int lo = -1, hi = -1; // Bins of the clipped range
+    for (int iter = 0; iter < 100; iter++) {
+        int new_lo = std::min(num_bins - 1, std::max(0, (int)std::ceil(med - 3*sigma) - base));
+        int new_hi = std::max(0, std::min(num_bins - 1, (int)std::floor(med + 3*sigma) - base + 1));
+        if (new_lo == lo && new_hi == hi) {
+            break;
+        }
+        lo = new_lo;
+        hi = new_hi;
+        double m = count[hi] - count[lo];
+        if (m <= 0) {
+            break;
+        }
+        mean = (sum[hi] - sum[lo])/m;
+        sigma = std::sqrt(std::max(0.0, (sum_sq[hi] - sum_sq[lo])/m - mean*mean));
+        // The median is in the first bin with more than half of the clipped values at or below it
+        double half = count[lo] + std::floor(m/2) + 1;
+        med = base + (std::lower_bound(count.begin() + lo + 1, count.begin() + hi + 1, half) - count.begin()) - 1;
+    }
+    *back = (sigma > 0 && std::fabs(mean - med) >= 0.3*sigma) ? med : 2.5*med - 1.5*mean;
+    *rms = sigma;
+}
+
+// The background mesh, interpolated bilinearly between the mesh centres
+class Background {
+    public:
+        /*
+        Function to measure the background mesh of the destriped frame
+        Inputs
+            frame - raw camera frame
+            width - width of the frame in pixels
+            height - height of the frame in pixels
+            row_medians - median of each row, subtracted first
+            settings - extraction settings (mesh size and filter)
+            num_threads - number of threads
+        */
+        void measure(const unsigned short *frame, int width, int height, const std::vector<float> &row_medians,
+                     const Settings &settings, int num_threads) {
+            size_x_ = settings.back_size > 0 ? std::min(settings.back_size, width) : width;
+            size_y_ = settings.back_size > 0 ? std::min(settings.back_size, height) : height;
+            nx_ = (width + size_x_ - 1)/size_x_;
+            ny_ = (height + size_y_ - 1)/size_y_;
+            std::vector<float> back(nx_*ny_), rms(nx_*ny_);
+            parallelFor(ny_, num_threads, [&](int j0, int j1) {
+                std::vector<int> values;
+                for (int j = j0; j < j1; j++) {
+                    int y0 = j*size_y_, y1 = std::min(height, y0 + size_y_);
+                    for (int i = 0; i < nx_; i++) {
+                        int x0 = i*size_x_, x1 = std::min(width, x0 + size_x_);
+                        values.clear();
+                        for (int y = y0; y < y1; y++) {
+                            const unsigned short *p = frame + (size_t)y*width;
+                            for (int x = x0; x < x1; x++) {
+                                values.push_back(p[x] - (int)row_medians[y]);
+                            }
+                        }
+                        meshLevel(values, &back[j*nx_ + i], &rms[j*nx_ + i]);
+                    }
+                }
+            });
+            back_ = medianFilter(back, settings.back_filter);
+            rms_ = medianFilter(rms, settings.back_filter);
+
+            // Where each column lies between the mesh centres
+            col_mesh_.resize(width);
+            col_weight_.resize(width);
+            for (int x = 0; x < width; x++) {
+                locate(x, width, size_x_, nx_, &col_mesh_[x], &col_weight_[x]);
+            }
+            height_ = height;
+        }
+
+        /*
+        Function to interpolate the background along a row
+        Inputs
+            y - row
+            out - output background of each pixel of the row
+        */
+        void row(int y, float *out) const {
+            int j;
+            float wy;
+            locate(y, height_, size_y_, ny_, &j, &wy);
+            int j1 = std::min(j + 1, ny_ - 1);
+            std::vector<float> mesh_row(nx_);
+            for (int i = 0; i < nx_; i++) {
+                mesh_row[i] = (1 - wy)*back_[j*nx_ + i] + wy*back_[j1*nx_ + i];
+            }
+            for (size_t x = 0; x < col_mesh_.size(); x++) {
+                int i = col_mesh_[x];
+                int i1 = std::min(i + 1, nx_ - 1);
+                float wx = col_weight_[x];
+                out[x] = (1 - wx)*mesh_row[i] + wx*mesh_row[i1];
+            }
+        }
+
+        double globalBack() const { return medianOf(back_); }
+
+        double globalRms() const { return medianOf(rms_); }
+
+    private:
+        /*
+        Function to find the mesh centre at or before a pixel, and the weight of the next one
+        Inputs
+            p - pixel
+            n - number of pixels
+            size - mesh size
+            num_mesh - number of meshes
+            mesh - output mesh index
+            weight - output weight of mesh + 1
+        */
+        static void locate(int p, int n, int size, int num_mesh, int *mesh, float *weight) {
+            auto centre = [&](int i) {
+                return 0.5*(i*size + std::min(n, (i + 1)*size) - 1);
+            };
+            int i = std::min(std::max(0, (int)std::floor((p - 0.5*(size - 1))/size)), num_mesh - 1);
+            if (i + 1 < num_mesh && p >= centre(i + 1)) {
+                i++;
+            }
+            *mesh = i;
+            *weight = 0;
+            if (p > centre(0) && i + 1 < num_mesh) {
+                *weight = (p - centre(i))/(centre(i + 1) - centre(i));
+            }
+        }
+
+        std::vector<float> medianFilter(const std::vector<float> &mesh, int size) const {
+            int r = size/2;
+            if (r <= 0) {
+                return mesh;
+            }
+            std::vector<float> out(mesh.size()), values;
+            for (int j = 0; j < ny_; j++) {
+                for (int i = 0; i < nx_; i++) {
+                    values.clear();
+                    for (int jj = std::max(0, j - r); jj <= std::min(ny_ - 1, j + r); jj++) {
+                        for (int ii = std::max(0, i - r); ii <= std::min(nx_ - 1, i + r); ii++) {
+                            values.push_back(mesh[jj*nx_ + ii]);
+                        }
+                    }
+                    std::nth_element(values.begin(), values.begin() + values.size()/2, values.end());
+                    out[j*nx_ + i] = values[values.size()/2];
+                }
+            }
+            return out;
+        }
+
+        static double medianOf(std::vector<float> values) {
+            std::nth_element(values.begin(), values.begin() + values.size()/2, values.end());
+            return values[values.size()/2];
+        }
+
+        int size_x_ = 0, size_y_ = 0, nx_ = 0, ny_ = 0, height_ = 0;
+        std::vector<float> back_, rms_;
+        std::vector<int> col_mesh_;
+        std::vector<float> col_weight_;
+};
+
+// A pixel of a detection: its index in the frame, background subtracted and filtered values
+struct Pixel {
+    int i;
+    float value;
+    float filtered;
+};
+
+// A connected group of pixels above the threshold, with the sums its centroid is made from
+struct Detection {
+    double sum = 0, sum_x = 0, sum_y = 0, sum_w = 0, peak = -HUGE_VAL;
+    int npix = 0;
+    std::vector<Pixel> pixels; // Only kept for deblending
+
+    void add(int x, int y, double v) {
+        double w = std::max(v, 0.0);
+        sum += v;
+        sum_x += w*x;
+        sum_y += w*y;
+        sum_w += w;
+        peak = std::max(peak, v);
+        npix++;
+    }
+
+    void merge(Detection &other) {
+        sum += other.sum;
+        sum_x += other.sum_x;
+        sum_y += other.sum_y;
+        sum_w += other.sum_w;
+        peak = std::max(peak, other.peak);
+        npix += other.npix;
+        pixels.insert(pixels.end(), other.pixels.begin(), other.pixels.end());
+        other.pixels.clear();
+    }
+};
+
+// The detections of one strip of rows, with the detection each pixel of its first and last
+// rows belongs to (or -1), to join them to the detections of the neighbouring strips
+struct Strip {
+    std::vector<Detection> detections;
+    std::vector<int> first_row, last_row;
+};
+
+/*
+Function to detect the connected pixels above the threshold in a strip of rows
+Inputs
+    frame - raw camera frame
+    width - width of the frame in pixels
+    height - height of the frame in pixels
+    y0, y1 - rows of the strip
+    row_medians - median of each row
+    background - background mesh
+    kernel - filter kernel, square, row major (empty for none)
+    threshold - detection threshold on the filtered frame
+    keep_pixels - keep the pixels of each detection (for deblending)
+    strip - output detections
+*/
+static void detectStrip(const unsigned short *frame, int width, int height, int y0, int y1,
+                        const std::vector<float> &row_medians, const Background &background,
+                        const std::vector<float> &kernel, double threshold, bool keep_pixels, Strip *strip) {
+    int size = (int)std::lround(std::sqrt((double)kernel.size()));
+    int r = size/2;
+    int ya = std::max(0, y0 - r), yb = std::min(height, y1 + r);
+
+    // Background subtracted rows of the strip, with the rows the filter reaches beyond it
+    std::vector<float> sub((size_t)(yb - ya)*width);
+    for (int y = ya; y < yb; y++) {
+        float *out = sub.data() + (size_t)(y - ya)*width;
+        const unsigned short *p = frame + (size_t)y*width;
+        background.row(y, out);
+        for (int x = 0; x < width; x++) {
+            out[x] = p[x] - row_medians[y] - out[x];
+        }
+    }
+
+    // Filter (pixels outside the frame are background) and threshold
+    int rows = y1 - y0;
+    std::vector<float> filtered((size_t)rows*width, 0.0f);
+    std::vector<unsigned char> mask((size_t)rows*width);
+    for (int y = y0; y < y1; y++) {
+        float *out = filtered.data() + (size_t)(y - y0)*width;
+        if (size == 0) {
+            std::copy(sub.begin() + (size_t)(y - ya)*width, sub.begin() + (size_t)(y - ya + 1)*width, out);
+        }
+        for (int ky = 0; ky < size; ky++) {
+            int yy = y + ky - r;
+            if (yy < 0 || yy >= height) {
+                continue;
+            }
+            const float *in = sub.data() + (size_t)(yy - ya)*width;
+            for (int kx = 0; kx < size; kx++) {
+                float k = kernel[ky*size + kx];
+                int dx = kx - r;
+                int x0 = std::max(0, -dx);
+                int x1 = std::min(width, width - dx);
+                for (int x = x0; x < x1; x++) {
+                    out[x] += k*in[x + dx];
+                }
+            }
+        }
+        unsigned char *m = mask.data() + (size_t)(y - y0)*width;
+        for (int x = 0; x < width; x++) {
+            m[x] = out[x] > threshold;
+        }
+    }
+
+    // Label the 8-connected pixels above the threshold within the strip
+    strip->first_row.assign(width, -1);
+    strip->last_row.assign(width, -1);
+    std::vector<int> stack;
+    for (int start = 0; start < rows*width; start++) {
+        if (!mask[start]) {
+            continue;
+        }
+        int label = strip->detections.size();
+        strip->detections.emplace_back();
+        Detection &d = strip->detections.back();
+        mask[start] = 0;
+        stack.push_back(start);
+        while (!stack.empty()) {
+            int i = stack.back();
+            stack.pop_back();
+            int x = i%width, y = i/width;
+            float v = sub[(size_t)(y + y0 - ya)*width + x];
+            d.add(x, y + y0, v);
+            if (keep_pixels) {
+                d.pixels.push_back({(y + y0)*width + x, v, filtered[i]});
+            }
+            if (y == 0) {
+                strip->first_row[x] = label;
+            }
+            if (y == rows - 1) {
+                strip->last_row[x] = label;
+            }
+            for (int dy = -1; dy <= 1; dy++) {
+                int yy = y + dy;
+                if (yy < 0 || yy >= rows) {
+                    continue;
+                }
+                for (int dx = -1; dx <= 1; dx++) {
+                    int xx = x + dx;
+                    if (xx < 0 || xx >= width) {
+                        continue;
+                    }
+                    int j = yy*width + xx;
+                    if (mask[j]) {
+                        mask[j] = 0;
+                        stack.push_back(j);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// The pixels of a detection, indexed on their bounding box
+struct PixelBox {
+    int x0, y0, w, h;
+    std::vector<int> index; // Pixel at each point of the box, or -1
+
+    PixelBox(const std::vector<Pixel> &pixels, int width) {
+        int x1 = 0, y1 = 0;
+        x0 = width;
+        y0 = 1 << 30;
+        for (auto &p : pixels) {
+            x0 = std::min(x0, p.i%width);
+            x1 = std::max(x1, p.i%width);
+            y0 = std::min(y0, p.i/width);
+            y1 = std::max(y1, p.i/width);
+        }
+        w = x1 - x0 + 1;
+        h = y1 - y0 + 1;
+        index.assign((size_t)w*h, -1);
+        for (size_t k = 0; k < pixels.size(); k++) {
+            index[(pixels[k].i/width - y0)*w + pixels[k].i%width - x0] = k;
+        }
+    }
+
+    // Call fn(n) for each pixel n next to pixel k
+    template <typename Fn>
+    void neighbours(const Pixel &pixel, int width, Fn fn) const {
+        int x = pixel.i%width - x0, y = pixel.i/width - y0;
+        for (int yy = std::max(0, y - 1); yy <= std::min(h - 1, y + 1); yy++) {
+            for (int xx = std::max(0, x - 1); xx <= std::min(w - 1, x + 1); xx++) {
+                int n = index[yy*w + xx];
+                if (n >= 0) {
+                    fn(n);
+                }
+            }
+        }
+    }
+};
+
+/*
+Function to find the 8-connected groups of the pixels of a detection above a level
+Inputs
+    pixels - pixels of the detection
+    box - the pixels indexed on their bounding box
+    width - width of the frame in pixels
+    level - level on the filtered frame
+    labels - output group of each pixel (-1 if below the level)
+Output
+    the number of groups
+*/
+static int groupPixels(const std::vector<Pixel> &pixels, const PixelBox &box, int width, double level,
+                       std::vector<int> *labels) {
+    labels->assign(pixels.size(), -1);
+    int num_groups = 0;
+    std::vector<int> stack;
+    for (size_t k = 0; k < pixels.size(); k++) {
+        if (pixels[k].filtered <= level || (*labels)[k] >= 0) {
+            continue;
+        }
+        (*labels)[k] = num_groups;
+        stack.push_back(k);
+        while (!stack.empty()) {
+            int j = stack.back();
+            stack.pop_back();
+            box.neighbours(pixels[j], width, [&](int n) {
+                if (pixels[n].filtered > level && (*labels)[n] < 0) {
+                    (*labels)[n] = num_groups;
+                    stack.push_back(n);
+                }
+            });
+        }
+        num_groups++;
+    }
+    return num_groups;
+}
+
+/*
+Function to split a detection that has two or more peaks, a simplified SExtractor deblend:
+the filtered pixels are thresholded at deblend_nthresh levels between the detection
+threshold and the peak, and at the first level where two or more groups each hold at
+least deblend_cont of the flux (and minarea pixels) the detection is split, with the
+remaining pixels given to the nearest group. Each part is then deblended in turn.
+Inputs
+    pixels - pixels of the detection
+    width - width of the frame in pixels
+    settings - extraction settings
+    threshold - detection threshold on the filtered frame
+    parts - output parts (the detection itself if it isn't split)
+*/
+static void deblend(std::vector<Pixel> &pixels, int width, const Settings &settings, double threshold,
+                    std::vector<std::vector<Pixel>> *parts) {
+    double peak = threshold, total = 0;
+    for (auto &p : pixels) {
+        peak = std::max(peak, (double)p.filtered);
+        total += p.filtered;
+    }
+    if ((int)pixels.size() < 2*settings.minarea || peak <= threshold || total <= 0) {
+        parts->push_back(std::move(pixels));
+        return;
+    }
+
+    // Add the pixels from the brightest down, joining them into groups, to find the lowest
+    // level with two or more groups big enough to be parts
+    PixelBox box(pixels, width);
+    int n = pixels.size();
+    std::vector<int> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+        return pixels[a].filtered > pixels[b].filtered;
+    });
+    std::vector<int> parent(n, -1), npix(n, 0);
+    std::vector<double> flux(n, 0);
+    auto root = [&](int a) {
+        while (parent[a] != a) {
+            a = parent[a] = parent[parent[a]];
+        }
+        return a;
+    };
+    auto isPart = [&](int r) {
+        return flux[r] >= settings.deblend_cont*total && npix[r] >= settings.minarea;
+    };
+    int num_parts = 0, split_level = 0, next = 0;
+    for (int level = settings.deblend_nthresh - 1; level >= 1; level--) {
+        double t = threshold*std::pow(peak/threshold, (double)level/settings.deblend_nthresh);
+        for (; next < n && pixels[order[next]].filtered > t; next++) {
+            int k = order[next];
+            parent[k] = k;
+            flux[k] = pixels[k].filtered;
+            npix[k] = 1;
+            num_parts += isPart(k);
+            box.neighbours(pixels[k], width, [&](int m) {
+                if (parent[m] < 0) {
+                    return;
+                }
+                int a = root(k), b = root(m);
+                if (a == b) {
+                    return;
+                }
+                num_parts -= isPart(a) + isPart(b);
+                parent[b] = a;
+                flux[a] += flux[b];
+                npix[a] += npix[b];
+                num_parts += isPart(a);
+            });
+        }
+        if (num_parts >= 2) {
+            split_level = level;
+        }
+    }
+
+    if (split_level > 0) {
+        double t = threshold*std::pow(peak/threshold, (double)split_level/settings.deblend_nthresh);
+        std::vector<int> labels;
+        int num_groups = groupPixels(pixels, box, width, t, &labels);
+        std::fill(flux.begin(), flux.begin() + num_groups, 0.0);
+        std::fill(npix.begin(), npix.begin() + num_groups, 0);
+        for (int k = 0; k < n; k++) {
+            if (labels[k] >= 0) {
+                flux[labels[k]] += pixels[k].filtered;
+                npix[labels[k]]++;
+            }
+        }
+        std::vector<int> part(num_groups, -1);
+        num_parts = 0;
+        for (int g = 0; g < num_groups; g++) {
+            if (isPart(g)) {
+                part[g] = num_parts++;
+            }
+        }
+
+        // Grow the parts through the rest of the detection, breadth first
+        std::vector<int> owner(pixels.size(), -1), queue;
+        for (size_t k = 0; k < pixels.size(); k++) {
+            if (labels[k] >= 0 && part[labels[k]] >= 0) {
+                owner[k] = part[labels[k]];
+                queue.push_back(k);
+            }
+        }
+        for (size_t q = 0; q < queue.size(); q++) {
+            int k = queue[q];
+            box.neighbours(pixels[k], width, [&](int m) {
+                if (owner[m] < 0) {
+                    owner[m] = owner[k];
+                    queue.push_back(m);
+                }
+            });
+        }
+        std::vector<std::vector<Pixel>> split(num_parts);
+        for (size_t k = 0; k < pixels.size(); k++) {
+            split[owner[k]].push_back(pixels[k]);
+        }
+        for (auto &s : split) {
+            deblend(s, width, settings, threshold, parts);
+        }
+        return;
+    }
+    parts->push_back(std::move(pixels));
+}
+
+int extractSources(const unsigned short *frame, int width, int height, const Settings &settings,
+                   std::vector<Source> *sources, FrameStats *stats) {
+    sources->clear();
+    int size = (int)std::lround(std::sqrt((double)settings.filter_kernel.size()));
+    if (width <= 0 || height <= 0 || size*size != (int)settings.filter_kernel.size() ||
+        (size > 0 && size%2 == 0) || settings.deblend_nthresh < 1) {
+        std::cout << "Bad extraction settings: " << width << "x" << height << " frame, "
+                  << settings.filter_kernel.size() << " element filter kernel" << std::endl;
+        return 1;
+    }
+    int num_threads = settings.num_threads > 0 ? settings.num_threads : std::thread::hardware_concurrency();
+    num_threads = std::max(1, num_threads);
+
+    std::vector<float> row_medians(height, 0.0f);
+    if (settings.destripe) {
+        row_medians = rowMedians(frame, width, height, num_threads);
+    }
+    Background background;
+    background.measure(frame, width, height, row_medians, settings, num_threads);
+    double rms = background.globalRms();
+
+    // Matched filter: threshold the filtered frame in units of its own noise
+    std::vector<float> kernel(settings.filter_kernel.begin(), settings.filter_kernel.end());
+    double threshold = settings.thresh*rms;
+    if (size > 0) {
+        double sum_sq = 0;
+        for (double k : settings.filter_kernel) {
+            sum_sq += k*k;
+        }
+        threshold *= std::sqrt(sum_sq);
+    }
+    if (threshold <= 0) {
+        // A flat frame: anything above the background is a detection
+        threshold = 1e-6;
+    }
+
+    // Detect in strips of rows, then join the detections that cross from one strip to the next
+    bool deblending = settings.deblend_cont < 1;
+    int num_strips = std::min(num_threads, height);
+    std::vector<Strip> strips(num_strips);
+    std::vector<int> strip_rows(num_strips + 1);
+    for (int s = 0; s <= num_strips; s++) {
+        strip_rows[s] = (long)height*s/num_strips;
+    }
+    parallelFor(num_strips, num_threads, [&](int s0, int s1) {
+        for (int s = s0; s < s1; s++) {
+            detectStrip(frame, width, height, strip_rows[s], strip_rows[s + 1], row_medians, background,
+                        kernel, threshold, deblending, &strips[s]);
+        }
+    });
+
+    std::vector<int> offset(num_strips + 1, 0);
+    for (int s = 0; s < num_strips; s++) {
+        offset[s + 1] = offset[s] + strips[s].detections.size();
+    }
+    std::vector<int> parent(offset[num_strips]);
+    std::iota(parent.begin(), parent.end(), 0);
+    auto root = [&](int a) {
+        while (parent[a] != a) {
+            a = parent[a] = parent[parent[a]];
+        }
+        return a;
+    };
+    for (int s = 0; s + 1 < num_strips; s++) {
+        const std::vector<int> &last = strips[s].last_row, &first = strips[s + 1].first_row;
+        for (int x = 0; x < width; x++) {
+            if (last[x] < 0) {
+                continue;
+            }
+            for (int xx = std::max(0, x - 1); xx <= std::min(width - 1, x + 1); xx++) {
+                if (first[xx] >= 0) {
+                    int a = root(offset[s] + last[x]), b = root(offset[s + 1] + first[xx]);
+                    parent[std::max(a, b)] = std::min(a, b);
+                }
+            }
+        }
+    }
+    std::vector<Detection*> detections;
+    for (int s = 0; s < num_strips; s++) {
+        for (size_t k = 0; k < strips[s].detections.size(); k++) {
+            int id = offset[s] + k;
+            int r = root(id);
+            if (r == id) {
+                detections.push_back(&strips[s].detections[k]);
+            } else {
+                // Joined to a detection in an earlier strip (the root has the lowest id)
+                auto it = std::upper_bound(offset.begin(), offset.end(), r) - 1;
+                int rs = it - offset.begin();
+                strips[rs].detections[r - offset[rs]].merge(strips[s].detections[k]);
+            }
+        }
+    }
+
+    int num_deblended = 0;
+    for (Detection *d : detections) {
+        if (d->npix < settings.minarea || d->sum_w <= 0) {
+            continue;
+        }
+        if (!deblending) {
+            sources->push_back({d->sum_x/d->sum_w, d->sum_y/d->sum_w, d->sum, d->peak, d->npix});
+            continue;
+        }
+        // In frame order, so that the parts don't depend on how the frame was split into strips
+        std::sort(d->pixels.begin(), d->pixels.end(), [](const Pixel &a, const Pixel &b) {
+            return a.i < b.i;
+        });
+        std::vector<std::vector<Pixel>> parts;
+        deblend(d->pixels, width, settings, threshold, &parts);
+        num_deblended += parts.size() > 1;
+        for (auto &part : parts) {
+            Detection p;
+            for (auto &pixel : part) {
+                p.add(pixel.i%width, pixel.i/width, pixel.value);
+            }
+            if (p.sum_w > 0) {
+                sources->push_back({p.sum_x/p.sum_w, p.sum_y/p.sum_w, p.sum, p.peak, p.npix});
+            }
+        }
+    }
+
+    std::sort(sources->begin(), sources->end(), [](const Source &a, const Source &b) {
+        return a.flux > b.flux;
+    });
+    if (settings.max_sources > 0 && (int)sources->size() > settings.max_sources) {
+        sources->resize(settings.max_sources);
+    }
+    if (stats) {
+        stats->back = background.globalBack();
+        stats->rms = rms;
+        stats->threshold = threshold;
+        stats->num_deblended = num_deblended;
+    }
+    return 0;
+}
+
+}
@@ -0,0 +1,115 @@
+/*
+Benchmark of the star source extractor (extract.hpp) on saved star tracker frames.
+
+Extracts the sources from every frame of the given FITS cubes, repeating each extraction
+to time it, and optionally writes the sources of each frame to a text file (x y flux peak
+npix, brightest first) so that they can be compared with SEP (extract_vs_sep.py).
+
+Usage:
+    ExtractBench cube1.fits [cube2.fits ...]
+        --threads 4 (0 for one per core)
+        --repeats 10
+        --thresh 2 --minarea 6 --deblend-cont 1 --back-size 64 --back-filter 3
+        --kernel 1,2,1,2,4,2,1,2,1 (square, row major)
+        --out sources (writes sources_<file>_<frame>.txt)
+*/
+
+#include "extract.hpp"
+#include "replay.h"
+#include <boost/program_options.hpp>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+namespace po = boost::program_options;
+using namespace std;
+
+int main(int argc, char* argv[]) {
+
+    vector<string> fits_files;
+    int repeats;
+    string out_prefix, kernel;
+    extract::Settings settings;
+
+    po::options_description desc("Extraction benchmark options");
+    desc.add_options()
+        ("help,h", "Print this message")
+        ("fits", po::value<vector<string>>(&fits_files)->required(), "FITS cubes of star tracker frames")
+        ("threads", po::value<int>(&settings.num_threads)->default_value(0), "Threads (0 for one per core)")
+        ("repeats", po::value<int>(&repeats)->default_value(10), "Extractions of each frame to time")
+        ("thresh", po::value<double>(&settings.thresh)->default_value(2), "Detection threshold (background RMS)")
+        ("minarea", po::value<int>(&settings.minarea)->default_value(6), "Minimum pixels above the threshold")
+        ("deblend-cont", po::value<double>(&settings.deblend_cont)->default_value(1), "Deblending contrast (1 for none)")
+        ("back-size", po::value<int>(&settings.back_size)->default_value(64), "Background mesh size (pixels)")
+        ("back-filter", po::value<int>(&settings.back_filter)->default_value(3), "Background mesh filter (meshes)")
+        ("kernel", po::value<string>(&kernel), "Filter kernel, comma separated (square, row major)")
+        ("no-destripe", "Don't subtract the row medians")
+        ("out", po::value<string>(&out_prefix), "Prefix of the source lists to write");
+    po::positional_options_description pos;
+    pos.add("fits", -1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(pos).run(), vm);
+        if (vm.count("help")) {
+            cout << desc << endl;
+            return 0;
+        }
+        po::notify(vm);
+    } catch (const std::exception& e) {
+        cerr << e.what() << endl << desc << endl;
+        return 1;
+    }
+    settings.destripe = !vm.count("no-destripe");
+    if (!kernel.empty()) {
+        settings.filter_kernel.clear();
+        stringstream ss(kernel);
+        string value;
+        while (getline(ss, value, ',')) {
+            settings.filter_kernel.push_back(stod(value));
+        }
+    }
+    repeats = max(1, repeats);
+
+    LatencyHistogram latency;
+    for (auto &fits_file : fits_files) {
+        vector<unsigned short> data;
+        long width, height, num_frames;
+        int exptime_us;
+        if (readFITSCube(fits_file, data, width, height, num_frames, exptime_us)) {
+            continue;
+        }
+        string name = fits_file.substr(fits_file.rfind('/') + 1);
+        name = name.substr(0, name.rfind('.'));
+        for (long f = 0; f < num_frames; f++) {
+            const unsigned short *frame = data.data() + (size_t)width*height*f;
+            vector<extract::Source> sources;
+            extract::FrameStats stats;
+            for (int r = 0; r < repeats; r++) {
+                auto start = chrono::steady_clock::now();
+                extract::extractSources(frame, width, height, settings, &sources, &stats);
+                auto end = chrono::steady_clock::now();
+                latency.add(chrono::duration<double, micro>(end - start).count());
+            }
+            cout << name << " frame " << f << ": " << sources.size() << " sources, background RMS "
+                 << stats.rms << ", " << stats.num_deblended << " deblended" << endl;
+
+            if (!out_prefix.empty()) {
+                ofstream out(out_prefix + "_" + name + "_" + to_string(f) + ".txt");
+                out.precision(10);
+                for (auto &s : sources) {
+                    out << s.x << " " << s.y << " " << s.flux << " " << s.peak << " " << s.npix << "\n";
+                }
+            }
+        }
+    }
+    if (latency.count() == 0) {
+        cout << "No frames read" << endl;
+        return 1;
+    }
+    cout << endl << "Extraction time (us):" << endl;
+    latency.print();
+    return 0;
+}
@@ -0,0 +1,136 @@
+#ifndef TEENSY_FRAME_H_INCLUDE_GUARD
+#define TEENSY_FRAME_H_INCLUDE_GUARD
+/*
+Framing of the serial link between the host and the Teensys. This header is used
+by both the host (servers/libs/teensy_comms) and the firmware, so it only uses
+stdint and no heap. The firmware sketches hold copies of it - keep them identical
+to this file.
+
+Frame:
+    0xFF LEN SEQ PAYLOAD[LEN] CK_A CK_B
+
+    LEN        - payload length in bytes (0 to TEENSY_MAX_PAYLOAD)
+    SEQ        - sequence number of the host request. The Teensy echoes it on the
+                 frames holding the responses to that request (0 for frames that
+                 do not answer a request, e.g. framing errors)
+    PAYLOAD    - command (host to Teensy) or response (Teensy to host) bytes, each
+                 a code followed by its data
+    CK_A, CK_B - Fletcher-16 checksum of LEN, SEQ and PAYLOAD
+*/
+#include <stdint.h>
+#include <string.h>
+
+#define TEENSY_FRAME_START 0xFF
+#define TEENSY_MAX_PAYLOAD 120
+#define TEENSY_FRAME_OVERHEAD 5
+#define TEENSY_MAX_FRAME (TEENSY_MAX_PAYLOAD + TEENSY_FRAME_OVERHEAD)
+
+// Fletcher-16 of n bytes, continuing from the running sums a and b
+inline void TeensyFletcher16(const uint8_t* data, int n, uint8_t* a, uint8_t* b) {
+    uint16_t sum_a = *a;
+    uint16_t sum_b = *b;
+    for (int i = 0; i < n; i++) {
+        sum_a = (sum_a + data[i]) % 255;
+        sum_b = (sum_b + sum_a) % 255;
+    }
+    *a = sum_a;
+    *b = sum_b;
+}
+
+// Write a frame holding len bytes of payload into out (at least len + TEENSY_FRAME_OVERHEAD
+// bytes). Returns the frame length, or 0 if the payload is too long.
+inline int TeensyEncodeFrame(uint8_t seq, const uint8_t* payload, int len, uint8_t* out) {
+    if (len < 0 || len > TEENSY_MAX_PAYLOAD) {
+        return 0;
+    }
+    out[0] = TEENSY_FRAME_START;
+    out[1] = len;
+    out[2] = seq;
+    memcpy(out + 3, payload, len);
+    uint8_t a = 0, b = 0;
+    TeensyFletcher16(out + 1, len + 2, &a, &b);
+    out[len + 3] = a;
+    out[len + 4] = b;
+    return len + TEENSY_FRAME_OVERHEAD;
+}
+
+/*
+Incremental frame parser. Bytes can arrive in any chunks: feed them one at a time,
+and each time Feed (or Next) returns 1 a frame with a valid checksum is in
+payload/len/seq. Bytes before a start byte are skipped, and after a bad length or
+checksum the parser resynchronises on the next start byte inside the rejected
+bytes, so a corrupted frame costs at most that frame.
+
+    if (parser.Feed(byte)) {
+        do { Handle(parser.seq, parser.payload, parser.len); } while (parser.Next());
+    }
+*/
+struct TeensyFrameParser {
+    uint8_t payload[TEENSY_MAX_PAYLOAD];
+    uint8_t len = 0;
+    uint8_t seq = 0;
+
+    // Error counters
+    uint32_t checksum_errors = 0;
+    uint32_t skipped_bytes = 0;
+
+    // Feed one byte. Returns 1 if a frame is ready.
+    int Feed(uint8_t byte) {
+        if (n_ == 0 && byte != TEENSY_FRAME_START) {
+            skipped_bytes++;
+            return 0;
+        }
+        raw_[n_++] = byte;
+        return Next();
+    }
+
+    // Look for another frame in the bytes already fed. Returns 1 if a frame is ready.
+    int Next() {
+        while (n_ >= 2) {
+            int frame_len = raw_[1] + TEENSY_FRAME_OVERHEAD;
+            if (raw_[1] > TEENSY_MAX_PAYLOAD) {
+                Resync();
+                continue;
+            }
+            if (n_ < frame_len) {
+                return 0;
+            }
+            uint8_t a = 0, b = 0;
+            TeensyFletcher16(raw_ + 1, raw_[1] + 2, &a, &b);
+            if (a != raw_[frame_len - 2] || b != raw_[frame_len - 1]) {
+                checksum_errors++;
+                Resync();
+                continue;
+            }
+            len = raw_[1];
+            seq = raw_[2];
+            memcpy(payload, raw_ + 3, len);
+            n_ -= frame_len;
+            memmove(raw_, raw_ + frame_len, n_);
+            return 1;
+        }
+        return 0;
+    }
+
+    // Drop any partial frame (e.g. after reopening the port)
+    void Reset() {
+        n_ = 0;
+    }
+
+  private:
+    uint8_t raw_[TEENSY_MAX_FRAME];
+    int n_ = 0;
+
+    // Drop the start byte at raw_[0] and everything up to the next start byte
+    void Resync() {
+        int i = 1;
+        while (i < n_ && raw_[i] != TEENSY_FRAME_START) {
+            i++;
+        }
+        skipped_bytes += i;
+        n_ -= i;
+        memmove(raw_, raw_ + i, n_);
+    }
+};
+
+#endif
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "TeensyFrame.h"
+
+/*
+Event-driven serial transport to the Teensys (robot, chief aux and deputy aux).
+
+A Port owns the serial file descriptor and a reader thread that sleeps in
+epoll_wait until bytes arrive, feeds them through the TeensyFrameParser (so
+partial reads and corrupted frames are handled) and splits each frame into
+responses. Every response code has a latest-value register holding its data
+bytes, the CLOCK_MONOTONIC time the frame arrived and the request it answered.
+
+Requests are sent as one frame with a new sequence number. The Teensy echoes
+the sequence number on its responses, so wait() returns when every response to
+that request has arrived, without polling or guessing delays.
+
+The payload format (which codes exist and how many data bytes follow each
+response code) is device specific and given by a ResponseTable.
+*/
+namespace teensy {
+
+// Codes shared by all of the firmware
+constexpr uint8_t ID_CODE = 0x04; // Request/response with the device ID and firmware version
+constexpr uint8_t UNRECOGNISED = 0xFD; // Error: the command code is unrecognised
+constexpr uint8_t SCHEDULE_FULL = 0xFE; // Error: the command could not be scheduled
+constexpr uint8_t FRAME_ERROR = 0xFF; // Error: the Teensy rejected a frame
+
+/*
+Number of data bytes after each response code, or -1 for codes that are never
+responses. A request command expects one response if its code is a response
+code (the Teensy replies with the same code).
+*/
+struct ResponseTable {
+    std::array<int, 256> length;
+
+    ResponseTable() { length.fill(-1); }
+
+    ResponseTable& set(uint8_t code, int data_bytes) {
+        length[code] = data_bytes;
+        return *this;
+    }
+};
+
+// Latest value of one response code
+struct Register {
+    uint8_t data[TEENSY_MAX_PAYLOAD] = {0};
+    int len = 0; // Number of data bytes
+    int64_t time_ns = 0; // CLOCK_MONOTONIC time the frame was read (0 if never received)
+    uint8_t seq = 0; // Request this was a response to
+    uint32_t count = 0; // Number of times received
+};
+
+// Link statistics since the port was opened
+struct Stats {
+    uint64_t bytes_read = 0;
+    uint64_t frames = 0;
+    uint64_t checksum_errors = 0;
+    uint64_t skipped_bytes = 0;
+    uint64_t unknown_codes = 0; // Frames with a code not in the ResponseTable
+    uint64_t device_errors = 0; // UNRECOGNISED, SCHEDULE_FULL and FRAME_ERROR responses
+    uint64_t timeouts = 0; // Calls to wait() that timed out
+};
+
+class Port {
+public:
+    explicit Port(const ResponseTable& table);
+    ~Port();
+
+    Port(const Port&) = delete;
+    Port& operator=(const Port&) = delete;
+
+    /*
+    Open a serial device (e.g. /dev/ttyACM0 or a pty), set it to raw mode and
+    start the reader thread. Returns 0 on success.
+    */
+    int open(const std::string& device);
+
+    /*
+    Open /dev/ttyACM0 ... /dev/ttyACM<max_index-1> in turn and keep the first one
+    whose ID response matches device_id. Returns 0 on success.
+    */
+    int find(int device_id, int max_index = 16, int timeout_ms = 500);
+
+    // Stop the reader thread and close the device
+    void close();
+
+    bool isOpen() const { return fd_ >= 0; }
+
+    /*
+    Send one request frame. n_responses is the number of responses to wait for
+    (see expectedResponses). Returns the sequence number (1-255), or -1 on error.
+    */
+    int send(const uint8_t* payload, int len, int n_responses);
+
+    // Number of responses a payload of 3-byte commands will produce
+    int expectedResponses(const uint8_t* payload, int len, int command_size = 3) const;
+
+    /*
+    Wait until all of the responses to request seq have arrived (or an error
+    response replaced them). Returns 0 on success, 1 on timeout.
+    */
+    int wait(int seq, int timeout_ms);
+
+    // Send the ID request and wait for the reply. Returns 0 on success.
+    int identify(int timeout_ms = 500);
+
+    // Copy of the latest value of a response code
+    Register latest(uint8_t code);
+
+    Stats stats();
+
+    std::string device; // Currently open device
+    int device_id = -1;
+    int firmware_version = -1;
+
+private:
+    void readerLoop();
+    void handleFrame(uint8_t seq, const uint8_t* payload, int len, int64_t time_ns);
+
+    ResponseTable table_;
+    int fd_ = -1;
+    int epoll_fd_ = -1;
+    int wake_fd_ = -1; // eventfd used to stop the reader thread
+    std::thread reader_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::array<Register, 256> registers_;
+    std::array<int, 256> outstanding_; // Responses still to come, per sequence number
+    uint8_t next_seq_ = 1;
+    TeensyFrameParser parser_; // Only used by the reader thread
+    Stats stats_;
+};
+
+// Returns the current CLOCK_MONOTONIC time in nanoseconds
+int64_t monotonicNs();
+
+} // namespace teensy
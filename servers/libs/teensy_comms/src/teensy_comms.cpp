@@ -0,0 +1,286 @@
+#include "teensy_comms.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace teensy {
+
+int64_t monotonicNs() {
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return 1000000000LL * t.tv_sec + t.tv_nsec;
+}
+
+Port::Port(const ResponseTable& table) : table_(table) {
+    // The error codes carry no data on every device
+    table_.set(UNRECOGNISED, 0).set(SCHEDULE_FULL, 0).set(FRAME_ERROR, 0);
+    outstanding_.fill(0);
+}
+
+Port::~Port() {
+    close();
+}
+
+int Port::open(const std::string& device_name) {
+    close();
+
+    fd_ = ::open(device_name.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd_ < 0) {
+        printf("Error %i from open %s: %s\n", errno, device_name.c_str(), strerror(errno));
+        return 1;
+    }
+
+    termios tty;
+    if (tcgetattr(fd_, &tty) != 0) {
+        printf("Error %i from tcgetattr: %s\n", errno, strerror(errno));
+        ::close(fd_);
+        fd_ = -1;
+        return 1;
+    }
+    cfmakeraw(&tty);
+    tty.c_cflag |= CREAD | CLOCAL;
+    tty.c_cflag &= ~CRTSCTS;
+    tty.c_cc[VTIME] = 0;
+    tty.c_cc[VMIN] = 0;
+    // The Teensy is USB, so the baud rate is ignored
+    cfsetispeed(&tty, B4000000);
+    cfsetospeed(&tty, B4000000);
+    if (tcsetattr(fd_, TCSANOW, &tty) != 0) {
+        printf("Error %i from tcsetattr: %s\n", errno, strerror(errno));
+    }
+    tcflush(fd_, TCIOFLUSH);
+
+    epoll_fd_ = epoll_create1(0);
+    wake_fd_ = eventfd(0, EFD_NONBLOCK);
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd_, &ev);
+    ev.data.fd = wake_fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& r : registers_) {
+            r = Register();
+        }
+        outstanding_.fill(0);
+        stats_ = Stats();
+        parser_ = TeensyFrameParser();
+    }
+    device = device_name;
+    device_id = -1;
+    firmware_version = -1;
+    reader_ = std::thread(&Port::readerLoop, this);
+    printf("Comms Opened %s\n", device.c_str());
+    return 0;
+}
+
+int Port::find(int target_id, int max_index, int timeout_ms) {
+    char device_name[64];
+    for (int i = 0; i < max_index; i++) {
+        snprintf(device_name, sizeof(device_name), "/dev/ttyACM%d", i);
+        if (open(device_name) != 0) {
+            continue;
+        }
+        if (identify(timeout_ms) == 0) {
+            printf("Device ID: %d\n", device_id);
+            printf("Device Firmware Version: %d\n", firmware_version);
+            if (device_id == target_id) {
+                return 0;
+            }
+        }
+        close();
+    }
+    printf("WARNING: teensy %d could not be found\n", target_id);
+    return 1;
+}
+
+void Port::close() {
+    if (fd_ < 0) {
+        return;
+    }
+    uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) < 0) {
+        printf("Error %i waking the reader thread: %s\n", errno, strerror(errno));
+    }
+    if (reader_.joinable()) {
+        reader_.join();
+    }
+    ::close(epoll_fd_);
+    ::close(wake_fd_);
+    ::close(fd_);
+    fd_ = epoll_fd_ = wake_fd_ = -1;
+    printf("Comms Closed %s\n", device.c_str());
+}
+
+int Port::expectedResponses(const uint8_t* payload, int len, int command_size) const {
+    int n = 0;
+    for (int i = 0; i < len; i += command_size) {
+        if (table_.length[payload[i]] >= 0) {
+            n++;
+        }
+    }
+    return n;
+}
+
+int Port::send(const uint8_t* payload, int len, int n_responses) {
+    if (fd_ < 0) {
+        return -1;
+    }
+    uint8_t frame[TEENSY_MAX_FRAME];
+    uint8_t seq;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        seq = next_seq_;
+        next_seq_ = (next_seq_ == 255) ? 1 : next_seq_ + 1;
+        outstanding_[seq] = n_responses;
+    }
+    int frame_len = TeensyEncodeFrame(seq, payload, len, frame);
+    if (frame_len == 0) {
+        printf("Teensy request too long (%d bytes)\n", len);
+        return -1;
+    }
+
+    // The port is non-blocking, so wait for space if the output buffer is full
+    int written = 0;
+    while (written < frame_len) {
+        ssize_t ret = write(fd_, frame + written, frame_len - written);
+        if (ret > 0) {
+            written += ret;
+        } else if (ret < 0 && errno != EAGAIN && errno != EINTR) {
+            printf("Error %i from write: %s\n", errno, strerror(errno));
+            return -1;
+        } else {
+            pollfd pfd = {fd_, POLLOUT, 0};
+            if (poll(&pfd, 1, 100) == 0) {
+                printf("Teensy write timed out\n");
+                return -1;
+            }
+        }
+    }
+    return seq;
+}
+
+int Port::wait(int seq, int timeout_ms) {
+    if (seq < 1 || seq > 255) {
+        return 1;
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+    bool done = cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                             [&] { return outstanding_[seq] <= 0; });
+    if (!done) {
+        stats_.timeouts++;
+        return 1;
+    }
+    return 0;
+}
+
+int Port::identify(int timeout_ms) {
+    uint8_t request[3] = {ID_CODE, 0x00, 0x00};
+    int seq = send(request, 3, 1);
+    if (seq < 0 || wait(seq, timeout_ms) != 0) {
+        return 1;
+    }
+    Register r = latest(ID_CODE);
+    if (r.len < 2) {
+        return 1;
+    }
+    device_id = r.data[0];
+    firmware_version = r.data[1];
+    return 0;
+}
+
+Register Port::latest(uint8_t code) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return registers_[code];
+}
+
+Stats Port::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void Port::readerLoop() {
+    uint8_t buffer[4096];
+    epoll_event events[2];
+    while (true) {
+        int n = epoll_wait(epoll_fd_, events, 2, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("Error %i from epoll_wait: %s\n", errno, strerror(errno));
+            return;
+        }
+        for (int e = 0; e < n; e++) {
+            if (events[e].data.fd == wake_fd_) {
+                return;
+            }
+            if (events[e].events & (EPOLLERR | EPOLLHUP)) {
+                printf("Teensy %s disconnected\n", device.c_str());
+                return;
+            }
+            ssize_t ret;
+            while ((ret = read(fd_, buffer, sizeof(buffer))) > 0) {
+                int64_t time_ns = monotonicNs();
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    stats_.bytes_read += ret;
+                }
+                for (ssize_t i = 0; i < ret; i++) {
+                    if (parser_.Feed(buffer[i])) {
+                        do {
+                            handleFrame(parser_.seq, parser_.payload, parser_.len, time_ns);
+                        } while (parser_.Next());
+                    }
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.checksum_errors = parser_.checksum_errors;
+        stats_.skipped_bytes = parser_.skipped_bytes;
+    }
+}
+
+void Port::handleFrame(uint8_t seq, const uint8_t* payload, int len, int64_t time_ns) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.frames++;
+    int i = 0;
+    while (i < len) {
+        uint8_t code = payload[i];
+        int data_bytes = table_.length[code];
+        if (data_bytes < 0 || i + 1 + data_bytes > len) {
+            // The rest of the frame cannot be split without knowing this code
+            printf("Unknown Code %#X\n", code);
+            stats_.unknown_codes++;
+            break;
+        }
+        if (code == UNRECOGNISED || code == SCHEDULE_FULL || code == FRAME_ERROR) {
+            printf("Teensy error %#X for request %d\n", code, seq);
+            stats_.device_errors++;
+        }
+        Register& r = registers_[code];
+        memcpy(r.data, payload + i + 1, data_bytes);
+        r.len = data_bytes;
+        r.time_ns = time_ns;
+        r.seq = seq;
+        r.count++;
+        if (seq != 0) {
+            outstanding_[seq]--;
+        }
+        i += 1 + data_bytes;
+    }
+    cv_.notify_all();
+}
+
+} // namespace teensy
@@ -0,0 +1,247 @@
+/*
+Loopback check of the Teensy transport without hardware. A fake robot Teensy runs
+on the master side of a pty and the host Port opens the slave side, so the whole
+path (termios, epoll reader, framing, correlation, registers) is exercised.
+
+The fake Teensy answers the robot commands (ID, accelerometers, step counts and
+motor velocities) with values derived from the request sequence number, writes
+its frames back in random-sized pieces, and can add garbage bytes between frames
+and corrupt a fraction of them. The host sends robot-loop-like requests, waits
+for each one, and checks that every register holds the value for that request.
+
+Usage: teensy_loopback [num_requests] [corrupt_fraction]
+Exits with 1 if a register held the wrong value, or a request without a
+corrupted response timed out.
+*/
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <poll.h>
+#include <random>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "teensy_comms.hpp"
+
+// Robot codes (see servers/robot_controller/include/Commands.h)
+#define STOP 0x02
+#define SetRaw0 0x10
+#define Raw0Wr 0x20
+#define Acc0Wr 0xA3
+#define Acc1Wr 0xB3
+#define Acc2Wr 0xC3
+#define Step0Wr 0x30
+#define FAKE_DEVICE_ID 128
+
+using namespace std;
+
+teensy::ResponseTable robotTable() {
+    teensy::ResponseTable table;
+    table.set(teensy::ID_CODE, 2);
+    for (int i = 0; i < 7; i++) {
+        table.set(Step0Wr + i, 4).set(Raw0Wr + i, 2);
+    }
+    table.set(Acc0Wr, 6).set(Acc1Wr, 6).set(Acc2Wr, 6);
+    return table;
+}
+
+// The step count the fake Teensy reports for motor i in reply to request seq
+int32_t fakeSteps(int seq, int i) {
+    return 1000 * seq - 7 * i;
+}
+
+struct FakeTeensy {
+    int fd;
+    atomic<double> corrupt_fraction{0};
+    atomic<bool> running{true};
+    atomic<int> corrupted{0};
+    mt19937 rng{1234};
+    int16_t velocities[7] = {0};
+
+    void writeChunked(const uint8_t* data, int len) {
+        uniform_int_distribution<int> chunk(1, 16);
+        int i = 0;
+        while (i < len) {
+            int n = min(chunk(rng), len - i);
+            ssize_t ret = write(fd, data + i, n);
+            if (ret > 0) {
+                i += ret;
+            } else {
+                pollfd pfd = {fd, POLLOUT, 0};
+                poll(&pfd, 1, 10);
+            }
+        }
+    }
+
+    void reply(uint8_t seq, const uint8_t* payload, int len) {
+        uint8_t out[TEENSY_MAX_PAYLOAD];
+        int n = 0;
+        for (int i = 0; i + 2 < len; i += 3) {
+            uint8_t code = payload[i];
+            if (code == teensy::ID_CODE) {
+                out[n++] = code;
+                out[n++] = FAKE_DEVICE_ID;
+                out[n++] = 2;
+            } else if (code == Acc0Wr || code == Acc1Wr || code == Acc2Wr) {
+                out[n++] = code;
+                for (int k = 0; k < 6; k++) {
+                    out[n++] = seq + k;
+                }
+            } else if (code >= Step0Wr && code < Step0Wr + 7) {
+                int32_t steps = fakeSteps(seq, code - Step0Wr);
+                out[n++] = code;
+                out[n++] = (steps >> 24) & 0xFF;
+                out[n++] = (steps >> 16) & 0xFF;
+                out[n++] = (steps >> 8) & 0xFF;
+                out[n++] = steps & 0xFF;
+            } else if (code >= SetRaw0 && code < SetRaw0 + 7) {
+                velocities[code - SetRaw0] = (payload[i + 1] << 8) | payload[i + 2];
+            } else if (code == STOP) {
+                fill(velocities, velocities + 7, 0);
+            } else if (code != 0x00) {
+                out[n++] = teensy::UNRECOGNISED;
+            }
+            // Split long replies across frames, as the firmware does when its buffer fills
+            if (n > TEENSY_MAX_PAYLOAD - 8) {
+                send(seq, out, n);
+                n = 0;
+            }
+        }
+        if (n > 0) {
+            send(seq, out, n);
+        }
+    }
+
+    void send(uint8_t seq, const uint8_t* payload, int len) {
+        uint8_t frame[TEENSY_MAX_FRAME];
+        int frame_len = TeensyEncodeFrame(seq, payload, len, frame);
+        uniform_real_distribution<double> u(0, 1);
+        // Garbage between frames, which the parser should skip
+        if (u(rng) < 0.05) {
+            uint8_t garbage[3] = {0x00, 0x37, 0xFF};
+            writeChunked(garbage, 3);
+        }
+        if (u(rng) < corrupt_fraction) {
+            frame[3 + uniform_int_distribution<int>(0, len)(rng)] ^= 0x5A;
+            corrupted++;
+        }
+        writeChunked(frame, frame_len);
+    }
+
+    void run() {
+        TeensyFrameParser parser;
+        uint8_t buffer[512];
+        while (running) {
+            pollfd pfd = {fd, POLLIN, 0};
+            if (poll(&pfd, 1, 50) <= 0) {
+                continue;
+            }
+            ssize_t ret = read(fd, buffer, sizeof(buffer));
+            for (ssize_t i = 0; i < ret; i++) {
+                if (parser.Feed(buffer[i])) {
+                    do {
+                        reply(parser.seq, parser.payload, parser.len);
+                    } while (parser.Next());
+                }
+            }
+        }
+    }
+};
+
+int main(int argc, char* argv[]) {
+    int num_requests = 10000;
+    double corrupt_fraction = 0.01;
+    if (argc > 1) {
+        num_requests = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        corrupt_fraction = atof(argv[2]);
+    }
+
+    // Pseudo-terminal pair: the fake Teensy has the master, the Port the slave
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        perror("posix_openpt");
+        return 1;
+    }
+    fcntl(master, F_SETFL, O_NONBLOCK);
+    string slave_name = ptsname(master);
+
+    FakeTeensy fake;
+    fake.fd = master;
+    thread fake_thread(&FakeTeensy::run, &fake);
+
+    teensy::Port port(robotTable());
+    if (port.open(slave_name) != 0 || port.identify(1000) != 0 || port.device_id != FAKE_DEVICE_ID) {
+        cout << "FAIL: could not identify the fake Teensy" << endl;
+        fake.running = false;
+        fake_thread.join();
+        return 1;
+    }
+    fake.corrupt_fraction = corrupt_fraction;
+
+    // One robot loop tick: set 7 velocities, read 3 accelerometers and 7 step counts
+    vector<uint8_t> request;
+    for (int i = 0; i < 7; i++) {
+        request.insert(request.end(), {(uint8_t)(SetRaw0 + i), 0x01, (uint8_t)i});
+    }
+    for (uint8_t code : {Acc0Wr, Acc1Wr, Acc2Wr}) {
+        request.insert(request.end(), {code, 0x00, 0x00});
+    }
+    for (int i = 0; i < 7; i++) {
+        request.insert(request.end(), {(uint8_t)(Step0Wr + i), 0x00, 0x00});
+    }
+    int n_responses = port.expectedResponses(request.data(), request.size());
+
+    int timeouts = 0, wrong = 0;
+    vector<double> latency_us;
+    latency_us.reserve(num_requests);
+    for (int r = 0; r < num_requests; r++) {
+        int64_t t0 = teensy::monotonicNs();
+        int seq = port.send(request.data(), request.size(), n_responses);
+        if (port.wait(seq, 100) != 0) {
+            timeouts++;
+            continue;
+        }
+        latency_us.push_back(0.001 * (teensy::monotonicNs() - t0));
+        for (int i = 0; i < 7; i++) {
+            teensy::Register reg = port.latest(Step0Wr + i);
+            int32_t steps = (reg.data[0] << 24) | (reg.data[1] << 16) | (reg.data[2] << 8) | reg.data[3];
+            if (reg.seq != seq || steps != fakeSteps(seq, i)) {
+                wrong++;
+            }
+        }
+        teensy::Register acc = port.latest(Acc2Wr);
+        if (acc.seq != seq || acc.data[5] != (uint8_t)(seq + 5)) {
+            wrong++;
+        }
+    }
+
+    fake.running = false;
+    fake_thread.join();
+    teensy::Stats stats = port.stats();
+    port.close();
+    close(master);
+
+    sort(latency_us.begin(), latency_us.end());
+    auto percentile = [&](double p) {
+        return latency_us.empty() ? 0.0 : latency_us[(size_t)(p * (latency_us.size() - 1))];
+    };
+    cout << "Requests: " << num_requests << ", timeouts: " << timeouts
+         << ", corrupted frames: " << fake.corrupted << ", wrong registers: " << wrong << endl;
+    cout << "Frames: " << stats.frames << ", checksum errors: " << stats.checksum_errors
+         << ", skipped bytes: " << stats.skipped_bytes << ", unknown codes: " << stats.unknown_codes << endl;
+    cout << "Round trip (us): p50 " << percentile(0.5) << ", p99 " << percentile(0.99)
+         << ", max " << percentile(1.0) << endl;
+
+    // Each corrupted frame can cost at most one request
+    if (wrong > 0 || timeouts > fake.corrupted) {
+        cout << "FAIL" << endl;
+        return 1;
+    }
+    cout << "PASS" << endl;
+    return 0;
+}
@@ -0,0 +1,361 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+Binary, append-only telemetry logging for the servo loops.
+
+A Logger owns a fixed-record binary file and a background writer thread. The
+real-time thread (camera callback, robot loop) only copies one record into a
+lock-free single-producer/single-consumer queue; all file I/O happens on the
+writer thread.
+
+File layout (little-endian):
+    FileHeader
+    FieldHeader x num_fields
+    records of record_size bytes: uint64 CLOCK_MONOTONIC time in ns, then the
+    fields packed in schema order with no padding.
+
+The header stores a CLOCK_REALTIME/CLOCK_MONOTONIC pair taken at open, so
+readers can convert record times to UTC. See read_telemetry.py for the
+CSV/numpy converter.
+*/
+namespace telemetry {
+
+// Field types. The values are the numpy/struct type codes used by the reader.
+enum FieldType : char {
+    F64 = 'd',
+    F32 = 'f',
+    I64 = 'q',
+    U64 = 'Q',
+    I32 = 'i',
+    U32 = 'I',
+    I16 = 'h',
+    U16 = 'H',
+    I8 = 'b',
+    U8 = 'B'
+};
+
+// One column of the schema
+struct Field {
+    std::string name; // Column name (truncated to 31 characters in the file)
+    FieldType type; // Storage type
+};
+
+// Fixed size file header, written once at open
+struct FileHeader {
+    char magic[8]; // "PYXTLM1"
+    uint32_t header_size; // Bytes before the first record
+    uint32_t record_size; // Bytes per record, including the timestamp
+    uint32_t num_fields; // Number of FieldHeaders following
+    uint32_t reserved;
+    int64_t realtime_ns; // CLOCK_REALTIME at open
+    int64_t monotonic_ns; // CLOCK_MONOTONIC at open
+    char stream[32]; // Name of the stream, e.g. "gd_servo"
+};
+
+// Fixed size field description
+struct FieldHeader {
+    char name[31];
+    char type;
+};
+
+// Returns the size in bytes of a field type
+size_t fieldSize(FieldType type);
+
+// Returns the current CLOCK_MONOTONIC time in nanoseconds
+uint64_t monotonicNs();
+
+/*
+Builds a filename of the form prefix_YYYYMMDD_HHMMSS.tlm from the local time,
+so every server run gets its own file.
+*/
+std::string timestampedFilename(const std::string& prefix);
+
+/*
+Lock-free single-producer/single-consumer queue of fixed size slots.
+The producer calls reserve(), fills the slot and calls commit(); the consumer
+calls peek() to get a contiguous run of filled slots and release() once they
+have been written out.
+*/
+class SPSCQueue {
+public:
+    SPSCQueue(size_t slot_size, size_t num_slots);
+
+    // Producer: pointer to the next free slot, or nullptr if the queue is full
+    unsigned char* reserve() {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) > mask_) {
+            return nullptr;
+        }
+        return &buffer_[(head & mask_) * slot_size_];
+    }
+
+    // Producer: publish the slot returned by reserve()
+    void commit() {
+        head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Consumer: number of contiguous filled slots, starting at *first
+    size_t peek(unsigned char** first);
+
+    // Consumer: hand n slots back to the producer
+    void release(size_t n);
+
+private:
+    std::vector<unsigned char> buffer_;
+    size_t slot_size_;
+    size_t mask_;
+    alignas(64) std::atomic<size_t> head_{0}; // Written by the producer only
+    alignas(64) std::atomic<size_t> tail_{0}; // Written by the consumer only
+};
+
+/*
+Record layout of a stream: a uint64 timestamp, then the fields packed in
+schema order with no padding.
+*/
+class Schema {
+public:
+    Schema(std::vector<Field> fields);
+
+    const std::vector<Field>& fields() const { return fields_; }
+
+    // Record size in bytes, including the timestamp
+    size_t recordSize() const { return record_size_; }
+
+    /*
+    Pack a record stamped t into slot. Values are converted to the schema
+    type of their column; the caller checks that there is one per field.
+    */
+    template <typename... Args>
+    void pack(unsigned char* slot, uint64_t t, Args... values) const {
+        std::memcpy(slot, &t, sizeof(t));
+        size_t i = 0;
+        size_t offset = sizeof(t);
+        (packField(slot, i, offset, values), ...);
+    }
+
+    // Write the file header and field headers. Returns 0 on success, 1 on error
+    int writeHeader(FILE* file, const std::string& stream) const;
+
+    // Write records as CSV lines ("t_mono" then the fields), with a header line if first
+    void writeCsv(FILE* file, const unsigned char* records, size_t n, bool first) const;
+
+private:
+    template <typename T>
+    void packField(unsigned char* slot, size_t& i, size_t& offset, T value) const {
+        unsigned char* dst = slot + offset;
+        switch (fields_[i].type) {
+            case F64: store<double>(dst, value); break;
+            case F32: store<float>(dst, value); break;
+            case I64: store<int64_t>(dst, value); break;
+            case U64: store<uint64_t>(dst, value); break;
+            case I32: store<int32_t>(dst, value); break;
+            case U32: store<uint32_t>(dst, value); break;
+            case I16: store<int16_t>(dst, value); break;
+            case U16: store<uint16_t>(dst, value); break;
+            case I8: store<int8_t>(dst, value); break;
+            case U8: store<uint8_t>(dst, value); break;
+        }
+        offset += field_sizes_[i];
+        i++;
+    }
+
+    template <typename Dst, typename T>
+    static void store(unsigned char* dst, T value) {
+        Dst v = static_cast<Dst>(value);
+        std::memcpy(dst, &v, sizeof(Dst));
+    }
+
+    std::vector<Field> fields_;
+    std::vector<size_t> field_sizes_;
+    size_t record_size_;
+};
+
+class Logger {
+public:
+    /*
+    Inputs:
+        stream - name of the stream stored in the header
+        fields - schema of one record (excluding the timestamp)
+        queue_records - number of records the queue can hold before dropping
+    */
+    Logger(std::string stream, std::vector<Field> fields, size_t queue_records = 8192);
+    ~Logger();
+
+    /*
+    Create the file, write the header and start the writer thread. Any
+    previously open file is closed first.
+    Inputs:
+        filename - file to create
+    Outputs:
+        0 on success, 1 on error
+    */
+    int open(const std::string& filename);
+
+    // Flush everything queued, stop the writer thread and close the file
+    void close();
+
+    bool isOpen() const { return running_.load(std::memory_order_acquire); }
+
+    // Current filename (empty if never opened)
+    const std::string& filename() const { return filename_; }
+
+    // Number of records dropped because the queue was full or the file closed
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    // Record size in bytes, including the timestamp
+    size_t recordSize() const { return schema_.recordSize(); }
+
+    /*
+    Log one record, timestamped now. Values are converted to the schema type
+    of their column, so the number of arguments must equal the number of
+    fields. Called from the real-time thread: no allocation, no locks.
+    Outputs:
+        true if the record was queued
+    */
+    template <typename... Args>
+    bool log(Args... values) {
+        static_assert(sizeof...(Args) > 0, "telemetry::Logger::log needs at least one value");
+        if (sizeof...(Args) != schema_.fields().size() || !isOpen()) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        unsigned char* slot = queue_.reserve();
+        if (slot == nullptr) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        schema_.pack(slot, monotonicNs(), values...);
+        queue_.commit();
+        return true;
+    }
+
+private:
+    void writerLoop();
+    size_t drain();
+
+    std::string stream_;
+    Schema schema_;
+    SPSCQueue queue_;
+    std::string filename_;
+    FILE* file_ = nullptr;
+    std::thread writer_;
+    std::atomic<bool> running_{false};
+    std::atomic<uint64_t> dropped_{0};
+};
+
+/*
+In-memory flight recorder: the last num_records records of a stream, kept in
+a ring allocated up front, for looking at what led up to a fault.
+
+The real-time thread calls record() every tick, which only packs one record
+into the ring. Other threads control it with requests that record() acts on,
+so the ring itself is only ever touched by one thread at a time:
+    start() clears the ring and starts recording (RUNNING)
+    trigger() keeps recording for post_trigger more records (TRIGGERED) and
+        then freezes the ring (FROZEN). It may also be called from the
+        real-time thread, e.g. when an output saturates.
+    stop() stops recording (STOPPED)
+Once the ring is FROZEN or STOPPED, dump() writes it out oldest record first,
+as a .tlm file (same format as Logger) or as CSV if the name ends in .csv.
+*/
+class Recorder {
+public:
+    enum State { STOPPED = 0, RUNNING, TRIGGERED, FROZEN };
+
+    Recorder(std::string stream, std::vector<Field> fields, size_t num_records);
+
+    // Clear the ring and start recording; a trigger then freezes it post_trigger records later
+    void start(size_t post_trigger);
+
+    void stop();
+
+    /*
+    Trigger a freeze, noting the reason (e.g. "saturation"). Only the first
+    trigger after start() counts.
+    Outputs:
+        true if this was the first trigger
+    */
+    bool trigger(const char* reason);
+
+    /*
+    Freeze the ring at once. Only for use when the recording thread has
+    stopped (e.g. the watchdog has cancelled it), as the ring is not guarded.
+    */
+    void freeze(const char* reason);
+
+    int state() const { return state_.load(std::memory_order_acquire); }
+
+    // Records in the ring, and the reason for the trigger (once frozen)
+    size_t size() const { return count_.load(std::memory_order_relaxed); }
+    std::string reason() const { return reason_; }
+
+    /*
+    Write the ring to filename, oldest record first.
+    Outputs:
+        0 on success, 1 if the ring is still recording or the file could not be written
+    */
+    int dump(const std::string& filename) const;
+
+    /*
+    Record one tick, timestamped now (no allocation, no locks). The number of
+    values must equal the number of fields.
+    Outputs:
+        true if the record was stored
+    */
+    template <typename... Args>
+    bool record(Args... values) {
+        static_assert(sizeof...(Args) > 0, "telemetry::Recorder::record needs at least one value");
+        if (request_.load(std::memory_order_acquire) != NO_REQUEST) {
+            handleRequest();
+        }
+        int state = state_.load(std::memory_order_relaxed);
+        if (state == STOPPED || state == FROZEN || sizeof...(Args) != schema_.fields().size()) {
+            return false;
+        }
+        if (state == RUNNING && trigger_.load(std::memory_order_acquire) == TRIGGER_SET) {
+            state = TRIGGERED;
+            state_.store(state, std::memory_order_relaxed);
+            remaining_ = post_trigger_;
+        }
+        schema_.pack(&ring_[next_*schema_.recordSize()], monotonicNs(), values...);
+        next_ = next_ + 1 == num_records_ ? 0 : next_ + 1;
+        size_t count = count_.load(std::memory_order_relaxed);
+        if (count < num_records_) {
+            count_.store(count + 1, std::memory_order_relaxed);
+        }
+        if (state == TRIGGERED && remaining_-- == 0) {
+            state_.store(FROZEN, std::memory_order_release);
+        }
+        return true;
+    }
+
+private:
+    enum Request { NO_REQUEST = 0, START_REQUEST, STOP_REQUEST };
+    enum Trigger { TRIGGER_CLEAR = 0, TRIGGER_WRITING, TRIGGER_SET };
+
+    void handleRequest();
+
+    std::string stream_;
+    Schema schema_;
+    std::vector<unsigned char> ring_;
+    size_t num_records_;
+    size_t next_ = 0; // Slot the next record goes in
+    std::atomic<size_t> count_{0}; // Read by size() from other threads
+    size_t post_trigger_ = 0;
+    size_t remaining_ = 0;
+    std::atomic<int> state_{STOPPED};
+    std::atomic<int> request_{NO_REQUEST};
+    std::atomic<size_t> requested_post_trigger_{0};
+    std::atomic<int> trigger_{TRIGGER_CLEAR};
+    char reason_[64] = {0};
+};
+
+}
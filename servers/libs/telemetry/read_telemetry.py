@@ -0,0 +1,69 @@
+#Reader for the binary telemetry files written by libs/telemetry (*.tlm)
+#
+#As a module:
+#    from read_telemetry import read_telemetry
+#    data, header = read_telemetry("GD_servo_20250101_000000.tlm")
+#    data["gd"], data["time"] ...
+#
+#From the command line, convert to CSV or numpy:
+#    python read_telemetry.py file.tlm            (prints the header)
+#    python read_telemetry.py file.tlm out.csv
+#    python read_telemetry.py file.tlm out.npy
+
+import struct
+import sys
+import numpy as np
+
+FILE_HEADER = struct.Struct("<8sIIIIqq32s")
+FIELD_HEADER = struct.Struct("<31sc")
+
+
+def read_header(f):
+    magic, header_size, record_size, num_fields, _, realtime_ns, monotonic_ns, stream = FILE_HEADER.unpack(f.read(FILE_HEADER.size))
+    if magic.rstrip(b"\0") != b"PYXTLM1":
+        raise ValueError("Not a telemetry file")
+    fields = []
+    for i in range(num_fields):
+        name, code = FIELD_HEADER.unpack(f.read(FIELD_HEADER.size))
+        fields.append((name.rstrip(b"\0").decode(), code.decode()))
+    return {"header_size": header_size, "record_size": record_size,
+            "realtime_ns": realtime_ns, "monotonic_ns": monotonic_ns,
+            "stream": stream.rstrip(b"\0").decode(), "fields": fields}
+
+
+def read_telemetry(filename):
+    #Returns a numpy structured array and the header dictionary.
+    #"t_mono" is the raw CLOCK_MONOTONIC time in ns, "time" is the UNIX time in s.
+    with open(filename, "rb") as f:
+        header = read_header(f)
+        f.seek(header["header_size"])
+        raw = f.read()
+    dtype = np.dtype([("t_mono", "<u8")] + [(name, "<" + code) for name, code in header["fields"]])
+    if dtype.itemsize != header["record_size"]:
+        raise ValueError("Record size mismatch")
+    #A partially written final record is ignored
+    n = len(raw)//dtype.itemsize
+    records = np.frombuffer(raw[:n*dtype.itemsize], dtype=dtype)
+    unix_time = (records["t_mono"].astype(np.int64) - header["monotonic_ns"] + header["realtime_ns"])*1e-9
+    out = np.empty(n, dtype=[("time", "<f8")] + dtype.descr)
+    out["time"] = unix_time
+    for name in dtype.names:
+        out[name] = records[name]
+    return out, header
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2:
+        print("Usage: python read_telemetry.py file.tlm [out.csv | out.npy]")
+        sys.exit(1)
+    data, header = read_telemetry(sys.argv[1])
+    if len(sys.argv) < 3:
+        print("Stream: " + header["stream"])
+        print("Records: " + str(len(data)))
+        for name, code in header["fields"]:
+            print("    " + name + " (" + code + ")")
+    elif sys.argv[2].endswith(".npy"):
+        np.save(sys.argv[2], data)
+    else:
+        fmt = ["%.6f", "%d"] + ["%.9g" if code in "df" else "%d" for _, code in header["fields"]]
+        np.savetxt(sys.argv[2], data, delimiter=",", fmt=fmt, header=",".join(data.dtype.names), comments="")
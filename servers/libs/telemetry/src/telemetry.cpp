@@ -0,0 +1,291 @@
+#include "telemetry.hpp"
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <iostream>
+
+namespace telemetry {
+
+size_t fieldSize(FieldType type) {
+    switch (type) {
+        case F64: case I64: case U64: return 8;
+        case F32: case I32: case U32: return 4;
+        case I16: case U16: return 2;
+        case I8: case U8: return 1;
+    }
+    return 0;
+}
+
+uint64_t monotonicNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec)*1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+std::string timestampedFilename(const std::string& prefix) {
+    time_t t = time(nullptr);
+    struct tm local;
+    localtime_r(&t, &local);
+    char buf[32];
+    strftime(buf, sizeof(buf), "_%Y%m%d_%H%M%S.tlm", &local);
+    return prefix + buf;
+}
+
+// Round up to the next power of two so that indices can be masked
+static size_t roundPow2(size_t n) {
+    size_t p = 1;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+SPSCQueue::SPSCQueue(size_t slot_size, size_t num_slots)
+    : buffer_(slot_size*roundPow2(num_slots)), slot_size_(slot_size), mask_(roundPow2(num_slots) - 1) {}
+
+size_t SPSCQueue::peek(unsigned char** first) {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t head = head_.load(std::memory_order_acquire);
+    size_t index = tail & mask_;
+    size_t n = head - tail;
+    // Only return the part up to the end of the buffer; the rest comes next call
+    if (index + n > mask_ + 1) {
+        n = mask_ + 1 - index;
+    }
+    *first = &buffer_[index*slot_size_];
+    return n;
+}
+
+void SPSCQueue::release(size_t n) {
+    tail_.store(tail_.load(std::memory_order_relaxed) + n, std::memory_order_release);
+}
+
+// Total record size: timestamp plus all of the fields
+static size_t calcRecordSize(const std::vector<Field>& fields) {
+    size_t size = sizeof(uint64_t);
+    for (const Field& f : fields) {
+        size += fieldSize(f.type);
+    }
+    return size;
+}
+
+static std::vector<size_t> calcFieldSizes(const std::vector<Field>& fields) {
+    std::vector<size_t> sizes;
+    for (const Field& f : fields) {
+        sizes.push_back(fieldSize(f.type));
+    }
+    return sizes;
+}
+
+Schema::Schema(std::vector<Field> fields)
+    : fields_(fields), field_sizes_(calcFieldSizes(fields)), record_size_(calcRecordSize(fields)) {}
+
+int Schema::writeHeader(FILE* file, const std::string& stream) const {
+    // Header, with a realtime/monotonic pair to anchor the record timestamps
+    FileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "PYXTLM1", 8);
+    header.header_size = sizeof(FileHeader) + fields_.size()*sizeof(FieldHeader);
+    header.record_size = record_size_;
+    header.num_fields = fields_.size();
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    header.realtime_ns = static_cast<int64_t>(ts.tv_sec)*1000000000LL + ts.tv_nsec;
+    header.monotonic_ns = static_cast<int64_t>(monotonicNs());
+    strncpy(header.stream, stream.c_str(), sizeof(header.stream) - 1);
+    fwrite(&header, sizeof(header), 1, file);
+
+    for (const Field& f : fields_) {
+        FieldHeader field;
+        memset(&field, 0, sizeof(field));
+        strncpy(field.name, f.name.c_str(), sizeof(field.name) - 1);
+        field.type = f.type;
+        fwrite(&field, sizeof(field), 1, file);
+    }
+    return fflush(file) != 0;
+}
+
+// Read a value of type T at src, for printing
+template <typename T>
+static T load(const unsigned char* src) {
+    T v;
+    memcpy(&v, src, sizeof(T));
+    return v;
+}
+
+void Schema::writeCsv(FILE* file, const unsigned char* records, size_t n, bool first) const {
+    if (first) {
+        fprintf(file, "t_mono");
+        for (const Field& f : fields_) {
+            fprintf(file, ",%s", f.name.c_str());
+        }
+        fprintf(file, "\n");
+    }
+    for (size_t r = 0; r < n; r++) {
+        const unsigned char* src = records + r*record_size_;
+        fprintf(file, "%llu", static_cast<unsigned long long>(load<uint64_t>(src)));
+        src += sizeof(uint64_t);
+        for (size_t i = 0; i < fields_.size(); i++) {
+            switch (fields_[i].type) {
+                case F64: fprintf(file, ",%.17g", load<double>(src)); break;
+                case F32: fprintf(file, ",%.9g", load<float>(src)); break;
+                case I64: fprintf(file, ",%lld", static_cast<long long>(load<int64_t>(src))); break;
+                case U64: fprintf(file, ",%llu", static_cast<unsigned long long>(load<uint64_t>(src))); break;
+                case I32: fprintf(file, ",%d", load<int32_t>(src)); break;
+                case U32: fprintf(file, ",%u", load<uint32_t>(src)); break;
+                case I16: fprintf(file, ",%d", load<int16_t>(src)); break;
+                case U16: fprintf(file, ",%u", load<uint16_t>(src)); break;
+                case I8: fprintf(file, ",%d", load<int8_t>(src)); break;
+                case U8: fprintf(file, ",%u", load<uint8_t>(src)); break;
+            }
+            src += field_sizes_[i];
+        }
+        fprintf(file, "\n");
+    }
+}
+
+Logger::Logger(std::string stream, std::vector<Field> fields, size_t queue_records)
+    : stream_(stream), schema_(fields), queue_(schema_.recordSize(), queue_records) {}
+
+Logger::~Logger() {
+    close();
+}
+
+int Logger::open(const std::string& filename) {
+    close();
+
+    file_ = fopen(filename.c_str(), "wb");
+    if (file_ == nullptr) {
+        std::cout << "Telemetry: could not open " << filename << std::endl;
+        return 1;
+    }
+    filename_ = filename;
+
+    if (schema_.writeHeader(file_, stream_)) {
+        std::cout << "Telemetry: could not write header to " << filename << std::endl;
+        fclose(file_);
+        file_ = nullptr;
+        return 1;
+    }
+
+    running_.store(true, std::memory_order_release);
+    writer_ = std::thread(&Logger::writerLoop, this);
+    return 0;
+}
+
+void Logger::close() {
+    if (!running_.exchange(false)) {
+        return;
+    }
+    writer_.join();
+    // Anything logged after the writer saw running_ drop
+    while (drain() > 0) {}
+    fclose(file_);
+    file_ = nullptr;
+}
+
+// Write all currently queued records. Returns the number written.
+size_t Logger::drain() {
+    size_t total = 0;
+    unsigned char* first;
+    size_t n;
+    while ((n = queue_.peek(&first)) > 0) {
+        fwrite(first, schema_.recordSize(), n, file_);
+        queue_.release(n);
+        total += n;
+    }
+    if (total > 0) {
+        fflush(file_);
+    }
+    return total;
+}
+
+// Background writer: batches whatever has been queued every 10ms
+void Logger::writerLoop() {
+    while (running_.load(std::memory_order_acquire)) {
+        if (drain() == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+}
+
+Recorder::Recorder(std::string stream, std::vector<Field> fields, size_t num_records)
+    : stream_(stream), schema_(fields), ring_(schema_.recordSize()*std::max<size_t>(num_records, 1)),
+      num_records_(std::max<size_t>(num_records, 1)) {}
+
+void Recorder::start(size_t post_trigger) {
+    requested_post_trigger_.store(post_trigger, std::memory_order_relaxed);
+    request_.store(START_REQUEST, std::memory_order_release);
+}
+
+void Recorder::stop() {
+    request_.store(STOP_REQUEST, std::memory_order_release);
+}
+
+bool Recorder::trigger(const char* reason) {
+    int expected = TRIGGER_CLEAR;
+    if (!trigger_.compare_exchange_strong(expected, TRIGGER_WRITING, std::memory_order_acq_rel)) {
+        return false;
+    }
+    strncpy(reason_, reason, sizeof(reason_) - 1);
+    trigger_.store(TRIGGER_SET, std::memory_order_release);
+    return true;
+}
+
+void Recorder::freeze(const char* reason) {
+    trigger(reason);
+    request_.store(NO_REQUEST, std::memory_order_relaxed);
+    if (state() != STOPPED) {
+        state_.store(FROZEN, std::memory_order_release);
+    }
+}
+
+// Act on a start or stop request, from the recording thread
+void Recorder::handleRequest() {
+    int request = request_.exchange(NO_REQUEST, std::memory_order_acq_rel);
+    if (request == START_REQUEST) {
+        next_ = 0;
+        count_.store(0, std::memory_order_relaxed);
+        post_trigger_ = std::min(requested_post_trigger_.load(std::memory_order_relaxed), num_records_ - 1);
+        memset(reason_, 0, sizeof(reason_));
+        trigger_.store(TRIGGER_CLEAR, std::memory_order_release);
+        state_.store(RUNNING, std::memory_order_release);
+    } else if (request == STOP_REQUEST) {
+        state_.store(STOPPED, std::memory_order_release);
+    }
+}
+
+int Recorder::dump(const std::string& filename) const {
+    int state = state_.load(std::memory_order_acquire);
+    if (state == RUNNING || state == TRIGGERED) {
+        std::cout << "Telemetry: " << stream_ << " is still recording, not dumping" << std::endl;
+        return 1;
+    }
+    bool csv = filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".csv") == 0;
+    FILE* file = fopen(filename.c_str(), csv ? "w" : "wb");
+    if (file == nullptr) {
+        std::cout << "Telemetry: could not open " << filename << std::endl;
+        return 1;
+    }
+    // Oldest first: once the ring has wrapped, the oldest record is the one at next_
+    size_t size = schema_.recordSize();
+    size_t count = count_.load(std::memory_order_relaxed);
+    size_t first = count < num_records_ ? 0 : next_;
+    size_t n1 = std::min(count, num_records_ - first);
+    size_t n2 = count - n1;
+    if (csv) {
+        schema_.writeCsv(file, &ring_[first*size], n1, true);
+        schema_.writeCsv(file, &ring_[0], n2, false);
+    } else {
+        schema_.writeHeader(file, stream_);
+        fwrite(&ring_[first*size], size, n1, file);
+        fwrite(&ring_[0], size, n2, file);
+    }
+    if (fclose(file) != 0) {
+        std::cout << "Telemetry: could not write " << filename << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+}
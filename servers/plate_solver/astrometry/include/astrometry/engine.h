@@ -49,6 +49,9 @@ struct job_t {
     double dec_center;
     double search_radius;
     anbool use_radec_center;
+    // If set, only the engine's indexes i with use_index[i] are searched (so
+    // that parallel jobs can split the indexes between them).
+    const anbool* use_index;
     onefield_t bp;
 };
 typedef struct job_t job_t;
@@ -58,6 +61,10 @@ void engine_add_search_path(engine_t* engine, const char* path);
 char* engine_find_index(engine_t*, const char* name);
 // note that "path" must be a full path name.
 int engine_add_index(engine_t* engine, char* path);
+// add an index from its metadata alone (as the "indexset" config lines do),
+// without opening the file; "ind" must be malloc'd, with indexfn and indexname
+// set, and is owned by the engine afterwards.
+int engine_add_index_metadata(engine_t* engine, index_t* ind);
 // look in all the search path directories for index files.
 int engine_autoindex_search_paths(engine_t* engine);
 int engine_parse_config_file_stream(engine_t* engine, FILE* fconf);
@@ -66,6 +73,9 @@ int engine_run_job(engine_t* engine, job_t* job);
 void engine_free(engine_t* engine);
 
 job_t* engine_read_job_file(engine_t* engine, const char* jobfn);
+// a job from the primary header of an .axy file, already in memory; the
+// field must be given with job->bp.field_xy or onefield_set_field_file().
+job_t* engine_read_job_header(engine_t* engine, const qfits_header* hdr);
 int job_set_base_dir(job_t* job, const char* dir);
 int job_set_input_base_dir(job_t* job, const char* dir);
 int job_set_output_base_dir(job_t* job, const char* dir);
@@ -170,6 +170,11 @@ int fitsbin_n_ext(const fitsbin_t* fb);
 
 fitsbin_t* fitsbin_open(const char* fn);
 
+// Reading: chunks are mmap'd read-only and shared, so their pages come from
+// the page cache; if "populate" is set they are read in when mapped
+// (MAP_POPULATE, where available) instead of on first access.
+void fitsbin_set_mmap_populate(anbool populate);
+
 fitsbin_t* fitsbin_open_fits(anqfits_t* fits);
 
 fitsbin_t* fitsbin_open_for_writing(const char* fn);
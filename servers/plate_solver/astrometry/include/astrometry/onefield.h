@@ -121,6 +121,20 @@ struct onefield_params {
     anbool cancelled;
 
     anbool best_hit_only;
+
+    // Called with the best solution of each solved field before it is freed, so that
+    // a resident caller can take the WCS from memory instead of the output files.
+    void (*solution_callback)(const MatchObj* mo, void* userdata);
+    void* solution_userdata;
+
+    // If set, shared by parallel jobs solving the same field: only the first to
+    // finish with a solution (the one to set it) writes the output files and
+    // passes its solution to solution_callback; the others' are dropped.
+    volatile int* solution_claimed;
+
+    // If set, solved as field 1 instead of reading the field file (the caller
+    // keeps ownership).
+    starxy_t* field_xy;
 };
 typedef struct onefield_params onefield_t;
 
@@ -147,6 +147,11 @@ struct solver_t {
     // Bail out ASAP.
     anbool quit_now;
 
+    // If set, also bail out when this becomes TRUE: set from another thread
+    // (e.g. when a parallel search of other indexes has solved the field).
+    // Unlike quit_now, it is not reset between runs.
+    const volatile anbool* cancel;
+
     // SOLVER OUTPUTS
     // ==============
     // NOTE: these are only incremented, not initialized.  It's up to you to set
@@ -207,6 +207,21 @@ int engine_add_index(engine_t* engine, char* path) {
     return 0;
 }
 
+int engine_add_index_metadata(engine_t* engine, index_t* ind) {
+    // the index file isn't opened here: add_index_to_onefield() loads it
+    // the first time it is searched (inparallel) or onefield does (not).
+    if (!ind->indexfn || !ind->indexname) {
+        ERROR("Index metadata must include the index filename");
+        return -1;
+    }
+    if (add_index(engine, ind)) {
+        ERROR("Failed to add index \"%s\"", ind->indexfn);
+        return -1;
+    }
+    pl_append(engine->free_indexes, ind);
+    return 0;
+}
+
 static void add_index_to_onefield(engine_t* engine, onefield_t* bp,
                                int i) {
     index_t* index;
@@ -572,6 +587,8 @@ int engine_run_job(engine_t* engine, job_t* job) {
                 int ii = il_get(indexlist, k);
                 index_t* index = pl_get(engine->indexes, ii);
                 anbool inrange = TRUE;
+                if (job->use_index && !job->use_index[ii])
+                    continue;
                 if (job->use_radec_center)
                     inrange = index_is_within_range(index, job->ra_center, job->dec_center, job->search_radius);
                 if (!inrange) {
@@ -600,6 +617,11 @@ int engine_run_job(engine_t* engine, job_t* job) {
                 solved = TRUE;
                 break;
             }
+            // Cancelled by the caller: stop as if solved
+            if (sp->cancel && *sp->cancel) {
+                solved = TRUE;
+                break;
+            }
         }
         if (solved)
             break;
@@ -1022,7 +1044,6 @@ void engine_free(engine_t* engine) {
 job_t* engine_read_job_file(engine_t* engine, const char* jobfn) {
     qfits_header* hdr;
     job_t* job;
-    onefield_t* bp;
 
     // Read primary header.
     hdr = anqfits_get_header2(jobfn, 0);
@@ -1030,18 +1051,27 @@ job_t* engine_read_job_file(engine_t* engine, const char* jobfn) {
         ERROR("Failed to parse FITS header from file \"%s\"", jobfn);
         return NULL;
     }
+    job = engine_read_job_header(engine, hdr);
+    qfits_header_destroy(hdr);
+    if (!job)
+        return NULL;
+
+    onefield_set_field_file(&(job->bp), jobfn);
+    return job;
+}
+
+job_t* engine_read_job_header(engine_t* engine, const qfits_header* hdr) {
+    job_t* job;
+    onefield_t* bp;
+
     job = job_new();
     if (!parse_job_from_qfits_header(hdr, job)) {
         job_free(job);
-        qfits_header_destroy(hdr);
         return NULL;
     }
-    qfits_header_destroy(hdr);
 
     bp = &(job->bp);
 
-    onefield_set_field_file(bp, jobfn);
-
     // If the job has no scale estimate, search everything provided
     // by the engine
     if (!dl_size(job->scales) || job->include_default_scales) {
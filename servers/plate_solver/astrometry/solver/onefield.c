@@ -338,20 +338,26 @@ void onefield_run(onefield_t* bp) {
     // Parse WCS files submitted for verification.
     load_and_parse_wcsfiles(bp);
 
-    // Read .xyls file...
-    logverb("Reading fields file %s...", bp->fieldfname);
-    bp->xyls = xylist_open(bp->fieldfname);
-    if (!bp->xyls) {
-        ERROR("Failed to read xylist.\n");
-        exit( -1);
-    }
-    xylist_set_xname(bp->xyls, bp->xcolname);
-    xylist_set_yname(bp->xyls, bp->ycolname);
-    xylist_set_include_flux(bp->xyls, FALSE);
-    xylist_set_include_background(bp->xyls, FALSE);
-    logverb("found %u fields.\n", xylist_n_fields(bp->xyls));
+    if (bp->field_xy) {
+        // In-memory field: there is no xylist to read.
+        bp->xyls = NULL;
+        remove_invalid_fields(bp->fieldlist, 1);
+    } else {
+        // Read .xyls file...
+        logverb("Reading fields file %s...", bp->fieldfname);
+        bp->xyls = xylist_open(bp->fieldfname);
+        if (!bp->xyls) {
+            ERROR("Failed to read xylist.\n");
+            exit( -1);
+        }
+        xylist_set_xname(bp->xyls, bp->xcolname);
+        xylist_set_yname(bp->xyls, bp->ycolname);
+        xylist_set_include_flux(bp->xyls, FALSE);
+        xylist_set_include_background(bp->xyls, FALSE);
+        logverb("found %u fields.\n", xylist_n_fields(bp->xyls));
 
-    remove_invalid_fields(bp->fieldlist, xylist_n_fields(bp->xyls));
+        remove_invalid_fields(bp->fieldlist, xylist_n_fields(bp->xyls));
+    }
 
     Nindexes = n_indexes(bp);
 
@@ -486,11 +492,33 @@ void onefield_run(onefield_t* bp) {
 
  cleanup:
     // Clean up.
-    xylist_close(bp->xyls);
+    if (bp->xyls)
+        xylist_close(bp->xyls);
+
+    // Another job of a parallel search has already claimed the field.
+    if (bp->solution_claimed && bl_size(bp->solutions) &&
+        __sync_lock_test_and_set(bp->solution_claimed, 1)) {
+        logverb("Field already solved by a parallel job: dropping %zu solutions\n",
+                bl_size(bp->solutions));
+        for (i=0; i<bl_size(bp->solutions); i++) {
+            MatchObj* mo = bl_access(bp->solutions, i);
+            verify_free_matchobj(mo);
+            onefield_free_matchobj(mo);
+        }
+        bl_remove_all(bp->solutions);
+    }
 
     if (write_solutions(bp))
         exit(-1);
 
+    // write_solutions() has left only the best solution for each field.
+    if (bp->solution_callback) {
+        for (i=0; i<bl_size(bp->solutions); i++) {
+            MatchObj* mo = bl_access(bp->solutions, i);
+            bp->solution_callback(mo, bp->solution_userdata);
+        }
+    }
+
     for (i=0; i<bl_size(bp->solutions); i++) {
         MatchObj* mo = bl_access(bp->solutions, i);
         verify_free_matchobj(mo);
@@ -530,7 +558,7 @@ int onefield_parameters_are_okay(onefield_t* bp, solver_t* sp) {
         logerr("You must specify one or more indexes.\n");
         return 0;
     }
-    if (!bp->fieldfname) {
+    if (!bp->fieldfname && !bp->field_xy) {
         logerr("You must specify a field filename (xylist).\n");
         return 0;
     }
@@ -765,7 +793,7 @@ static anbool record_match_callback(MatchObj* mo, void* userdata) {
         // FIXME -- we don't support specifying individual fields (yet)
         assert(bp->xyls_tagalong_all);
         assert(!bp->xyls_tagalong);
-        if (bp->xyls_tagalong_all)
+        if (bp->xyls_tagalong_all && bp->xyls)
             grab_field_tagalong_data(mymo, bp->xyls, mymo->nfield);
     }
 
@@ -904,11 +932,12 @@ static void solve_fields(onefield_t* bp, sip_t* verify_wcs) {
         template.fieldfile = bp->fieldid;
 
         // Get the FIELDID string from the xyls FITS header.
-        if (xylist_open_field(bp->xyls, fieldnum)) {
+        if (bp->xyls && xylist_open_field(bp->xyls, fieldnum)) {
             logerr("Failed to open extension %i in xylist.\n", fieldnum);
             goto cleanup;
         }
-        fieldhdr = xylist_get_header(bp->xyls);
+        if (bp->xyls)
+            fieldhdr = xylist_get_header(bp->xyls);
         if (fieldhdr) {
             char* idstr = fits_get_dupstring(fieldhdr, bp->fieldid_key);
             if (idstr)
@@ -921,7 +950,10 @@ static void solve_fields(onefield_t* bp, sip_t* verify_wcs) {
             goto cleanup;
 
         // Get the field.
-        solver_set_field(sp, xylist_read_field(bp->xyls, NULL));
+        if (bp->field_xy)
+            solver_set_field(sp, starxy_copy(bp->field_xy));
+        else
+            solver_set_field(sp, xylist_read_field(bp->xyls, NULL));
         if (!sp->fieldxy_orig) {
             logerr("Failed to read xylist field.\n");
             goto cleanup;
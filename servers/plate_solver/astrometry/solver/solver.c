@@ -351,6 +351,11 @@ static void update_timeused(solver_t* sp) {
         sp->timeused = 0.0;
 }
 
+// Bail out because of this solver (quit_now) or its caller (cancel)?
+static inline anbool should_quit(const solver_t* sp) {
+    return sp->quit_now || (sp->cancel && *sp->cancel);
+}
+
 static void set_matchobj_template(solver_t* solver, MatchObj* mo) {
     if (solver->mo_template)
         memcpy(mo, solver->mo_template, sizeof(MatchObj));
@@ -746,7 +751,7 @@ static void add_stars(const pquad* pq, int* field, int fieldoffset,
     for (f[adding]=bottom; f[adding]<fieldtop; f[adding]++) {
         if (!pq->inbox[f[adding]])
             continue;
-        if (unlikely(solver->quit_now))
+        if (unlikely(should_quit(solver)))
             return;
 
         // If we've hit the end of the recursion (we're adding the last star),
@@ -967,12 +972,12 @@ void solver_run(solver_t* solver) {
                     // Now look at all sets of (C, D, ...) stars (subject to field[C] < field[D] < ...)
                     // ("dimquads - 2" because we've set stars A and B at this point)
                     add_stars(pq, field, C, dimquads-2, 0, newpoint, dimquads, solver, tol2);
-                    if (solver->quit_now)
+                    if (should_quit(solver))
                         goto quitnow;
                 }
             }
 
-            if (solver->quit_now)
+            if (should_quit(solver))
                 goto quitnow;
 
             // Now try building quads with the new star not on the diagonal:
@@ -1019,7 +1024,7 @@ void solver_run(solver_t* solver) {
                         } else {
                             TRY_ALL_CODES(pq, field, dimquads, solver, tol2);
                         }
-                        if (solver->quit_now)
+                        if (should_quit(solver))
                             goto quitnow;
                     }
                 }
@@ -1029,7 +1034,7 @@ void solver_run(solver_t* solver) {
 
             if ((solver->maxquads && (solver->numtries >= solver->maxquads))
                 || (solver->maxmatches && (solver->nummatches >= solver->maxmatches))
-                || solver->quit_now)
+                || should_quit(solver))
                 break;
         }
 
@@ -1117,7 +1122,7 @@ static void try_all_codes_2(const int* fieldstars, int dimquad,
 
     try_permutations(fieldstars, dimquad, code, solver, current_parity,
                      tol2, stars, NULL, 0, placed, &result);
-    if (unlikely(solver->quit_now))
+    if (unlikely(should_quit(solver)))
         goto bailout;
 
     // Flipped:
@@ -1256,7 +1261,7 @@ static void try_permutations(const int* origstars, int dimquad,
                 resolve_matches(*presult, pixvals, stars, dimquad, solver,
                                 current_parity);
             }
-            if (unlikely(solver->quit_now))
+            if (unlikely(should_quit(solver)))
                 return;
         }
     }
@@ -1358,7 +1363,7 @@ static void resolve_matches(kdtree_qres_t* krez, const double *field_xy,
         if (solver_handle_hit(solver, &mo, NULL, FALSE))
             solver->quit_now = TRUE;
 
-        if (unlikely(solver->quit_now))
+        if (unlikely(should_quit(solver)))
             return;
     }
 }
@@ -12,7 +12,9 @@
 #include "ioutils.h"
 #include "an-bool.h"
 
-static pl* estack = NULL;
+// One error stack per thread, so that parallel solves don't share it (only the
+// main thread's is freed at exit)
+static __thread pl* estack = NULL;
 static anbool atexit_registered = FALSE;
 
 static err_t* error_copy(err_t* e) {
@@ -28,6 +28,14 @@ struct fitsext {
 };
 typedef struct fitsext fitsext_t;
 
+// Fault in the pages of each chunk when it is mapped, rather than on first
+// access.
+static anbool mmap_populate = FALSE;
+
+void fitsbin_set_mmap_populate(anbool populate) {
+    mmap_populate = populate;
+}
+
 qfits_header* fitsbin_get_header(const fitsbin_t* fb, int ext) {
     assert(fb->fits);
     return anqfits_get_header(fb->fits, ext);
@@ -508,6 +516,10 @@ static int read_chunk(fitsbin_t* fb, fitsbin_chunk_t* chunk) {
         get_mmap_size(tabstart, tabsize, &mapstart, &(chunk->mapsize), &mapoffset);
         mode = PROT_READ;
         flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+        if (mmap_populate)
+            flags |= MAP_POPULATE;
+#endif
         chunk->map = mmap(0, chunk->mapsize, mode, flags, fileno(fb->fid), mapstart);
         if (chunk->map == MAP_FAILED) {
             SYSERROR("Couldn't mmap file \"%s\"", fb->filename);
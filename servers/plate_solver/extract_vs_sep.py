@@ -0,0 +1,142 @@
+"""
+Compares the C++ source extractor (libs/imageproc extract.hpp, as run in the star tracker
+servers) with SEP (as run_image in run_plate_solver.py runs it) on saved star tracker
+frames, for speed and detection parity.
+
+Each frame of each FITS cube is extracted with SEP here, and with ExtractBench (built by
+"make extract_bench" in coarse_star_tracker/src) with the same [SExtractor] settings.
+Sources are matched within a pixel; the brightest SEP sources are the ones that matter to
+the solver (depth in [Astrometry]), so recall is also given for those.
+
+Usage:
+    python extract_vs_sep.py Dextra_astrometry.toml cube1.fits [cube2.fits ...]
+        [--bench ../coarse_star_tracker/bin/ExtractBench] [--threads 0] [--repeats 10]
+"""
+import os, sys
+import argparse
+import subprocess as sp
+import tempfile
+import time
+import numpy as np
+import pytomlpp
+import sep
+from astropy.io import fits
+
+"""
+Extract sources from a frame as run_image does: median of each row subtracted,
+sep.Background and sep.extract with the [SExtractor] settings
+
+INPUTS
+img = frame
+config = plate solver config
+
+RETURNS
+array of x, y, flux (brightest first) and the time taken (ms)
+"""
+def sep_extract(img, config):
+    start = time.perf_counter()
+    img = img.astype(np.float32)
+    img -= np.median(img, axis=1, keepdims=True)
+    back_size = config["SExtractor"].get("back_size", 64)
+    back_filter = config["SExtractor"].get("back_filter", 3)
+    bkg = sep.Background(img, bw=back_size, bh=back_size, fw=back_filter, fh=back_filter)
+    img_sub = img - bkg
+    lst = sep.extract(img_sub,
+                      thresh=config["SExtractor"]["thresh"],
+                      err=bkg.globalrms,
+                      minarea=config["SExtractor"]["minarea"],
+                      filter_kernel=np.array(config["SExtractor"]["filter_kernel"]),
+                      deblend_cont=config["SExtractor"]["deblend_cont"])
+    elapsed = (time.perf_counter() - start)*1e3
+    lst = lst[np.argsort(lst['flux'])[::-1]]
+    return np.array([lst['x'], lst['y'], lst['flux']]).T, elapsed
+
+"""
+Match two source lists: for each reference source, the nearest other source within
+max_dist pixels (each source matched at most once, brightest reference first)
+
+RETURNS
+indices into other (-1 if unmatched) for each reference source
+"""
+def match(ref, other, max_dist=1.0):
+    matched = -np.ones(len(ref), dtype=int)
+    used = np.zeros(len(other), dtype=bool)
+    for i, (x, y) in enumerate(ref[:, :2]):
+        if len(other) == 0:
+            break
+        d2 = (other[:, 0] - x)**2 + (other[:, 1] - y)**2
+        d2[used] = np.inf
+        j = np.argmin(d2)
+        if d2[j] <= max_dist**2:
+            matched[i] = j
+            used[j] = True
+    return matched
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare the C++ source extractor with SEP")
+    parser.add_argument("config", help="Plate solver config (e.g. Dextra_astrometry.toml)")
+    parser.add_argument("fits", nargs="+", help="FITS cubes of star tracker frames")
+    parser.add_argument("--bench", default="../coarse_star_tracker/bin/ExtractBench")
+    parser.add_argument("--threads", type=int, default=0)
+    parser.add_argument("--repeats", type=int, default=10)
+    args = parser.parse_args()
+
+    config = pytomlpp.load(args.config)
+    depth = config["Astrometry"].get("depth", 10)
+    kernel = np.array(config["SExtractor"]["filter_kernel"])
+    if kernel.ndim != 2 or kernel.shape[0] != kernel.shape[1]:
+        print("ExtractBench takes square filter kernels only")
+        return 1
+
+    # The C++ extractor, with the same settings
+    tmpdir = tempfile.mkdtemp()
+    prefix = os.path.join(tmpdir, "sources")
+    cmd = [args.bench, *args.fits,
+           "--threads", str(args.threads), "--repeats", str(args.repeats),
+           "--thresh", str(config["SExtractor"]["thresh"]),
+           "--minarea", str(config["SExtractor"]["minarea"]),
+           "--deblend-cont", str(config["SExtractor"]["deblend_cont"]),
+           "--back-size", str(config["SExtractor"].get("back_size", 64)),
+           "--back-filter", str(config["SExtractor"].get("back_filter", 3)),
+           "--kernel", ",".join(str(k) for k in kernel.flatten()),
+           "--out", prefix]
+    print(" ".join(cmd))
+    sp.run(cmd, check=True)
+
+    sep_times = []
+    recall, recall_top, precision, dx, dy, flux_ratio = [], [], [], [], [], []
+    for filename in args.fits:
+        name = os.path.splitext(os.path.basename(filename))[0]
+        cube = fits.getdata(filename)
+        if cube.ndim == 2:
+            cube = cube[np.newaxis]
+        for f, img in enumerate(cube):
+            ref = None
+            for _ in range(args.repeats):
+                ref, elapsed = sep_extract(img, config)
+                sep_times.append(elapsed)
+            ours = np.loadtxt("%s_%s_%d.txt" % (prefix, name, f), ndmin=2)
+            ours = ours[:, :3] if len(ours) else np.zeros((0, 3))
+            m = match(ref, ours)
+            ok = m >= 0
+            recall.append(ok.mean() if len(ref) else 1.0)
+            recall_top.append(ok[:depth].mean() if len(ref) else 1.0)
+            precision.append(ok.sum()/len(ours) if len(ours) else 1.0)
+            dx.extend(ours[m[ok], 0] - ref[ok, 0])
+            dy.extend(ours[m[ok], 1] - ref[ok, 1])
+            flux_ratio.extend(ours[m[ok], 2]/ref[ok, 2])
+            print("%s frame %d: SEP %d sources, C++ %d sources, %d matched, brightest %d: %d matched"
+                  % (name, f, len(ref), len(ours), ok.sum(), min(depth, len(ref)), ok[:depth].sum()))
+
+    print("\nRecall %.3f (brightest %d: %.3f), precision %.3f"
+          % (np.mean(recall), depth, np.mean(recall_top), np.mean(precision)))
+    if dx:
+        print("Centroid offset (C++ - SEP) mean %.4f, %.4f pix, RMS %.4f pix"
+              % (np.mean(dx), np.mean(dy), np.sqrt(np.mean(np.square(dx) + np.square(dy)))))
+        print("Flux ratio (C++/SEP) median %.4f" % np.median(flux_ratio))
+    print("SEP extraction time (ms): median %.2f, 95%% %.2f"
+          % (np.median(sep_times), np.percentile(sep_times, 95)))
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
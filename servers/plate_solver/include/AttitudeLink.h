@@ -0,0 +1,74 @@
+//AttitudeLink.h
+//Sends the pointing offsets of plate solutions straight to the robot controller, without
+//going through run_plate_solver.py: a solution is converted to the azimuth, altitude and
+//position angle offsets to the target (attitude.hpp, as conversion.diffRaDec2AltAz), which
+//are sent as RC.receive_ST_angles. The robot controller queues that command in its command
+//mailbox, and the robot loop picks it up on its next tick. A solution of a frame taken some
+//time ago (e.g. by the fine star tracker's fused mode) is sent as RC.receive_ST_fix with its
+//age instead, so that the robot can take off the motion since.
+//
+//The site is the [Site] table of the plate solver config, and the robot controller is the
+//one run_plate_solver.py talks to (IP and robot_control_port). Offsets are only sent if
+//send_angles is set; otherwise they are just returned with the solution.
+#ifndef ATTITUDE_LINK_H_INCLUDE_GUARD
+#define ATTITUDE_LINK_H_INCLUDE_GUARD
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <commander/client/socket.h>
+#include "attitude.hpp"
+#include "PlateSolutionJson.h"
+
+//A solution, with the offsets from it to the target
+struct AttitudeSolution {
+    PlateSolution solution;
+    attitude::Offsets offsets; //radians (zero if it did not solve)
+    int sent = 0; //1 if the offsets were sent to the robot controller
+};
+
+class AttitudeLink {
+    public:
+        //Read the site, send_angles and the robot controller address from a plate solver
+        //config, and connect to the robot controller if sending. Returns 0, or 1 on error
+        int Init(const std::string &config_file);
+
+        //Convert a solution of a frame taken age_s ago to the offsets to a target at
+        //target_ra, target_dec (deg) then, and send them to the robot controller if sending
+        //is on (with the age, if not 0)
+        AttitudeSolution Convert(const PlateSolution &solution, double target_ra, double target_dec,
+                                 double age_s = 0);
+
+        const attitude::Site &site() const { return site_; }
+        bool sending() const { return robot_ != nullptr; }
+
+    private:
+        attitude::Site site_;
+        std::unique_ptr<commander::client::Socket> robot_;
+        std::mutex robot_mutex_; //The socket takes one request at a time
+};
+
+// Serialiser to convert the AttitudeSolution struct to JSON: the PlateSolution fields, and
+// the offsets as "az", "alt" and "pos"
+namespace nlohmann {
+    template <>
+    struct adl_serializer<AttitudeSolution> {
+        static void to_json(json& j, const AttitudeSolution& a) {
+            j = a.solution;
+            j["az"] = a.offsets.az;
+            j["alt"] = a.offsets.alt;
+            j["pos"] = a.offsets.pos;
+            j["sent"] = a.sent;
+        }
+
+        static void from_json(const json& j, AttitudeSolution& a) {
+            j.get_to(a.solution);
+            j.at("az").get_to(a.offsets.az);
+            j.at("alt").get_to(a.offsets.alt);
+            j.at("pos").get_to(a.offsets.pos);
+            j.at("sent").get_to(a.sent);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,61 @@
+//FrameSolver.h
+//Plate solving inside the star tracker camera servers: the latest frame is copied out of
+//the camera's ring buffer, its stars extracted (extract.hpp) and the field solved by a
+//resident PlateSolver, with no FITS files written or read on the way. The frame, star
+//list (.axy) and WCS of the latest solve can still be written for debugging.
+//
+//The settings come from the plate solver config (e.g. Dextra_astrometry.toml): the
+//[Astrometry], [SExtractor] and [Tracking] sections, astrometry_config and the index options.
+#ifndef FRAME_SOLVER_H_INCLUDE_GUARD
+#define FRAME_SOLVER_H_INCLUDE_GUARD
+
+#include <string>
+#include <vector>
+#include "PlateSolver.h"
+#include "extract.hpp"
+
+//What changes from one solve to the next, as sent by run_plate_solver.py
+struct FrameRequest {
+    double ref_offset_x = 0, ref_offset_y = 0; //Added to the reference pixel (tip/tilt correction)
+    bool use_estimate = false; //Search around the last solution only
+    double est_ra = 0, est_dec = 0; //deg
+};
+
+class FrameSolver {
+    public:
+        //Read the plate solver config and load the indexes. debug_prefix, if set, is
+        //where the frame, .axy and .wcs of each solve are written (overwritten each time).
+        //Returns 0, or 1 on error
+        int Init(const std::string &config_file, const std::string &debug_prefix);
+
+        //Extract and solve a frame, from the last solution if [Tracking] is enabled. Returns
+        //0 if it solved, 1 if it didn't and -1 on error
+        int Solve(const unsigned short *frame, int width, int height, const FrameRequest &request,
+                  PlateSolution *solution);
+
+        bool ready() const { return ready_; }
+
+    private:
+        //Write the frame as a FITS image (the solver writes the .axy and .wcs). Returns 0,
+        //or 1 on error
+        int WriteDebugFiles(const unsigned short *frame, const FieldStars &field);
+
+        PlateSolver solver_;
+        extract::Settings extract_settings_;
+        FieldStars field_settings_; //Depth, FOV, reference pixel and search radius
+        std::string debug_prefix_;
+        bool ready_ = false;
+};
+
+//Copy the latest frame from the camera ring buffer (globals.h). Returns 0, or 1 if the
+//camera isn't acquiring
+int CopyLatestFrame(std::vector<unsigned short> *frame, int *width, int *height);
+
+//Average the latest num_frames consecutive frames from the camera ring buffer (fewer if
+//the buffer doesn't hold that many), to reach the depth of a longer exposure without
+//changing the exposure time. host_time is the mean time of the middle of their exposures
+//(unix seconds). Returns the number of frames averaged, or 0 if the camera isn't acquiring
+int CopyLatestFrames(int num_frames, std::vector<unsigned short> *frame, int *width, int *height,
+                     double *host_time);
+
+#endif
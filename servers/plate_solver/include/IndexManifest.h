@@ -0,0 +1,87 @@
+//IndexManifest.h
+//A text file listing the indexes an astrometry.net config file finds, with the metadata
+//the engine needs to choose between them (scale range, healpix, quad parameters). With a
+//current manifest the solver starts without scanning the index directories or opening
+//any index file, and can choose the indexes for a field of view before loading them.
+//
+//The manifest is current while the config file, every index directory and every index
+//file keep the modification times (and sizes) recorded in it. Paths in it are absolute,
+//so servers running from different directories can share it.
+#ifndef INDEX_MANIFEST_H_INCLUDE_GUARD
+#define INDEX_MANIFEST_H_INCLUDE_GUARD
+
+#include <string>
+#include <utility>
+#include <vector>
+
+//One index file, with the fields of index_t that are filled in from its headers
+struct IndexEntry {
+    std::string path;
+    long long size = 0;
+    long long mtime = 0; //ns
+    int index_id = 0;
+    int healpix = 0;
+    int hpnside = 0;
+    double scale_lower = 0, scale_upper = 0; //Quad sizes (arcsec)
+    int dimquads = 0;
+    int nstars = 0;
+    int nquads = 0;
+    int circle = 0;
+    int cx_less_than_dx = 0;
+    int meanx_less_than_half = 0;
+    double jitter = 0; //arcsec
+    int cutnside = 0;
+    int cutnsweep = 0;
+    double cutdedup = 0;
+    int cutmargin = 0;
+    std::string cutband;
+
+    //Whether the index has quads between quad_lo and quad_hi (arcsec)
+    bool Overlaps(double quad_lo, double quad_hi) const {
+        return !(quad_lo > scale_upper || quad_hi < scale_lower);
+    }
+};
+
+class IndexManifest {
+    public:
+        //Parse an astrometry.net config file, reading only the headers of the indexes
+        //it finds. Returns 0, or 1 on error
+        int Scan(const std::string &config_file);
+
+        //Returns 0, or 1 if the file is missing or can't be parsed
+        int Read(const std::string &filename);
+
+        //Returns 0, or 1 on error
+        int Write(const std::string &filename) const;
+
+        //Whether the manifest was made from config_file, and nothing it lists has changed
+        bool Current(const std::string &config_file) const;
+
+        //The indexes with quads that a field of fov_min to fov_max degrees wide can
+        //match, allowing for aspect ratios up to 2. fov_max = 0 selects every index
+        std::vector<const IndexEntry*> Select(double fov_min, double fov_max) const;
+
+        const std::vector<IndexEntry> &indexes() const { return indexes_; }
+
+    private:
+        std::string config_file_;
+        long long config_mtime_ = 0;
+        std::vector<std::pair<std::string, long long>> dirs_; //add_path directories, with mtimes
+        std::vector<IndexEntry> indexes_;
+};
+
+struct engine;
+
+//Parse an astrometry.net config file into an engine, leaving out the lines that find
+//indexes unless find_indexes is set. Relative add_path directories are taken from the
+//directory of the config file (not the working directory). Returns 0, or 1 on error
+int ParseAstrometryConfig(struct engine *engine, const std::string &config_file, bool find_indexes);
+
+//The absolute path of an existing file, or the path unchanged if it doesn't exist
+std::string AbsolutePath(const std::string &path);
+
+//Modification time (ns) and size of a file or directory. Returns 0, or 1 if it can't be
+//read
+int FileStat(const std::string &path, long long *mtime, long long *size);
+
+#endif
@@ -0,0 +1,139 @@
+//PatternDatabase.h
+//A star pattern hash database for lost-in-space solving, as tetra3.py builds: every set of
+//four nearby bright catalogue stars is hashed by the ratios of its six edge lengths, which
+//don't depend on where the field points, its roll or its pixel scale. The patterns of the
+//brightest field stars are then looked up directly, and a match verified against the
+//catalogue stars around it, without searching the astrometry.net indexes.
+//
+//The database is built once for the largest field of view it is to solve (BuildPatterns)
+//and written as a flat binary file, which is mmap'd read-only as the index files are: a
+//header, the catalogue star vectors grouped by healpix (so the stars around a field can be
+//found), the first star of each healpix, and the pattern hash table (a power of two at
+//least twice the number of patterns, probed triangularly so that every slot is reached).
+#ifndef PATTERN_DATABASE_H_INCLUDE_GUARD
+#define PATTERN_DATABASE_H_INCLUDE_GUARD
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "PlateSolver.h"
+
+//A catalogue star to build a database from
+struct CatalogueStar {
+    double xyz[3]; //Unit vector
+    double rank; //Lower is brighter (magnitude, or the order the catalogue sorts the stars in)
+};
+
+//How a database is built
+struct PatternBuildOptions {
+    double max_fov = 10; //Widest field to solve (deg): the stars of a pattern are at most this far apart
+    int pattern_stars_per_fov = 10; //Brightest stars in each circle of diameter max_fov to make patterns of
+    int catalogue_stars_per_fov = 20; //Brightest stars in each such circle to verify matches with
+    double min_separation = 0.05; //Drop a star this close to a brighter one (deg), as a double would confuse the centroids
+    double pattern_max_error = 0.005; //Largest difference in edge ratio between a field and a catalogue pattern
+    int pattern_bins = 25; //Hash bins of each edge ratio (at most 50)
+};
+
+//The header at the start of a database file
+struct PatternFileHeader {
+    char magic[8]; //"PYXPATDB"
+    uint32_t version;
+    uint32_t pattern_bins;
+    uint32_t nside; //Of the healpixes the stars are grouped by
+    uint32_t pattern_stars_per_fov;
+    uint32_t catalogue_stars_per_fov;
+    uint32_t reserved;
+    uint64_t num_stars;
+    uint64_t num_patterns;
+    uint64_t num_slots; //Size of the hash table, a power of two
+    double max_fov; //deg
+    double pattern_max_error;
+    double min_separation; //deg
+    uint64_t stars_offset; //Bytes from the start of the file: float[num_stars][3]
+    uint64_t cells_offset; //uint32_t[12*nside*nside + 1], the first star of each healpix
+    uint64_t slots_offset; //PatternSlot[num_slots]
+};
+
+//A slot of the hash table: the four stars of a pattern (star[0] == EMPTY_SLOT if empty)
+struct PatternSlot {
+    uint32_t star[4];
+    float largest_edge; //Chord between the furthest apart stars
+};
+
+//A pattern match, verified and refit as a TAN WCS
+struct PatternMatch {
+    double crval[2] = {0, 0}; //deg
+    double crpix[2] = {0, 0}; //The field's reference pixel
+    double cd[2][2] = {{0, 0}, {0, 0}}; //deg/pixel
+    int num_matched = 0; //Field stars matched to catalogue stars
+    double prob = 1; //Probability that the match is false
+    double rms = 0; //Of the matched star residuals (pixels)
+    int patterns_tried = 0; //Field patterns looked up
+};
+
+class PatternDatabase {
+    public:
+        static const uint32_t EMPTY_SLOT = 0xffffffff;
+
+        PatternDatabase() {}
+        ~PatternDatabase();
+        PatternDatabase(const PatternDatabase &) = delete;
+        PatternDatabase &operator=(const PatternDatabase &) = delete;
+
+        //Map a database file read-only, and optionally read it all in now rather than on
+        //its first solves. Returns 0, or 1 on error
+        int Open(const std::string &filename, bool prefault = false);
+
+        //Look up the patterns of the brightest field stars, and verify each match against
+        //the catalogue stars in the field. The field width (fov_min to fov_max) must fit
+        //the database. Returns 0 if a match was verified, 1 if not, and -1 on error
+        int Solve(const FieldStars &field, const PatternOptions &options, PatternMatch *match) const;
+
+        //The catalogue stars within radius (deg) of xyz, appended to star_xyz
+        void StarsNear(const double *xyz, double radius, std::vector<double> *star_xyz) const;
+
+        const PatternFileHeader &header() const { return *header_; }
+
+    private:
+        void *map_ = nullptr;
+        size_t size_ = 0;
+        const PatternFileHeader *header_ = nullptr;
+        const float *stars_ = nullptr;
+        const uint32_t *cells_ = nullptr;
+        const PatternSlot *slots_ = nullptr;
+        double cell_radius_ = 0; //Largest radius (deg) StarsNear finds from neighbouring healpixes alone
+};
+
+/*
+Function to read the stars of an astrometry.net index file, ranked by the sweep they were
+chosen in when the index was made (the brightest stars of each healpix of the cut come
+first), scaled by the number of healpixes so that stars from different indexes rank alike
+Inputs
+    index_file - index file (e.g. index-5006.fits)
+    stars - the stars are appended to it
+Output
+    0 on success, 1 on error
+*/
+int ReadIndexStars(const std::string &index_file, std::vector<CatalogueStar> *stars);
+
+/*
+Function to read a text catalogue of "ra dec [mag]" lines (deg). Lines starting with #
+are skipped. Without magnitudes, the stars rank in the order of the file
+Output
+    0 on success, 1 on error
+*/
+int ReadTextCatalogue(const std::string &filename, std::vector<CatalogueStar> *stars);
+
+/*
+Function to build a pattern database and write it to a file
+Inputs
+    stars - catalogue stars, in any order
+    options - build options
+    filename - database file to write
+Output
+    0 on success, 1 on error
+*/
+int BuildPatternDatabase(std::vector<CatalogueStar> stars, const PatternBuildOptions &options,
+                         const std::string &filename);
+
+#endif
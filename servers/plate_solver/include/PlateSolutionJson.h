@@ -0,0 +1,63 @@
+//PlateSolutionJson.h
+//JSON serialisers for PlateSolution and SolveTimes, for the servers that return solutions over commander
+#ifndef PLATE_SOLUTION_JSON_H_INCLUDE_GUARD
+#define PLATE_SOLUTION_JSON_H_INCLUDE_GUARD
+
+#include <commander/commander.h>
+#include "PlateSolver.h"
+
+// Serialiser to convert the PlateSolution struct to/from JSON
+namespace nlohmann {
+    template <>
+    struct adl_serializer<PlateSolution> {
+        static void to_json(json& j, const PlateSolution& s) {
+            j = json{{"solved", s.solved}, {"ra", s.ra}, {"dec", s.dec},
+                     {"orientation", s.orientation}, {"pixscale", s.pixscale},
+                     {"ra_center", s.ra_center}, {"dec_center", s.dec_center},
+                     {"field_w", s.field_w}, {"field_h", s.field_h},
+                     {"crpix", {s.crpix[0], s.crpix[1]}},
+                     {"cd", {s.cd[0][0], s.cd[0][1], s.cd[1][0], s.cd[1][1]}},
+                     {"log_odds", s.log_odds}, {"num_matched", s.num_matched},
+                     {"index_id", s.index_id}, {"solve_ms", s.solve_ms},
+                     {"tracked", s.tracked}, {"pattern", s.pattern}, {"rms", s.rms}};
+        }
+
+        static void from_json(const json& j, PlateSolution& s) {
+            j.at("solved").get_to(s.solved);
+            j.at("ra").get_to(s.ra);
+            j.at("dec").get_to(s.dec);
+            j.at("orientation").get_to(s.orientation);
+            j.at("pixscale").get_to(s.pixscale);
+            j.at("ra_center").get_to(s.ra_center);
+            j.at("dec_center").get_to(s.dec_center);
+            j.at("field_w").get_to(s.field_w);
+            j.at("field_h").get_to(s.field_h);
+            j.at("log_odds").get_to(s.log_odds);
+            j.at("num_matched").get_to(s.num_matched);
+            j.at("index_id").get_to(s.index_id);
+            j.at("solve_ms").get_to(s.solve_ms);
+            j.at("tracked").get_to(s.tracked);
+            j.at("pattern").get_to(s.pattern);
+            j.at("rms").get_to(s.rms);
+        }
+    };
+
+    template <>
+    struct adl_serializer<SolveTimes> {
+        static void to_json(json& j, const SolveTimes& t) {
+            j = json{{"count", t.count}, {"solved", t.solved}, {"p50", t.p50},
+                     {"p90", t.p90}, {"p99", t.p99}, {"max", t.max}};
+        }
+
+        static void from_json(const json& j, SolveTimes& t) {
+            j.at("count").get_to(t.count);
+            j.at("solved").get_to(t.solved);
+            j.at("p50").get_to(t.p50);
+            j.at("p90").get_to(t.p90);
+            j.at("p99").get_to(t.p99);
+            j.at("max").get_to(t.max);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,237 @@
+//PlateSolver.h
+//The bundled astrometry.net engine, kept resident in the process: the config file is
+//parsed and every index loaded once at start-up, and each solve runs a job against the
+//loaded indexes and returns the WCS solution as a struct (no astrometry-engine or wcsinfo
+//subprocesses).
+//
+//Index files are mmap'd read-only and shared by the kd-tree code, so their pages live in
+//the page cache and are shared with every other process solving from the same files. With
+//an index manifest (IndexManifest.h) the indexes are added from their metadata alone and
+//each is opened the first time a job searches it, and the set of indexes can be swapped
+//for another field of view while the server runs.
+//
+//In tracking mode each solution is kept, and the next field is solved from it: the star
+//positions are predicted from the last WCS (moved by the drift of the sky since), the
+//catalogue stars around the predicted field are found in the index star kd-trees and
+//matched to the extracted stars, and the WCS refit to them by least squares. Only if
+//that fails is the full index search run.
+//
+//With a pattern database (PatternDatabase.h), a field that can't be tracked is first looked
+//up by the shapes of its brightest star patterns, as Tetra does, which takes a few ms
+//wherever the field is; the index search only runs if no pattern matches.
+//
+//The index search is split between a pool of threads, each searching its own share of
+//the indexes; the first to find a verified solution cancels the others. The time of each
+//solve is kept for each index config, for solve time percentiles.
+#ifndef PLATE_SOLVER_H_INCLUDE_GUARD
+#define PLATE_SOLVER_H_INCLUDE_GUARD
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct engine;
+struct job_t;
+struct TrackingState;
+class SearchPool;
+class PatternDatabase;
+
+//A WCS solution, with the quantities run_plate_solver.py used to take from wcsinfo
+struct PlateSolution {
+    int solved = 0;
+    double ra = 0, dec = 0; //At the reference pixel (crval0, crval1) (deg)
+    double orientation = 0; //East of north (deg)
+    double pixscale = 0; //arcsec/pixel
+    double ra_center = 0, dec_center = 0; //At the image centre (deg)
+    double field_w = 0, field_h = 0; //deg
+    double crpix[2] = {0, 0}; //Reference pixel
+    double cd[2][2] = {{0, 0}, {0, 0}}; //deg/pixel
+    double log_odds = 0;
+    int num_matched = 0; //Stars matched in the verification
+    int index_id = 0; //Index that solved the field
+    double solve_ms = 0; //Wall clock time of the solve
+    int tracked = 0; //Solved from the last solution (tracking mode), without an index search
+    double rms = 0; //RMS of the matched star residuals of a tracked or pattern solve (pixels)
+    int pattern = 0; //Solved by pattern lookup (PatternDatabase.h), without an index search
+};
+
+//A field of extracted stars to solve from memory, with the settings writeANxy
+//(run_plate_solver.py) puts in the .axy header
+struct FieldStars {
+    std::vector<double> x, y; //Star positions (pixels), brightest first
+    int width = 0, height = 0; //Image size (pixels)
+    int depth = 10; //How many stars to match
+    double fov_min = 0, fov_max = 0; //Field width estimate (deg)
+    double ref_pix_x = -1, ref_pix_y = -1; //WCS reference pixel, or -1 for the image centre
+    bool use_estimate = false; //Search only within est_radius of est_ra, est_dec (deg)
+    double est_ra = 0, est_dec = 0, est_radius = 10;
+    std::string wcs_file; //Also write the WCS to this file, if set
+    std::string axy_file; //Also write the field as an .axy file, if set (for astrometry-engine)
+};
+
+//Which indexes to load, and how
+struct IndexOptions {
+    std::string manifest_file; //Made if missing or out of date. Empty to find the indexes from the config file
+    double fov_min = 0, fov_max = 0; //Field width (deg) to choose the indexes for. fov_max = 0 for all
+    bool prefault = false; //Read every chosen index into memory when loading, not on its first search
+    std::string pattern_file; //Pattern database (BuildPatterns) to try before the index search. Empty for none
+};
+
+//Tracking mode: how far the last solution is trusted, and how its stars are matched
+struct TrackingOptions {
+    bool enabled = false;
+    double drift_rate = 0; //RA drift of the field (deg/s): 0 if the mount tracks the sky, 0.0041781 (sidereal) if it is fixed
+    double max_age_s = 10; //Search the indexes if the last solution is older than this
+    double match_radius = 10; //Largest distance from a predicted star to an extracted star (pixels)
+    int max_stars = 50; //Brightest extracted stars to match
+    int min_matches = 8; //Fewest matched stars for a tracked solution
+    double max_rms = 1.5; //Largest RMS residual of a tracked solution (pixels)
+};
+
+//Pattern lookup: which field stars make the patterns, and how a match is verified
+struct PatternOptions {
+    int checking_stars = 8; //Brightest field stars to look up the patterns of (every 4 of them)
+    int verify_stars = 30; //Brightest field stars to verify a matched pattern with
+    double match_radius = 0.01; //Largest distance from a catalogue star to a field star (fraction of the field width)
+    double match_threshold = 1e-9; //Largest probability of a false match
+};
+
+//Solve times of one index config and kind of solve, over its last solves
+struct SolveTimes {
+    int count = 0; //Solves timed
+    int solved = 0; //How many of them solved
+    double p50 = 0, p90 = 0, p99 = 0, max = 0; //ms
+};
+
+//Memory use of the process from /proc/self/status (kB). The mmap'd index files count
+//in rss_file
+struct MemoryUsage {
+    long rss = 0;
+    long rss_anon = 0;
+    long rss_file = 0;
+    long rss_shmem = 0;
+};
+
+//Returns 0, or 1 if /proc/self/status can't be read
+int ReadMemoryUsage(MemoryUsage *usage);
+
+class PlateSolver {
+    public:
+        PlateSolver();
+        ~PlateSolver();
+
+        //Parse an astrometry.net config file (astrometry.cfg) and load its indexes.
+        //Returns 0, or 1 on error
+        int Init(const std::string &config_file, const IndexOptions &options = IndexOptions());
+
+        //Swap the loaded indexes for those chosen by another config file or options.
+        //The new indexes are loaded while solves carry on, and swapped in between solves.
+        //Returns 0, or 1 on error, keeping the old indexes
+        int Load(const std::string &config_file, const IndexOptions &options);
+
+        //Solve an augmented xylist (.axy) job file, as written by writeANxy. Output files
+        //named in the job (ANWCS etc) are still written. Returns 0 if the field solved,
+        //1 if it didn't and -1 on error
+        int Solve(const std::string &job_file, PlateSolution *solution);
+
+        //Solve a field held in memory, without reading or writing an .axy file. Returns
+        //as above
+        int Solve(const FieldStars &field, PlateSolution *solution);
+
+        //Solve from the last solution if tracking is enabled and it is recent enough, then
+        //by pattern lookup if there is a pattern database, and otherwise (or if the stars
+        //match neither) as Solve. Returns as Solve
+        int Track(const std::string &job_file, PlateSolution *solution);
+        int Track(const FieldStars &field, PlateSolution *solution);
+
+        //Turn tracking on or off. The last solution is forgotten
+        void SetTracking(const TrackingOptions &options);
+
+        //Forget the last solution (e.g. after a slew), so the next solve searches the indexes
+        void ResetTracking();
+
+        //Set how fields are looked up in the pattern database (IndexOptions::pattern_file)
+        void SetPatterns(const PatternOptions &options);
+
+        //Threads to split the index search between (0 for one per core)
+        void SetThreads(int num_threads);
+
+        //Solve times of each index config (the config file and field of view it was loaded
+        //with), for index searches ("search"), tracked solves ("tracked") and pattern
+        //lookups ("pattern")
+        std::map<std::string, SolveTimes> solve_times();
+
+        int num_indexes();
+
+        IndexOptions options();
+
+    private:
+        //Run a job, split between the search threads (each with its own job from new_job),
+        //fill in the solution and free the jobs. Returns as Solve
+        int RunJob(const std::function<job_t*()> &new_job, std::chrono::steady_clock::time_point start,
+                   PlateSolution *solution);
+
+        //Keep the time of a solve, for solve_times
+        void RecordTime(const PlateSolution &solution);
+
+        //Whether there is a recent enough solution to track from
+        bool Trackable(std::chrono::steady_clock::time_point now);
+
+        //Solve(field) with the lock held
+        int SolveField(const FieldStars &field, PlateSolution *solution);
+
+        //Match the field to the catalogue stars around the last solution and refit it.
+        //Returns 0 if it matched, or 1 if the index search is needed
+        int MatchLast(const FieldStars &field, std::chrono::steady_clock::time_point start,
+                      PlateSolution *solution);
+
+        //Look the field up in the pattern database. Returns 0 if it matched, or 1 if the
+        //index search is needed
+        int MatchPatterns(const FieldStars &field, std::chrono::steady_clock::time_point start,
+                          PlateSolution *solution);
+
+        //A new engine with the indexes chosen by the options, or nullptr on error
+        struct engine *NewEngine(const std::string &config_file, const IndexOptions &options);
+
+        std::mutex mutex_; //Held for each solve, and to swap the engine
+        struct engine *engine_ = nullptr;
+        IndexOptions options_;
+        TrackingOptions tracking_;
+        std::unique_ptr<TrackingState> last_; //The last solution, kept for tracking
+        std::unique_ptr<SearchPool> pool_;
+        std::unique_ptr<PatternDatabase> patterns_; //Loaded with the indexes, if the options name one
+        PatternOptions pattern_options_;
+        std::string config_name_; //The index config, as solve_times names it
+
+        std::mutex times_mutex_; //Held to add or read solve times (not for a whole solve)
+        std::map<std::string, std::deque<std::pair<double, bool>>> times_; //ms and solved, by config
+};
+
+/*
+Function to write a field as an augmented xylist (.axy) job file, as writeANxy
+(run_plate_solver.py) does, for astrometry-engine to solve
+Inputs
+    filename - .axy file to write
+    field - the stars and job settings (wcs_file is the ANWCS the engine writes)
+Output
+    0 on success, 1 on error
+*/
+int WriteJobFile(const std::string &filename, const FieldStars &field);
+
+/*
+Function to read a WCS from the primary header of a FITS file: the .wcs file
+astrometry-engine writes, or a frame with WCS keywords of its own
+Inputs
+    filename - FITS file
+    solution - the WCS, as a solve would give it
+Output
+    0 on success, 1 if the file can't be read or has no WCS
+*/
+int ReadWcsFile(const std::string &filename, PlateSolution *solution);
+
+#endif
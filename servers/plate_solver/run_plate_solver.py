@@ -73,6 +73,38 @@ def writeANxy(filename, x, y, dim, depth=10, scale_bounds = (0.,0.), ref_pix = (
     thdulist.writeto(filename+extension, overwrite=True)
 
 
+"""
+Function that solves an .axy file with the resident plate solver server (PlateSolverServer)
+
+INPUTS
+folder_prefix: prefix of the .axy file
+config: plate solver config, with "solver_port" (and "IP") of the server
+target: target Ra and Dec. With send_angles in the config, the server converts the
+        solution to angles and sends them to the robot itself (PS.solve_attitude)
+
+OUTPUTS
+The solution dictionary from PS.solve, or None if the server could not be reached
+"""
+def solve_resident(folder_prefix, config, target):
+    context = zmq.Context.instance()
+    socket = context.socket(zmq.REQ)
+    socket.setsockopt(zmq.LINGER, 0)
+    socket.RCVTIMEO = int(config.get("solver_timeout_s", 300)*1000)
+    socket.connect("tcp://%s:%s"%(config["IP"], config["solver_port"]))
+    try:
+        if config.get("send_angles", False):
+            args = [os.path.abspath(folder_prefix+".axy"), float(target[0]), float(target[1])]
+            socket.send_string("PS.solve_attitude %s"%json.dumps(args))
+        else:
+            socket.send_string("PS.solve %s"%json.dumps([os.path.abspath(folder_prefix+".axy")]))
+        solution = json.loads(socket.recv())
+    except zmq.ZMQError:
+        print("ERROR: Could not reach the plate solver server")
+        solution = None
+    socket.close()
+    return solution
+
+
 """
 Main function to run an image
 Takes a FITS image, extracts stars, solves the field and converts into Euler angles.
@@ -110,7 +142,9 @@ def run_image(img_filename,config,target,offset):
     #                                       filtsize=config["Tetra3"]["filt_size"])
 
     #Edited by Qianhui: Get a list of positions via Source Extractor instead of Tetra3
-    bkg = sep.Background(img)
+    back_size = config["SExtractor"].get("back_size", 64)
+    back_filter = config["SExtractor"].get("back_filter", 3)
+    bkg = sep.Background(img, bw=back_size, bh=back_size, fw=back_filter, fh=back_filter)
     img_sub = img - bkg
     filter_list = config["SExtractor"]["filter_kernel"]
     
@@ -146,23 +180,97 @@ def run_image(img_filename,config,target,offset):
     #remove previous results if they exist
     if (os.path.exists("%s.wcs"%folder_prefix)):
         os.remove("%s.wcs"%folder_prefix)
-    
-    #Run astrometry.net
-    os.system("./astrometry/solver/astrometry-engine %s.axy -c astrometry.cfg"%folder_prefix)
 
-    #If failed solve, return error
-    if not(os.path.exists("%s.wcs"%folder_prefix)):
+    if "solver_port" in config:
+        #Solve with the resident PlateSolverServer, which has the indexes already loaded
+        solution = solve_resident(folder_prefix, config, target)
+        if solution is None or not solution["solved"]:
+            print("DID NOT SOLVE")
+            config["Astrometry"]["estimate_position"]["flag"] = 0
+            return (0,np.array([0,0,0]))
+        print("\nRESULTS:")
+        print(solution)
+        if "az" in solution:
+            return server_angles(solution,config,start_time)
+        [RA,DEC,POS] = [solution["ra"], solution["dec"], solution["orientation"]]
+    else:
+        #Run astrometry.net
+        os.system("./astrometry/solver/astrometry-engine %s.axy -c astrometry.cfg"%folder_prefix)
+
+        #If failed solve, return error
+        if not(os.path.exists("%s.wcs"%folder_prefix)):
+            print("DID NOT SOLVE")
+            config["Astrometry"]["estimate_position"]["flag"] = 0
+            return (0,np.array([0,0,0]))
+
+        #Extract astrometry.net WCS info and print to terminal
+        print("\nRESULTS:")
+        os.system("./astrometry/util/wcsinfo %s.wcs| grep -E -w 'ra_center|dec_center|crval0|crval1|orientation|pixscale|fieldw|fieldh'"%folder_prefix)
+
+        #Extract RA, DEC and POSANGLE from astrometry.net output
+        output = sp.getoutput("./astrometry/util/wcsinfo %s.wcs| grep -E -w 'crval0|crval1|orientation'"%folder_prefix)
+        [RA,DEC,POS] = [float(s.split(" ")[1]) for s in output.splitlines()]
+    return solution_angles(RA,DEC,POS,config,target,start_time)
+
+
+"""
+Function that has the star tracker camera server extract and solve its latest frame in
+memory (its "solve" command), so that no FITS files are written or read.
+Needs [PlateSolver] solve_frames in the camera config. With send_angles in the config, the
+camera server also converts the solution to angles and sends them to the robot itself
+("solve_attitude").
+
+INPUTS:
+    camera_socket - socket of the camera server
+    config - configuration file
+    target - target Ra and Dec
+    offset - offset to reference pixel
+
+OUTPUTS:
+    Error code (1 if successful)
+    Euler angles in AltAz coordinate frame of the image
+"""
+def run_camera_frame(camera_socket,config,target,offset):
+    start_time = time.perf_counter()
+
+    est_pos = config["Astrometry"]["estimate_position"]
+    args = [float(offset[0]), float(offset[1]), int(est_pos["flag"]), float(est_pos["ra"]), float(est_pos["dec"])]
+    command = ".solve"
+    if config.get("send_angles", False):
+        command = ".solve_attitude"
+        args += [float(target[0]), float(target[1])]
+    try:
+        camera_socket.send_string(config["camera_port_name"]+command+" %s"%json.dumps(args))
+        solution = json.loads(camera_socket.recv())
+    except zmq.ZMQError:
+        print("ERROR: Could not reach the camera server")
+        solution = None
+
+    if solution is None or not solution["solved"]:
         print("DID NOT SOLVE")
         config["Astrometry"]["estimate_position"]["flag"] = 0
         return (0,np.array([0,0,0]))
-
-    #Extract astrometry.net WCS info and print to terminal
     print("\nRESULTS:")
-    os.system("./astrometry/util/wcsinfo %s.wcs| grep -E -w 'ra_center|dec_center|crval0|crval1|orientation|pixscale|fieldw|fieldh'"%folder_prefix)
+    print(solution)
+    if "az" in solution:
+        return server_angles(solution,config,start_time)
+    return solution_angles(solution["ra"],solution["dec"],solution["orientation"],config,target,start_time)
+
+
+"""
+Function to keep a solution as the next position estimate, and convert it into Euler angles
+
+INPUTS:
+    RA, DEC, POS - solved position and position angle (deg)
+    config - configuration file
+    target - target Ra and Dec
+    start_time - time the solve started (time.perf_counter)
 
-    #Extract RA, DEC and POSANGLE from astrometry.net output
-    output = sp.getoutput("./astrometry/util/wcsinfo %s.wcs| grep -E -w 'crval0|crval1|orientation'"%folder_prefix)
-    [RA,DEC,POS] = [float(s.split(" ")[1]) for s in output.splitlines()]
+OUTPUTS:
+    Error code (1 if successful)
+    Euler angles in AltAz coordinate frame of the image
+"""
+def solution_angles(RA,DEC,POS,config,target,start_time):
     print(RA,DEC)
     config["Astrometry"]["estimate_position"]["ra"] = RA
     config["Astrometry"]["estimate_position"]["dec"] = DEC
@@ -177,6 +285,32 @@ def run_image(img_filename,config,target,offset):
 
     return (1,angles)
 
+"""
+Function to keep a solution as the next position estimate, and take the Euler angles the
+solving server converted it to (solve_attitude)
+
+INPUTS:
+    solution - solution dictionary, with the angles as "az", "alt" and "pos"
+    config - configuration file
+    start_time - time the solve started (time.perf_counter)
+
+OUTPUTS:
+    Error code (1 if successful, 2 if the server has already sent the angles to the robot)
+    Euler angles in AltAz coordinate frame of the image
+"""
+def server_angles(solution,config,start_time):
+    config["Astrometry"]["estimate_position"]["ra"] = solution["ra"]
+    config["Astrometry"]["estimate_position"]["dec"] = solution["dec"]
+    config["Astrometry"]["estimate_position"]["flag"] = 1
+
+    angles = np.array([solution["az"], solution["alt"], solution["pos"]])
+    end_time = time.perf_counter()
+    print(f"\nCompleted in {end_time - start_time:0.4f} seconds")
+
+    print(f"Angles: Az={angles[0]}, Alt={angles[1]}, PosAng={angles[2]}")
+
+    return (2 if solution["sent"] else 1, angles)
+
 """
 Function to convert the tip/tilt pixel offsets into a star tracker pixel offset for the plate solver.
 Inputs:
@@ -291,6 +425,11 @@ if __name__ == "__main__":
             camera_socket.send_string(config["camera_port_name"]+".status")
             message = camera_socket.recv()
             print("Connected to camera, port %s"%config["camera_port"])
+            if config.get("camera_solve", False):
+                #Solves take longer than status requests. Let the socket be reused after a timeout
+                camera_socket.RCVTIMEO = int(config.get("solver_timeout_s", 300)*1000)
+                camera_socket.setsockopt(zmq.REQ_RELAXED, 1)
+                camera_socket.setsockopt(zmq.REQ_CORRELATE, 1)
         except:
             print('ERROR: Could not connect to camera server. Please check that the server is running and IP is correct.')
             error_flag = 1
@@ -425,43 +564,50 @@ if __name__ == "__main__":
         else:
             offset = (0,0)
         
-        camera_socket.send_string(config["camera_port_name"]+".getlatestfilename")
-    
-        #Ask camera for next image
-        message = camera_socket.recv()
-        print("Received camera message: %s" % message.decode("utf-8").strip('\"') )
+        if config.get("camera_solve", False):
+            #Have the camera server solve its latest frame in memory
+            flag,angles = run_camera_frame(camera_socket,config,target,offset)
+        else:
+            camera_socket.send_string(config["camera_port_name"]+".getlatestfilename")
 
-        # WORK ON MESSAGE -> FILENAME
-        filename = message.decode("utf-8").strip('\"') 
-        
-        if os.path.exists(str(config["path_to_data"]+"/"+filename)):
+            #Ask camera for next image
+            message = camera_socket.recv()
+            print("Received camera message: %s" % message.decode("utf-8").strip('\"') )
+
+            # WORK ON MESSAGE -> FILENAME
+            filename = message.decode("utf-8").strip('\"') 
+
+            if not os.path.exists(str(config["path_to_data"]+"/"+filename)):
+                print("Not a real file")
+                time.sleep(1)
+                continue
             print("Filename Exists. Running solver")
 
             #run image
             flag,angles = run_image(filename,config,target,offset)
 
-            if flag>0:
-
-                # WORK ON ANGLES -> return_message
-                return_message = "RC.receive_ST_angles %s,%s,%s"%(angles[0],angles[1],angles[2]) #angles
-
-                #Send reply to robot
-                print(return_message)
-                print("Delta Azimuth: {:.2f}, Delta Altitude: {:.2f}, Position Angle: {:.2f} in radians".format(angles[0], angles[1], angles[2]))
-                try:
-                    robot_control_socket.send_string(return_message) #Edited by Qianhui: moved this line here to avoid failing to send the command
-                    message = robot_control_socket.recv()
-                    print("Robot response: %s" % message)
-                except:
-                    fsm_socket.send_string(f"set_st_state {FSM_process}, RESET")
-                    # (Any connection problem will be noticed on next while loop run)
-                    print("Could not communicate with robot")
-            else:
+        if flag>1:
+            #The solving server has sent the angles to the robot itself
+            print("Delta Azimuth: {:.2f}, Delta Altitude: {:.2f}, Position Angle: {:.2f} in radians (sent by the solving server)".format(angles[0], angles[1], angles[2]))
+        elif flag>0:
+
+            # WORK ON ANGLES -> return_message
+            return_message = "RC.receive_ST_angles %s,%s,%s"%(angles[0],angles[1],angles[2]) #angles
+
+            #Send reply to robot
+            print(return_message)
+            print("Delta Azimuth: {:.2f}, Delta Altitude: {:.2f}, Position Angle: {:.2f} in radians".format(angles[0], angles[1], angles[2]))
+            try:
+                robot_control_socket.send_string(return_message) #Edited by Qianhui: moved this line here to avoid failing to send the command
+                message = robot_control_socket.recv()
+                print("Robot response: %s" % message)
+            except:
                 fsm_socket.send_string(f"set_st_state {FSM_process}, RESET")
-                print("ERROR in run_image, could not solve")
+                # (Any connection problem will be noticed on next while loop run)
+                print("Could not communicate with robot")
         else:
-            print("Not a real file")
-            time.sleep(1)
+            fsm_socket.send_string(f"set_st_state {FSM_process}, RESET")
+            print("ERROR in run_image, could not solve")
         
 #-------------
 """
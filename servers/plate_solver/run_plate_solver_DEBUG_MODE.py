@@ -75,6 +75,32 @@ def writeANxy(filename, x, y, dim, depth=10, scale_bounds = (0.,0.), ref_pix = (
     thdulist.writeto(filename+extension, overwrite=True)
 
 
+"""
+Function that solves an .axy file with the resident plate solver server (PlateSolverServer)
+
+INPUTS
+folder_prefix: prefix of the .axy file
+config: plate solver config, with "solver_port" (and "IP") of the server
+
+OUTPUTS
+The solution dictionary from PS.solve, or None if the server could not be reached
+"""
+def solve_resident(folder_prefix, config):
+    context = zmq.Context.instance()
+    socket = context.socket(zmq.REQ)
+    socket.setsockopt(zmq.LINGER, 0)
+    socket.RCVTIMEO = int(config.get("solver_timeout_s", 300)*1000)
+    socket.connect("tcp://%s:%s"%(config["IP"], config["solver_port"]))
+    try:
+        socket.send_string("PS.solve %s"%json.dumps([os.path.abspath(folder_prefix+".axy")]))
+        solution = json.loads(socket.recv())
+    except zmq.ZMQError:
+        print("ERROR: Could not reach the plate solver server")
+        solution = None
+    socket.close()
+    return solution
+
+
 """
 Main function to run an image
 Takes a FITS image, extracts stars, solves the field and converts into an AltAz
@@ -153,30 +179,41 @@ def run_image(img_filename,config,target):
     #remove previous results if they exist
     if (os.path.exists("%s.wcs"%folder_prefix)):
         os.remove("%s.wcs"%folder_prefix)
-    
-    #Run astrometry.net
-    # os.system("./astrometry/solver/astrometry-engine %s.axy -c astrometry.cfg"%folder_prefix)
-    #Edited by Qianhui: use subprocess to run astrometry-engine, so the output can be captured in log file
-    result = subprocess.run(
-            ["./astrometry/solver/astrometry-engine", f"{folder_prefix}.axy", "-c", "astrometry.cfg"],
-            stdout=subprocess.PIPE,
-            stderr=subprocess.STDOUT,
-            text=True
-        )
-    print(result.stdout) 
-
-    if not(os.path.exists("%s.wcs"%folder_prefix)):
-        print("DID NOT SOLVE")
-        config["Astrometry"]["estimate_position"]["flag"] = 0
-        return (0,np.array([0,0,0]))
 
-    #Extract astrometry.net WCS info and print to terminal
-    print("\nRESULTS:")
-    os.system("./astrometry/util/wcsinfo %s.wcs| grep -E -w 'ra_center|dec_center|crval0|crval1|orientation|pixscale|fieldw|fieldh'"%folder_prefix)
-
-    #Extract RA, DEC and POSANGLE from astrometry.net output
-    output = sp.getoutput("./astrometry/util/wcsinfo %s.wcs| grep -E -w 'crval0|crval1|orientation'"%folder_prefix)
-    [RA,DEC,POS] = [float(s.split(" ")[1]) for s in output.splitlines()]
+    if "solver_port" in config:
+        #Solve with the resident PlateSolverServer, which has the indexes already loaded
+        solution = solve_resident(folder_prefix, config)
+        if solution is None or not solution["solved"]:
+            print("DID NOT SOLVE")
+            config["Astrometry"]["estimate_position"]["flag"] = 0
+            return (0,np.array([0,0,0]))
+        print("\nRESULTS:")
+        print(solution)
+        [RA,DEC,POS] = [solution["ra"], solution["dec"], solution["orientation"]]
+    else:
+        #Run astrometry.net
+        # os.system("./astrometry/solver/astrometry-engine %s.axy -c astrometry.cfg"%folder_prefix)
+        #Edited by Qianhui: use subprocess to run astrometry-engine, so the output can be captured in log file
+        result = subprocess.run(
+                ["./astrometry/solver/astrometry-engine", f"{folder_prefix}.axy", "-c", "astrometry.cfg"],
+                stdout=subprocess.PIPE,
+                stderr=subprocess.STDOUT,
+                text=True
+            )
+        print(result.stdout) 
+
+        if not(os.path.exists("%s.wcs"%folder_prefix)):
+            print("DID NOT SOLVE")
+            config["Astrometry"]["estimate_position"]["flag"] = 0
+            return (0,np.array([0,0,0]))
+
+        #Extract astrometry.net WCS info and print to terminal
+        print("\nRESULTS:")
+        os.system("./astrometry/util/wcsinfo %s.wcs| grep -E -w 'ra_center|dec_center|crval0|crval1|orientation|pixscale|fieldw|fieldh'"%folder_prefix)
+
+        #Extract RA, DEC and POSANGLE from astrometry.net output
+        output = sp.getoutput("./astrometry/util/wcsinfo %s.wcs| grep -E -w 'crval0|crval1|orientation'"%folder_prefix)
+        [RA,DEC,POS] = [float(s.split(" ")[1]) for s in output.splitlines()]
     print(RA,DEC)
     config["Astrometry"]["estimate_position"]["ra"] = RA
     config["Astrometry"]["estimate_position"]["dec"] = DEC
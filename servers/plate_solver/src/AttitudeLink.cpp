@@ -0,0 +1,78 @@
+//AttitudeLink.cpp
+#include "AttitudeLink.h"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <unistd.h>
+#include "toml.hpp"
+
+using namespace std;
+
+int AttitudeLink::Init(const string &config_file) {
+    if (access(config_file.c_str(), R_OK) == -1) {
+        cout << "Plate solver config " << config_file << " is not readable" << endl;
+        return 1;
+    }
+    toml::table config = toml::parse_file(config_file);
+
+    // The site, defaulting to Mt Stromlo as conversion.py
+    site_.latitude = config["Site"]["latitude"].value_or(site_.latitude);
+    site_.longitude = config["Site"]["longitude"].value_or(site_.longitude);
+    site_.height = config["Site"]["height"].value_or(site_.height);
+    site_.temperature = config["Site"]["temperature"].value_or(site_.temperature);
+    site_.pressure = config["Site"]["pressure"].value_or(site_.pressure);
+    site_.dut1 = config["Site"]["dut1"].value_or(site_.dut1);
+    site_.refraction = config["Site"]["refraction"].value_or(site_.refraction);
+
+    lock_guard<mutex> lock(robot_mutex_);
+    robot_.reset();
+    if (!config["send_angles"].value_or(false)) {
+        return 0;
+    }
+    string IP = config["IP"].value_or("127.0.0.1");
+    string port = config["robot_control_port"].value_or("4100");
+    try {
+        robot_ = make_unique<commander::client::Socket>("tcp://" + IP + ":" + port);
+        // Don't hold up the solves if the robot controller is down, and let the socket be
+        // reused after a timeout
+        robot_->sock.set(zmq::sockopt::rcvtimeo, 1000);
+        robot_->sock.set(zmq::sockopt::linger, 0);
+        robot_->sock.set(zmq::sockopt::req_relaxed, 1);
+        robot_->sock.set(zmq::sockopt::req_correlate, 1);
+    } catch (const exception &e) {
+        cout << "Could not connect to the robot controller at " << IP << ":" << port << ": " << e.what() << endl;
+        robot_.reset();
+        return 1;
+    }
+    cout << "Sending star tracker angles to the robot controller at " << IP << ":" << port << endl;
+    return 0;
+}
+
+AttitudeSolution AttitudeLink::Convert(const PlateSolution &solution, double target_ra, double target_dec,
+                                       double age_s) {
+    AttitudeSolution result;
+    result.solution = solution;
+    if (!solution.solved) {
+        return result;
+    }
+    // The target's Alt/Az when the frame was taken
+    auto age = chrono::duration_cast<chrono::system_clock::duration>(chrono::duration<double>(age_s));
+    double jd = attitude::julianDate(chrono::system_clock::now() - age);
+    result.offsets = attitude::raDecOffsets(solution.ra, solution.dec, solution.orientation,
+                                            target_ra, target_dec, jd, site_);
+
+    lock_guard<mutex> lock(robot_mutex_);
+    if (robot_) {
+        try {
+            if (age_s > 0) {
+                robot_->send<nlohmann::json>("RC.receive_ST_fix", result.offsets.az, result.offsets.alt, result.offsets.pos, age_s);
+            } else {
+                robot_->send<nlohmann::json>("RC.receive_ST_angles", result.offsets.az, result.offsets.alt, result.offsets.pos);
+            }
+            result.sent = 1;
+        } catch (const exception &e) {
+            cout << "Could not send the angles to the robot controller: " << e.what() << endl;
+        }
+    }
+    return result;
+}
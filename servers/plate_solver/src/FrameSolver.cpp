@@ -0,0 +1,216 @@
+//FrameSolver.cpp
+#include "FrameSolver.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <unistd.h>
+#include "globals.h"
+#include "toml.hpp"
+#include "fitsio.h"
+
+using namespace std;
+
+// A path in the config file, taken relative to the config file's directory
+static string ConfigPath(const string &config_file, const string &path) {
+    if (path.empty() || path[0] == '/') {
+        return path;
+    }
+    size_t slash = config_file.rfind('/');
+    return slash == string::npos ? path : config_file.substr(0, slash + 1) + path;
+}
+
+int FrameSolver::Init(const string &config_file, const string &debug_prefix) {
+    if (access(config_file.c_str(), R_OK) == -1) {
+        cout << "Plate solver config " << config_file << " is not readable" << endl;
+        return 1;
+    }
+    toml::table config = toml::parse_file(config_file);
+
+    // Extraction, as run_image (run_plate_solver.py) does it with SEP
+    extract_settings_.thresh = config["SExtractor"]["thresh"].value_or(2.0);
+    extract_settings_.minarea = config["SExtractor"]["minarea"].value_or(6);
+    extract_settings_.deblend_cont = config["SExtractor"]["deblend_cont"].value_or(1.0);
+    extract_settings_.back_size = config["SExtractor"]["back_size"].value_or(64);
+    extract_settings_.back_filter = config["SExtractor"]["back_filter"].value_or(3);
+    extract_settings_.num_threads = config["SExtractor"]["threads"].value_or(0);
+    if (auto rows = config["SExtractor"]["filter_kernel"].as_array()) {
+        extract_settings_.filter_kernel.clear();
+        for (auto &row : *rows) {
+            if (auto values = row.as_array()) {
+                for (auto &v : *values) {
+                    extract_settings_.filter_kernel.push_back(v.value_or(0.0));
+                }
+            }
+        }
+    }
+
+    // The job settings writeANxy puts in the .axy header
+    field_settings_.depth = config["Astrometry"]["depth"].value_or(10);
+    field_settings_.fov_min = config["Astrometry"]["FOV_min"].value_or(0.0);
+    field_settings_.fov_max = config["Astrometry"]["FOV_max"].value_or(0.0);
+    field_settings_.ref_pix_x = config["Astrometry"]["ref_pix_x"].value_or(-1.0);
+    field_settings_.ref_pix_y = config["Astrometry"]["ref_pix_y"].value_or(-1.0);
+    field_settings_.est_radius = config["Astrometry"]["estimate_position"]["rad"].value_or(10.0);
+
+    IndexOptions options;
+    options.manifest_file = ConfigPath(config_file, config["index_manifest"].value_or(""));
+    options.prefault = config["index_prefault"].value_or(false);
+    options.pattern_file = ConfigPath(config_file, config["Patterns"]["database"].value_or(""));
+    options.fov_min = field_settings_.fov_min;
+    options.fov_max = field_settings_.fov_max;
+    string astrometry_config = ConfigPath(config_file, config["astrometry_config"].value_or("astrometry.cfg"));
+    if (solver_.Init(astrometry_config, options)) {
+        cout << "Could not start the plate solver from " << astrometry_config << endl;
+        return 1;
+    }
+
+    // Solve from the last solution where possible, as PlateSolverServer does
+    TrackingOptions tracking;
+    tracking.enabled = config["Tracking"]["enabled"].value_or(false);
+    tracking.drift_rate = config["Tracking"]["drift_rate"].value_or(0.0);
+    tracking.max_age_s = config["Tracking"]["max_age_s"].value_or(tracking.max_age_s);
+    tracking.match_radius = config["Tracking"]["match_radius"].value_or(tracking.match_radius);
+    tracking.max_stars = config["Tracking"]["max_stars"].value_or(tracking.max_stars);
+    tracking.min_matches = config["Tracking"]["min_matches"].value_or(tracking.min_matches);
+    tracking.max_rms = config["Tracking"]["max_rms"].value_or(tracking.max_rms);
+    solver_.SetTracking(tracking);
+    PatternOptions patterns;
+    patterns.checking_stars = config["Patterns"]["checking_stars"].value_or(patterns.checking_stars);
+    patterns.verify_stars = config["Patterns"]["verify_stars"].value_or(patterns.verify_stars);
+    patterns.match_radius = config["Patterns"]["match_radius"].value_or(patterns.match_radius);
+    patterns.match_threshold = config["Patterns"]["match_threshold"].value_or(patterns.match_threshold);
+    solver_.SetPatterns(patterns);
+    solver_.SetThreads(config["solver_threads"].value_or(0));
+
+    debug_prefix_ = debug_prefix;
+    ready_ = true;
+    return 0;
+}
+
+int FrameSolver::Solve(const unsigned short *frame, int width, int height, const FrameRequest &request,
+                       PlateSolution *solution) {
+    *solution = PlateSolution();
+    if (!ready_) {
+        cout << "Plate solver not initialised" << endl;
+        return -1;
+    }
+    auto start = chrono::steady_clock::now();
+    vector<extract::Source> sources;
+    if (extract::extractSources(frame, width, height, extract_settings_, &sources)) {
+        return -1;
+    }
+    auto extracted = chrono::steady_clock::now();
+    cout << "Found " << sources.size() << " sources" << endl;
+    if (sources.empty()) {
+        cout << "COULD NOT EXTRACT STARS" << endl;
+        return 1;
+    }
+
+    FieldStars field = field_settings_;
+    for (auto &s : sources) {
+        field.x.push_back(s.x);
+        field.y.push_back(s.y);
+    }
+    field.width = width;
+    field.height = height;
+    if (field.ref_pix_x >= 0 && field.ref_pix_y >= 0) {
+        field.ref_pix_x += request.ref_offset_x;
+        field.ref_pix_y += request.ref_offset_y;
+    }
+    field.use_estimate = request.use_estimate;
+    field.est_ra = request.est_ra;
+    field.est_dec = request.est_dec;
+    if (!debug_prefix_.empty()) {
+        field.wcs_file = debug_prefix_ + ".wcs";
+        field.axy_file = debug_prefix_ + ".axy";
+        WriteDebugFiles(frame, field);
+    }
+
+    int ret = solver_.Track(field, solution);
+    double extract_ms = chrono::duration<double, milli>(extracted - start).count();
+    const char *how = solution->tracked ? "tracked" : solution->pattern ? "matched a pattern" : "solved";
+    cout << "Extracted in " << extract_ms << " ms, " << how << " in " << solution->solve_ms << " ms" << endl;
+    return ret;
+}
+
+int FrameSolver::WriteDebugFiles(const unsigned short *frame, const FieldStars &field) {
+    fitsfile *fptr;
+    int status = 0;
+    long naxes[2] = {field.width, field.height};
+    // "!" to overwrite the frame of the last solve
+    string filename = "!" + debug_prefix_ + ".fits";
+    if (fits_create_file(&fptr, filename.c_str(), &status)) {
+        cout << "Could not create " << debug_prefix_ << ".fits" << endl;
+        return 1;
+    }
+    fits_create_img(fptr, USHORT_IMG, 2, naxes, &status);
+    fits_write_img(fptr, TUSHORT, 1, (long)field.width*field.height, (void *)frame, &status);
+    fits_close_file(fptr, &status);
+    if (status) {
+        cout << "Could not write " << debug_prefix_ << ".fits" << endl;
+        return 1;
+    }
+    return 0;
+}
+
+int CopyLatestFrame(vector<unsigned short> *frame, int *width, int *height) {
+    if (GLOB_CAM_STATUS != CAM_CONNECTED || GLOB_RUNNING != 1 || GLOB_RECONFIGURE || GLOB_STOPPING) {
+        return 1;
+    }
+    pthread_mutex_lock(&GLOB_LATEST_IMG_INDEX_LOCK);
+    int img_index = GLOB_LATEST_IMG_INDEX;
+    pthread_mutex_unlock(&GLOB_LATEST_IMG_INDEX_LOCK);
+
+    *width = GLOB_WIDTH;
+    *height = GLOB_IMSIZE/GLOB_WIDTH;
+    frame->resize(GLOB_IMSIZE);
+    pthread_mutex_lock(&GLOB_IMG_MUTEX_ARRAY[img_index]);
+    copy(GLOB_IMG_ARRAY + (size_t)GLOB_IMSIZE*img_index, GLOB_IMG_ARRAY + (size_t)GLOB_IMSIZE*(img_index + 1),
+         frame->begin());
+    pthread_mutex_unlock(&GLOB_IMG_MUTEX_ARRAY[img_index]);
+    return 0;
+}
+
+int CopyLatestFrames(int num_frames, vector<unsigned short> *frame, int *width, int *height, double *host_time) {
+    if (GLOB_CAM_STATUS != CAM_CONNECTED || GLOB_RUNNING != 1 || GLOB_RECONFIGURE || GLOB_STOPPING) {
+        return 0;
+    }
+    pthread_mutex_lock(&GLOB_LATEST_IMG_INDEX_LOCK);
+    int img_index = GLOB_LATEST_IMG_INDEX;
+    pthread_mutex_unlock(&GLOB_LATEST_IMG_INDEX_LOCK);
+
+    // The callback may be writing the slot after the latest, so leave it out
+    int buffersize = GLOB_CONFIG_PARAMS.buffersize;
+    num_frames = max(1, min(num_frames, buffersize - 1));
+    *width = GLOB_WIDTH;
+    *height = GLOB_IMSIZE/GLOB_WIDTH;
+    vector<unsigned int> sum(GLOB_IMSIZE, 0);
+    unsigned long first_id = 0;
+    double time_sum = 0;
+    int n = 0;
+    for (; n < num_frames; n++) {
+        int index = (img_index - n + buffersize) % buffersize;
+        pthread_mutex_lock(&GLOB_IMG_MUTEX_ARRAY[index]);
+        const frame_metadata &meta = GLOB_IMG_META[index];
+        // Stop at a gap in the frames, e.g. the start of the acquisition
+        if (n == 0) {
+            first_id = meta.frame_id;
+        } else if (meta.frame_id != first_id - n) {
+            pthread_mutex_unlock(&GLOB_IMG_MUTEX_ARRAY[index]);
+            break;
+        }
+        const unsigned short *image = GLOB_IMG_ARRAY + (size_t)GLOB_IMSIZE*index;
+        for (int i = 0; i < GLOB_IMSIZE; i++) {
+            sum[i] += image[i];
+        }
+        // Middle of the exposure, which ended when the frame arrived
+        time_sum += meta.host_time - 0.5e-6*meta.exptime;
+        pthread_mutex_unlock(&GLOB_IMG_MUTEX_ARRAY[index]);
+    }
+    frame->resize(GLOB_IMSIZE);
+    for (int i = 0; i < GLOB_IMSIZE; i++) {
+        (*frame)[i] = (sum[i] + n/2)/n;
+    }
+    *host_time = time_sum/n;
+    return n;
+}
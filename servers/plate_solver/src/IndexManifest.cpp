@@ -0,0 +1,238 @@
+//IndexManifest.cpp
+#include "IndexManifest.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+
+extern "C" {
+#include "astrometry/engine.h"
+#include "astrometry/index.h"
+}
+
+using namespace std;
+
+// Quad sizes the engine searches, as fractions of the image size (onefield.h defaults)
+const double QUAD_FRACTION_LO = DEFAULT_QSF_LO;
+const double QUAD_FRACTION_HI = DEFAULT_QSF_HI;
+
+string AbsolutePath(const string &path) {
+    char *resolved = realpath(path.c_str(), NULL);
+    if (!resolved) {
+        return path;
+    }
+    string absolute = resolved;
+    free(resolved);
+    return absolute;
+}
+
+int ParseAstrometryConfig(engine_t *engine, const string &config_file, bool find_indexes) {
+    ifstream file(config_file);
+    if (!file) {
+        cout << "Could not read the astrometry config " << config_file << endl;
+        return 1;
+    }
+    size_t slash = config_file.rfind('/');
+    string dir = slash == string::npos ? "." : config_file.substr(0, slash);
+    string text, line;
+    while (getline(file, line)) {
+        istringstream words(line);
+        string word;
+        words >> word;
+        if (!find_indexes &&
+            (word == "index" || word == "indexset" || word == "multiindex" || word == "autoindex")) {
+            continue;
+        }
+        if (word == "add_path") {
+            string path;
+            words >> path;
+            if (!path.empty() && path[0] != '/') {
+                path = dir + "/" + path;
+            }
+            line = "add_path " + AbsolutePath(path);
+        }
+        text += line + "\n";
+    }
+    FILE *stream = fmemopen((void *)text.data(), text.size(), "r");
+    if (!stream) {
+        return 1;
+    }
+    int err = engine_parse_config_file_stream(engine, stream);
+    fclose(stream);
+    if (err) {
+        cout << "Could not parse the astrometry config " << config_file << endl;
+        return 1;
+    }
+    return 0;
+}
+
+int FileStat(const string &path, long long *mtime, long long *size) {
+    struct stat st;
+    if (stat(path.c_str(), &st)) {
+        return 1;
+    }
+    *mtime = (long long)st.st_mtim.tv_sec*1000000000LL + st.st_mtim.tv_nsec;
+    *size = (long long)st.st_size;
+    return 0;
+}
+
+int IndexManifest::Scan(const string &config_file) {
+    long long size;
+    if (FileStat(config_file, &config_mtime_, &size)) {
+        cout << "Could not read the astrometry config " << config_file << endl;
+        return 1;
+    }
+    config_file_ = AbsolutePath(config_file);
+    dirs_.clear();
+    indexes_.clear();
+
+    // Not inparallel, so that the engine only reads each index's headers
+    engine_t *engine = engine_new();
+    if (ParseAstrometryConfig(engine, config_file, true)) {
+        engine_free(engine);
+        return 1;
+    }
+    for (size_t i = 0; i < sl_size(engine->index_paths); i++) {
+        string dir = sl_get(engine->index_paths, i);
+        long long mtime;
+        if (FileStat(dir, &mtime, &size) == 0) {
+            dirs_.push_back(make_pair(dir, mtime));
+        }
+    }
+    for (size_t i = 0; i < pl_size(engine->indexes); i++) {
+        index_t *index = (index_t *)pl_get(engine->indexes, i);
+        IndexEntry entry;
+        entry.path = index->indexfn;
+        if (FileStat(entry.path, &entry.mtime, &entry.size)) {
+            continue;
+        }
+        entry.index_id = index->indexid;
+        entry.healpix = index->healpix;
+        entry.hpnside = index->hpnside;
+        entry.scale_lower = index->index_scale_lower;
+        entry.scale_upper = index->index_scale_upper;
+        entry.dimquads = index->dimquads;
+        entry.nstars = index->nstars;
+        entry.nquads = index->nquads;
+        entry.circle = index->circle;
+        entry.cx_less_than_dx = index->cx_less_than_dx;
+        entry.meanx_less_than_half = index->meanx_less_than_half;
+        entry.jitter = index->index_jitter;
+        entry.cutnside = index->cutnside;
+        entry.cutnsweep = index->cutnsweep;
+        entry.cutdedup = index->cutdedup;
+        entry.cutmargin = index->cutmargin;
+        entry.cutband = index->cutband ? index->cutband : "";
+        indexes_.push_back(entry);
+    }
+    engine_free(engine);
+    return 0;
+}
+
+int IndexManifest::Read(const string &filename) {
+    ifstream file(filename);
+    if (!file) {
+        return 1;
+    }
+    config_file_.clear();
+    dirs_.clear();
+    indexes_.clear();
+    string line;
+    while (getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        istringstream words(line);
+        string kind;
+        words >> kind;
+        if (kind == "config") {
+            words >> config_file_ >> config_mtime_;
+        } else if (kind == "dir") {
+            pair<string, long long> dir;
+            words >> dir.first >> dir.second;
+            dirs_.push_back(dir);
+        } else if (kind == "index") {
+            IndexEntry e;
+            words >> e.path >> e.size >> e.mtime >> e.index_id >> e.healpix >> e.hpnside
+                  >> e.scale_lower >> e.scale_upper >> e.dimquads >> e.nstars >> e.nquads
+                  >> e.circle >> e.cx_less_than_dx >> e.meanx_less_than_half >> e.jitter
+                  >> e.cutnside >> e.cutnsweep >> e.cutdedup >> e.cutmargin >> e.cutband;
+            if (e.cutband == "-") {
+                e.cutband.clear();
+            }
+            indexes_.push_back(e);
+        } else {
+            words.setstate(ios::failbit);
+        }
+        if (words.fail()) {
+            cout << "Could not parse the index manifest line: " << line << endl;
+            return 1;
+        }
+    }
+    return config_file_.empty();
+}
+
+int IndexManifest::Write(const string &filename) const {
+    ofstream file(filename);
+    if (!file) {
+        cout << "Could not write the index manifest " << filename << endl;
+        return 1;
+    }
+    file.precision(17);
+    file << "# Index manifest, written by the plate solver. Deleting it is harmless\n";
+    file << "# index path size mtime indexid healpix hpnside scale_lower scale_upper dimquads "
+            "nstars nquads circle cx<dx meanx<half jitter cutnside cutnsweep cutdedup "
+            "cutmargin cutband\n";
+    file << "config " << config_file_ << " " << config_mtime_ << "\n";
+    for (auto &dir : dirs_) {
+        file << "dir " << dir.first << " " << dir.second << "\n";
+    }
+    for (auto &e : indexes_) {
+        file << "index " << e.path << " " << e.size << " " << e.mtime << " " << e.index_id
+             << " " << e.healpix << " " << e.hpnside << " " << e.scale_lower << " "
+             << e.scale_upper << " " << e.dimquads << " " << e.nstars << " " << e.nquads
+             << " " << e.circle << " " << e.cx_less_than_dx << " " << e.meanx_less_than_half
+             << " " << e.jitter << " " << e.cutnside << " " << e.cutnsweep << " "
+             << e.cutdedup << " " << e.cutmargin << " "
+             << (e.cutband.empty() ? "-" : e.cutband) << "\n";
+    }
+    return file.fail();
+}
+
+bool IndexManifest::Current(const string &config_file) const {
+    long long mtime, size;
+    if (AbsolutePath(config_file) != config_file_ || FileStat(config_file, &mtime, &size) ||
+        mtime != config_mtime_) {
+        return false;
+    }
+    // A directory's mtime changes when index files are added to or removed from it
+    for (auto &dir : dirs_) {
+        if (FileStat(dir.first, &mtime, &size) || mtime != dir.second) {
+            return false;
+        }
+    }
+    for (auto &e : indexes_) {
+        if (FileStat(e.path, &mtime, &size) || mtime != e.mtime || size != e.size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+vector<const IndexEntry*> IndexManifest::Select(double fov_min, double fov_max) const {
+    // The engine's range of quad sizes for a job (engine_run_job): from
+    // QUAD_FRACTION_LO of the shorter side at the smallest scale to QUAD_FRACTION_HI of
+    // the diagonal at the largest
+    double quad_lo = QUAD_FRACTION_LO*fov_min*3600/2;
+    double quad_hi = QUAD_FRACTION_HI*fov_max*3600*sqrt(2.0);
+    vector<const IndexEntry*> selected;
+    for (auto &e : indexes_) {
+        if (fov_max <= 0 || e.Overlaps(quad_lo, quad_hi)) {
+            selected.push_back(&e);
+        }
+    }
+    return selected;
+}
@@ -0,0 +1,672 @@
+//PatternDatabase.cpp
+#include "PatternDatabase.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern "C" {
+#include "astrometry/fit-wcs.h"
+#include "astrometry/healpix.h"
+#include "astrometry/mathutil.h"
+#include "astrometry/sip.h"
+#include "astrometry/starkd.h"
+#include "astrometry/starutil.h"
+}
+
+using namespace std;
+
+static const char MAGIC[8] = {'P', 'Y', 'X', 'P', 'A', 'T', 'D', 'B'};
+static const uint32_t VERSION = 2;
+// Randomises the hash of a pattern, as tetra3's _MAGIC_RAND
+static const uint64_t MAGIC_RAND = 2654435761u;
+
+// The six edges (chords) of a pattern of four unit vectors, shortest first
+static array<double, 6> PatternEdges(const double xyz[4][3]) {
+    array<double, 6> edges;
+    int e = 0;
+    for (int i = 0; i < 4; i++) {
+        for (int j = i + 1; j < 4; j++) {
+            edges[e++] = sqrt(distsq(xyz[i], xyz[j], 3));
+        }
+    }
+    sort(edges.begin(), edges.end());
+    return edges;
+}
+
+// The slot a pattern's hash code (its binned edge ratios) starts probing from
+static uint64_t HashIndex(const array<int, 5> &code, int bins, uint64_t num_slots) {
+    uint64_t key = 0;
+    for (int i = 4; i >= 0; i--) {
+        key = key*bins + code[i];
+    }
+    return key*MAGIC_RAND % num_slots;
+}
+
+// The slot of the nth probe from start. With triangular steps (0, 1, 3, 6, ...) and a power of
+// two num_slots, the first num_slots probes reach every slot once
+static uint64_t ProbeSlot(uint64_t start, uint64_t probe, uint64_t num_slots) {
+    return (start + probe*(probe + 1)/2) & (num_slots - 1);
+}
+
+// Order the four stars of a pattern by their distance from its centroid, so that the stars
+// of a field pattern and of the catalogue pattern it matches are in the same order
+static void SortByRadius(double xyz[4][3], int order[4]) {
+    double centroid[3] = {0, 0, 0};
+    for (int i = 0; i < 4; i++) {
+        for (int k = 0; k < 3; k++) {
+            centroid[k] += xyz[i][k]/4;
+        }
+    }
+    double radius[4];
+    for (int i = 0; i < 4; i++) {
+        radius[i] = distsq(xyz[i], centroid, 3);
+        order[i] = i;
+    }
+    sort(order, order + 4, [&](int a, int b) { return radius[a] < radius[b]; });
+}
+
+// Probability that at most k of n trials succeed, each with probability p
+static double BinomialCdf(int k, int n, double p) {
+    if (k >= n) {
+        return 1;
+    }
+    if (k < 0) {
+        return 0;
+    }
+    if (p <= 0) {
+        return 1;
+    }
+    if (p >= 1) {
+        return 0;
+    }
+    double sum = 0;
+    for (int i = 0; i <= k; i++) {
+        sum += exp(lgamma(n + 1) - lgamma(i + 1) - lgamma(n - i + 1) + i*log(p) + (n - i)*log1p(-p));
+    }
+    return min(sum, 1.0);
+}
+
+// Stars grouped by healpix, for finding the stars near a point while building
+class StarGrid {
+    public:
+        StarGrid(int nside) : nside_(nside), cells_(12*nside*nside) {}
+
+        void Add(int star, const double *xyz) { cells_[xyzarrtohealpix(xyz, nside_)].push_back(star); }
+
+        void Remove(int star, const double *xyz) {
+            auto &cell = cells_[xyzarrtohealpix(xyz, nside_)];
+            cell.erase(find(cell.begin(), cell.end(), star));
+        }
+
+        // The stars within radius (deg, at most the healpix size) of xyz
+        void Near(const double *xyz, double radius, const vector<CatalogueStar> &stars, vector<int> *near) {
+            near->clear();
+            int hps[9];
+            int n = healpix_get_neighbours_within_range((double *)xyz, deg2dist(radius), hps, nside_);
+            double min_dot = cos(deg2rad(radius));
+            for (int h = 0; h < n; h++) {
+                for (int s : cells_[hps[h]]) {
+                    const double *v = stars[s].xyz;
+                    if (v[0]*xyz[0] + v[1]*xyz[1] + v[2]*xyz[2] > min_dot) {
+                        near->push_back(s);
+                    }
+                }
+            }
+        }
+
+    private:
+        int nside_;
+        vector<vector<int>> cells_;
+};
+
+// The healpix nside to group the stars of a database by: each healpix three times the field
+// wide (they vary in shape), so that the stars within max_fov of a point are all in its
+// healpix and the ones next to it
+static int GridNside(double max_fov) {
+    return max(1, (int)floor(healpix_nside_for_side_length_arcmin(3*max_fov*60)));
+}
+
+PatternDatabase::~PatternDatabase() {
+    if (map_) {
+        munmap(map_, size_);
+    }
+}
+
+int PatternDatabase::Open(const string &filename, bool prefault) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd == -1) {
+        cout << "Could not open the pattern database " << filename << endl;
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(PatternFileHeader)) {
+        cout << filename << " is not a pattern database" << endl;
+        close(fd);
+        return 1;
+    }
+    size_ = st.st_size;
+    map_ = mmap(NULL, size_, PROT_READ, MAP_SHARED | (prefault ? MAP_POPULATE : 0), fd, 0);
+    close(fd);
+    if (map_ == MAP_FAILED) {
+        cout << "Could not map the pattern database " << filename << endl;
+        map_ = nullptr;
+        return 1;
+    }
+    const char *base = (const char *)map_;
+    header_ = (const PatternFileHeader *)base;
+    const PatternFileHeader &h = *header_;
+    // Each part must fit in the file, checked so that a corrupt header cannot overflow
+    auto fits = [&](uint64_t offset, uint64_t count, uint64_t item_size) {
+        return offset <= size_ && count <= (size_ - offset)/item_size;
+    };
+    uint64_t num_cells = 12*(uint64_t)h.nside*h.nside;
+    if (memcmp(h.magic, MAGIC, sizeof(MAGIC)) || h.version != VERSION || h.nside == 0 || h.nside > (1u << 20) ||
+        h.num_slots == 0 || (h.num_slots & (h.num_slots - 1)) != 0 || h.num_stars >= PatternDatabase::EMPTY_SLOT ||
+        !fits(h.stars_offset, h.num_stars, 3*sizeof(float)) ||
+        !fits(h.cells_offset, num_cells + 1, sizeof(uint32_t)) ||
+        !fits(h.slots_offset, h.num_slots, sizeof(PatternSlot))) {
+        cout << filename << " is not a pattern database (version " << VERSION << ")" << endl;
+        munmap(map_, size_);
+        map_ = nullptr;
+        return 1;
+    }
+    stars_ = (const float *)(base + h.stars_offset);
+    cells_ = (const uint32_t *)(base + h.cells_offset);
+    slots_ = (const PatternSlot *)(base + h.slots_offset);
+    cell_radius_ = healpix_side_length_arcmin(h.nside)/60/3;
+    cout << "Pattern database " << filename << ": " << h.num_stars << " stars, " << h.num_patterns
+         << " patterns for fields up to " << h.max_fov << " deg" << endl;
+    return 0;
+}
+
+void PatternDatabase::StarsNear(const double *xyz, double radius, vector<double> *star_xyz) const {
+    int nside = header_->nside;
+    int hps[9];
+    int n = 0;
+    if (radius <= cell_radius_) {
+        n = healpix_get_neighbours_within_range((double *)xyz, deg2dist(radius), hps, nside);
+    }
+    // Too wide for the neighbouring healpixes: look through every star
+    uint32_t ranges[9][2];
+    if (n <= 0) {
+        n = 1;
+        ranges[0][0] = 0;
+        ranges[0][1] = header_->num_stars;
+    } else {
+        for (int h = 0; h < n; h++) {
+            ranges[h][0] = cells_[hps[h]];
+            ranges[h][1] = min<uint64_t>(cells_[hps[h] + 1], header_->num_stars);
+        }
+    }
+    double min_dot = cos(deg2rad(radius));
+    for (int h = 0; h < n; h++) {
+        for (uint32_t s = ranges[h][0]; s < ranges[h][1]; s++) {
+            const float *v = stars_ + 3*s;
+            if (v[0]*xyz[0] + v[1]*xyz[1] + v[2]*xyz[2] > min_dot) {
+                star_xyz->insert(star_xyz->end(), {v[0], v[1], v[2]});
+            }
+        }
+    }
+}
+
+// Match the brightest field stars to the catalogue stars projected into the field by the
+// WCS, as tetra3 does: a field star matches if exactly one catalogue star is within the
+// match radius. Returns the number of catalogue stars in the field
+static int MatchStars(const tan_t &wcs, const FieldStars &field, int num_field, const vector<double> &catalogue,
+                      double radius, vector<double> *star_xyz, vector<double> *field_xy) {
+    vector<double> cat_xy;
+    for (size_t c = 0; c < catalogue.size()/3; c++) {
+        double x, y;
+        if (tan_xyzarr2pixelxy(&wcs, &catalogue[3*c], &x, &y) && x > -radius && x < field.width + radius &&
+            y > -radius && y < field.height + radius) {
+            cat_xy.push_back(x);
+            cat_xy.push_back(y);
+            cat_xy.push_back(c);
+        }
+    }
+    star_xyz->clear();
+    field_xy->clear();
+    for (int s = 0; s < num_field; s++) {
+        int num_near = 0, nearest = -1;
+        for (size_t c = 0; c < cat_xy.size(); c += 3) {
+            double dx = cat_xy[c] - field.x[s], dy = cat_xy[c + 1] - field.y[s];
+            if (dx*dx + dy*dy <= radius*radius) {
+                num_near++;
+                nearest = cat_xy[c + 2];
+            }
+        }
+        if (num_near == 1) {
+            star_xyz->insert(star_xyz->end(), &catalogue[3*nearest], &catalogue[3*nearest + 3]);
+            field_xy->push_back(field.x[s]);
+            field_xy->push_back(field.y[s]);
+        }
+    }
+    return cat_xy.size()/3;
+}
+
+int PatternDatabase::Solve(const FieldStars &field, const PatternOptions &options, PatternMatch *match) const {
+    *match = PatternMatch();
+    if (!header_) {
+        cout << "No pattern database loaded" << endl;
+        return -1;
+    }
+    const PatternFileHeader &h = *header_;
+    int num_stars = min(field.x.size(), field.y.size());
+    int num_check = min(num_stars, options.checking_stars);
+    int num_verify = min(num_stars, max(options.verify_stars, num_check));
+    if (num_check < 4 || field.width <= 0 || field.height <= 0) {
+        return 1;
+    }
+    // The range of field widths to accept, and the width to turn pixels into vectors with
+    // (the edge ratios barely depend on it)
+    double fov_min = field.fov_max > 0 ? field.fov_min : 0;
+    double fov_max = field.fov_max > 0 ? min(field.fov_max, h.max_fov) : h.max_fov;
+    if (fov_min > h.max_fov) {
+        return 1;
+    }
+    double fov_estimate = fov_min > 0 ? (fov_min + fov_max)/2 : fov_max;
+    double scale = tan(deg2rad(fov_estimate)/2)/(field.width/2.0);
+    double radius = options.match_radius*field.width;
+    double ref_pix[2] = {field.ref_pix_x < 0 ? field.width/2 + 0.5 : field.ref_pix_x,
+                         field.ref_pix_y < 0 ? field.height/2 + 0.5 : field.ref_pix_y};
+
+    // Every 4 of the brightest stars, brightest first: all patterns of the brightest n
+    // stars before any with the next star, as tetra3
+    int p[4];
+    for (p[3] = 3; p[3] < num_check; p[3]++) {
+        for (p[2] = 2; p[2] < p[3]; p[2]++) {
+            for (p[1] = 1; p[1] < p[2]; p[1]++) {
+                for (p[0] = 0; p[0] < p[1]; p[0]++) {
+                    match->patterns_tried++;
+                    // Pinhole camera vectors of the field stars
+                    double field_xyz[4][3];
+                    for (int i = 0; i < 4; i++) {
+                        double u = (field.width/2.0 - field.x[p[i]])*scale;
+                        double v = (field.height/2.0 - field.y[p[i]])*scale;
+                        double norm = sqrt(1 + u*u + v*v);
+                        field_xyz[i][0] = 1/norm;
+                        field_xyz[i][1] = u/norm;
+                        field_xyz[i][2] = v/norm;
+                    }
+                    array<double, 6> edges = PatternEdges(field_xyz);
+                    double ratios[5];
+                    for (int i = 0; i < 5; i++) {
+                        ratios[i] = edges[i]/edges[5];
+                    }
+
+                    // Every hash code within the largest error of the edge ratios
+                    int lo[5], hi[5];
+                    for (int i = 0; i < 5; i++) {
+                        lo[i] = max(0, (int)((ratios[i] - h.pattern_max_error)*h.pattern_bins));
+                        hi[i] = min((int)h.pattern_bins - 1, (int)((ratios[i] + h.pattern_max_error)*h.pattern_bins));
+                    }
+                    set<array<int, 5>> codes;
+                    array<int, 5> code;
+                    for (code[0] = lo[0]; code[0] <= hi[0]; code[0]++)
+                    for (code[1] = lo[1]; code[1] <= hi[1]; code[1]++)
+                    for (code[2] = lo[2]; code[2] <= hi[2]; code[2]++)
+                    for (code[3] = lo[3]; code[3] <= hi[3]; code[3]++)
+                    for (code[4] = lo[4]; code[4] <= hi[4]; code[4]++) {
+                        array<int, 5> sorted = code;
+                        sort(sorted.begin(), sorted.end());
+                        codes.insert(sorted);
+                    }
+
+                    for (auto &c : codes) {
+                        uint64_t start = HashIndex(c, h.pattern_bins, h.num_slots);
+                        for (uint64_t probe = 0; probe < h.num_slots; probe++) {
+                            const PatternSlot &slot = slots_[ProbeSlot(start, probe, h.num_slots)];
+                            if (slot.star[0] == EMPTY_SLOT) {
+                                break;
+                            }
+                            // Stars outside the catalogue only come from a corrupt file
+                            if (slot.star[0] >= h.num_stars || slot.star[1] >= h.num_stars ||
+                                slot.star[2] >= h.num_stars || slot.star[3] >= h.num_stars) {
+                                continue;
+                            }
+                            // The pattern's scale must fit the field width
+                            double fov = fov_estimate*slot.largest_edge/edges[5];
+                            if (fov < fov_min || fov > fov_max) {
+                                continue;
+                            }
+                            double cat_xyz[4][3];
+                            for (int i = 0; i < 4; i++) {
+                                for (int k = 0; k < 3; k++) {
+                                    cat_xyz[i][k] = stars_[3*slot.star[i] + k];
+                                }
+                            }
+                            array<double, 6> cat_edges = PatternEdges(cat_xyz);
+                            bool close = true;
+                            for (int i = 0; i < 5 && close; i++) {
+                                close = fabs(cat_edges[i]/cat_edges[5] - ratios[i]) <= h.pattern_max_error;
+                            }
+                            if (!close) {
+                                continue;
+                            }
+
+                            // Pair the stars by their distance from the pattern centroid, and
+                            // fit a WCS to the four
+                            int field_order[4], cat_order[4];
+                            SortByRadius(field_xyz, field_order);
+                            SortByRadius(cat_xyz, cat_order);
+                            double star_xyz[12], field_xy[8];
+                            for (int i = 0; i < 4; i++) {
+                                memcpy(star_xyz + 3*i, cat_xyz[cat_order[i]], 3*sizeof(double));
+                                field_xy[2*i] = field.x[p[field_order[i]]];
+                                field_xy[2*i + 1] = field.y[p[field_order[i]]];
+                            }
+                            tan_t wcs;
+                            if (fit_tan_wcs(star_xyz, field_xy, 4, &wcs, NULL)) {
+                                continue;
+                            }
+                            wcs.imagew = field.width;
+                            wcs.imageh = field.height;
+
+                            // Verify against the catalogue stars in the field
+                            double centre[3];
+                            tan_pixelxy2xyzarr(&wcs, field.width/2.0, field.height/2.0, centre);
+                            double field_radius = tan_pixel_scale(&wcs)/3600*(hypot(field.width, field.height)/2 + radius);
+                            vector<double> catalogue, matched_xyz, matched_xy;
+                            StarsNear(centre, field_radius, &catalogue);
+                            int num_catalogue = MatchStars(wcs, field, num_verify, catalogue, radius,
+                                                           &matched_xyz, &matched_xy);
+                            int num_matched = matched_xy.size()/2;
+                            // A field star lands near a catalogue star by chance with the fraction
+                            // of the field within the match radius of one. Two matches come free
+                            // with the fit of the pattern
+                            double p_single = min(1.0, num_catalogue*M_PI*radius*radius/(field.width*field.height));
+                            double prob = BinomialCdf(num_verify - (num_matched - 2), num_verify, 1 - p_single);
+                            if (num_matched < 4 || prob >= options.match_threshold) {
+                                continue;
+                            }
+
+                            // Refit to every matched star, match again with the refit WCS, and
+                            // move the reference point to the field's reference pixel
+                            for (int pass = 0; pass < 2; pass++) {
+                                tan_t fit;
+                                if (fit_tan_wcs(matched_xyz.data(), matched_xy.data(), num_matched, &fit, NULL)) {
+                                    break;
+                                }
+                                fit.imagew = field.width;
+                                fit.imageh = field.height;
+                                vector<double> xyz2, xy2;
+                                MatchStars(fit, field, num_verify, catalogue, radius, &xyz2, &xy2);
+                                if (xy2.size()/2 < (size_t)num_matched) {
+                                    break;
+                                }
+                                wcs = fit;
+                                matched_xyz.swap(xyz2);
+                                matched_xy.swap(xy2);
+                                num_matched = matched_xy.size()/2;
+                            }
+                            tan_t moved;
+                            if (fit_tan_wcs_move_tangent_point(matched_xyz.data(), matched_xy.data(), num_matched,
+                                                               ref_pix, &wcs, &moved) == 0) {
+                                wcs = moved;
+                            }
+                            double sum2 = 0;
+                            for (int m = 0; m < num_matched; m++) {
+                                double x, y;
+                                if (tan_xyzarr2pixelxy(&wcs, &matched_xyz[3*m], &x, &y)) {
+                                    sum2 += pow(x - matched_xy[2*m], 2) + pow(y - matched_xy[2*m + 1], 2);
+                                }
+                            }
+
+                            for (int i = 0; i < 2; i++) {
+                                match->crval[i] = wcs.crval[i];
+                                match->crpix[i] = wcs.crpix[i];
+                                for (int j = 0; j < 2; j++) {
+                                    match->cd[i][j] = wcs.cd[i][j];
+                                }
+                            }
+                            match->num_matched = num_matched;
+                            match->prob = prob;
+                            match->rms = sqrt(sum2/num_matched);
+                            return 0;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+int ReadIndexStars(const string &index_file, vector<CatalogueStar> *stars) {
+    startree_t *tree = startree_open(index_file.c_str());
+    if (!tree) {
+        cout << "Could not read the stars of " << index_file << endl;
+        return 1;
+    }
+    int n = startree_N(tree);
+    // Each sweep of the cut chose a star from each of its healpixes
+    int cut_nside = startree_get_cut_nside(tree);
+    double stars_per_sweep = 12.0*max(1, cut_nside)*max(1, cut_nside);
+    if (startree_get_sweep(tree, 0) < 0) {
+        cout << index_file << " has no sweep numbers: its stars are taken in the order of the file" << endl;
+    }
+    for (int i = 0; i < n; i++) {
+        CatalogueStar star;
+        startree_get(tree, i, star.xyz);
+        int sweep = startree_get_sweep(tree, i);
+        star.rank = sweep < 0 ? i : (sweep + 0.5)*stars_per_sweep;
+        stars->push_back(star);
+    }
+    startree_close(tree);
+    return 0;
+}
+
+int ReadTextCatalogue(const string &filename, vector<CatalogueStar> *stars) {
+    ifstream in(filename);
+    if (!in) {
+        cout << "Could not read " << filename << endl;
+        return 1;
+    }
+    string line;
+    int count = 0;
+    while (getline(in, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        istringstream words(line);
+        double ra, dec, mag;
+        if (!(words >> ra >> dec)) {
+            cout << "Bad line in " << filename << ": " << line << endl;
+            return 1;
+        }
+        CatalogueStar star;
+        radecdeg2xyzarr(ra, dec, star.xyz);
+        star.rank = (words >> mag) ? mag : count;
+        stars->push_back(star);
+        count++;
+    }
+    return 0;
+}
+
+int BuildPatternDatabase(vector<CatalogueStar> stars, const PatternBuildOptions &options, const string &filename) {
+    if (options.max_fov <= 0 || options.max_fov > 60 || options.pattern_stars_per_fov < 4 ||
+        options.catalogue_stars_per_fov < options.pattern_stars_per_fov || options.pattern_bins < 1 ||
+        options.pattern_bins > 50 || options.pattern_max_error <= 0) {
+        cout << "Bad pattern database options" << endl;
+        return 1;
+    }
+    auto start = chrono::steady_clock::now();
+    sort(stars.begin(), stars.end(), [](const CatalogueStar &a, const CatalogueStar &b) { return a.rank < b.rank; });
+    cout << "Read " << stars.size() << " catalogue stars" << endl;
+
+    // Keep the brightest stars in each circle of diameter max_fov for the patterns, and more
+    // of them for verifying matches, dropping any star close to a brighter one (tetra3)
+    int nside = GridNside(options.max_fov);
+    StarGrid pattern_grid(nside), verify_grid(nside);
+    vector<int> kept, pattern_stars, near;
+    double cos_sep = cos(deg2rad(options.min_separation));
+    for (size_t s = 0; s < stars.size(); s++) {
+        const double *xyz = stars[s].xyz;
+        bool is_pattern = false, is_verify = false;
+        auto no_doubles = [&](const vector<int> &ids) {
+            for (int id : ids) {
+                const double *v = stars[id].xyz;
+                if (v[0]*xyz[0] + v[1]*xyz[1] + v[2]*xyz[2] >= cos_sep) {
+                    return false;
+                }
+            }
+            return true;
+        };
+        pattern_grid.Near(xyz, options.max_fov/2, stars, &near);
+        if (no_doubles(near) && (int)near.size() < options.pattern_stars_per_fov) {
+            is_pattern = is_verify = true;
+        }
+        verify_grid.Near(xyz, options.max_fov/2, stars, &near);
+        if (no_doubles(near) && (int)near.size() < options.catalogue_stars_per_fov) {
+            is_verify = true;
+        }
+        if (is_pattern) {
+            pattern_grid.Add(s, xyz);
+            pattern_stars.push_back(s);
+        }
+        if (is_verify) {
+            verify_grid.Add(s, xyz);
+            kept.push_back(s);
+        }
+    }
+    cout << "Kept " << pattern_stars.size() << " pattern stars and " << kept.size() << " stars in all" << endl;
+
+    // Order the kept stars by healpix for the file (brightest first within each)
+    uint64_t num_cells = 12*(uint64_t)nside*nside;
+    vector<int> cell_of(stars.size(), -1);
+    for (int s : kept) {
+        cell_of[s] = xyzarrtohealpix(stars[s].xyz, nside);
+    }
+    stable_sort(kept.begin(), kept.end(), [&](int a, int b) { return cell_of[a] < cell_of[b]; });
+    vector<uint32_t> file_index(stars.size(), PatternDatabase::EMPTY_SLOT);
+    vector<uint32_t> cells(num_cells + 1, 0);
+    vector<float> star_xyz;
+    for (size_t i = 0; i < kept.size(); i++) {
+        file_index[kept[i]] = i;
+        cells[cell_of[kept[i]] + 1]++;
+        for (int k = 0; k < 3; k++) {
+            star_xyz.push_back(stars[kept[i]].xyz[k]);
+        }
+    }
+    for (uint64_t c = 0; c < num_cells; c++) {
+        cells[c + 1] += cells[c];
+    }
+
+    // Every pattern of four pattern stars within max_fov of each other, each star taking
+    // the patterns with the fainter stars around it before it is removed
+    double cos_fov = cos(deg2rad(options.max_fov));
+    auto within_fov = [&](int a, int b) {
+        const double *u = stars[a].xyz, *v = stars[b].xyz;
+        return u[0]*v[0] + u[1]*v[1] + u[2]*v[2] > cos_fov;
+    };
+    vector<array<uint32_t, 4>> patterns;
+    for (int s : pattern_stars) {
+        pattern_grid.Remove(s, stars[s].xyz);
+        pattern_grid.Near(stars[s].xyz, options.max_fov, stars, &near);
+        for (size_t i = 0; i < near.size(); i++) {
+            for (size_t j = i + 1; j < near.size(); j++) {
+                if (!within_fov(near[i], near[j])) {
+                    continue;
+                }
+                for (size_t k = j + 1; k < near.size(); k++) {
+                    if (within_fov(near[i], near[k]) && within_fov(near[j], near[k])) {
+                        patterns.push_back({file_index[s], file_index[near[i]], file_index[near[j]], file_index[near[k]]});
+                    }
+                }
+            }
+        }
+    }
+    cout << "Found " << patterns.size() << " patterns" << endl;
+    if (patterns.empty()) {
+        cout << "No patterns: too few stars for max_fov" << endl;
+        return 1;
+    }
+
+    // The hash table, at least twice the size of the patterns (tetra3), rounded up to a power
+    // of two for the triangular probing
+    uint64_t num_slots = 1;
+    while (num_slots < 2*patterns.size()) {
+        num_slots *= 2;
+    }
+    vector<PatternSlot> slots(num_slots);
+    for (auto &slot : slots) {
+        slot.star[0] = PatternDatabase::EMPTY_SLOT;
+    }
+    for (auto &pattern : patterns) {
+        double xyz[4][3];
+        for (int i = 0; i < 4; i++) {
+            for (int k = 0; k < 3; k++) {
+                xyz[i][k] = star_xyz[3*pattern[i] + k];
+            }
+        }
+        array<double, 6> edges = PatternEdges(xyz);
+        array<int, 5> code;
+        for (int i = 0; i < 5; i++) {
+            code[i] = min(options.pattern_bins - 1, (int)(edges[i]/edges[5]*options.pattern_bins));
+        }
+        uint64_t index = HashIndex(code, options.pattern_bins, num_slots);
+        uint64_t probe = 0;
+        for (; probe < num_slots; probe++) {
+            PatternSlot &slot = slots[ProbeSlot(index, probe, num_slots)];
+            if (slot.star[0] == PatternDatabase::EMPTY_SLOT) {
+                copy(pattern.begin(), pattern.end(), slot.star);
+                slot.largest_edge = edges[5];
+                break;
+            }
+        }
+        if (probe == num_slots) {
+            cout << "The pattern hash table is full" << endl;
+            return 1;
+        }
+    }
+
+    PatternFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.version = VERSION;
+    h.pattern_bins = options.pattern_bins;
+    h.nside = nside;
+    h.pattern_stars_per_fov = options.pattern_stars_per_fov;
+    h.catalogue_stars_per_fov = options.catalogue_stars_per_fov;
+    h.num_stars = kept.size();
+    h.num_patterns = patterns.size();
+    h.num_slots = num_slots;
+    h.max_fov = options.max_fov;
+    h.pattern_max_error = options.pattern_max_error;
+    h.min_separation = options.min_separation;
+    // Each part 8 byte aligned, so it can be read where it is mapped
+    auto align = [](uint64_t offset) { return (offset + 7)/8*8; };
+    h.stars_offset = align(sizeof(h));
+    h.cells_offset = align(h.stars_offset + star_xyz.size()*sizeof(float));
+    h.slots_offset = align(h.cells_offset + cells.size()*sizeof(uint32_t));
+
+    ofstream out(filename, ios::binary);
+    auto write_at = [&](uint64_t offset, const void *data, size_t size) {
+        static const char zeros[8] = {0};
+        out.write(zeros, offset - out.tellp());
+        out.write((const char *)data, size);
+    };
+    out.write((const char *)&h, sizeof(h));
+    write_at(h.stars_offset, star_xyz.data(), star_xyz.size()*sizeof(float));
+    write_at(h.cells_offset, cells.data(), cells.size()*sizeof(uint32_t));
+    write_at(h.slots_offset, slots.data(), slots.size()*sizeof(PatternSlot));
+    out.close();
+    if (!out) {
+        cout << "Could not write " << filename << endl;
+        return 1;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Wrote " << filename << " (" << (h.slots_offset + num_slots*sizeof(PatternSlot))/1048576.0
+         << " MB) in " << seconds << " s" << endl;
+    return 0;
+}
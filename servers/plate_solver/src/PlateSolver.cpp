@@ -0,0 +1,911 @@
+//PlateSolver.cpp
+#include "PlateSolver.h"
+#include "IndexManifest.h"
+#include "PatternDatabase.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+extern "C" {
+#include "astrometry/anqfits.h"
+#include "astrometry/engine.h"
+#include "astrometry/fitsbin.h"
+#include "astrometry/fit-wcs.h"
+#include "astrometry/fitsioutils.h"
+#include "astrometry/gslutils.h"
+#include "astrometry/log.h"
+#include "astrometry/matchobj.h"
+#include "astrometry/sip.h"
+#include "astrometry/sip-utils.h"
+#include "astrometry/sip_qfits.h"
+#include "astrometry/starkd.h"
+#include "astrometry/starutil.h"
+#include "astrometry/starxy.h"
+#include "astrometry/xylist.h"
+}
+
+using namespace std;
+
+// Solve times kept for each config, for the percentiles
+static const size_t NUM_SOLVE_TIMES = 1000;
+
+// The index_id of a last solution found by pattern lookup, whose catalogue stars are the
+// pattern database's
+static const int PATTERN_INDEX_ID = -1;
+
+// Best solution passed to the onefield solution callback during one job
+struct BestMatch {
+    volatile anbool *cancel = nullptr; //Set when found, to stop the other threads of a parallel search
+    bool found = false;
+    double log_odds = 0;
+    int num_matched = 0;
+    int index_id = 0;
+    sip_t sip;
+};
+
+// The last solution, as the prior of the next solve in tracking mode
+struct TrackingState {
+    bool valid = false;
+    sip_t sip;
+    int sip_order = 1; //Of the last index search, which tracked solutions are refit to when they have stars enough
+    int index_id = 0;
+    chrono::steady_clock::time_point time; //When the solved field was given to the solver
+};
+
+static void RecordSolution(const MatchObj *mo, void *userdata) {
+    BestMatch *best = (BestMatch *)userdata;
+    if (!mo->wcs_valid || (best->found && mo->logodds <= best->log_odds)) {
+        return;
+    }
+    if (mo->sip) {
+        best->sip = *mo->sip;
+    } else {
+        sip_wrap_tan(&mo->wcstan, &best->sip);
+    }
+    best->found = true;
+    best->log_odds = mo->logodds;
+    best->num_matched = mo->nmatch;
+    best->index_id = mo->indexid;
+    if (best->cancel) {
+        *best->cancel = TRUE;
+    }
+}
+
+// A pool of threads for the parallel index search, started once and kept for every solve
+class SearchPool {
+    public:
+        explicit SearchPool(int num_threads) {
+            for (int i = 0; i < num_threads; i++) {
+                threads_.emplace_back(&SearchPool::Work, this, i);
+            }
+        }
+
+        ~SearchPool() {
+            {
+                lock_guard<mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            start_.notify_all();
+            for (auto &t : threads_) {
+                t.join();
+            }
+        }
+
+        int size() const { return threads_.size(); }
+
+        // Run task(i) on thread i for i < num_tasks (at most size()), and wait for them all
+        void Run(int num_tasks, const function<void(int)> &task) {
+            unique_lock<mutex> lock(mutex_);
+            task_ = &task;
+            num_tasks_ = num_tasks;
+            remaining_ = num_tasks;
+            generation_++;
+            start_.notify_all();
+            done_.wait(lock, [this] { return remaining_ == 0; });
+            task_ = nullptr;
+        }
+
+    private:
+        void Work(int i) {
+            int generation = 0;
+            unique_lock<mutex> lock(mutex_);
+            while (true) {
+                start_.wait(lock, [&] { return stopping_ || generation_ != generation; });
+                if (stopping_) {
+                    return;
+                }
+                generation = generation_;
+                if (i >= num_tasks_) {
+                    continue;
+                }
+                const function<void(int)> *task = task_;
+                lock.unlock();
+                (*task)(i);
+                lock.lock();
+                if (--remaining_ == 0) {
+                    done_.notify_one();
+                }
+            }
+        }
+
+        vector<thread> threads_;
+        mutex mutex_;
+        condition_variable start_, done_;
+        const function<void(int)> *task_ = nullptr;
+        int num_tasks_ = 0, remaining_ = 0, generation_ = 0;
+        bool stopping_ = false;
+};
+
+int ReadMemoryUsage(MemoryUsage *usage) {
+    ifstream status("/proc/self/status");
+    if (!status) {
+        return 1;
+    }
+    string line;
+    while (getline(status, line)) {
+        istringstream words(line);
+        string key;
+        long kb = 0;
+        words >> key >> kb;
+        if (key == "VmRSS:") {
+            usage->rss = kb;
+        } else if (key == "RssAnon:") {
+            usage->rss_anon = kb;
+        } else if (key == "RssFile:") {
+            usage->rss_file = kb;
+        } else if (key == "RssShmem:") {
+            usage->rss_shmem = kb;
+        }
+    }
+    return 0;
+}
+
+static void PrintMemoryUsage(const string &when) {
+    MemoryUsage usage;
+    if (ReadMemoryUsage(&usage) == 0) {
+        cout << "Memory " << when << ": RSS " << usage.rss << " kB (anonymous " << usage.rss_anon
+             << " kB, file " << usage.rss_file << " kB, shared memory " << usage.rss_shmem
+             << " kB)" << endl;
+    }
+}
+
+// A metadata-only index_t for the engine to load when it first searches it
+static index_t *NewIndexMetadata(const IndexEntry &e) {
+    index_t *index = (index_t *)calloc(1, sizeof(index_t));
+    index->indexfn = strdup(e.path.c_str());
+    index->indexname = strdup(e.path.c_str());
+    index->indexid = e.index_id;
+    index->healpix = e.healpix;
+    index->hpnside = e.hpnside;
+    index->index_scale_lower = e.scale_lower;
+    index->index_scale_upper = e.scale_upper;
+    index->dimquads = e.dimquads;
+    index->nstars = e.nstars;
+    index->nquads = e.nquads;
+    index->circle = e.circle;
+    index->cx_less_than_dx = e.cx_less_than_dx;
+    index->meanx_less_than_half = e.meanx_less_than_half;
+    index->index_jitter = e.jitter;
+    index->cutnside = e.cutnside;
+    index->cutnsweep = e.cutnsweep;
+    index->cutdedup = e.cutdedup;
+    index->cutmargin = e.cutmargin;
+    index->cutband = e.cutband.empty() ? NULL : strdup(e.cutband.c_str());
+    return index;
+}
+
+// The cards writeANxy (run_plate_solver.py) puts in the primary header of the .axy file
+static void AddJobCards(qfits_header *hdr, const FieldStars &field) {
+    fits_header_add_int(hdr, "IMAGEW", field.width, "image width");
+    fits_header_add_int(hdr, "IMAGEH", field.height, "image height");
+    qfits_header_add(hdr, "ANRUN", "T", "Solve this field!", NULL);
+    qfits_header_add(hdr, "ANVERUNI", "T", "Uniformize field during verification", NULL);
+    qfits_header_add(hdr, "ANVERDUP", "F", "Deduplicate field during verification", NULL);
+    fits_header_add_double(hdr, "ANAPPL1", field.fov_min/field.width*3600, "scale: arcsec/pixel min");
+    fits_header_add_double(hdr, "ANAPPU1", field.fov_max/field.width*3600, "scale: arcsec/pixel max");
+    qfits_header_add(hdr, "ANTWEAK", "T", "Tweak: yes please!", NULL);
+    fits_header_add_int(hdr, "ANTWEAKO", 2, "Tweak order");
+    fits_header_add_int(hdr, "ANDPL1", 1, NULL);
+    fits_header_add_int(hdr, "ANDPU1", field.depth, NULL);
+    double ref_pix_x = field.ref_pix_x < 0 ? field.width/2 + 0.5 : field.ref_pix_x;
+    double ref_pix_y = field.ref_pix_y < 0 ? field.height/2 + 0.5 : field.ref_pix_y;
+    fits_header_add_double(hdr, "ANCRPIX1", ref_pix_x, "WCS x reference point");
+    fits_header_add_double(hdr, "ANCRPIX2", ref_pix_y, "WCS y reference point");
+    if (field.use_estimate) {
+        fits_header_add_double(hdr, "ANERA", field.est_ra, "RA center estimate (deg)");
+        fits_header_add_double(hdr, "ANEDEC", field.est_dec, "Dec center estimate (deg)");
+        fits_header_add_double(hdr, "ANERAD", field.est_radius, "Search radius from estimated posn (deg)");
+    }
+    if (!field.wcs_file.empty()) {
+        qfits_header_add(hdr, "ANWCS", field.wcs_file.c_str(), "WCS header output filename", NULL);
+    }
+}
+
+// Write the field as an .axy file that astrometry-engine can solve. Returns 0, or 1 on error
+static int WriteAxy(const string &filename, const FieldStars &field, starxy_t *xy) {
+    xylist_t *ls = xylist_open_for_writing(filename.c_str());
+    if (!ls) {
+        return 1;
+    }
+    AddJobCards(xylist_get_primary_header(ls), field);
+    int err = xylist_write_primary_header(ls) || xylist_write_header(ls) ||
+              xylist_write_field(ls, xy) || xylist_fix_header(ls);
+    return xylist_close(ls) || err;
+}
+
+// Read the stars and job settings of an .axy file, as AddJobCards writes them. Returns 0,
+// or 1 on error
+static int ReadAxy(const string &filename, FieldStars *field) {
+    if (access(filename.c_str(), R_OK) == -1) {
+        return 1;
+    }
+    xylist_t *ls = xylist_open(filename.c_str());
+    if (!ls) {
+        return 1;
+    }
+    qfits_header *hdr = xylist_get_primary_header(ls);
+    field->width = qfits_header_getint(hdr, "IMAGEW", 0);
+    field->height = qfits_header_getint(hdr, "IMAGEH", 0);
+    field->depth = qfits_header_getint(hdr, "ANDPU1", field->depth);
+    field->ref_pix_x = qfits_header_getdouble(hdr, "ANCRPIX1", -1);
+    field->ref_pix_y = qfits_header_getdouble(hdr, "ANCRPIX2", -1);
+    field->fov_min = qfits_header_getdouble(hdr, "ANAPPL1", 0)*field->width/3600;
+    field->fov_max = qfits_header_getdouble(hdr, "ANAPPU1", 0)*field->width/3600;
+    char *wcs_file = fits_get_dupstring(hdr, "ANWCS");
+    if (wcs_file) {
+        field->wcs_file = wcs_file;
+        free(wcs_file);
+    }
+    starxy_t *xy = xylist_read_field(ls, NULL);
+    xylist_close(ls);
+    if (!xy) {
+        return 1;
+    }
+    for (int i = 0; i < starxy_n(xy); i++) {
+        field->x.push_back(starxy_getx(xy, i));
+        field->y.push_back(starxy_gety(xy, i));
+    }
+    starxy_free(xy);
+    return 0;
+}
+
+// Load an index the engine has only the metadata of, as the engine does when a job first
+// searches it. Returns 0, or 1 on error
+static int LoadIndex(index_t *index) {
+    char *indexfn = index->indexfn;
+    char *indexname = index->indexname;
+    if (!index_load(indexfn, 0, index)) {
+        return 1;
+    }
+    free(indexname);
+    free(indexfn);
+    return 0;
+}
+
+// Fill in a solution from its WCS
+static void FillSolution(const sip_t *sip, PlateSolution *solution) {
+    solution->solved = 1;
+    solution->ra = sip->wcstan.crval[0];
+    solution->dec = sip->wcstan.crval[1];
+    solution->orientation = sip_get_orientation(sip);
+    solution->pixscale = sip_pixel_scale(sip);
+    sip_get_radec_center(sip, &solution->ra_center, &solution->dec_center);
+    solution->field_w = sip->wcstan.imagew*solution->pixscale/3600;
+    solution->field_h = sip->wcstan.imageh*solution->pixscale/3600;
+    for (int i = 0; i < 2; i++) {
+        solution->crpix[i] = sip->wcstan.crpix[i];
+        for (int j = 0; j < 2; j++) {
+            solution->cd[i][j] = sip->wcstan.cd[i][j];
+        }
+    }
+}
+
+PlateSolver::PlateSolver() : last_(new TrackingState()) {}
+
+PlateSolver::~PlateSolver() {
+    engine_free(engine_);
+}
+
+int PlateSolver::Init(const string &config_file, const IndexOptions &options) {
+    if (engine_) {
+        cout << "Plate solver already initialised" << endl;
+        return 1;
+    }
+    gslutils_use_error_system();
+    log_init(LOG_MSG);
+    return Load(config_file, options);
+}
+
+engine_t *PlateSolver::NewEngine(const string &config_file, const IndexOptions &options) {
+    engine_t *engine = engine_new();
+    // Load every index completely when it is first searched (rather than only its
+    // metadata, which would have each job reload the index files), and search them together
+    engine->inparallel = TRUE;
+    fitsbin_set_mmap_populate(options.prefault);
+
+    // Without a manifest or a field of view, the config file finds and loads the indexes
+    if (options.manifest_file.empty() && options.fov_max <= 0) {
+        if (ParseAstrometryConfig(engine, config_file, true)) {
+            engine_free(engine);
+            return nullptr;
+        }
+        return engine;
+    }
+
+    IndexManifest manifest;
+    if (options.manifest_file.empty() || manifest.Read(options.manifest_file) ||
+        !manifest.Current(config_file)) {
+        cout << "Scanning the indexes of " << config_file << endl;
+        if (manifest.Scan(config_file)) {
+            engine_free(engine);
+            return nullptr;
+        }
+        if (!options.manifest_file.empty() && manifest.Write(options.manifest_file) == 0) {
+            cout << "Wrote the index manifest " << options.manifest_file << endl;
+        }
+    }
+    if (ParseAstrometryConfig(engine, config_file, false)) {
+        engine_free(engine);
+        return nullptr;
+    }
+    vector<const IndexEntry*> selected = manifest.Select(options.fov_min, options.fov_max);
+    for (const IndexEntry *e : selected) {
+        int err;
+        if (options.prefault) {
+            err = engine_add_index(engine, (char *)e->path.c_str());
+        } else {
+            err = engine_add_index_metadata(engine, NewIndexMetadata(*e));
+        }
+        if (err) {
+            cout << "Could not add the index " << e->path << endl;
+        }
+    }
+    cout << "Chose " << selected.size() << " of " << manifest.indexes().size()
+         << " indexes for a " << options.fov_min << " to " << options.fov_max
+         << " deg field" << endl;
+    return engine;
+}
+
+int PlateSolver::Load(const string &config_file, const IndexOptions &options) {
+    PrintMemoryUsage("before loading the indexes");
+    auto start = chrono::steady_clock::now();
+    engine_t *engine = NewEngine(config_file, options);
+    if (!engine) {
+        return 1;
+    }
+    auto end = chrono::steady_clock::now();
+    int n = pl_size(engine->indexes);
+    cout << "Loaded " << n << " indexes from " << config_file << " in "
+         << chrono::duration<double>(end - start).count() << " s" << endl;
+    if (n == 0) {
+        cout << "No indexes found: every solve will fail" << endl;
+    }
+    unique_ptr<PatternDatabase> patterns;
+    if (!options.pattern_file.empty()) {
+        patterns.reset(new PatternDatabase());
+        if (patterns->Open(options.pattern_file, options.prefault)) {
+            engine_free(engine);
+            return 1;
+        }
+    }
+
+    ostringstream name;
+    name << config_file.substr(config_file.rfind('/') + 1);
+    if (options.fov_max > 0) {
+        name << " " << options.fov_min << "-" << options.fov_max << " deg";
+    }
+
+    // Swap between solves, and free the old indexes (unmapping them) outside the lock
+    engine_t *old_engine;
+    {
+        lock_guard<mutex> lock(mutex_);
+        old_engine = engine_;
+        engine_ = engine;
+        patterns_.swap(patterns);
+        options_ = options;
+        // The last solution may be from another camera
+        last_->valid = false;
+        config_name_ = name.str();
+    }
+    engine_free(old_engine);
+    PrintMemoryUsage("after loading the indexes");
+    return 0;
+}
+
+int PlateSolver::num_indexes() {
+    lock_guard<mutex> lock(mutex_);
+    return engine_ ? pl_size(engine_->indexes) : 0;
+}
+
+IndexOptions PlateSolver::options() {
+    lock_guard<mutex> lock(mutex_);
+    return options_;
+}
+
+void PlateSolver::SetThreads(int num_threads) {
+    if (num_threads == 0) {
+        num_threads = thread::hardware_concurrency();
+    }
+    lock_guard<mutex> lock(mutex_);
+    if (num_threads <= 1) {
+        pool_.reset();
+    } else if (!pool_ || pool_->size() != num_threads) {
+        pool_.reset(new SearchPool(num_threads));
+    }
+}
+
+void PlateSolver::RecordTime(const PlateSolution &solution) {
+    lock_guard<mutex> lock(times_mutex_);
+    auto &times = times_[config_name_ + (solution.tracked ? " tracked" : solution.pattern ? " pattern" : " search")];
+    times.emplace_back(solution.solve_ms, solution.solved);
+    if (times.size() > NUM_SOLVE_TIMES) {
+        times.pop_front();
+    }
+}
+
+map<string, SolveTimes> PlateSolver::solve_times() {
+    lock_guard<mutex> lock(times_mutex_);
+    map<string, SolveTimes> result;
+    for (auto &kv : times_) {
+        vector<double> ms;
+        SolveTimes &t = result[kv.first];
+        for (auto &time : kv.second) {
+            ms.push_back(time.first);
+            t.solved += time.second;
+        }
+        t.count = ms.size();
+        if (ms.empty()) {
+            continue;
+        }
+        sort(ms.begin(), ms.end());
+        // Nearest rank percentiles
+        auto percentile = [&](double p) { return ms[max(0, (int)ceil(p*ms.size()/100) - 1)]; };
+        t.p50 = percentile(50);
+        t.p90 = percentile(90);
+        t.p99 = percentile(99);
+        t.max = ms.back();
+    }
+    return result;
+}
+
+int PlateSolver::Solve(const string &job_file, PlateSolution *solution) {
+    *solution = PlateSolution();
+    lock_guard<mutex> lock(mutex_);
+    if (!engine_) {
+        cout << "Plate solver not initialised" << endl;
+        return -1;
+    }
+    // onefield exits the process if it can't open the field, so check here first
+    if (access(job_file.c_str(), R_OK) == -1) {
+        cout << "Job file " << job_file << " is not readable" << endl;
+        return -1;
+    }
+    auto start = chrono::steady_clock::now();
+    return RunJob([&]() {
+        job_t *job = engine_read_job_file(engine_, job_file.c_str());
+        if (!job) {
+            cout << "Could not read the job file " << job_file << endl;
+        }
+        return job;
+    }, start, solution);
+}
+
+int PlateSolver::Solve(const FieldStars &field, PlateSolution *solution) {
+    *solution = PlateSolution();
+    lock_guard<mutex> lock(mutex_);
+    if (!engine_) {
+        cout << "Plate solver not initialised" << endl;
+        return -1;
+    }
+    return SolveField(field, solution);
+}
+
+int PlateSolver::SolveField(const FieldStars &field, PlateSolution *solution) {
+    if (field.x.size() != field.y.size() || field.width <= 0 || field.height <= 0) {
+        cout << "Bad field: " << field.x.size() << " x and " << field.y.size() << " y positions, "
+             << field.width << "x" << field.height << " pixels" << endl;
+        return -1;
+    }
+    auto start = chrono::steady_clock::now();
+
+    starxy_t *xy = starxy_new(field.x.size(), FALSE, FALSE);
+    for (size_t i = 0; i < field.x.size(); i++) {
+        starxy_set(xy, i, field.x[i], field.y[i]);
+    }
+    if (!field.axy_file.empty() && WriteAxy(field.axy_file, field, xy)) {
+        cout << "Could not write " << field.axy_file << endl;
+    }
+
+    // Every job of a parallel search reads the same field (each solver takes a copy)
+    qfits_header *hdr = qfits_table_prim_header_default();
+    qfits_header_add(hdr, "AN_FILE", "XYLS", "Astrometry.net file type", NULL);
+    AddJobCards(hdr, field);
+    int ret = RunJob([&]() {
+        job_t *job = engine_read_job_header(engine_, hdr);
+        if (!job) {
+            cout << "Could not make a job for the field" << endl;
+            return job;
+        }
+        job->bp.field_xy = xy;
+        return job;
+    }, start, solution);
+    qfits_header_destroy(hdr);
+    starxy_free(xy);
+    return ret;
+}
+
+int PlateSolver::RunJob(const function<job_t*()> &new_job, chrono::steady_clock::time_point start,
+                        PlateSolution *solution) {
+    // One job per search thread, each searching every num_jobs-th index so that each has a
+    // share of every scale and part of the sky
+    int num_indexes = pl_size(engine_->indexes);
+    int num_jobs = pool_ ? max(1, min(pool_->size(), num_indexes)) : 1;
+    vector<job_t*> jobs;
+    for (int j = 0; j < num_jobs; j++) {
+        job_t *job = new_job();
+        if (!job) {
+            for (job_t *other : jobs) {
+                job_free(other);
+            }
+            return -1;
+        }
+        jobs.push_back(job);
+    }
+    double image_w = jobs[0]->bp.solver.field_maxx;
+    double image_h = jobs[0]->bp.solver.field_maxy;
+
+    volatile anbool cancel = FALSE;
+    volatile int claimed = 0;
+    vector<vector<anbool>> use_index(num_jobs, vector<anbool>(num_indexes, FALSE));
+    vector<BestMatch> found(num_jobs);
+    vector<int> err(num_jobs, 0);
+    for (int j = 0; j < num_jobs; j++) {
+        if (num_jobs > 1) {
+            for (int i = j; i < num_indexes; i += num_jobs) {
+                use_index[j][i] = TRUE;
+            }
+            jobs[j]->use_index = use_index[j].data();
+            jobs[j]->bp.solver.cancel = &cancel;
+            jobs[j]->bp.solution_claimed = &claimed;
+            found[j].cancel = &cancel;
+        }
+        jobs[j]->bp.solution_callback = RecordSolution;
+        jobs[j]->bp.solution_userdata = &found[j];
+    }
+    if (num_jobs == 1) {
+        err[0] = engine_run_job(engine_, jobs[0]);
+    } else {
+        pool_->Run(num_jobs, [&](int j) { err[j] = engine_run_job(engine_, jobs[j]); });
+    }
+    for (job_t *job : jobs) {
+        job_free(job);
+    }
+    auto end = chrono::steady_clock::now();
+    solution->solve_ms = chrono::duration<double, milli>(end - start).count();
+
+    // Only the job that claimed the field (the first to finish with a solution) reports it
+    BestMatch best;
+    for (auto &f : found) {
+        if (f.found) {
+            best = f;
+        }
+    }
+    if (!best.found && *max_element(err.begin(), err.end())) {
+        cout << "Failed to run the job" << endl;
+        return -1;
+    }
+    if (!best.found) {
+        RecordTime(*solution);
+        return 1;
+    }
+
+    sip_t *sip = &best.sip;
+    if (sip->wcstan.imagew == 0) {
+        sip->wcstan.imagew = image_w;
+        sip->wcstan.imageh = image_h;
+    }
+    FillSolution(sip, solution);
+    solution->log_odds = best.log_odds;
+    solution->num_matched = best.num_matched;
+    solution->index_id = best.index_id;
+
+    last_->valid = true;
+    last_->sip = *sip;
+    last_->sip_order = max(1, sip->a_order);
+    last_->index_id = best.index_id;
+    last_->time = start;
+    RecordTime(*solution);
+    return 0;
+}
+
+void PlateSolver::SetTracking(const TrackingOptions &options) {
+    lock_guard<mutex> lock(mutex_);
+    tracking_ = options;
+    last_->valid = false;
+}
+
+void PlateSolver::SetPatterns(const PatternOptions &options) {
+    lock_guard<mutex> lock(mutex_);
+    pattern_options_ = options;
+}
+
+void PlateSolver::ResetTracking() {
+    lock_guard<mutex> lock(mutex_);
+    last_->valid = false;
+}
+
+bool PlateSolver::Trackable(chrono::steady_clock::time_point now) {
+    return tracking_.enabled && last_->valid &&
+           chrono::duration<double>(now - last_->time).count() <= tracking_.max_age_s;
+}
+
+int PlateSolver::Track(const string &job_file, PlateSolution *solution) {
+    *solution = PlateSolution();
+    {
+        lock_guard<mutex> lock(mutex_);
+        auto start = chrono::steady_clock::now();
+        FieldStars field;
+        if (engine_ && (Trackable(start) || patterns_) && ReadAxy(job_file, &field) == 0 &&
+            ((Trackable(start) && MatchLast(field, start, solution) == 0) ||
+             (patterns_ && MatchPatterns(field, start, solution) == 0))) {
+            return 0;
+        }
+    }
+    // Searched with the job itself, so that the output files it names are written
+    return Solve(job_file, solution);
+}
+
+int PlateSolver::Track(const FieldStars &field, PlateSolution *solution) {
+    *solution = PlateSolution();
+    lock_guard<mutex> lock(mutex_);
+    if (!engine_) {
+        cout << "Plate solver not initialised" << endl;
+        return -1;
+    }
+    auto start = chrono::steady_clock::now();
+    if (Trackable(start) && MatchLast(field, start, solution) == 0) {
+        return 0;
+    }
+    if (patterns_ && MatchPatterns(field, start, solution) == 0) {
+        return 0;
+    }
+    return SolveField(field, solution);
+}
+
+int PlateSolver::MatchPatterns(const FieldStars &field, chrono::steady_clock::time_point start,
+                               PlateSolution *solution) {
+    PatternMatch match;
+    int ret = patterns_->Solve(field, pattern_options_, &match);
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    if (ret) {
+        cout << "No pattern matched (" << match.patterns_tried << " patterns tried, " << ms
+             << " ms): searching the indexes" << endl;
+        return 1;
+    }
+    tan_t tan;
+    memset(&tan, 0, sizeof(tan_t));
+    for (int i = 0; i < 2; i++) {
+        tan.crval[i] = match.crval[i];
+        tan.crpix[i] = match.crpix[i];
+        for (int j = 0; j < 2; j++) {
+            tan.cd[i][j] = match.cd[i][j];
+        }
+    }
+    tan.imagew = field.width;
+    tan.imageh = field.height;
+    sip_t sip;
+    sip_wrap_tan(&tan, &sip);
+
+    FillSolution(&sip, solution);
+    solution->num_matched = match.num_matched;
+    solution->pattern = 1;
+    solution->rms = match.rms;
+    solution->solve_ms = ms;
+    if (!field.wcs_file.empty() && sip_write_to_file(&sip, field.wcs_file.c_str())) {
+        cout << "Could not write " << field.wcs_file << endl;
+    }
+
+    // Track from it, matching the pattern database's stars
+    last_->valid = true;
+    last_->sip = sip;
+    last_->sip_order = 1;
+    last_->index_id = PATTERN_INDEX_ID;
+    last_->time = start;
+    RecordTime(*solution);
+    return 0;
+}
+
+int PlateSolver::MatchLast(const FieldStars &field, chrono::steady_clock::time_point start,
+                           PlateSolution *solution) {
+    if (field.x.size() != field.y.size() || field.width <= 0 || field.height <= 0) {
+        return 1;
+    }
+    double elapsed = chrono::duration<double>(start - last_->time).count();
+
+    // Predict the field: the sky turns about the pole, which moves the field in RA without
+    // rotating it, so only CRVAL changes. Then move the reference point to this field's
+    // reference pixel (which follows the tip/tilt offsets)
+    sip_t wcs = last_->sip;
+    wcs.wcstan.crval[0] = fmod(wcs.wcstan.crval[0] + tracking_.drift_rate*elapsed + 360, 360);
+    double ref_pix_x = field.ref_pix_x < 0 ? field.width/2 + 0.5 : field.ref_pix_x;
+    double ref_pix_y = field.ref_pix_y < 0 ? field.height/2 + 0.5 : field.ref_pix_y;
+    double ref_ra, ref_dec;
+    sip_pixelxy2radec(&wcs, ref_pix_x, ref_pix_y, &ref_ra, &ref_dec);
+    wcs.wcstan.crval[0] = ref_ra;
+    wcs.wcstan.crval[1] = ref_dec;
+    wcs.wcstan.crpix[0] = ref_pix_x;
+    wcs.wcstan.crpix[1] = ref_pix_y;
+    wcs.wcstan.imagew = field.width;
+    wcs.wcstan.imageh = field.height;
+
+    // The catalogue stars of the solving index around the predicted field, from the star
+    // kd-trees (only the healpixes near the field are searched, or loaded)
+    double centre_ra, centre_dec, centre_xyz[3];
+    sip_pixelxy2radec(&wcs, field.width/2.0, field.height/2.0, &centre_ra, &centre_dec);
+    radecdeg2xyzarr(centre_ra, centre_dec, centre_xyz);
+    double scale = sip_pixel_scale(&wcs)/3600;
+    double radius = (hypot(field.width, field.height)/2 + tracking_.match_radius)*scale;
+    vector<double> catalogue; //xyz
+    if (last_->index_id == PATTERN_INDEX_ID && patterns_) {
+        patterns_->StarsNear(centre_xyz, radius, &catalogue);
+    }
+    for (size_t i = 0; i < pl_size(engine_->indexes) && last_->index_id != PATTERN_INDEX_ID; i++) {
+        index_t *index = (index_t *)pl_get(engine_->indexes, i);
+        if (index->indexid != last_->index_id ||
+            !index_is_within_range(index, centre_ra, centre_dec, radius)) {
+            continue;
+        }
+        if (!index->starkd && LoadIndex(index)) {
+            cout << "Could not load the index " << index->indexname << endl;
+            continue;
+        }
+        double *xyz = NULL;
+        int n = 0;
+        startree_search_for(index->starkd, centre_xyz, deg2distsq(radius), &xyz, NULL, NULL, &n);
+        catalogue.insert(catalogue.end(), xyz, xyz + 3*n);
+        free(xyz);
+    }
+    int num_catalogue = catalogue.size()/3;
+    int num_field = min((int)field.x.size(), tracking_.max_stars);
+
+    // Match, fit, and match again with the refit WCS and a radius closer to its residuals
+    vector<double> star_xyz, field_xy;
+    double match_radius = tracking_.match_radius;
+    double rms = 0;
+    int num_matched = 0;
+    for (int pass = 0; pass < 3; pass++) {
+        vector<double> cat_xy(2*num_catalogue);
+        vector<char> in_field(num_catalogue);
+        for (int c = 0; c < num_catalogue; c++) {
+            double *px = &cat_xy[2*c];
+            in_field[c] = sip_xyzarr2pixelxy(&wcs, &catalogue[3*c], px, px + 1) &&
+                          px[0] > -match_radius && px[0] < field.width + match_radius &&
+                          px[1] > -match_radius && px[1] < field.height + match_radius;
+        }
+        // The nearest catalogue star to each extracted star, keeping only the nearest
+        // extracted star to each catalogue star
+        vector<int> nearest(num_field, -1);
+        vector<double> nearest_d2(num_field);
+        vector<int> matched(num_catalogue, -1);
+        for (int s = 0; s < num_field; s++) {
+            double best_d2 = match_radius*match_radius;
+            for (int c = 0; c < num_catalogue; c++) {
+                if (!in_field[c]) {
+                    continue;
+                }
+                double dx = cat_xy[2*c] - field.x[s], dy = cat_xy[2*c + 1] - field.y[s];
+                double d2 = dx*dx + dy*dy;
+                if (d2 <= best_d2) {
+                    best_d2 = d2;
+                    nearest[s] = c;
+                }
+            }
+            nearest_d2[s] = best_d2;
+            int c = nearest[s];
+            if (c >= 0 && (matched[c] < 0 || best_d2 < nearest_d2[matched[c]])) {
+                matched[c] = s;
+            }
+        }
+        star_xyz.clear();
+        field_xy.clear();
+        for (int c = 0; c < num_catalogue; c++) {
+            if (matched[c] >= 0) {
+                star_xyz.insert(star_xyz.end(), &catalogue[3*c], &catalogue[3*c + 3]);
+                field_xy.push_back(field.x[matched[c]]);
+                field_xy.push_back(field.y[matched[c]]);
+            }
+        }
+        num_matched = field_xy.size()/2;
+        if (num_matched < tracking_.min_matches) {
+            break;
+        }
+
+        // Refit the distortion of the last solution if there are stars enough for it,
+        // keeping the reference pixel
+        int order = last_->sip_order;
+        if (num_matched < 3*(order + 1)*(order + 2)/2) {
+            order = 1;
+        }
+        sip_t fit;
+        if (fit_sip_wcs(star_xyz.data(), field_xy.data(), NULL, num_matched, &wcs.wcstan, order, order + 1,
+                        TRUE, &fit)) {
+            num_matched = 0;
+            break;
+        }
+        wcs = fit;
+
+        double sum_d2 = 0;
+        for (int m = 0; m < num_matched; m++) {
+            double x, y;
+            if (sip_xyzarr2pixelxy(&wcs, &star_xyz[3*m], &x, &y)) {
+                sum_d2 += pow(x - field_xy[2*m], 2) + pow(y - field_xy[2*m + 1], 2);
+            }
+        }
+        rms = sqrt(sum_d2/num_matched);
+        match_radius = min(tracking_.match_radius, max(3*rms, 2*tracking_.max_rms));
+    }
+
+    auto end = chrono::steady_clock::now();
+    double ms = chrono::duration<double, milli>(end - start).count();
+    if (num_matched < tracking_.min_matches || rms > tracking_.max_rms) {
+        cout << "Tracking failed (" << num_matched << " of " << num_catalogue << " catalogue stars near the field matched, RMS "
+             << rms << " pixels, " << ms << " ms): searching the indexes" << endl;
+        return 1;
+    }
+
+    FillSolution(&wcs, solution);
+    solution->num_matched = num_matched;
+    solution->index_id = last_->index_id == PATTERN_INDEX_ID ? 0 : last_->index_id;
+    solution->tracked = 1;
+    solution->rms = rms;
+    solution->solve_ms = ms;
+    if (!field.wcs_file.empty() && sip_write_to_file(&wcs, field.wcs_file.c_str())) {
+        cout << "Could not write " << field.wcs_file << endl;
+    }
+
+    last_->sip = wcs;
+    last_->time = start;
+    RecordTime(*solution);
+    return 0;
+}
+
+int WriteJobFile(const string &filename, const FieldStars &field) {
+    if (field.x.size() != field.y.size()) {
+        return 1;
+    }
+    starxy_t *xy = starxy_new(field.x.size(), FALSE, FALSE);
+    for (size_t i = 0; i < field.x.size(); i++) {
+        starxy_set(xy, i, field.x[i], field.y[i]);
+    }
+    int ret = WriteAxy(filename, field, xy);
+    starxy_free(xy);
+    return ret;
+}
+
+int ReadWcsFile(const string &filename, PlateSolution *solution) {
+    *solution = PlateSolution();
+    if (access(filename.c_str(), R_OK) == -1) {
+        return 1;
+    }
+    qfits_header *hdr = anqfits_get_header2(filename.c_str(), 0);
+    if (!hdr) {
+        return 1;
+    }
+    // sip_read_header logs an error for a header without a WCS, so check for one first
+    sip_t sip;
+    int ret = 1;
+    if (qfits_header_getstr(hdr, "CTYPE1") && sip_read_header(hdr, &sip)) {
+        FillSolution(&sip, solution);
+        ret = 0;
+    }
+    qfits_header_destroy(hdr);
+    return ret;
+}
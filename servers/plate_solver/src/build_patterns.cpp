@@ -0,0 +1,81 @@
+/*
+Builds a pattern database (PatternDatabase.h) for the plate solver's pattern lookup, from
+the stars of astrometry.net index files or a text catalogue, for fields up to a given
+width. Build one for each camera's field of view, and name it in the [Patterns] table of
+that camera's plate solver config.
+
+Usage:
+    BuildPatterns --fov-max 8 --out patterns_coarse.db ../index_files/index-50*.fits
+    BuildPatterns --fov-max 8 --out patterns_coarse.db --catalogue hip_main.txt (ra dec mag lines)
+        --pattern-stars 10 --catalogue-stars 20 (in each circle of diameter fov-max)
+        --min-separation 0.05 (deg) --max-error 0.005 --bins 25
+*/
+
+#include "PatternDatabase.h"
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <string>
+
+extern "C" {
+#include "astrometry/gslutils.h"
+#include "astrometry/log.h"
+}
+
+namespace po = boost::program_options;
+using namespace std;
+
+int main(int argc, char* argv[]) {
+
+    vector<string> index_files;
+    string catalogue, out_file;
+    PatternBuildOptions options;
+
+    po::options_description desc("Pattern database options");
+    desc.add_options()
+        ("help,h", "Print this message")
+        ("index", po::value<vector<string>>(&index_files), "astrometry.net index files to take the stars of")
+        ("catalogue", po::value<string>(&catalogue), "Text catalogue of ra dec [mag] lines (deg), instead of index files")
+        ("out", po::value<string>(&out_file)->required(), "Database file to write")
+        ("fov-max", po::value<double>(&options.max_fov)->required(), "Widest field to solve (deg)")
+        ("pattern-stars", po::value<int>(&options.pattern_stars_per_fov)->default_value(options.pattern_stars_per_fov),
+         "Stars to make patterns of, in each circle of diameter fov-max")
+        ("catalogue-stars", po::value<int>(&options.catalogue_stars_per_fov)->default_value(options.catalogue_stars_per_fov),
+         "Stars to verify matches with, in each circle of diameter fov-max")
+        ("min-separation", po::value<double>(&options.min_separation)->default_value(options.min_separation),
+         "Drop stars this close to a brighter one (deg)")
+        ("max-error", po::value<double>(&options.pattern_max_error)->default_value(options.pattern_max_error),
+         "Largest edge ratio error of a match")
+        ("bins", po::value<int>(&options.pattern_bins)->default_value(options.pattern_bins), "Hash bins of each edge ratio");
+    po::positional_options_description pos;
+    pos.add("index", -1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(pos).run(), vm);
+        if (vm.count("help")) {
+            cout << desc << endl;
+            return 0;
+        }
+        po::notify(vm);
+    } catch (const std::exception& e) {
+        cerr << e.what() << endl << desc << endl;
+        return 1;
+    }
+    if (index_files.empty() == catalogue.empty()) {
+        cerr << "Give either index files or a catalogue" << endl << desc << endl;
+        return 1;
+    }
+
+    gslutils_use_error_system();
+    log_init(LOG_MSG);
+    vector<CatalogueStar> stars;
+    if (!catalogue.empty() && ReadTextCatalogue(catalogue, &stars)) {
+        return 1;
+    }
+    for (auto &index_file : index_files) {
+        if (ReadIndexStars(index_file, &stars)) {
+            return 1;
+        }
+    }
+    return BuildPatternDatabase(stars, options, out_file);
+}
@@ -0,0 +1,264 @@
+#include <commander/commander.h>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <unistd.h>
+#include "toml.hpp"
+#include "PlateSolver.h"
+#include "PlateSolutionJson.h"
+#include "AttitudeLink.h"
+
+namespace co = commander;
+using namespace std;
+
+// The resident astrometry.net engine, with its indexes loaded once in main
+PlateSolver GLOB_PLATE_SOLVER;
+
+//config_file
+char* GLOB_CONFIGFILE = (char*)"./";
+
+// The astrometry.net config file the loaded indexes came from
+string GLOB_ASTROMETRY_CONFIG;
+
+// Converts solutions to offsets from the target, and sends them to the robot controller
+AttitudeLink GLOB_ATTITUDE_LINK;
+
+// Read the index options from a plate solver config file: the manifest and prefault
+// settings, the field of view the jobs will ask for (indexes with quads outside it
+// are never searched, so aren't loaded) and the pattern database built for it
+IndexOptions ReadIndexOptions(toml::table &config) {
+    IndexOptions options;
+    options.manifest_file = config["index_manifest"].value_or("");
+    options.prefault = config["index_prefault"].value_or(false);
+    options.pattern_file = config["Patterns"]["database"].value_or("");
+    options.fov_min = config["Astrometry"]["FOV_min"].value_or(0.0);
+    options.fov_max = config["Astrometry"]["FOV_max"].value_or(0.0);
+    return options;
+}
+
+// Read the tracking options from the [Tracking] section of a plate solver config file
+TrackingOptions ReadTrackingOptions(toml::table &config) {
+    TrackingOptions options;
+    options.enabled = config["Tracking"]["enabled"].value_or(false);
+    options.drift_rate = config["Tracking"]["drift_rate"].value_or(0.0);
+    options.max_age_s = config["Tracking"]["max_age_s"].value_or(options.max_age_s);
+    options.match_radius = config["Tracking"]["match_radius"].value_or(options.match_radius);
+    options.max_stars = config["Tracking"]["max_stars"].value_or(options.max_stars);
+    options.min_matches = config["Tracking"]["min_matches"].value_or(options.min_matches);
+    options.max_rms = config["Tracking"]["max_rms"].value_or(options.max_rms);
+    return options;
+}
+
+// Read the pattern lookup options from the [Patterns] section of a plate solver config file
+PatternOptions ReadPatternOptions(toml::table &config) {
+    PatternOptions options;
+    options.checking_stars = config["Patterns"]["checking_stars"].value_or(options.checking_stars);
+    options.verify_stars = config["Patterns"]["verify_stars"].value_or(options.verify_stars);
+    options.match_radius = config["Patterns"]["match_radius"].value_or(options.match_radius);
+    options.match_threshold = config["Patterns"]["match_threshold"].value_or(options.match_threshold);
+    return options;
+}
+
+// Plate solver server definition
+struct PlateSolverServer {
+
+    PlateSolverServer()
+    {
+        fmt::print("PlateSolverServer\n");
+    }
+
+    ~PlateSolverServer()
+    {
+        fmt::print("~PlateSolverServer\n");
+    }
+
+    /*
+    Function to plate solve a field, from the last solution if tracking is enabled (falling
+    back to the pattern database if one is loaded, then to searching the indexes)
+    Inputs:
+        job_file - augmented xylist (.axy) of the field, as written by writeANxy
+    Output:
+        The WCS solution (solved = 0 if the field did not solve)
+    */
+    PlateSolution solve(string job_file){
+        PlateSolution solution;
+        int ret = GLOB_PLATE_SOLVER.Track(job_file, &solution);
+        if (ret == 0) {
+            const char *how = solution.tracked ? "Tracked " : solution.pattern ? "Matched a pattern for " : "Solved ";
+            cout << how << job_file << " in " << solution.solve_ms
+                 << " ms: RA " << solution.ra << ", Dec " << solution.dec << ", orientation "
+                 << solution.orientation << endl;
+        } else if (ret > 0) {
+            cout << "Did not solve " << job_file << " (" << solution.solve_ms << " ms)" << endl;
+        }
+        return solution;
+    }
+
+    /*
+    Function to plate solve a field as solve does, and convert the solution to the azimuth,
+    altitude and position angle offsets to a target (as conversion.diffRaDec2AltAz). If
+    send_angles is set, the offsets are sent straight to the robot controller
+    Inputs:
+        job_file - augmented xylist (.axy) of the field
+        target_ra, target_dec - target position (deg)
+    Output:
+        The WCS solution, with the offsets (radians) and whether they were sent
+    */
+    AttitudeSolution solve_attitude(string job_file, double target_ra, double target_dec){
+        AttitudeSolution result = GLOB_ATTITUDE_LINK.Convert(solve(job_file), target_ra, target_dec);
+        if (result.solution.solved) {
+            cout << "Angles: Az=" << result.offsets.az << ", Alt=" << result.offsets.alt << ", PosAng="
+                 << result.offsets.pos << (result.sent ? " (sent to the robot)" : "") << endl;
+        }
+        return result;
+    }
+
+    /*
+    Function to swap the loaded indexes for those of another camera config (e.g.
+    astrometry_coarse.toml or astrometry_fine.toml), without restarting the server
+    Inputs:
+        config_file - plate solver config file, with its field of view under [Astrometry]
+                      and optionally its own astrometry_config
+    */
+    string load_fov_config(string config_file){
+        string ret_msg;
+        if (access(config_file.c_str(), R_OK) == -1) {
+            ret_msg = "Config file " + config_file + " is not readable";
+            return ret_msg;
+        }
+        toml::table config;
+        try {
+            config = toml::parse_file(config_file);
+        } catch (const toml::parse_error &err) {
+            ret_msg = "Could not parse " + config_file + ": " + string(err.description());
+            return ret_msg;
+        }
+        // Keep the manifest and prefault settings the server was started with, but take
+        // the pattern database built for this field of view (if any)
+        IndexOptions options = GLOB_PLATE_SOLVER.options();
+        IndexOptions fov_options = ReadIndexOptions(config);
+        options.fov_min = fov_options.fov_min;
+        options.fov_max = fov_options.fov_max;
+        options.pattern_file = fov_options.pattern_file;
+        string astrometry_config = config["astrometry_config"].value_or(GLOB_ASTROMETRY_CONFIG);
+        if (GLOB_PLATE_SOLVER.Load(astrometry_config, options)) {
+            ret_msg = "Could not load the indexes for " + config_file + ": keeping the old indexes";
+            return ret_msg;
+        }
+        GLOB_ASTROMETRY_CONFIG = astrometry_config;
+        ret_msg = "Loaded " + to_string(GLOB_PLATE_SOLVER.num_indexes()) + " indexes for " + config_file;
+        return ret_msg;
+    }
+
+    /*
+    Function to forget the last solution (e.g. after a slew), so the next field is found by
+    searching the indexes
+    */
+    string reset_tracking(){
+        GLOB_PLATE_SOLVER.ResetTracking();
+        return "Tracking reset";
+    }
+
+    /*
+    Function to get the solve time percentiles (ms) of each index config the server has
+    solved with, for index searches, pattern matches and tracked solves, over the last 1000 of each
+    */
+    map<string, SolveTimes> solve_times(){
+        return GLOB_PLATE_SOLVER.solve_times();
+    }
+
+    /*
+    Function to check if the server is alive!
+    */
+    string status(){
+        string ret_msg;
+        MemoryUsage usage;
+        ReadMemoryUsage(&usage);
+        ret_msg = "Server Running with " + to_string(GLOB_PLATE_SOLVER.num_indexes()) + " indexes loaded, RSS "
+                  + to_string(usage.rss) + " kB (" + to_string(usage.rss_file) + " kB file backed)";
+        return ret_msg;
+    }
+
+};
+
+
+// Register with commander
+COMMANDER_REGISTER(m)
+{
+    m.instance<PlateSolverServer>("PS")
+        .def("solve", &PlateSolverServer::solve, "Plate solve an .axy job file [filename]")
+        .def("solve_attitude", &PlateSolverServer::solve_attitude, "Plate solve an .axy job file and send the offsets to a target to the robot [filename, target ra, target dec]")
+        .def("load_fov_config", &PlateSolverServer::load_fov_config, "Swap to the indexes for another config's field of view [filename]")
+        .def("reset_tracking", &PlateSolverServer::reset_tracking, "Forget the last solution, so the next solve searches the indexes")
+        .def("solve_times", &PlateSolverServer::solve_times, "Solve time percentiles (ms) of each index config")
+        .def("status", &PlateSolverServer::status, "Check status");
+}
+
+// Main server function. Accepts one parameter: link to the plate solver config file.
+int main(int argc, char* argv[]) {
+
+    // Print application build information
+    cout << "Application build date: " << __DATE__ << " " << __TIME__ << endl << endl;
+
+    string config_file;
+
+    // Check if config file path is passed as argument
+    if (argc > 2) {
+        cout << "Too many arguments!" << endl;
+        exit(1);
+    } else if (argc < 2){
+        // Load default config if nothing is passed
+        cout << "No CONFIG file loaded" << endl;
+        cout << "Will attempt to load default CONFIG" << endl;
+        config_file = string("Sinistra_astrometry.toml");
+    } else {
+        // Assign config file value as string
+        config_file = string(argv[1]);
+    }
+
+    // Check whether config file is readable/exists
+    if (access(config_file.c_str(), R_OK) == -1) {
+        cerr << "Config file is not readable" << endl;
+        exit(0);
+    }
+
+    // Parse the configuration file
+    toml::table config = toml::parse_file(config_file);
+
+    // Set config file path as a global variable
+    GLOB_CONFIGFILE = (char*)config_file.c_str();
+
+    // Load the indexes once, before taking any requests
+    GLOB_ASTROMETRY_CONFIG = config["astrometry_config"].value_or("astrometry.cfg");
+    if (GLOB_PLATE_SOLVER.Init(GLOB_ASTROMETRY_CONFIG, ReadIndexOptions(config))) {
+        cerr << "Could not start the astrometry engine" << endl;
+        exit(1);
+    }
+    GLOB_PLATE_SOLVER.SetTracking(ReadTrackingOptions(config));
+    GLOB_PLATE_SOLVER.SetPatterns(ReadPatternOptions(config));
+    // Split the index search between threads (0 for one per core)
+    GLOB_PLATE_SOLVER.SetThreads(config["solver_threads"].value_or(0));
+    // The site, and the robot controller to send the offsets of solve_attitude to
+    GLOB_ATTITUDE_LINK.Init(config_file);
+
+    // Retrieve port and IP
+    string port = config["solver_port"].value_or("4107");
+    string IP = config["IP"].value_or("192.168.1.4");
+
+    // Turn into a TCPString
+    string TCPString = "tcp://" + IP + ":" + port;
+    char TCPCharArr[TCPString.length() + 1];
+    strcpy(TCPCharArr, TCPString.c_str());
+
+    // Argc/Argv to turn into the required server input
+    argc = 3;
+    char* argv_new[3];
+    argv_new[1] = (char*)"--socket";
+    argv_new[2] = TCPCharArr;
+
+    // Start server!
+    co::Server s(argc, argv_new);
+
+    s.run();
+}
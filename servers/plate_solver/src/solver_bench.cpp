@@ -0,0 +1,534 @@
+/*
+Benchmark of the plate solver on a corpus of saved star tracker frames, and the
+regression gate for solver performance work.
+
+Walks the given directories for FITS frames (and cubes), extracts the sources of each frame
+with the [SExtractor] settings of a plate solver config, and solves the field by each path:
+    engine   - writes an .axy file and runs astrometry-engine on it, as run_image does
+               without a resident server (the indexes are loaded on every solve)
+    resident - PlateSolver::Solve, with the indexes loaded once (PlateSolverServer)
+    hinted   - as resident, searching only within [Astrometry] estimate_position rad of
+               the known solution (as run_image does once it has solved a field)
+    tracking - PlateSolver::Track with [Tracking] enabled, solving each frame from the last
+               (the frames are solved in name order; frames that can't be tracked are
+               searched for)
+    pattern  - the pattern database alone (PatternDatabase::Solve)
+
+The known solution of frame f of name.fits is read from name_f.wcs or name.wcs beside it
+(as astrometry-engine writes them), or else the WCS keywords of the frame's own header.
+The boresight (field centre) and roll errors of each solution are measured against it, and
+a solution more than --max-error from it counts as a false solve.
+
+The success rate, false solves, extraction and solve time percentiles and attitude errors
+of each path are printed, and can be written as JSON (--json). Given the JSON of an earlier
+run (--baseline), the run fails (exit code 2) if any path solves fewer frames, gives more
+false solves, or is slower or less accurate by more than --tolerance.
+
+Usage:
+    SolverBench --config ../Dextra_astrometry.toml frames/ [more frames or directories]
+        --paths engine,resident,hinted,tracking,pattern (those available, by default)
+        --database patterns_coarse.db (else [Patterns] database in the config)
+        --engine ../astrometry/solver/astrometry-engine
+        --max-error 60 (arcsec)
+        --json results.json --baseline baseline.json --tolerance 0.2
+*/
+
+#include "PatternDatabase.h"
+#include "PlateSolver.h"
+#include "extract.hpp"
+#include "replay.h"
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <nlohmann/json.hpp>
+#include "toml.hpp"
+
+extern "C" {
+#include "astrometry/sip.h"
+#include "astrometry/sip-utils.h"
+#include "astrometry/starutil.h"
+}
+
+namespace po = boost::program_options;
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+using namespace std;
+
+// The ways a frame is solved
+enum SolvePath {ENGINE, RESIDENT, HINTED, TRACKING, PATTERN, NUM_PATHS};
+static const char *PATH_NAMES[NUM_PATHS] = {"engine", "resident", "hinted", "tracking", "pattern"};
+
+// The results of one path over the corpus
+struct PathResults {
+    bool enabled = false;
+    int frames = 0; //Frames solved by this path
+    int solved = 0;
+    int known = 0; //Solved frames with a known solution
+    int false_solves = 0; //Solved more than max_error from the known solution
+    int tracked = 0; //Solved from the last solution
+    LatencyHistogram solve_ms;
+    vector<double> boresight_err, roll_err; //arcsec, of the correct solves with known solutions
+};
+
+// A frame of the corpus
+struct Frame {
+    string file, name;
+    long index;
+    bool known;
+    PlateSolution truth;
+};
+
+// A path in the config file, taken relative to the config file's directory
+static string ConfigPath(const string &config_file, const string &path) {
+    if (path.empty() || path[0] == '/') {
+        return path;
+    }
+    size_t slash = config_file.rfind('/');
+    return slash == string::npos ? path : config_file.substr(0, slash + 1) + path;
+}
+
+// The FITS files under each path (or the path itself, if it is a file), in name order
+static vector<string> FindFrames(const vector<string> &paths) {
+    vector<string> files;
+    for (auto &path : paths) {
+        if (!fs::is_directory(path)) {
+            files.push_back(path);
+            continue;
+        }
+        for (auto &entry : fs::recursive_directory_iterator(path)) {
+            string ext = entry.path().extension().string();
+            string stem = entry.path().stem().string();
+            // Skip the destriped copies run_image writes
+            if (entry.is_regular_file() && (ext == ".fits" || ext == ".fit") &&
+                (stem.size() < 4 || stem.compare(stem.size() - 4, 4, "_tmp") != 0)) {
+                files.push_back(entry.path().string());
+            }
+        }
+    }
+    sort(files.begin(), files.end());
+    return files;
+}
+
+// The known solution of a frame: name_<frame>.wcs, name.wcs, or the frame's own WCS
+static bool ReadTruth(const string &fits_file, long index, PlateSolution *truth) {
+    fs::path path(fits_file);
+    string base = (path.parent_path()/path.stem()).string();
+    return ReadWcsFile(base + "_" + to_string(index) + ".wcs", truth) == 0 ||
+           ReadWcsFile(base + ".wcs", truth) == 0 || ReadWcsFile(fits_file, truth) == 0;
+}
+
+// Boresight and roll differences between a solution and the known one (arcsec)
+static void AttitudeError(const PlateSolution &solution, const PlateSolution &truth, double *boresight,
+                          double *roll) {
+    *boresight = arcsec_between_radecdeg(solution.ra_center, solution.dec_center, truth.ra_center,
+                                         truth.dec_center);
+    *roll = fabs(fmod(solution.orientation - truth.orientation + 540.0, 360.0) - 180.0)*3600;
+}
+
+// The value at fraction p of sorted values (nearest rank), or 0 if there are none
+static double Percentile(vector<double> values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+    sort(values.begin(), values.end());
+    size_t rank = (size_t)ceil(p*values.size());
+    return values[min(values.size() - 1, rank > 0 ? rank - 1 : 0)];
+}
+
+// The summary of a path's results, as written to --json and compared with --baseline
+static json Summary(const PathResults &r) {
+    json j = {{"frames", r.frames}, {"solved", r.solved}, {"known", r.known},
+              {"false_solves", r.false_solves}, {"tracked", r.tracked},
+              {"success_rate", r.frames ? (double)r.solved/r.frames : 0.0}};
+    if (r.solve_ms.count()) {
+        j["p50_ms"] = r.solve_ms.percentile(0.5);
+        j["p90_ms"] = r.solve_ms.percentile(0.9);
+        j["p99_ms"] = r.solve_ms.percentile(0.99);
+        j["mean_ms"] = r.solve_ms.mean();
+    }
+    if (!r.boresight_err.empty()) {
+        j["boresight_p50"] = Percentile(r.boresight_err, 0.5);
+        j["boresight_p90"] = Percentile(r.boresight_err, 0.9);
+        j["roll_p50"] = Percentile(r.roll_err, 0.5);
+        j["roll_p90"] = Percentile(r.roll_err, 0.9);
+    }
+    return j;
+}
+
+/*
+Function to compare a run with a baseline run
+Inputs
+    results - summaries of this run, by path
+    baseline - summaries of the baseline run, by path
+    tolerance - fractional slowdown or loss of accuracy allowed
+Output
+    Number of regressions (each is printed)
+*/
+static int CompareBaseline(const json &results, const json &baseline, double tolerance) {
+    int regressions = 0;
+    auto report = [&](const string &path, const string &what, double base, double now) {
+        cout << "REGRESSION " << path << " " << what << ": " << base << " -> " << now << endl;
+        regressions++;
+    };
+    for (auto &[path, base] : baseline.items()) {
+        if (!results.contains(path)) {
+            continue;
+        }
+        const json &now = results[path];
+        if (now["success_rate"].get<double>() < base["success_rate"].get<double>() - 1e-9) {
+            report(path, "success rate", base["success_rate"], now["success_rate"]);
+        }
+        if (now["false_solves"].get<int>() > base["false_solves"].get<int>()) {
+            report(path, "false solves", base["false_solves"], now["false_solves"]);
+        }
+        // Latency and accuracy, with a floor so that timer noise on fast paths isn't flagged
+        for (auto &[key, floor] : {pair<string, double>{"p50_ms", 0.5}, {"p90_ms", 0.5},
+                                   {"boresight_p50", 1.0}, {"roll_p50", 5.0}}) {
+            if (base.contains(key) && now.contains(key) &&
+                now[key].get<double>() > base[key].get<double>()*(1 + tolerance) + floor) {
+                report(path, key, base[key], now[key]);
+            }
+        }
+    }
+    return regressions;
+}
+
+int main(int argc, char* argv[]) {
+
+    vector<string> inputs;
+    string config_file, database, engine, paths, json_file, baseline_file, work_dir;
+    double max_error, tolerance;
+
+    po::options_description desc("Solver benchmark options");
+    desc.add_options()
+        ("help,h", "Print this message")
+        ("frames", po::value<vector<string>>(&inputs)->required(), "FITS frames, or directories of them")
+        ("config", po::value<string>(&config_file)->required(), "Plate solver config (e.g. Dextra_astrometry.toml)")
+        ("paths", po::value<string>(&paths)->default_value("engine,resident,hinted,tracking,pattern"),
+         "Ways to solve each frame, comma separated")
+        ("database", po::value<string>(&database), "Pattern database (else [Patterns] database in the config)")
+        ("engine", po::value<string>(&engine)->default_value("../astrometry/solver/astrometry-engine"),
+         "astrometry-engine binary")
+        ("work-dir", po::value<string>(&work_dir), "Directory for the engine's .axy and .wcs files (else a temporary one)")
+        ("max-error", po::value<double>(&max_error)->default_value(60), "Largest boresight error of a correct solve (arcsec)")
+        ("json", po::value<string>(&json_file), "Write the results to this file")
+        ("baseline", po::value<string>(&baseline_file), "Results of an earlier run to compare with")
+        ("tolerance", po::value<double>(&tolerance)->default_value(0.2), "Fractional slowdown allowed against the baseline");
+    po::positional_options_description pos;
+    pos.add("frames", -1);
+
+    po::variables_map vm;
+    try {
+        po::store(po::command_line_parser(argc, argv).options(desc).positional(pos).run(), vm);
+        if (vm.count("help")) {
+            cout << desc << endl;
+            return 0;
+        }
+        po::notify(vm);
+    } catch (const std::exception& e) {
+        cerr << e.what() << endl << desc << endl;
+        return 1;
+    }
+
+    toml::table config;
+    try {
+        config = toml::parse_file(config_file);
+    } catch (const toml::parse_error &err) {
+        cerr << "Could not parse " << config_file << ": " << err.description() << endl;
+        return 1;
+    }
+
+    // Extraction and field settings, as FrameSolver reads them
+    extract::Settings settings;
+    settings.thresh = config["SExtractor"]["thresh"].value_or(2.0);
+    settings.minarea = config["SExtractor"]["minarea"].value_or(6);
+    settings.deblend_cont = config["SExtractor"]["deblend_cont"].value_or(1.0);
+    settings.back_size = config["SExtractor"]["back_size"].value_or(64);
+    settings.back_filter = config["SExtractor"]["back_filter"].value_or(3);
+    settings.num_threads = config["SExtractor"]["threads"].value_or(0);
+    if (auto rows = config["SExtractor"]["filter_kernel"].as_array()) {
+        settings.filter_kernel.clear();
+        for (auto &row : *rows) {
+            if (auto values = row.as_array()) {
+                for (auto &v : *values) {
+                    settings.filter_kernel.push_back(v.value_or(0.0));
+                }
+            }
+        }
+    }
+    FieldStars field_settings;
+    field_settings.depth = config["Astrometry"]["depth"].value_or(10);
+    field_settings.fov_min = config["Astrometry"]["FOV_min"].value_or(0.0);
+    field_settings.fov_max = config["Astrometry"]["FOV_max"].value_or(0.0);
+    field_settings.ref_pix_x = config["Astrometry"]["ref_pix_x"].value_or(-1.0);
+    field_settings.ref_pix_y = config["Astrometry"]["ref_pix_y"].value_or(-1.0);
+    field_settings.est_radius = config["Astrometry"]["estimate_position"]["rad"].value_or(10.0);
+
+    PathResults results[NUM_PATHS];
+    stringstream ss(paths);
+    string path_name;
+    while (getline(ss, path_name, ',')) {
+        auto name = find(PATH_NAMES, PATH_NAMES + NUM_PATHS, path_name);
+        if (name == PATH_NAMES + NUM_PATHS) {
+            cerr << "Unknown path " << path_name << endl << desc << endl;
+            return 1;
+        }
+        results[name - PATH_NAMES].enabled = true;
+    }
+
+    // astrometry-engine, reading the same astrometry.cfg as the resident engine
+    string astrometry_config = ConfigPath(config_file, config["astrometry_config"].value_or("astrometry.cfg"));
+    if (results[ENGINE].enabled && access(engine.c_str(), X_OK) == -1) {
+        cout << "No astrometry-engine at " << engine << ": skipping the engine path" << endl;
+        results[ENGINE].enabled = false;
+    }
+    if (results[ENGINE].enabled) {
+        if (work_dir.empty()) {
+            work_dir = (fs::temp_directory_path()/("solver_bench_" + to_string(getpid()))).string();
+        }
+        fs::create_directories(work_dir);
+        work_dir = fs::absolute(work_dir).string();
+    }
+
+    PatternOptions pattern_options;
+    pattern_options.checking_stars = config["Patterns"]["checking_stars"].value_or(pattern_options.checking_stars);
+    pattern_options.verify_stars = config["Patterns"]["verify_stars"].value_or(pattern_options.verify_stars);
+    pattern_options.match_radius = config["Patterns"]["match_radius"].value_or(pattern_options.match_radius);
+    pattern_options.match_threshold = config["Patterns"]["match_threshold"].value_or(pattern_options.match_threshold);
+    if (database.empty()) {
+        database = ConfigPath(config_file, config["Patterns"]["database"].value_or(""));
+    }
+    PatternDatabase patterns;
+    if (results[PATTERN].enabled && (database.empty() || patterns.Open(database, true))) {
+        cout << "No pattern database: skipping the pattern path" << endl;
+        results[PATTERN].enabled = false;
+    }
+
+    // The index search alone (no pattern database), and a second solver to track with so
+    // that the other paths' solutions don't seed it
+    IndexOptions options;
+    options.manifest_file = ConfigPath(config_file, config["index_manifest"].value_or(""));
+    options.fov_min = field_settings.fov_min;
+    options.fov_max = field_settings.fov_max;
+    int num_threads = config["solver_threads"].value_or(0);
+    PlateSolver solver, tracker;
+    if (results[RESIDENT].enabled || results[HINTED].enabled) {
+        if (solver.Init(astrometry_config, options)) {
+            cerr << "Could not start the plate solver from " << astrometry_config << endl;
+            return 1;
+        }
+        solver.SetThreads(num_threads);
+    }
+    if (results[TRACKING].enabled) {
+        if (tracker.Init(astrometry_config, options)) {
+            cerr << "Could not start the plate solver from " << astrometry_config << endl;
+            return 1;
+        }
+        tracker.SetThreads(num_threads);
+        TrackingOptions tracking;
+        tracking.enabled = true;
+        tracking.drift_rate = config["Tracking"]["drift_rate"].value_or(0.0);
+        tracking.max_age_s = config["Tracking"]["max_age_s"].value_or(tracking.max_age_s);
+        tracking.match_radius = config["Tracking"]["match_radius"].value_or(tracking.match_radius);
+        tracking.max_stars = config["Tracking"]["max_stars"].value_or(tracking.max_stars);
+        tracking.min_matches = config["Tracking"]["min_matches"].value_or(tracking.min_matches);
+        tracking.max_rms = config["Tracking"]["max_rms"].value_or(tracking.max_rms);
+        tracker.SetTracking(tracking);
+    }
+
+    LatencyHistogram extract_ms;
+    int num_frames = 0, num_known = 0;
+    for (auto &fits_file : FindFrames(inputs)) {
+        vector<unsigned short> data;
+        long width, height, cube_frames;
+        int exptime_us;
+        if (readFITSCube(fits_file, data, width, height, cube_frames, exptime_us)) {
+            continue;
+        }
+        for (long f = 0; f < cube_frames; f++) {
+            Frame frame;
+            frame.file = fits_file;
+            frame.index = f;
+            frame.name = fs::path(fits_file).stem().string() + (cube_frames > 1 ? "[" + to_string(f) + "]" : "");
+            frame.known = ReadTruth(fits_file, f, &frame.truth);
+            num_frames++;
+            num_known += frame.known;
+
+            const unsigned short *pixels = data.data() + (size_t)width*height*f;
+            vector<extract::Source> sources;
+            auto start = chrono::steady_clock::now();
+            int ret = extract::extractSources(pixels, width, height, settings, &sources);
+            auto end = chrono::steady_clock::now();
+            extract_ms.add(chrono::duration<double, milli>(end - start).count());
+            // The solvers log as they go, so the frame's results are printed together at the end
+            ostringstream line;
+            line << frame.name << ": " << sources.size() << " sources";
+            if (ret || sources.empty()) {
+                cout << line.str() << ", COULD NOT EXTRACT STARS" << endl;
+                for (int p = 0; p < NUM_PATHS; p++) {
+                    results[p].frames += results[p].enabled && (p != HINTED || frame.known);
+                }
+                continue;
+            }
+            FieldStars field = field_settings;
+            for (auto &s : sources) {
+                field.x.push_back(s.x);
+                field.y.push_back(s.y);
+            }
+            field.width = width;
+            field.height = height;
+
+            for (int p = 0; p < NUM_PATHS; p++) {
+                PathResults &r = results[p];
+                if (!r.enabled) {
+                    continue;
+                }
+                PlateSolution solution;
+                int solved = 1;
+                start = chrono::steady_clock::now();
+                if (p == ENGINE) {
+                    string axy_file = work_dir + "/bench.axy";
+                    FieldStars job = field;
+                    job.wcs_file = work_dir + "/bench.wcs";
+                    remove(job.wcs_file.c_str());
+                    string cmd = engine + " " + axy_file + " -c " + astrometry_config + " > /dev/null 2>&1";
+                    if (WriteJobFile(axy_file, job) == 0 && system(cmd.c_str()) == 0 &&
+                        ReadWcsFile(job.wcs_file, &solution) == 0) {
+                        solved = 0;
+                    }
+                } else if (p == RESIDENT) {
+                    solved = solver.Solve(field, &solution);
+                } else if (p == HINTED) {
+                    // Only frames with a known solution have a hint to search around
+                    if (!frame.known) {
+                        continue;
+                    }
+                    FieldStars hinted = field;
+                    hinted.use_estimate = true;
+                    hinted.est_ra = frame.truth.ra_center;
+                    hinted.est_dec = frame.truth.dec_center;
+                    solved = solver.Solve(hinted, &solution);
+                } else if (p == TRACKING) {
+                    solved = tracker.Track(field, &solution);
+                } else if (p == PATTERN) {
+                    PatternMatch match;
+                    solved = patterns.Solve(field, pattern_options, &match);
+                    if (solved == 0) {
+                        tan_t tan;
+                        memset(&tan, 0, sizeof(tan_t));
+                        for (int i = 0; i < 2; i++) {
+                            tan.crval[i] = match.crval[i];
+                            tan.crpix[i] = match.crpix[i];
+                            for (int j = 0; j < 2; j++) {
+                                tan.cd[i][j] = match.cd[i][j];
+                            }
+                        }
+                        tan.imagew = width;
+                        tan.imageh = height;
+                        solution.solved = 1;
+                        tan_get_radec_center(&tan, &solution.ra_center, &solution.dec_center);
+                        solution.orientation = tan_get_orientation(&tan);
+                        solution.pattern = 1;
+                    }
+                }
+                end = chrono::steady_clock::now();
+                double ms = chrono::duration<double, milli>(end - start).count();
+                r.frames++;
+                r.solve_ms.add(ms);
+                line << ", " << PATH_NAMES[p] << " ";
+                if (solved != 0) {
+                    line << "unsolved (" << fixed << setprecision(1) << ms << " ms)" << defaultfloat;
+                    continue;
+                }
+                r.solved++;
+                r.tracked += solution.tracked;
+                line << fixed << setprecision(1) << ms << " ms" << defaultfloat;
+                if (frame.known) {
+                    double boresight, roll;
+                    AttitudeError(solution, frame.truth, &boresight, &roll);
+                    r.known++;
+                    if (boresight > max_error) {
+                        r.false_solves++;
+                        line << " FALSE (" << boresight << " arcsec off)";
+                    } else {
+                        r.boresight_err.push_back(boresight);
+                        r.roll_err.push_back(roll);
+                        line << " (" << setprecision(3) << boresight << "\")" << defaultfloat;
+                    }
+                }
+            }
+            cout << line.str() << endl;
+        }
+    }
+    if (results[ENGINE].enabled && vm.count("work-dir") == 0) {
+        fs::remove_all(work_dir);
+    }
+    if (num_frames == 0) {
+        cout << "No frames read" << endl;
+        return 1;
+    }
+
+    cout << endl << num_frames << " frames (" << num_known << " with known solutions), extraction p50 "
+         << extract_ms.percentile(0.5) << " ms, p90 " << extract_ms.percentile(0.9) << " ms" << endl;
+    cout << left << setw(10) << "path" << right << setw(10) << "solved" << setw(8) << "false" << setw(10)
+         << "p50 ms" << setw(10) << "p90 ms" << setw(10) << "p99 ms" << setw(14) << "boresight\""
+         << setw(10) << "roll\"" << endl;
+    json summaries;
+    summaries["extract"] = {{"p50_ms", extract_ms.percentile(0.5)}, {"p90_ms", extract_ms.percentile(0.9)}};
+    json path_summaries;
+    for (int p = 0; p < NUM_PATHS; p++) {
+        PathResults &r = results[p];
+        if (!r.enabled) {
+            continue;
+        }
+        json j = Summary(r);
+        path_summaries[PATH_NAMES[p]] = j;
+        cout << left << setw(10) << PATH_NAMES[p] << right << setw(10)
+             << (to_string(r.solved) + "/" + to_string(r.frames)) << setw(8) << r.false_solves << fixed
+             << setprecision(1) << setw(10) << j.value("p50_ms", 0.0) << setw(10) << j.value("p90_ms", 0.0)
+             << setw(10) << j.value("p99_ms", 0.0) << setprecision(2) << setw(14)
+             << j.value("boresight_p50", 0.0) << setw(10) << j.value("roll_p50", 0.0) << defaultfloat;
+        if (p == TRACKING) {
+            cout << "  (" << r.tracked << " tracked)";
+        }
+        cout << endl;
+    }
+    summaries["paths"] = path_summaries;
+
+    if (!json_file.empty()) {
+        ofstream out(json_file);
+        out << setw(4) << summaries << endl;
+        if (!out) {
+            cerr << "Could not write " << json_file << endl;
+            return 1;
+        }
+    }
+    if (!baseline_file.empty()) {
+        json baseline;
+        try {
+            ifstream in(baseline_file);
+            in >> baseline;
+        } catch (const json::exception &e) {
+            cerr << "Could not read " << baseline_file << ": " << e.what() << endl;
+            return 1;
+        }
+        int regressions = CompareBaseline(path_summaries, baseline["paths"], tolerance);
+        if (regressions) {
+            cout << regressions << " regressions against " << baseline_file << endl;
+            return 2;
+        }
+        cout << "No regressions against " << baseline_file << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,116 @@
+//AttitudeEstimator.h
+//Fusion of the star tracker measurements into one pointing estimate for the tracking
+//loop, updated every tick. It combines three inputs:
+//  - plate solve fixes: absolute, at a low rate;
+//  - fine star tracker centroids: at the camera rate, but relative to a centroid target
+//    pixel, so offset from the fixes by an unknown bias;
+//  - the robot's own motion, from its step counts, every tick.
+//
+//A Kalman filter on each of azimuth and altitude keeps three states:
+//    e - pointing error, target minus current (arcsec), as RC.receive_ST_angles gives it
+//    r - drift of the error (arcsec/s), e.g. the target moving in Alt/Az
+//    c - centroid bias (arcsec): a centroid measures e + c
+//The steps move e every tick, a fix measures e, and a centroid measures e + c. Between
+//fixes the centroids keep e up to date, and each fix recalibrates c.
+//
+//A measurement describes the sky age_s before it arrives (exposure and solve time). The
+//robot's motion since then, read from a ring of the step history, is subtracted from it.
+//A fix that disagrees with the estimate by more than the gate restarts the estimate from
+//the fix, as after a slew; a centroid that disagrees is dropped.
+//
+//Everything is fixed size, so nothing allocates in the robot loop.
+#ifndef ATTITUDE_ESTIMATOR_H_INCLUDE_GUARD
+#define ATTITUDE_ESTIMATOR_H_INCLUDE_GUARD
+
+#include <Eigen/Dense>
+
+//Ticks of robot motion kept to take off late measurements (4 s at 1 kHz). Older
+//measurements are dropped
+#define ATTITUDE_HISTORY 4096
+
+//Noise and gating of the estimator, read from the [Fusion] table of the toml file
+struct AttitudeNoise {
+    double fix_sigma = 5.0; //Plate solve fix (arcsec)
+    double centroid_sigma = 1.0; //Fine star tracker centroid (arcsec)
+    double error_walk = 1.0; //Robot motion the steps miss, e.g. wheel slip (arcsec/sqrt(s))
+    double drift_walk = 0.1; //Change in the drift (arcsec/s/sqrt(s))
+    double bias_walk = 0.2; //Change in the centroid bias, e.g. field rotation (arcsec/sqrt(s))
+    double drift_sigma = 15.0; //Drift before any fix (arcsec/s): up to the sidereal rate
+    double bias_sigma = 60.0; //Centroid bias before any fix (arcsec)
+    double gate = 5.0; //Measurements further than this many sigma from the estimate are outliers
+    double max_age_s = 2.0; //Measurements older than this are dropped
+};
+
+//The estimate of one axis, for the status
+struct AttitudeAxisState {
+    double error = 0; //e (arcsec)
+    double drift = 0; //r (arcsec/s)
+    double bias = 0; //c (arcsec)
+    double error_sigma = 0; //Standard deviation of e (arcsec)
+    double bias_sigma = 0; //Standard deviation of c (arcsec)
+};
+
+class AttitudeEstimator {
+    public:
+        void Configure(const AttitudeNoise &noise);
+
+        //Forget everything, e.g. when fusion is switched on
+        void Reset();
+
+        //Advance to t_ns, given the robot motion (arcsec of azimuth and altitude, in the
+        //sense of the error) since the last call. Called once per tick
+        void Predict(long long t_ns, double d_az, double d_alt);
+
+        //A plate solve fix of the error (arcsec), measured age_s before t_ns. Returns 0,
+        //1 if it (re)started the estimate, or -1 if it was older than max_age_s or than
+        //the motion history
+        int Fix(long long t_ns, double az, double alt, double pos_angle, double age_s);
+
+        //A centroid of the error plus the centroid bias (arcsec), measured age_s before
+        //t_ns. Returns 0, or -1 if it was older than max_age_s or than the motion history,
+        //or an outlier
+        int Centroid(long long t_ns, double az, double alt, double age_s);
+
+        bool initialised() const { return initialised_; }
+        double az() const { return az_.x(0); }
+        double alt() const { return alt_.x(0); }
+        double pos_angle() const { return pos_angle_; }
+        AttitudeAxisState az_state() const { return az_.State(); }
+        AttitudeAxisState alt_state() const { return alt_.State(); }
+        int fixes() const { return fixes_; }
+        int centroids() const { return centroids_; }
+        int rejected() const { return rejected_; }
+        int restarts() const { return restarts_; }
+
+    private:
+        struct Axis {
+            Eigen::Vector3d x;
+            Eigen::Matrix3d P;
+
+            //Start the error at e, with variance e_var and covariance ec_cov with the bias
+            void Start(double e, double e_var, double ec_cov, const AttitudeNoise &noise);
+            void Predict(double dt, double motion, const AttitudeNoise &noise);
+            //The innovation of a measurement z of h.x with variance R, in sigma
+            double Sigma(const Eigen::RowVector3d &h, double z, double R) const;
+            void Update(const Eigen::RowVector3d &h, double z, double R);
+            AttitudeAxisState State() const;
+        };
+
+        //Robot motion (arcsec) since t_ns. Returns 1 if t_ns is older than the history
+        int MotionSince(long long t_ns, double *d_az, double *d_alt) const;
+
+        AttitudeNoise noise_;
+        Axis az_, alt_;
+        bool initialised_ = false;
+        long long t_ns_ = 0;
+        double pos_angle_ = 0;
+        int fixes_ = 0, centroids_ = 0, rejected_ = 0, restarts_ = 0;
+
+        //Ring of the cumulative motion at each tick
+        long long history_ns_[ATTITUDE_HISTORY];
+        double history_az_[ATTITUDE_HISTORY], history_alt_[ATTITUDE_HISTORY];
+        int history_next_ = 0, history_count_ = 0;
+        double total_az_ = 0, total_alt_ = 0;
+};
+
+#endif
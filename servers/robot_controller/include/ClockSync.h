@@ -0,0 +1,58 @@
+//ClockSync.h
+#ifndef CLOCK_SYNC_H_INCLUDE_GUARD
+#define CLOCK_SYNC_H_INCLUDE_GUARD
+
+#include <stdint.h>
+#include <vector>
+
+//Maps the Teensy micros() counter onto the host monotonic clock (ns).
+//
+//Each Snapshot gives a pair (firmware time when the response was written, host
+//time when its frame was read). The difference is the clock offset plus a USB
+//delay that is never negative but often much larger than its minimum, so the
+//offset and drift are fitted to the lower envelope of the pairs: the window of
+//recent pairs is split into blocks, and a line is fitted through the smallest
+//difference of each block. A pair's delay above that line is its excess latency,
+//which shows up the USB spikes.
+class ClockSync {
+    public:
+        //window: pairs kept for the fit; blocks: blocks the window is split into
+        ClockSync(int window = 1000, int blocks = 10);
+
+        //Add a pair. The Teensy counter wraps every 71 minutes, which is unwrapped here
+        void AddPair(uint32_t teensy_us, int64_t host_ns);
+
+        //Host time of a Teensy time near the recent pairs
+        int64_t ToHostNs(uint32_t teensy_us) const;
+
+        bool valid() const { return count_ > 0; }
+        double drift_ppm() const { return drift_ * 1e3; }   //Rate the host clock gains on the Teensy
+        double latency_us() const { return latency_ns_ * 1e-3; } //Excess latency of the last pair
+        double latency_max_us() const;                       //... and the largest in the window
+
+    private:
+        struct Pair {
+            int64_t teensy_us; //Unwrapped
+            int64_t delay_ns;  //host_ns - 1000*teensy_us
+        };
+        std::vector<Pair> pairs_; //Ring of the last window_ pairs
+        int window_, blocks_;
+        long count_ = 0;
+
+        uint32_t last_raw_us_ = 0;
+        int64_t last_us_ = 0;
+
+        //Fit: delay_ns = offset_ns_ + drift_ * (teensy_us - ref_us_)
+        int64_t ref_us_ = 0;
+        double offset_ns_ = 0;
+        double drift_ = 0; //ns per us
+        double latency_ns_ = 0;
+
+        int64_t Unwrap(uint32_t teensy_us) const;
+        void Fit();
+        double FitDelay(int64_t teensy_us) const {
+            return offset_ns_ + drift_ * (teensy_us - ref_us_);
+        }
+};
+
+#endif
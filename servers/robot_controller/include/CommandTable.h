@@ -0,0 +1,154 @@
+#ifndef COMMAND_TABLE_H_INCLUDE_GUARD
+#define COMMAND_TABLE_H_INCLUDE_GUARD
+//Descriptor table of the robot commands, shared by the host and the firmware
+//(robot/firmware/CommandTable.h must be kept identical to this file).
+//A request command is its code followed by request_bytes of data (two for the
+//per-item commands, so that unknown codes are skipped as ROBOT_COMMAND_SIZE bytes).
+//A command with a response is answered with the same code followed by
+//response_bytes of data. Adding a sensor is one entry here, plus its kind
+//if the data is laid out differently to the existing ones.
+
+#include <stdint.h>
+#include "Commands.h"
+#include "TeensyFrame.h"
+
+#define ROBOT_COMMAND_SIZE 3
+#define ROBOT_NUM_MOTORS 7 //Motors 0,1,2, actuators 3,4,5 and the goniometer 6
+#define ROBOT_NUM_ACCELEROMETERS 6
+
+//Layout of the Snapshot response: the firmware time in us when it was written, x, y, z
+//of the accelerometers fitted to the robot, then the step counts of every motor
+//(all big-endian). This replaces 3 AccNWr and 7 StepNWr requests and responses.
+#define ROBOT_SNAPSHOT_ACCELEROMETERS 3
+#define ROBOT_SNAPSHOT_TIME 0
+#define ROBOT_SNAPSHOT_ACCEL 4
+#define ROBOT_SNAPSHOT_STEPS (ROBOT_SNAPSHOT_ACCEL + 6*ROBOT_SNAPSHOT_ACCELEROMETERS)
+#define ROBOT_SNAPSHOT_BYTES (ROBOT_SNAPSHOT_STEPS + 4*ROBOT_NUM_MOTORS)
+
+//Layout of the AccStream response: the number of samples that follow (at most
+//ROBOT_STREAM_SAMPLES, the unused slots are zero), then each sample oldest first as the
+//firmware time in us when it was completed and x, y, z of the snapshot accelerometers.
+//The firmware samples them every ROBOT_STREAM_PERIOD_US (one pass of its schedule),
+//so a larger gap between consecutive samples means samples were dropped.
+#define ROBOT_STREAM_SAMPLES 3
+#define ROBOT_STREAM_PERIOD_US 1000
+#define ROBOT_STREAM_SAMPLE_BYTES (4 + 6*ROBOT_SNAPSHOT_ACCELEROMETERS)
+#define ROBOT_STREAM_BYTES (1 + ROBOT_STREAM_SAMPLES*ROBOT_STREAM_SAMPLE_BYTES)
+
+//How the data bytes of a command or its response are laid out
+enum RobotCommandKind : uint8_t {
+  KIND_NONE = 0,  //No data (e.g. STOP)
+  KIND_SET_VEL,   //Request: big-endian int16 raw velocity for motor `index`
+  KIND_VEL,       //Response: big-endian int16 raw velocity of motor `index`
+  KIND_ACCEL,     //Response: x, y, z big-endian int16 of accelerometer `index`
+  KIND_STEPS,     //Response: big-endian int32 step count of motor `index`
+  KIND_RUNTIME,   //Response: big-endian uint32 longest scheduler runtime (us)
+  KIND_ID,        //Response: device ID and firmware version
+  KIND_SET_VEL_ALL, //Request: big-endian int16 raw velocities of every motor
+  KIND_SNAPSHOT,  //Response: see ROBOT_SNAPSHOT_*
+  KIND_ACC_STREAM //Response: see ROBOT_STREAM_*
+};
+
+struct RobotCommand {
+  uint8_t code;
+  uint8_t kind;
+  uint8_t index;          //Motor or accelerometer the data belongs to
+  uint8_t request_bytes;  //Data bytes after the code in the request
+  int8_t response_bytes;  //Data bytes after the echoed code, or -1 if there is no response
+};
+
+constexpr RobotCommand kRobotCommands[] = {
+  {RUNTIME, KIND_RUNTIME, 0, 2, 4},
+  {STOP, KIND_NONE, 0, 2, -1},
+  {ResetSteps, KIND_NONE, 0, 2, -1},
+  {ID, KIND_ID, 0, 2, 2},
+
+  {SetRaw0, KIND_SET_VEL, 0, 2, -1},
+  {SetRaw1, KIND_SET_VEL, 1, 2, -1},
+  {SetRaw2, KIND_SET_VEL, 2, 2, -1},
+  {SetRaw3, KIND_SET_VEL, 3, 2, -1},
+  {SetRaw4, KIND_SET_VEL, 4, 2, -1},
+  {SetRaw5, KIND_SET_VEL, 5, 2, -1},
+  {SetRaw6, KIND_SET_VEL, 6, 2, -1},
+
+  {Raw0Wr, KIND_VEL, 0, 2, 2},
+  {Raw1Wr, KIND_VEL, 1, 2, 2},
+  {Raw2Wr, KIND_VEL, 2, 2, 2},
+  {Raw3Wr, KIND_VEL, 3, 2, 2},
+  {Raw4Wr, KIND_VEL, 4, 2, 2},
+  {Raw5Wr, KIND_VEL, 5, 2, 2},
+  {Raw6Wr, KIND_VEL, 6, 2, 2},
+
+  {Acc0Wr, KIND_ACCEL, 0, 2, 6},
+  {Acc1Wr, KIND_ACCEL, 1, 2, 6},
+  {Acc2Wr, KIND_ACCEL, 2, 2, 6},
+  {Acc3Wr, KIND_ACCEL, 3, 2, 6},
+  {Acc4Wr, KIND_ACCEL, 4, 2, 6},
+  {Acc5Wr, KIND_ACCEL, 5, 2, 6},
+
+  {Step0Wr, KIND_STEPS, 0, 2, 4},
+  {Step1Wr, KIND_STEPS, 1, 2, 4},
+  {Step2Wr, KIND_STEPS, 2, 2, 4},
+  {Step3Wr, KIND_STEPS, 3, 2, 4},
+  {Step4Wr, KIND_STEPS, 4, 2, 4},
+  {Step5Wr, KIND_STEPS, 5, 2, 4},
+  {Step6Wr, KIND_STEPS, 6, 2, 4},
+
+  {SetRawAll, KIND_SET_VEL_ALL, 0, 2*ROBOT_NUM_MOTORS, -1},
+  {Snapshot, KIND_SNAPSHOT, 0, 0, ROBOT_SNAPSHOT_BYTES},
+  {AccStream, KIND_ACC_STREAM, 0, 0, ROBOT_STREAM_BYTES},
+};
+
+constexpr int kNumRobotCommands = sizeof(kRobotCommands)/sizeof(kRobotCommands[0]);
+
+//Command byte -> entry of kRobotCommands (or -1), built at compile time
+struct RobotCommandLookup {
+  int8_t entry[256];
+  constexpr RobotCommandLookup() : entry() {
+    for(int i = 0; i < 256; ++i){
+      entry[i] = -1;
+    }
+    for(int i = 0; i < kNumRobotCommands; ++i){
+      entry[kRobotCommands[i].code] = i;
+    }
+  }
+};
+
+constexpr RobotCommandLookup kRobotCommandLookup;
+
+//Returns the descriptor of a command byte, or nullptr if it is not a robot command
+inline const RobotCommand* FindRobotCommand(uint8_t code) {
+  int i = kRobotCommandLookup.entry[code];
+  return i < 0 ? nullptr : &kRobotCommands[i];
+}
+
+//Bytes of a request command (the code and its data). Unknown codes are taken as
+//ROBOT_COMMAND_SIZE, like the per-item commands
+constexpr int RobotRequestSize(uint8_t code) {
+  return kRobotCommandLookup.entry[code] < 0 ?
+    ROBOT_COMMAND_SIZE : 1 + kRobotCommands[kRobotCommandLookup.entry[code]].request_bytes;
+}
+
+//Bytes the firmware writes in response to a command (the code and its data), or 0
+constexpr int RobotResponseSize(uint8_t code) {
+  return kRobotCommandLookup.entry[code] < 0 || kRobotCommands[kRobotCommandLookup.entry[code]].response_bytes < 0 ?
+    0 : 1 + kRobotCommands[kRobotCommandLookup.entry[code]].response_bytes;
+}
+
+//Compile-time checks that each code appears once and the indices are in range
+constexpr bool RobotCommandTableValid() {
+  for(int i = 0; i < kNumRobotCommands; ++i){
+    if(kRobotCommands[i].code == EMPTY || kRobotCommandLookup.entry[kRobotCommands[i].code] != i){
+      return false;
+    }
+    if(kRobotCommands[i].index >= (kRobotCommands[i].kind == KIND_ACCEL ? ROBOT_NUM_ACCELEROMETERS : ROBOT_NUM_MOTORS)){
+      return false;
+    }
+  }
+  return true;
+}
+static_assert(RobotCommandTableValid(), "Robot command codes must be unique and non-zero");
+static_assert(1 + ROBOT_SNAPSHOT_BYTES <= TEENSY_MAX_PAYLOAD, "The Snapshot response must fit in one frame");
+static_assert(2 + ROBOT_SNAPSHOT_BYTES + ROBOT_STREAM_BYTES <= TEENSY_MAX_PAYLOAD, "The Snapshot and AccStream responses must share a frame");
+
+#endif
@@ -74,5 +74,12 @@
 #define Step5Wr 0x35
 #define Step6Wr 0x36 
 
+//Batched commands (firmware version 4 onwards)
+#define SetRawAll 0x40 //Update all of the raw motor velocities at once
+#define Snapshot 0x41 //Request the accelerometers, step counts and firmware time together
+
+//Streamed sensors (firmware version 5 onwards)
+#define AccStream 0x42 //Request the timestamped accelerometer samples taken since the last request
+
 
 #endif
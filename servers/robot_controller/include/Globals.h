@@ -1,4 +1,8 @@
-#include <mutex>
+#include <atomic>
+#include <string>
+#include "LockFree.h"
+#include "SysId.h"
+#include "AttitudeEstimator.h"
 
 constexpr double PI = 3.14159265358979323846;
 constexpr double DEG_TO_RAD = PI / 180.0;
@@ -7,14 +11,14 @@ constexpr double ROBOT_RADIUS = 0.295; // Radius of the robot in meters, from ce
 constexpr double ACT_RADIUS = 0.1705; // Radius of the actuators in meters, from centre of robot to the actuators.
 constexpr double SIN30 = 0.5; // sin(30 degrees)
 constexpr double COS30 = 0.8660254037844386; // cos(30 degrees) = sqrt(3)/2
+constexpr double ARCSEC_PER_YAW_STEP = 295E-9/ROBOT_RADIUS/ARCSEC_TO_RAD/3; // Per step of the sum of the three wheels
+constexpr double ARCSEC_PER_EL_STEP = 0.090; // Per step of the goniometer
 
 
 // These are parameters read in from the toml file in main.cpp, and used in robotControllerServerFuncs.cpp
 // TODO: These should be in a struct, and passed to the robot loop, rather than being global variables. Could be a global struct too.
 extern double g_roll_gain;
 extern double g_pitch_gain;
-extern double g_roll_target;
-extern double g_pitch_target;
 extern double g_x_acc_offset0;
 extern double g_x_acc_offset1;
 extern double g_x_acc_offset2;
@@ -25,8 +29,31 @@ extern double g_z_acc_offset0;
 extern double g_z_acc_offset1;
 extern double g_z_acc_offset2;
 
+// Levelling filter (see LevelFilter.h), read in from the toml file in main.cpp
+extern int g_level_filter; // LEVEL_FILTER_MEAN, LEVEL_FILTER_BIQUAD or LEVEL_FILTER_COMPLEMENTARY
+extern int g_level_filter_length; // Samples averaged by the mean filter
+extern double g_level_cutoff_hz; // Cutoff of the biquad and complementary filters
+extern double g_level_rate_feedforward; // Gain from the commanded tilt rate to the complementary filter
+
+// Real-time settings for the robot loop, read in from the toml file in main.cpp
+extern long g_loop_period_us; // Loop period
+extern int g_loop_cpu; // CPU to pin the robot loop to (-1 for any CPU)
+extern int g_loop_priority; // SCHED_FIFO priority of the robot loop (0 for normal scheduling)
+
+// Fusion of the star tracker measurements with the step counts (see AttitudeEstimator.h),
+// read in from the toml file in main.cpp. Fusion can also be switched by RC.set_fusion.
+extern bool g_fusion_enabled;
+extern AttitudeNoise g_attitude_noise;
+
+// Flight recorder of every robot loop tick (a telemetry::Recorder, see robotThread.cpp).
+// It holds the last g_tick_ring_s seconds, read in from the toml file in main.cpp.
+namespace telemetry { class Recorder; }
+extern telemetry::Recorder* g_tick_recorder;
+extern double g_tick_ring_s;
+int InitTickRecorder(double seconds);
+
 // For the watchdog thread
-extern int alive_counter;
+extern std::atomic<int> alive_counter;
 extern int last_alive_counter;
 
 // A structure to hold the velocities of the robo
@@ -50,52 +77,106 @@ struct Doubles
 #define ST_FI_MONITORING 4
 
 
+// Modes of the robot loop
+#define ROBOT_IDLE 1
+#define ROBOT_TRANSLATE 2
+#define ROBOT_RESONANCE 3
+#define ROBOT_TRACK 4
+#define ROBOT_DISCONNECT 5
+#define ROBOT_SYSID 6 // System identification (see SysId.h)
+
 // Status that can be returned through the server
 struct Status {
-	double roll, pitch; // Current roll and pitch angles from accelerometers.
+	double roll = 0, pitch = 0; // Current roll and pitch angles from accelerometers.
     int delta_motors[7] = {0, 0, 0, 0, 0, 0, 0}; // Motor delta-steps
-    int loop_status, loop_counter;
+    int loop_status = ROBOT_IDLE, loop_counter = 0;
     int st_status = ST_IDLE; 
+    // Robot loop timing over the last second (us): lateness of each wake-up relative
+    // to its deadline, and time spent in the loop body. Overruns are the ticks missed
+    // since the loop was started.
+    double jitter_mean_us = 0, jitter_max_us = 0;
+    double work_mean_us = 0, work_max_us = 0;
+    int overruns = 0;
+    // Teensy clock relative to the host (see ClockSync.h): the drift, the USB latency of the
+    // last Snapshot above the lowest seen and the largest in the fit window, and the
+    // accelerometer stream samples dropped since the loop was started.
+    double clock_drift_ppm = 0;
+    double usb_latency_us = 0, usb_latency_max_us = 0;
+    long accel_dropped = 0;
+    // Fused star tracker estimate (see AttitudeEstimator.h), when fusion is on: the
+    // pointing error and its standard deviation, the centroid bias (arcsec), and the
+    // measurements used and rejected since fusion was switched on.
+    int fusion = 0;
+    double att_az = 0, att_alt = 0, att_az_sigma = 0, att_alt_sigma = 0;
+    double att_bias_az = 0, att_bias_alt = 0;
+    int att_fixes = 0, att_centroids = 0, att_rejected = 0, att_restarts = 0;
 };
 
 // A structure to hold the LEDs positions
 
-// The header for robotThread.cpp, which contains the main robot loop
-#define ROBOT_IDLE 1
-#define ROBOT_TRANSLATE 2
-#define ROBOT_RESONANCE 3
-#define ROBOT_TRACK 4
-#define ROBOT_DISCONNECT 5
-extern int GLOBAL_SERVER_STATUS;
-extern bool GLOBAL_STATUS_CHANGED;
+// State of the control loop. Only the robot loop thread reads and writes it: the
+// commander server sends it commands through g_commands, and reads the status from
+// g_status_snapshot, which the loop publishes every tick.
+struct ControlState {
+    int mode = ROBOT_IDLE;
+    bool mode_changed = false; // Set when a command changes the mode, to restart the timing
+    Velocities vel = {0, 0, 0, 0, 0, 0, 0, 0};
+
+    // Heading gain, plus gains and integral terms for yaw and elevation control
+    double h_gain = 0, ygain = 0, egain = 0, yint = 0, eint = 0;
+    double esum = 0, ysum = 0;
+    double heading = 0; // A coarse angle used to control the robot's direction
+
+    // Star tracker angles and offsets (arcsec), and the slew targets (steps). With fusion
+    // on, az and alt are the fused estimate, updated every tick.
+    bool fusion = false;
+    double az = 0, alt = 60, posang = 0, az_off = 0, alt_off = 0;
+    double yaw_target = 0, el_target = 0;
+
+    // Levelling targets (arcsec), initially from the toml file
+    double roll_target = 0, pitch_target = 0;
+
+    // Resonance log filename
+    char filename[256] = "state_file.tlm";
+};
+
+// Commands from the commander server to the robot loop
+#define CMD_START 1         // Go to ROBOT_IDLE
+#define CMD_STOP 2          // Zero the velocities and gains, and go to ROBOT_TRANSLATE
+#define CMD_TRANSLATE 3     // args: velocity, x, y, z, roll, pitch, yaw, el
+#define CMD_RESONANCE 4     // args: velocity, x, y, z, roll, pitch, yaw
+#define CMD_TRACK 5         // args: as CMD_TRANSLATE
+#define CMD_DISCONNECT 6    // Zero the velocities and gains, and stop the loop
+#define CMD_ST_ANGLES 7     // args: azimuth, altitude, position angle (radians)
+#define CMD_GAINS 8         // args: yaw gain, elevation gain, yaw and elevation integral gains
+#define CMD_HEADING 9       // args: heading, gain
+#define CMD_OFFSETS 10      // args: azimuth, altitude, roll and pitch offsets to add
+#define CMD_ST_STATE 11     // args: star tracker state
+#define CMD_MOVE_ACTUATOR 12 // args: index, velocity (m/s)
+#define CMD_MOVE_MOTOR 13   // args: index, velocity (m/s)
+#define CMD_FILE 14         // text: resonance log filename
+#define CMD_SET_EL_90 15    // Slew the goniometer back to zero steps
+#define CMD_SYSID 16        // args: excitation, axis, response, amplitude, f_start, f_stop, num_freqs, duration_s
+#define CMD_SYSID_STOP 17   // Stop the system identification, keeping the points measured
+#define CMD_ST_FIX 18       // args: azimuth, altitude, position angle (radians), age (s)
+#define CMD_ST_CENTROID 19  // args: azimuth, altitude (radians), age (s)
+#define CMD_FUSION 20       // args: 1 to fuse the star tracker measurements, 0 not to
+
+struct ControlCommand {
+    int type = 0;
+    double args[8] = {0};
+    char text[256] = {0};
+};
+
+#define COMMAND_MAILBOX_SIZE 64
+
+extern ControlState g_ctrl;
+extern Mailbox<ControlCommand, COMMAND_MAILBOX_SIZE> g_commands;
+extern SeqlockSnapshot<Status> g_status_snapshot;
+extern Status g_status; // The robot loop's copy
 extern int loop_counter;
-extern Velocities g_vel, g_zero_vel;
-
-extern Status g_status;
-extern std::mutex GLOB_STATUS_LOCK;
-void MoveSingleActuator(int actuator_index, double velocity);
-void MoveSingleMotor(int motor_index, double velocity);
-
-// Heading gain, plus gians and integral terms for yaw ane elevation control
-// TODO: These should be in a struct, and passed to the robot loop, 
-// rather than being global variables. Could be a global struct too.
-extern double h_gain;
-extern double g_ygain;
-extern double g_egain;
-extern double g_yint;
-extern double g_eint;
-extern double g_esum;
-extern double g_ysum;
-extern double g_heading;
-extern double g_az;
-extern double g_alt;
-extern double g_az_off;
-extern double g_alt_off;
-extern double g_yaw_target;
-extern double g_el_target;
-
-// Log filename
-extern std::string g_filename;
+extern const Velocities g_zero_vel;
+extern SeqlockSnapshot<SysIdResults> g_sysid_snapshot; // Published when a point is measured
 
 // Functions needed to be publicly accessible for the robot controller server
 int robot_loop();
@@ -0,0 +1,72 @@
+//Kinematics.h
+//Mixing between the robot's body velocities and the velocities of its seven motors, and
+//back from the motor step counts to the body displacement. Each direction is one 7x7
+//matrix-vector product, with the matrices fixed at start-up.
+//
+//Body axes: x, y, z (m or m/s), roll, pitch, yaw, el (rad or rad/s).
+//Motors: wheels 0, 1, 2 and actuators 3, 4, 5 (m/s, in the signs sent to the Teensy),
+//and the goniometer 6 (rad/s).
+#ifndef KINEMATICS_H_INCLUDE_GUARD
+#define KINEMATICS_H_INCLUDE_GUARD
+
+#include <Eigen/Dense>
+#include <string>
+
+#define KINEMATICS_AXES 7
+
+typedef Eigen::Matrix<double, KINEMATICS_AXES, KINEMATICS_AXES> KinematicsMatrix;
+typedef Eigen::Matrix<double, KINEMATICS_AXES, 1> KinematicsVector;
+
+//Read a comma separated matrix of rows x cols values (one row per line) into values,
+//row major. Returns 0, or 1 if the file can't be read or has the wrong shape
+int LoadMatrixCsv(const std::string &filename, int rows, int cols, double *values);
+
+template <int Rows, int Cols>
+int LoadMatrix(const std::string &filename, Eigen::Matrix<double, Rows, Cols> *matrix) {
+    double values[Rows*Cols];
+    if (LoadMatrixCsv(filename, Rows, Cols, values)) {
+        return 1;
+    }
+    *matrix = Eigen::Map<Eigen::Matrix<double, Rows, Cols, Eigen::RowMajor>>(values);
+    return 0;
+}
+
+class Kinematics {
+    public:
+        //The mixing from the robot geometry in Globals.h
+        Kinematics();
+
+        //Replace the mixing with a 7x7 matrix from a file (rows are motors, columns body
+        //axes). Returns 0, or 1 if it can't be read or inverted, keeping the old mixing
+        int LoadMixing(const std::string &filename);
+
+        //Motor velocities for the body velocities
+        void MotorVelocities(const KinematicsVector &body, double *motor) const {
+            Eigen::Map<KinematicsVector> out(motor);
+            out.noalias() = mixing_*body;
+        }
+
+        //Body displacement for motor step counts
+        KinematicsVector BodyDisplacement(const int *steps) const {
+            return forward_*Eigen::Map<const Eigen::Matrix<int, KINEMATICS_AXES, 1>>(steps).cast<double>();
+        }
+
+        //Largest element of forward*mixing - I, once the step sizes are taken out
+        double IdentityError() const { return IdentityError(mixing_, forward_); }
+
+        const KinematicsMatrix &mixing() const { return mixing_; }
+
+    private:
+        //Invert the mixing into *forward, with the step sizes. Returns 0, or 1 if it is singular
+        int Invert(const KinematicsMatrix &mixing, KinematicsMatrix *forward) const;
+        double IdentityError(const KinematicsMatrix &mixing, const KinematicsMatrix &forward) const;
+
+        KinematicsMatrix mixing_;
+        KinematicsMatrix forward_; //Inverse of the mixing, times the step sizes
+        KinematicsVector step_size_; //m (or rad for the goniometer) per step, in the motor signs
+};
+
+//Set up in main.cpp before the robot loop starts, and only read afterwards
+extern Kinematics g_kinematics;
+
+#endif
@@ -0,0 +1,78 @@
+//LevelFilter.h
+//Fusion of the three accelerometers and filtering of the pitch and roll estimates
+//for the levelling loop. Everything is fixed size, so nothing allocates in the robot loop.
+#ifndef LEVEL_FILTER_H_INCLUDE_GUARD
+#define LEVEL_FILTER_H_INCLUDE_GUARD
+
+#define LEVEL_FILTER_MEAN 0          //Mean of the last `length` samples
+#define LEVEL_FILTER_BIQUAD 1        //Second order Butterworth low-pass at cutoff_hz
+#define LEVEL_FILTER_COMPLEMENTARY 2 //First order low-pass at cutoff_hz, plus the integral of a rate
+
+#define LEVEL_FILTER_MAX_LENGTH 256
+
+//Combine one axis of the three accelerometers (offsets already removed). If one is
+//further from the middle value than `threshold` and three times the other's distance
+//it is dropped, and the mean of the other two is returned; otherwise the mean of all three.
+double FuseThree(double a, double b, double c, double threshold = 0.10);
+
+//Parse "mean", "biquad" or "complementary". Returns -1 if the name is unknown
+int LevelFilterType(const char *name);
+
+//Mean of the last `length` samples, as a circular buffer with a running sum
+class RunningMean {
+    public:
+        void SetLength(int length);
+        double Update(double x);
+        void Reset();
+
+    private:
+        double buffer_[LEVEL_FILTER_MAX_LENGTH] = {0};
+        int length_ = 10;
+        int next_ = 0;
+        int count_ = 0;
+        double sum_ = 0;
+};
+
+//Second order Butterworth low-pass (transposed direct form II), unity gain at DC.
+//At low frequencies it delays by sqrt(2)/(2 pi cutoff_hz) s, against (length - 1)/2
+//samples for the mean: at 1 kHz a 60 Hz cutoff lags no more than the 10-sample mean
+//(a 20 Hz cutoff would lag 11 samples), and it has no sidelobes, so it passes less of
+//the structural resonances above 150 Hz (see level_replay)
+class Biquad {
+    public:
+        void SetLowPass(double cutoff_hz, double sample_hz);
+        double Update(double x);
+        //Start in the steady state for a constant input x
+        void Reset(double x);
+
+    private:
+        double b0_ = 1, b1_ = 0, b2_ = 0, a1_ = 0, a2_ = 0;
+        double z1_ = 0, z2_ = 0;
+};
+
+//One of the filters above, chosen at run time.
+//The complementary filter follows the rate between samples (e.g. the commanded tilt
+//rate) and the samples only below cutoff_hz, so it lags less than the low-pass alone.
+class LevelFilter {
+    public:
+        void Configure(int type, int length, double cutoff_hz, double sample_hz);
+
+        //Filter a sample dt seconds after the last. rate (units of x per second) is
+        //only used by the complementary filter
+        double Update(double x, double rate, double dt);
+
+        //Start again from the next sample
+        void Reset() { primed_ = false; }
+
+        int type() const { return type_; }
+
+    private:
+        int type_ = LEVEL_FILTER_MEAN;
+        double cutoff_hz_ = 20;
+        bool primed_ = false;
+        double y_ = 0;
+        RunningMean mean_;
+        Biquad biquad_;
+};
+
+#endif
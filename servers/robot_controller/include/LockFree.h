@@ -0,0 +1,102 @@
+//LockFree.h
+//Lock-free exchange of data between the commander server thread and the robot loop,
+//so that neither ever waits for the other.
+#ifndef LOCK_FREE_H_INCLUDE_GUARD
+#define LOCK_FREE_H_INCLUDE_GUARD
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+//Latest value of a struct, published by one writer and read by any number of readers
+//(a seqlock). The writer never waits; a reader copies again if a publish overlapped its
+//copy, so it never sees a torn value. The value is held in atomic words, so the
+//overlapping copies are not data races.
+template <typename T>
+class SeqlockSnapshot {
+    static_assert(std::is_trivially_copyable<T>::value, "SeqlockSnapshot needs a trivially copyable type");
+    static constexpr int kWords = (sizeof(T) + 7) / 8;
+
+    public:
+        SeqlockSnapshot() {
+            for (int i = 0; i < kWords; ++i) {
+                words_[i].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        //Only ever called from one thread
+        void Publish(const T &value) {
+            uint64_t words[kWords] = {0};
+            memcpy(words, &value, sizeof(T));
+            unsigned seq = seq_.load(std::memory_order_relaxed);
+            seq_.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            for (int i = 0; i < kWords; ++i) {
+                words_[i].store(words[i], std::memory_order_relaxed);
+            }
+            seq_.store(seq + 2, std::memory_order_release);
+            published_.store(true, std::memory_order_release);
+        }
+
+        //The last value published (or `fallback` if nothing has been published yet)
+        T Read(const T &fallback = T()) const {
+            if (!published_.load(std::memory_order_acquire)) {
+                return fallback;
+            }
+            uint64_t words[kWords];
+            unsigned seq0, seq1;
+            do {
+                seq0 = seq_.load(std::memory_order_acquire);
+                for (int i = 0; i < kWords; ++i) {
+                    words[i] = words_[i].load(std::memory_order_relaxed);
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                seq1 = seq_.load(std::memory_order_relaxed);
+            } while ((seq0 & 1) || seq0 != seq1);
+            T value;
+            memcpy(&value, words, sizeof(T));
+            return value;
+        }
+
+    private:
+        std::atomic<unsigned> seq_{0};
+        std::atomic<bool> published_{false};
+        std::atomic<uint64_t> words_[kWords];
+};
+
+//Fixed-size queue from one producer thread to one consumer thread (a ring buffer
+//with atomic head and tail). Nothing allocates after construction.
+template <typename T, int N>
+class Mailbox {
+    public:
+        //Returns 0, or -1 if the mailbox is full
+        int Push(const T &item) {
+            size_t head = head_.load(std::memory_order_relaxed);
+            if (head - tail_.load(std::memory_order_acquire) == N) {
+                return -1;
+            }
+            items_[head % N] = item;
+            head_.store(head + 1, std::memory_order_release);
+            return 0;
+        }
+
+        //Returns false if the mailbox is empty
+        bool Pop(T *item) {
+            size_t tail = tail_.load(std::memory_order_relaxed);
+            if (tail == head_.load(std::memory_order_acquire)) {
+                return false;
+            }
+            *item = items_[tail % N];
+            tail_.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+    private:
+        T items_[N];
+        alignas(64) std::atomic<size_t> head_{0};
+        alignas(64) std::atomic<size_t> tail_{0};
+};
+
+#endif
@@ -0,0 +1,41 @@
+//RobotCodec.h
+//Encoding of the robot requests and decoding of the responses, driven by the
+//descriptor table in CommandTable.h
+#ifndef ROBOT_CODEC_H_INCLUDE_GUARD
+#define ROBOT_CODEC_H_INCLUDE_GUARD
+
+#include <stdint.h>
+#include "CommandTable.h"
+
+//One accelerometer sample of the AccStream response
+struct RobotAccelSample {
+    uint32_t teensy_time_us = 0; //Firmware micros() when the sample was completed
+    double accelerations[ROBOT_SNAPSHOT_ACCELEROMETERS][3] = {{0}}; //x, y, z in m/s^2
+};
+
+//Decoded values of the robot responses, in SI units
+struct RobotInputs {
+    int32_t step_counts[ROBOT_NUM_MOTORS] = {0};
+    double velocities[ROBOT_NUM_MOTORS] = {0}; //m/s
+    double accelerations[ROBOT_NUM_ACCELEROMETERS][3] = {{0}}; //x, y, z in m/s^2
+    uint32_t runtime_us = 0; //Longest scheduler runtime
+    uint32_t teensy_time_us = 0; //Firmware micros() when the last Snapshot was written
+    RobotAccelSample stream[ROBOT_STREAM_SAMPLES]; //Samples of the last AccStream, oldest first
+    int stream_count = 0;
+    uint8_t device_id = 0;
+    uint8_t firmware_version = 0;
+};
+
+//Write a request command into out (RobotRequestSize(code) bytes), taking the velocities
+//of SetRaw and SetRawAll from velocities_out (m/s, indexed by motor). Returns the bytes written.
+int EncodeRobotCommand(uint8_t code, const double *velocities_out, uint8_t *out);
+
+//Decode the data bytes of one response
+void DecodeRobotResponse(const RobotCommand &command, const uint8_t *data, RobotInputs *inputs);
+
+//Split a response payload into responses and decode them all. Returns the number of
+//responses decoded, or -1 if the payload holds a code that is not a response or is
+//truncated (the responses before it are still decoded)
+int DecodeRobotPayload(const uint8_t *payload, int len, RobotInputs *inputs);
+
+#endif
@@ -5,100 +5,79 @@
 // C library headers
 #include <stdio.h>
 #include <string.h>
-#include <pthread.h>
-#include <thread>
-
-// Linux headers
-#include <fcntl.h> // Contains file controls like O_RDWR
-#include <errno.h> // Error integer and strerror() function
-#include <termios.h> // Contains POSIX terminal control definitions
-#include <unistd.h> // write(), read(), close()
-#include <sys/file.h> // Contains the flock command
 
 //Macro headers
 #include "Commands.h"
 #include "ErrorCodes.h"
 
 #include "Decode.h"
+#include "RobotCodec.h"
+#include "ClockSync.h"
+#include "teensy_comms.hpp"
 
 namespace Comms
-{   
-    //Structures to store the acceleration and velocity values
-    struct AccelBytes 
-    {
-        unsigned char x [2], y[2], z [2];
-    };
-    struct VelBytes
-    {
-        unsigned char x [2], y[2], z [2];
-    };
-
+{
+    //Robot Teensy link. Requests are queued with Request() and sent as one frame by
+    //SendAllRequests(); the responses are read by the teensy::Port reader thread, and
+    //ReadMessage() decodes the latest values into inputs_.
     class SerialPort
     {
         public:
             SerialPort(int device_id_target);
-            
-            static int max_packet_size_;
-            int packet_size_;
-            void OpenPort();
+
             void ClosePort();
-            void ReadMessageAsync();
             int ReadMessage();
-            void WriteMessage();
             void SendAllRequests();
-            void AddToPacket(unsigned char command);
             int Request(unsigned char command);
 
-            int teensy_ = -1;
-            void PacketManager();
-            
-
-            VelBytes motor_velocities_out_;//Byte arrays to store the outgoing velocities
-            VelBytes actuator_velocities_out_; //For these take x,y,z == 0,1,2
-
-            VelBytes translational_velocities_in_;//Byte arrays to store the incoming velocities
-            VelBytes actuator_velocities_in_; //For these take x,y,z == 0,1,2
-            
-            unsigned char goniometer_velocity_out_ [2];
-            unsigned char goniometer_velocity_in_ [2];
-
-            AccelBytes accelerometer0_in_;//Byte arrays to store the incoming accelerations
-            AccelBytes accelerometer1_in_;
-            AccelBytes accelerometer2_in_;
-            AccelBytes accelerometer3_in_;
-            AccelBytes accelerometer4_in_;
-            AccelBytes accelerometer5_in_;
-
-            unsigned char runtime_in_ [4];//Byte array to store the incoming runtime
-            unsigned char step_count0_in_[4] = {0x00}; //Byte arrays to store in incoming step_counts
-            unsigned char step_count1_in_[4] = {0x00};
-            unsigned char step_count2_in_[4] = {0x00};
-            unsigned char step_count3_in_[4] = {0x00};//Actuators 0,1,2 and indexes 3,4,5
-            unsigned char step_count4_in_[4] = {0x00};
-            unsigned char step_count5_in_[4] = {0x00};
-            unsigned char step_count6_in_[4] = {0x00};//Goniometer steps.
+            //Wait for the responses to the last SendAllRequests(). Returns 0 on success.
+            int WaitForResponses(int timeout_ms);
+
+            //The underlying transport, e.g. for timestamps and link statistics
+            teensy::Port port_;
+
+            //Velocities sent by the SetRaw commands (m/s): motors 0,1,2, actuators 3,4,5
+            //and the goniometer 6
+            double velocities_out_[ROBOT_NUM_MOTORS] = {0};
+
+            //Latest decoded responses
+            RobotInputs inputs_;
+
+            //Maps the firmware times onto the host clock, from the Snapshot responses
+            ClockSync clock_sync_;
+
+            //AccStream samples that arrived since the last ReadMessage(), oldest first, with
+            //their host times (ns, on the teensy::monotonicNs() clock)
+            RobotAccelSample new_samples_[ROBOT_STREAM_SAMPLES];
+            int64_t new_sample_ns_[ROBOT_STREAM_SAMPLES] = {0};
+            int num_new_samples_ = 0;
+            long samples_dropped_ = 0; //Samples missing from the stream, from the gaps in their times
 
             unsigned char device_id_; //bytes to store the current device being commed with
             unsigned char device_firmware_v_;
-            int device_file_index_ = 0;
+
+            //Response lengths of the robot firmware
+            static teensy::ResponseTable ResponseLengths();
 
         private:
-            unsigned char write_buffer_ [128];
-            unsigned char read_buffer_ [128];
-            unsigned char last_pack_ [128];
+            unsigned char write_buffer_ [TEENSY_MAX_PAYLOAD];
+            int packet_size_ = 0;
+            int packet_response_size_ = 0; // Bytes the Teensy will send back for this packet
+            int packet_responses_ = 0;
             unsigned char request_buffer_ [1024];
             int request_buffer_first_empty_ = 0;
-            int max_req_buf = 0;
-            bool init = false;
-            sched_param sch_params;
-            std::thread serial_read_thread;
-
-            void ClearReadBuff();
-            void ClearWriteBuff();
-            void ClearRequestBuff();
-            void ClearStructVelBytes(VelBytes *structure);
-            void ClearStructAccelBytes(AccelBytes *structure);
-    }; 
+            int last_seq_ = -1;
+            uint32_t last_count_ = 0; // Total responses seen at the last ReadMessage()
+            uint32_t snapshot_count_ = 0;
+            uint32_t stream_count_ = 0;
+            uint32_t last_sample_us_ = 0;
+            bool have_last_sample_ = false;
+
+            void TimestampStream(int64_t frame_ns);
+
+            void AddToPacket(unsigned char command);
+            void SendPacket();
+    };
 }
 
 #endif
@@ -0,0 +1,128 @@
+//SysId.h
+//System identification of the robot: an excitation added to one velocity axis, and
+//synchronous demodulation of a response (e.g. an accelerometer axis) at each excitation
+//frequency, giving the gain and phase of the frequency response. Everything is fixed
+//size and incremental, so it runs in the robot loop without allocating or blocking.
+#ifndef SYS_ID_H_INCLUDE_GUARD
+#define SYS_ID_H_INCLUDE_GUARD
+
+#define SYSID_STEPPED_SINE 0 //One frequency at a time, settling then measuring whole cycles
+#define SYSID_CHIRP 1        //Exponential sweep, response over excitation spectra at each frequency
+#define SYSID_MULTISINE 2    //All frequencies at once (harmonics of f_start, Schroeder phases)
+
+#define SYSID_MAX_FREQS 64
+
+//Shortest time each frequency of the stepped sine settles before it is measured (s)
+#define SYSID_SETTLE_S 1.0
+
+//Velocity axis excited, in the units of the translate command (mm/s or arcsec/s)
+#define SYSID_AXIS_X 0
+#define SYSID_AXIS_Y 1
+#define SYSID_AXIS_Z 2
+#define SYSID_AXIS_ROLL 3
+#define SYSID_AXIS_PITCH 4
+#define SYSID_AXIS_YAW 5
+#define SYSID_AXIS_EL 6
+
+//Response demodulated: the fused accelerations (m/s^2) or the unfiltered tilt (degrees)
+#define SYSID_RESPONSE_ACC_X 0
+#define SYSID_RESPONSE_ACC_Y 1
+#define SYSID_RESPONSE_ACC_Z 2
+#define SYSID_RESPONSE_PITCH 3
+#define SYSID_RESPONSE_ROLL 4
+
+#define SYSID_IDLE 0
+#define SYSID_RUNNING 1
+#define SYSID_DONE 2
+
+//Parse the names above ("stepped", "chirp", "multisine"; "x" ... "el"; "acc_x" ... "roll").
+//Each returns -1 if the name is unknown
+int SysIdExcitationType(const char *name);
+int SysIdAxis(const char *name);
+int SysIdResponse(const char *name);
+
+struct SysIdConfig {
+    int excitation = SYSID_STEPPED_SINE;
+    int axis = SYSID_AXIS_X;
+    int response = SYSID_RESPONSE_ACC_X;
+    double amplitude = 0; //Peak excitation (the sum of all tones for the multisine)
+    double f_start = 1, f_stop = 10; //Hz
+    int num_freqs = 10;
+    //Stepped sine: measuring time per frequency. Chirp: sweep time. Multisine: measuring
+    //time after one settling period. Rounded up to whole cycles (s)
+    double duration_s = 1;
+};
+
+//One point of the frequency response: response units per excitation unit, and the
+//phase of the response relative to the excitation (degrees, -180 to 180)
+struct SysIdPoint {
+    double freq_hz = 0;
+    double gain = 0;
+    double phase_deg = 0;
+    int samples = 0;
+};
+
+struct SysIdResults {
+    int state = SYSID_IDLE;
+    SysIdConfig config;
+    int num_points = 0; //Points measured so far
+    SysIdPoint points[SYSID_MAX_FREQS];
+};
+
+class SysId {
+    public:
+        //Start at start_ns. Returns 0, or -1 if the configuration is invalid
+        int Start(const SysIdConfig &config, long long start_ns);
+
+        //Stop, keeping the points measured so far
+        void Stop();
+
+        //Excitation to add to the axis at t_ns (0 when not running). Called once per tick
+        double Excitation(long long t_ns);
+
+        //A response sample taken at t_ns
+        void AddSample(long long t_ns, double y);
+
+        bool running() const { return results_.state == SYSID_RUNNING; }
+        const SysIdResults &results() const { return results_; }
+
+        //True once after each new point or change of state, for publishing the results
+        bool TakeChanged();
+
+    private:
+        //Sums for demodulating one frequency
+        struct Sums {
+            int n;
+            double y, c, s, yc, ys;
+            double u, uc, us; //Chirp: the excitation too
+        };
+
+        //Demodulation phase (radians) of point k at t seconds from the start
+        double Phase(int k, double t) const;
+        //Phase of the chirp at t
+        double ChirpPhase(double t) const;
+        //Seconds from the start at which the measurement of point k starts and ends
+        double MeasureStart(int k) const;
+        double MeasureEnd(int k) const;
+        void Accumulate(int k, double t, double y, double u);
+        void Finalise(int k);
+        void Finish();
+
+        SysIdResults results_;
+        bool changed_ = false;
+        long long start_ns_ = 0;
+        int num_freqs_ = 0;
+        double end_s_ = 0; //End of the excitation
+        double freq_[SYSID_MAX_FREQS];
+        double tone_amplitude_[SYSID_MAX_FREQS];
+        double tone_phase_[SYSID_MAX_FREQS];
+        double segment_start_[SYSID_MAX_FREQS + 1]; //Stepped sine: start of each frequency
+        double settle_s_[SYSID_MAX_FREQS];
+        double chirp_rate_ = 0; //Chirp: log(f_stop/f_start)/duration
+        double period_s_ = 0; //Multisine: period of the excitation
+        int excitation_point_ = 0; //Stepped sine: frequency being excited
+        int sample_point_ = 0; //Point the next response sample goes to
+        Sums sums_[SYSID_MAX_FREQS];
+};
+
+#endif
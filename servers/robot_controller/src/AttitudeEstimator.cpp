@@ -0,0 +1,164 @@
+//AttitudeEstimator.cpp
+#include "AttitudeEstimator.h"
+#include <algorithm>
+#include <cmath>
+
+void AttitudeEstimator::Axis::Start(double e, double e_var, double ec_cov, const AttitudeNoise &noise) {
+    // The centroid bias and its variance are kept: a restart only loses the error and drift
+    x(0) = e;
+    x(1) = 0;
+    P.row(0).setZero();
+    P.col(0).setZero();
+    P.row(1).setZero();
+    P.col(1).setZero();
+    P(0, 0) = e_var;
+    P(1, 1) = noise.drift_sigma*noise.drift_sigma;
+    P(0, 2) = P(2, 0) = ec_cov;
+}
+
+void AttitudeEstimator::Axis::Predict(double dt, double motion, const AttitudeNoise &noise) {
+    Eigen::Matrix3d F = Eigen::Matrix3d::Identity();
+    F(0, 1) = dt;
+    x = F*x;
+    x(0) += motion;
+    P = F*P*F.transpose();
+    P(0, 0) += noise.error_walk*noise.error_walk*dt;
+    P(1, 1) += noise.drift_walk*noise.drift_walk*dt;
+    P(2, 2) += noise.bias_walk*noise.bias_walk*dt;
+}
+
+double AttitudeEstimator::Axis::Sigma(const Eigen::RowVector3d &h, double z, double R) const {
+    double S = h*P*h.transpose() + R;
+    return std::abs(z - h*x)/std::sqrt(S);
+}
+
+void AttitudeEstimator::Axis::Update(const Eigen::RowVector3d &h, double z, double R) {
+    double S = h*P*h.transpose() + R;
+    Eigen::Vector3d K = P*h.transpose()/S;
+    x += K*(z - h*x);
+    P = (Eigen::Matrix3d::Identity() - K*h)*P;
+    // Keep P symmetric against rounding
+    P = 0.5*(P + P.transpose()).eval();
+}
+
+AttitudeAxisState AttitudeEstimator::Axis::State() const {
+    AttitudeAxisState state;
+    state.error = x(0);
+    state.drift = x(1);
+    state.bias = x(2);
+    state.error_sigma = std::sqrt(std::max(P(0, 0), 0.0));
+    state.bias_sigma = std::sqrt(std::max(P(2, 2), 0.0));
+    return state;
+}
+
+void AttitudeEstimator::Configure(const AttitudeNoise &noise) {
+    noise_ = noise;
+    Reset();
+}
+
+void AttitudeEstimator::Reset() {
+    for (Axis *axis : {&az_, &alt_}) {
+        axis->x.setZero();
+        axis->P.setZero();
+        axis->P(2, 2) = noise_.bias_sigma*noise_.bias_sigma;
+    }
+    initialised_ = false;
+    t_ns_ = 0;
+    pos_angle_ = 0;
+    fixes_ = centroids_ = rejected_ = restarts_ = 0;
+    history_next_ = history_count_ = 0;
+    total_az_ = total_alt_ = 0;
+}
+
+void AttitudeEstimator::Predict(long long t_ns, double d_az, double d_alt) {
+    double dt = (t_ns_ == 0) ? 0.0 : 1e-9*(t_ns - t_ns_);
+    t_ns_ = t_ns;
+    total_az_ += d_az;
+    total_alt_ += d_alt;
+    history_ns_[history_next_] = t_ns;
+    history_az_[history_next_] = total_az_;
+    history_alt_[history_next_] = total_alt_;
+    history_next_ = (history_next_ + 1) % ATTITUDE_HISTORY;
+    if (history_count_ < ATTITUDE_HISTORY) {
+        history_count_++;
+    }
+    if (initialised_) {
+        az_.Predict(dt, d_az, noise_);
+        alt_.Predict(dt, d_alt, noise_);
+    }
+}
+
+int AttitudeEstimator::MotionSince(long long t_ns, double *d_az, double *d_alt) const {
+    *d_az = 0;
+    *d_alt = 0;
+    // Walk back from the latest tick to the last one at or before t_ns
+    for (int n = 0; n < history_count_; n++) {
+        int i = (history_next_ - 1 - n + ATTITUDE_HISTORY) % ATTITUDE_HISTORY;
+        *d_az = total_az_ - history_az_[i];
+        *d_alt = total_alt_ - history_alt_[i];
+        if (history_ns_[i] <= t_ns) {
+            return 0;
+        }
+    }
+    return (history_count_ == ATTITUDE_HISTORY) ? 1 : 0;
+}
+
+int AttitudeEstimator::Fix(long long t_ns, double az, double alt, double pos_angle, double age_s) {
+    // Bring the fix up to now: the robot's motion since (unknown before the history), and the drift
+    double d_az, d_alt;
+    if ((age_s > noise_.max_age_s) || MotionSince(t_ns - (long long)(1e9*age_s), &d_az, &d_alt)) {
+        rejected_++;
+        return -1;
+    }
+    double z_az = az + d_az + az_.x(1)*age_s;
+    double z_alt = alt + d_alt + alt_.x(1)*age_s;
+    pos_angle_ = pos_angle;
+    fixes_++;
+
+    const Eigen::RowVector3d h(1, 0, 0);
+    double R = noise_.fix_sigma*noise_.fix_sigma;
+    if (initialised_ && (az_.Sigma(h, z_az, R) <= noise_.gate) && (alt_.Sigma(h, z_alt, R) <= noise_.gate)) {
+        az_.Update(h, z_az, R);
+        alt_.Update(h, z_alt, R);
+        return 0;
+    }
+    // The first fix, or one the estimate cannot explain (e.g. the wheels slipped): start
+    // again from the fix
+    az_.Start(z_az, R, 0, noise_);
+    alt_.Start(z_alt, R, 0, noise_);
+    if (initialised_) {
+        restarts_++;
+    }
+    initialised_ = true;
+    return 1;
+}
+
+int AttitudeEstimator::Centroid(long long t_ns, double az, double alt, double age_s) {
+    double d_az, d_alt;
+    if ((age_s > noise_.max_age_s) || MotionSince(t_ns - (long long)(1e9*age_s), &d_az, &d_alt)) {
+        rejected_++;
+        return -1;
+    }
+    double z_az = az + d_az + az_.x(1)*age_s;
+    double z_alt = alt + d_alt + alt_.x(1)*age_s;
+
+    double R = noise_.centroid_sigma*noise_.centroid_sigma;
+    if (!initialised_) {
+        // Before any fix, the error is the centroid less the bias, with the bias's
+        // uncertainty and anticorrelated with it
+        az_.Start(z_az - az_.x(2), R + az_.P(2, 2), -az_.P(2, 2), noise_);
+        alt_.Start(z_alt - alt_.x(2), R + alt_.P(2, 2), -alt_.P(2, 2), noise_);
+        initialised_ = true;
+        centroids_++;
+        return 0;
+    }
+    const Eigen::RowVector3d h(1, 0, 1);
+    if ((az_.Sigma(h, z_az, R) > noise_.gate) || (alt_.Sigma(h, z_alt, R) > noise_.gate)) {
+        rejected_++;
+        return -1;
+    }
+    az_.Update(h, z_az, R);
+    alt_.Update(h, z_alt, R);
+    centroids_++;
+    return 0;
+}
@@ -0,0 +1,85 @@
+//ClockSync.cpp
+#include "ClockSync.h"
+#include <cmath>
+
+ClockSync::ClockSync(int window, int blocks) : pairs_(window), window_(window), blocks_(blocks) {
+}
+
+//Times within half a wrap (35 minutes) of the last pair
+int64_t ClockSync::Unwrap(uint32_t teensy_us) const {
+    return last_us_ + (int32_t)(teensy_us - last_raw_us_);
+}
+
+void ClockSync::AddPair(uint32_t teensy_us, int64_t host_ns) {
+    int64_t t = count_ == 0 ? teensy_us : Unwrap(teensy_us);
+    last_raw_us_ = teensy_us;
+    last_us_ = t;
+    Pair &p = pairs_[count_ % window_];
+    p.teensy_us = t;
+    p.delay_ns = host_ns - 1000 * t;
+    count_++;
+
+    //Refit when a block is complete (or on every pair while there is less than a block)
+    int block_length = window_ / blocks_;
+    if (count_ <= block_length || count_ % block_length == 0) {
+        Fit();
+    }
+    //A pair below the envelope means the offset has stepped down since the fit
+    latency_ns_ = p.delay_ns - FitDelay(t);
+    if (latency_ns_ < 0) {
+        offset_ns_ += latency_ns_;
+        latency_ns_ = 0;
+    }
+}
+
+//Least-squares line through the smallest delay of each block of the window
+void ClockSync::Fit() {
+    long n = count_ < window_ ? count_ : window_;
+    long first = count_ - n;
+    int block_length = window_ / blocks_;
+    double sum_t = 0, sum_d = 0, sum_tt = 0, sum_td = 0;
+    int64_t t0 = pairs_[first % window_].teensy_us;
+    int minima = 0;
+    for (long start = first; start < count_; start += block_length) {
+        const Pair *lowest = nullptr;
+        for (long k = start; k < start + block_length && k < count_; ++k) {
+            const Pair &p = pairs_[k % window_];
+            if (!lowest || p.delay_ns < lowest->delay_ns) {
+                lowest = &p;
+            }
+        }
+        double t = lowest->teensy_us - t0;
+        double d = lowest->delay_ns;
+        sum_t += t;
+        sum_d += d;
+        sum_tt += t*t;
+        sum_td += t*d;
+        minima++;
+    }
+    double mean_t = sum_t / minima;
+    double mean_d = sum_d / minima;
+    double var_t = sum_tt / minima - mean_t*mean_t;
+    // With a single block (or all minima at one time) only the offset is known
+    if (minima < 2 || var_t <= 0) {
+        drift_ = 0;
+    } else {
+        drift_ = (sum_td / minima - mean_t*mean_d) / var_t;
+    }
+    ref_us_ = t0 + (int64_t)std::llround(mean_t);
+    offset_ns_ = mean_d + drift_ * (mean_t - (ref_us_ - t0));
+}
+
+int64_t ClockSync::ToHostNs(uint32_t teensy_us) const {
+    int64_t t = Unwrap(teensy_us);
+    return 1000 * t + (int64_t)std::llround(FitDelay(t));
+}
+
+double ClockSync::latency_max_us() const {
+    long n = count_ < window_ ? count_ : window_;
+    double latency_max = 0;
+    for (long k = count_ - n; k < count_; ++k) {
+        const Pair &p = pairs_[k % window_];
+        latency_max = std::fmax(latency_max, p.delay_ns - FitDelay(p.teensy_us));
+    }
+    return latency_max * 1e-3;
+}
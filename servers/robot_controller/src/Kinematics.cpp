@@ -0,0 +1,107 @@
+//Kinematics.cpp
+#include "Kinematics.h"
+#include "Globals.h"
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+Kinematics g_kinematics;
+
+int LoadMatrixCsv(const std::string &filename, int rows, int cols, double *values) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        std::cout << "Could not open " << filename << std::endl;
+        return 1;
+    }
+    std::string line;
+    int row = 0;
+    while (std::getline(file, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+        if (row == rows) {
+            std::cout << filename << " has more than " << rows << " rows" << std::endl;
+            return 1;
+        }
+        std::stringstream ss(line);
+        std::string value;
+        int col = 0;
+        while (std::getline(ss, value, ',')) {
+            char *end;
+            double x = strtod(value.c_str(), &end);
+            if (end == value.c_str() || col == cols || !std::isfinite(x)) {
+                std::cout << filename << ": bad value or too many columns in row " << row + 1 << std::endl;
+                return 1;
+            }
+            values[row*cols + col++] = x;
+        }
+        if (col != cols) {
+            std::cout << filename << ": row " << row + 1 << " has " << col << " columns, not " << cols << std::endl;
+            return 1;
+        }
+        row++;
+    }
+    if (row != rows) {
+        std::cout << filename << " has " << row << " rows, not " << rows << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+Kinematics::Kinematics() {
+    // Wheels: x and y in the plane, and yaw at ROBOT_RADIUS, with the wheels 120 degrees apart
+    // Actuators: z, and roll and pitch at ACT_RADIUS, with a sign flip to the Teensy
+    // Goniometer: el directly
+    KinematicsMatrix mixing;
+    mixing <<
+        0,      -1,     0,  0,                 0,                 -ROBOT_RADIUS, 0,
+        -COS30, SIN30,  0,  0,                 0,                 -ROBOT_RADIUS, 0,
+        COS30,  SIN30,  0,  0,                 0,                 -ROBOT_RADIUS, 0,
+        0,      0,      -1, -ACT_RADIUS*COS30, ACT_RADIUS*SIN30,  0,             0,
+        0,      0,      -1, 0,                 -ACT_RADIUS,       0,             0,
+        0,      0,      -1, ACT_RADIUS*COS30,  ACT_RADIUS*SIN30,  0,             0,
+        0,      0,      0,  0,                 0,                 0,             1;
+    // Steps: 295nm per wheel step, 39nm per actuator step (counted opposite to the velocity
+    // sign) and 0.090 arcsec per goniometer step
+    step_size_ << 295e-9, 295e-9, 295e-9, -39e-9, -39e-9, -39e-9, 0.090*ARCSEC_TO_RAD;
+    mixing_ = mixing;
+    if (Invert(mixing, &forward_)) {
+        // Only if the geometry in Globals.h is broken: no odometry rather than garbage
+        std::cout << "Kinematics: the robot geometry gives no odometry" << std::endl;
+        forward_.setZero();
+    }
+}
+
+int Kinematics::Invert(const KinematicsMatrix &mixing, KinematicsMatrix *forward) const {
+    Eigen::FullPivLU<KinematicsMatrix> lu(mixing);
+    if (!lu.isInvertible()) {
+        std::cout << "Kinematics: the mixing matrix is singular" << std::endl;
+        return 1;
+    }
+    *forward = lu.inverse()*step_size_.asDiagonal();
+    return 0;
+}
+
+int Kinematics::LoadMixing(const std::string &filename) {
+    KinematicsMatrix mixing, forward;
+    if (LoadMatrix(filename, &mixing)) {
+        return 1;
+    }
+    if (Invert(mixing, &forward)) {
+        return 1;
+    }
+    double error = IdentityError(mixing, forward);
+    if (error > 1e-9) {
+        std::cout << "Kinematics: " << filename << " is badly conditioned (error " << error << ")" << std::endl;
+        return 1;
+    }
+    mixing_ = mixing;
+    forward_ = forward;
+    return 0;
+}
+
+double Kinematics::IdentityError(const KinematicsMatrix &mixing, const KinematicsMatrix &forward) const {
+    KinematicsMatrix product = forward*step_size_.cwiseInverse().asDiagonal()*mixing;
+    return (product - KinematicsMatrix::Identity()).cwiseAbs().maxCoeff();
+}
@@ -0,0 +1,125 @@
+//LevelFilter.cpp
+#include "LevelFilter.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+double FuseThree(double a, double b, double c, double threshold) {
+    // Order the values without sorting
+    double lo = std::min(a, std::min(b, c));
+    double hi = std::max(a, std::max(b, c));
+    double mid = std::max(std::min(a, b), std::min(std::max(a, b), c));
+    if ((mid - lo) > std::max(threshold, (hi - mid) * 3)) {
+        // lo is an outlier
+        return (mid + hi) / 2.0;
+    } else if ((hi - mid) > std::max(threshold, (mid - lo) * 3)) {
+        // hi is an outlier
+        return (lo + mid) / 2.0;
+    }
+    // No outliers or all three are very different
+    return (lo + mid + hi) / 3.0;
+}
+
+int LevelFilterType(const char *name) {
+    if (strcmp(name, "mean") == 0) {
+        return LEVEL_FILTER_MEAN;
+    } else if (strcmp(name, "biquad") == 0) {
+        return LEVEL_FILTER_BIQUAD;
+    } else if (strcmp(name, "complementary") == 0) {
+        return LEVEL_FILTER_COMPLEMENTARY;
+    }
+    return -1;
+}
+
+void RunningMean::SetLength(int length) {
+    length_ = std::max(1, std::min(length, LEVEL_FILTER_MAX_LENGTH));
+    Reset();
+}
+
+void RunningMean::Reset() {
+    next_ = 0;
+    count_ = 0;
+    sum_ = 0;
+}
+
+double RunningMean::Update(double x) {
+    if (count_ == length_) {
+        sum_ -= buffer_[next_];
+    } else {
+        count_++;
+    }
+    buffer_[next_] = x;
+    sum_ += x;
+    next_++;
+    if (next_ == length_) {
+        // Re-add the sum once per pass, so that rounding errors cannot build up
+        next_ = 0;
+        sum_ = 0;
+        for (int i = 0; i < count_; i++) {
+            sum_ += buffer_[i];
+        }
+    }
+    return sum_ / count_;
+}
+
+void Biquad::SetLowPass(double cutoff_hz, double sample_hz) {
+    // Bilinear transform of the analogue Butterworth, Q = 1/sqrt(2)
+    double w0 = 2 * M_PI * std::min(cutoff_hz, 0.45 * sample_hz) / sample_hz;
+    double alpha = sin(w0) / (2 * M_SQRT1_2);
+    double a0 = 1 + alpha;
+    b0_ = (1 - cos(w0)) / 2 / a0;
+    b1_ = (1 - cos(w0)) / a0;
+    b2_ = b0_;
+    a1_ = -2 * cos(w0) / a0;
+    a2_ = (1 - alpha) / a0;
+}
+
+void Biquad::Reset(double x) {
+    z2_ = (b2_ - a2_) * x;
+    z1_ = (b1_ - a1_) * x + z2_;
+}
+
+double Biquad::Update(double x) {
+    double y = b0_ * x + z1_;
+    z1_ = b1_ * x - a1_ * y + z2_;
+    z2_ = b2_ * x - a2_ * y;
+    return y;
+}
+
+void LevelFilter::Configure(int type, int length, double cutoff_hz, double sample_hz) {
+    type_ = type;
+    cutoff_hz_ = cutoff_hz;
+    mean_.SetLength(length);
+    biquad_.SetLowPass(cutoff_hz, sample_hz);
+    primed_ = false;
+}
+
+double LevelFilter::Update(double x, double rate, double dt) {
+    if (!primed_) {
+        mean_.Reset();
+        biquad_.Reset(x);
+        y_ = x;
+        primed_ = true;
+        if (type_ != LEVEL_FILTER_MEAN) {
+            return y_;
+        }
+    }
+    switch (type_) {
+        case LEVEL_FILTER_BIQUAD:
+            y_ = biquad_.Update(x);
+            break;
+        case LEVEL_FILTER_COMPLEMENTARY: {
+            // Time constant of the low-pass, from the actual time between samples
+            double tau = 1.0 / (2 * M_PI * cutoff_hz_);
+            double dt_clamped = std::max(0.0, dt);
+            double k = dt_clamped / (tau + dt_clamped);
+            y_ += rate * dt_clamped;
+            y_ += k * (x - y_);
+            break;
+        }
+        default:
+            y_ = mean_.Update(x);
+            break;
+    }
+    return y_;
+}
@@ -0,0 +1,97 @@
+//RobotCodec.cpp
+#include <string.h>
+#include "RobotCodec.h"
+#include "Decode.h"
+#include "ErrorCodes.h"
+
+int EncodeRobotCommand(uint8_t code, const double *velocities_out, uint8_t *out) {
+    const RobotCommand *command = FindRobotCommand(code);
+    int size = RobotRequestSize(code);
+    memset(out, 0, size);
+    out[0] = code;
+    if (command && command->kind == KIND_SET_VEL) {
+        PhysicalDoubleToVelocityBytes(velocities_out[command->index], &out[1], &out[2]);
+    } else if (command && command->kind == KIND_SET_VEL_ALL) {
+        for (int i = 0; i < ROBOT_NUM_MOTORS; ++i) {
+            PhysicalDoubleToVelocityBytes(velocities_out[i], &out[1+2*i], &out[2+2*i]);
+        }
+    }
+    return size;
+}
+
+void DecodeRobotResponse(const RobotCommand &command, const uint8_t *data, RobotInputs *inputs) {
+    switch (command.kind) {
+        case KIND_VEL:
+            inputs->velocities[command.index] = VelocityBytesToPhysicalDouble(data[0], data[1]);
+            break;
+        case KIND_ACCEL:
+            for (int axis = 0; axis < 3; ++axis) {
+                inputs->accelerations[command.index][axis] =
+                    AccelerationBytesToPhysicalDouble(data[2*axis], data[2*axis+1]);
+            }
+            break;
+        case KIND_STEPS:
+            inputs->step_counts[command.index] = BytesToInt(data[0], data[1], data[2], data[3]);
+            break;
+        case KIND_RUNTIME:
+            inputs->runtime_us = BytesTouInt(data[0], data[1], data[2], data[3]);
+            break;
+        case KIND_ID:
+            inputs->device_id = data[0];
+            inputs->firmware_version = data[1];
+            break;
+        case KIND_SNAPSHOT: {
+            const uint8_t *t = &data[ROBOT_SNAPSHOT_TIME];
+            inputs->teensy_time_us = BytesTouInt(t[0], t[1], t[2], t[3]);
+            for (int i = 0; i < ROBOT_SNAPSHOT_ACCELEROMETERS; ++i) {
+                const uint8_t *a = &data[ROBOT_SNAPSHOT_ACCEL + 6*i];
+                for (int axis = 0; axis < 3; ++axis) {
+                    inputs->accelerations[i][axis] = AccelerationBytesToPhysicalDouble(a[2*axis], a[2*axis+1]);
+                }
+            }
+            for (int i = 0; i < ROBOT_NUM_MOTORS; ++i) {
+                const uint8_t *steps = &data[ROBOT_SNAPSHOT_STEPS + 4*i];
+                inputs->step_counts[i] = BytesToInt(steps[0], steps[1], steps[2], steps[3]);
+            }
+            break;
+        }
+        case KIND_ACC_STREAM: {
+            //The latest sample also becomes the current acceleration
+            inputs->stream_count = data[0] < ROBOT_STREAM_SAMPLES ? data[0] : ROBOT_STREAM_SAMPLES;
+            for (int k = 0; k < inputs->stream_count; ++k) {
+                const uint8_t *sample = &data[1 + k*ROBOT_STREAM_SAMPLE_BYTES];
+                RobotAccelSample *out = &inputs->stream[k];
+                out->teensy_time_us = BytesTouInt(sample[0], sample[1], sample[2], sample[3]);
+                for (int i = 0; i < ROBOT_SNAPSHOT_ACCELEROMETERS; ++i) {
+                    for (int axis = 0; axis < 3; ++axis) {
+                        out->accelerations[i][axis] = inputs->accelerations[i][axis] =
+                            AccelerationBytesToPhysicalDouble(sample[4 + 6*i + 2*axis], sample[5 + 6*i + 2*axis]);
+                    }
+                }
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+int DecodeRobotPayload(const uint8_t *payload, int len, RobotInputs *inputs) {
+    int n = 0;
+    int i = 0;
+    while (i < len) {
+        uint8_t code = payload[i];
+        if (code == UnrecVal || code == SchedFull || code == PackFail) {
+            i += 1;
+            continue;
+        }
+        const RobotCommand *command = FindRobotCommand(code);
+        if (!command || command->response_bytes < 0 || i + 1 + command->response_bytes > len) {
+            return -1;
+        }
+        DecodeRobotResponse(*command, &payload[i+1], inputs);
+        i += 1 + command->response_bytes;
+        n++;
+    }
+    return n;
+}
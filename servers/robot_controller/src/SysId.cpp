@@ -0,0 +1,278 @@
+//SysId.cpp
+#include "SysId.h"
+#include <cmath>
+#include <complex>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+
+int SysIdExcitationType(const char *name) {
+    if (strcmp(name, "stepped") == 0) {
+        return SYSID_STEPPED_SINE;
+    } else if (strcmp(name, "chirp") == 0) {
+        return SYSID_CHIRP;
+    } else if (strcmp(name, "multisine") == 0) {
+        return SYSID_MULTISINE;
+    }
+    return -1;
+}
+
+int SysIdAxis(const char *name) {
+    const char *names[7] = {"x", "y", "z", "roll", "pitch", "yaw", "el"};
+    for (int i = 0; i < 7; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int SysIdResponse(const char *name) {
+    const char *names[5] = {"acc_x", "acc_y", "acc_z", "pitch", "roll"};
+    for (int i = 0; i < 5; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int SysId::Start(const SysIdConfig &config, long long start_ns) {
+    if (config.f_start <= 0 || config.f_stop < config.f_start || config.duration_s <= 0 ||
+        config.num_freqs < 1 || config.num_freqs > SYSID_MAX_FREQS || config.amplitude == 0) {
+        std::cout << "SysId: invalid configuration" << std::endl;
+        return -1;
+    }
+    if (config.excitation == SYSID_CHIRP && config.f_stop == config.f_start) {
+        std::cout << "SysId: a chirp needs f_stop > f_start" << std::endl;
+        return -1;
+    }
+    results_ = SysIdResults();
+    results_.config = config;
+    memset(sums_, 0, sizeof(sums_));
+    start_ns_ = start_ns;
+    excitation_point_ = 0;
+    sample_point_ = 0;
+    num_freqs_ = config.num_freqs;
+    double f0 = config.f_start, f1 = config.f_stop;
+
+    switch (config.excitation) {
+        case SYSID_STEPPED_SINE:
+            // Log spaced, each settling for SYSID_SETTLE_S and at least 4 cycles, then
+            // measuring whole cycles so that the excitation ends each frequency at zero
+            segment_start_[0] = 0;
+            for (int k = 0; k < num_freqs_; k++) {
+                freq_[k] = num_freqs_ == 1 ? f0 : f0*pow(f1/f0, (double)k/(num_freqs_ - 1));
+                tone_amplitude_[k] = config.amplitude;
+                settle_s_[k] = ceil(std::max(SYSID_SETTLE_S, 4/freq_[k])*freq_[k])/freq_[k];
+                double measure_s = std::max(1.0, ceil(config.duration_s*freq_[k]))/freq_[k];
+                segment_start_[k + 1] = segment_start_[k] + settle_s_[k] + measure_s;
+            }
+            end_s_ = segment_start_[num_freqs_];
+            break;
+        case SYSID_CHIRP:
+            // Log spaced, each measured over the whole sweep
+            chirp_rate_ = log(f1/f0)/config.duration_s;
+            for (int k = 0; k < num_freqs_; k++) {
+                freq_[k] = f0*exp(chirp_rate_*config.duration_s*(k + 0.5)/num_freqs_);
+                tone_amplitude_[k] = config.amplitude;
+            }
+            end_s_ = config.duration_s;
+            break;
+        case SYSID_MULTISINE: {
+            // Distinct harmonics of f_start, as close to log spaced as they can be
+            period_s_ = 1/f0;
+            int max_harmonic = (int)floor(f1/f0 + 1e-9);
+            int n = 0;
+            for (int k = 0; k < num_freqs_; k++) {
+                int harmonic = num_freqs_ == 1 ? 1 : (int)lround(pow(f1/f0, (double)k/(num_freqs_ - 1)));
+                if (n > 0) {
+                    harmonic = std::max(harmonic, (int)lround(freq_[n - 1]/f0) + 1);
+                }
+                if (harmonic > max_harmonic) {
+                    break;
+                }
+                freq_[n++] = harmonic*f0;
+            }
+            num_freqs_ = n;
+            // Schroeder phases keep the peak of the sum near the amplitude
+            for (int k = 0; k < num_freqs_; k++) {
+                tone_amplitude_[k] = config.amplitude/sqrt(num_freqs_);
+                tone_phase_[k] = -M_PI*(k + 1)*k/num_freqs_;
+            }
+            end_s_ = period_s_*(1 + std::max(1.0, ceil(config.duration_s/period_s_)));
+            break;
+        }
+        default:
+            std::cout << "SysId: unknown excitation " << config.excitation << std::endl;
+            return -1;
+    }
+    results_.config.num_freqs = num_freqs_;
+    for (int k = 0; k < num_freqs_; k++) {
+        results_.points[k].freq_hz = freq_[k];
+    }
+    results_.state = SYSID_RUNNING;
+    changed_ = true;
+    return 0;
+}
+
+void SysId::Stop() {
+    if (running()) {
+        results_.state = SYSID_DONE;
+        changed_ = true;
+    }
+}
+
+double SysId::Phase(int k, double t) const {
+    switch (results_.config.excitation) {
+        case SYSID_STEPPED_SINE:
+            return 2*M_PI*freq_[k]*(t - segment_start_[k]);
+        case SYSID_CHIRP:
+            return 2*M_PI*freq_[k]*t;
+        default:
+            return 2*M_PI*freq_[k]*t + tone_phase_[k];
+    }
+}
+
+double SysId::ChirpPhase(double t) const {
+    return 2*M_PI*results_.config.f_start*(exp(chirp_rate_*t) - 1)/chirp_rate_;
+}
+
+double SysId::MeasureStart(int k) const {
+    switch (results_.config.excitation) {
+        case SYSID_STEPPED_SINE:
+            return segment_start_[k] + settle_s_[k];
+        case SYSID_CHIRP:
+            return 0;
+        default:
+            return period_s_;
+    }
+}
+
+double SysId::MeasureEnd(int k) const {
+    switch (results_.config.excitation) {
+        case SYSID_STEPPED_SINE:
+            return segment_start_[k + 1];
+        default:
+            return end_s_;
+    }
+}
+
+double SysId::Excitation(long long t_ns) {
+    if (!running()) {
+        return 0;
+    }
+    double t = 1e-9*(t_ns - start_ns_);
+    if (t < 0) {
+        return 0;
+    }
+    if (t >= end_s_) {
+        // Finish even if the response samples have stopped
+        if (t >= end_s_ + 0.1) {
+            Finish();
+        }
+        return 0;
+    }
+    switch (results_.config.excitation) {
+        case SYSID_STEPPED_SINE:
+            while (excitation_point_ < num_freqs_ - 1 && t >= segment_start_[excitation_point_ + 1]) {
+                excitation_point_++;
+            }
+            return tone_amplitude_[excitation_point_]*sin(Phase(excitation_point_, t));
+        case SYSID_CHIRP:
+            return tone_amplitude_[0]*sin(ChirpPhase(t));
+        default: {
+            // Faded in over the settling period
+            double u = 0;
+            for (int k = 0; k < num_freqs_; k++) {
+                u += tone_amplitude_[k]*sin(Phase(k, t));
+            }
+            return std::min(1.0, t/period_s_)*u;
+        }
+    }
+}
+
+void SysId::AddSample(long long t_ns, double y) {
+    if (!running()) {
+        return;
+    }
+    double t = 1e-9*(t_ns - start_ns_);
+    if (t < 0) {
+        return;
+    }
+    if (results_.config.excitation != SYSID_STEPPED_SINE) {
+        // Every frequency at once
+        double u = results_.config.excitation == SYSID_CHIRP ? tone_amplitude_[0]*sin(ChirpPhase(t)) : 0;
+        if (t >= end_s_) {
+            Finish();
+        } else if (t >= MeasureStart(0)) {
+            for (int k = 0; k < num_freqs_; k++) {
+                Accumulate(k, t, y, u);
+            }
+        }
+        return;
+    }
+    while (sample_point_ < num_freqs_ && t >= MeasureEnd(sample_point_)) {
+        Finalise(sample_point_++);
+    }
+    if (sample_point_ == num_freqs_) {
+        Finish();
+    } else if (t >= MeasureStart(sample_point_)) {
+        Accumulate(sample_point_, t, y, 0);
+    }
+}
+
+void SysId::Accumulate(int k, double t, double y, double u) {
+    double phase = Phase(k, t);
+    double c = cos(phase), s = sin(phase);
+    Sums &sum = sums_[k];
+    sum.n++;
+    sum.y += y;
+    sum.c += c;
+    sum.s += s;
+    sum.yc += y*c;
+    sum.ys += y*s;
+    sum.u += u;
+    sum.uc += u*c;
+    sum.us += u*s;
+}
+
+// For a sine excitation the response to a*sin(phase) is y = gain*a*sin(phase + phi) plus a
+// constant, so the mean of (y - mean(y))*exp(-i*phase) is gain*a*exp(i*phi)/(2i). For the
+// chirp it is the ratio of the response and excitation spectra at the frequency.
+void SysId::Finalise(int k) {
+    const Sums &sum = sums_[k];
+    SysIdPoint &point = results_.points[k];
+    point.samples = sum.n;
+    if (sum.n > 0) {
+        double mean = sum.y/sum.n;
+        std::complex<double> y(sum.yc - mean*sum.c, -(sum.ys - mean*sum.s));
+        std::complex<double> h;
+        if (results_.config.excitation == SYSID_CHIRP) {
+            double u_mean = sum.u/sum.n;
+            h = y/std::complex<double>(sum.uc - u_mean*sum.c, -(sum.us - u_mean*sum.s));
+        } else {
+            h = std::complex<double>(0, 2)*y/(double)sum.n/tone_amplitude_[k];
+        }
+        point.gain = std::abs(h);
+        point.phase_deg = std::arg(h)*180/M_PI;
+    }
+    results_.num_points = std::max(results_.num_points, k + 1);
+    changed_ = true;
+}
+
+void SysId::Finish() {
+    int first = results_.config.excitation == SYSID_STEPPED_SINE ? sample_point_ : 0;
+    for (int k = first; k < num_freqs_; k++) {
+        Finalise(k);
+    }
+    sample_point_ = num_freqs_;
+    results_.state = SYSID_DONE;
+    changed_ = true;
+}
+
+bool SysId::TakeChanged() {
+    bool changed = changed_;
+    changed_ = false;
+    return changed;
+}
@@ -0,0 +1,274 @@
+/*
+Fuzz check of the robot packet codec (RobotCodec.cpp and CommandTable.h).
+
+Each iteration builds a response payload from random entries of the command
+table with random data, decodes it and compares every value against a
+reference decoding written out here by hand. The payload is then truncated or
+has random bytes flipped, and finally replaced by pure noise; those must be
+rejected or decoded without reading outside the payload. Payloads live in
+exactly-sized heap buffers, so `make fuzz` (built with AddressSanitizer and
+UBSan) catches any out of bounds read.
+
+A second pass sends the payloads as frames through TeensyFrameParser with
+noise between them, and checks that (nearly) every frame is recovered; a stray
+0xFF in the noise looks like a frame start and can cost the frame after it.
+
+Usage: codec_fuzz [iterations] [seed]
+Exits with 1 on the first mismatch.
+*/
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "RobotCodec.h"
+#include "ErrorCodes.h"
+#include "TeensyFrame.h"
+
+using namespace std;
+
+mt19937 rng;
+
+int randomInt(int lo, int hi) {
+    return uniform_int_distribution<int>(lo, hi)(rng);
+}
+
+// Reference decoding of one response, independent of the codec
+void referenceDecode(const RobotCommand& c, const uint8_t* d, RobotInputs* in) {
+    int16_t s0 = (int16_t)((d[0] << 8) | d[1]);
+    switch (c.kind) {
+        case KIND_VEL:
+            in->velocities[c.index] = s0 / 32768.0 * 0.015;
+            break;
+        case KIND_ACCEL:
+            for (int axis = 0; axis < 3; axis++) {
+                int16_t a = (int16_t)((d[2*axis] << 8) | d[2*axis+1]);
+                in->accelerations[c.index][axis] = a * (9.81/16110.0);
+            }
+            break;
+        case KIND_STEPS:
+            in->step_counts[c.index] = (int32_t)(((uint32_t)d[0] << 24) | (d[1] << 16) | (d[2] << 8) | d[3]);
+            break;
+        case KIND_RUNTIME:
+            in->runtime_us = ((uint32_t)d[0] << 24) | (d[1] << 16) | (d[2] << 8) | d[3];
+            break;
+        case KIND_ID:
+            in->device_id = d[0];
+            in->firmware_version = d[1];
+            break;
+        case KIND_SNAPSHOT:
+            in->teensy_time_us = ((uint32_t)d[0] << 24) | (d[1] << 16) | (d[2] << 8) | d[3];
+            for (int i = 0; i < ROBOT_SNAPSHOT_ACCELEROMETERS; i++) {
+                RobotCommand acc = {0, KIND_ACCEL, (uint8_t)i, 2, 6};
+                referenceDecode(acc, d + 4 + 6*i, in);
+            }
+            for (int i = 0; i < ROBOT_NUM_MOTORS; i++) {
+                RobotCommand steps = {0, KIND_STEPS, (uint8_t)i, 2, 4};
+                referenceDecode(steps, d + 4 + 6*ROBOT_SNAPSHOT_ACCELEROMETERS + 4*i, in);
+            }
+            break;
+        case KIND_ACC_STREAM:
+            in->stream_count = d[0] > 3 ? 3 : d[0];
+            for (int k = 0; k < in->stream_count; k++) {
+                const uint8_t* s = d + 1 + 22*k;
+                in->stream[k].teensy_time_us = ((uint32_t)s[0] << 24) | (s[1] << 16) | (s[2] << 8) | s[3];
+                for (int i = 0; i < ROBOT_SNAPSHOT_ACCELEROMETERS; i++) {
+                    RobotCommand acc = {0, KIND_ACCEL, (uint8_t)i, 2, 6};
+                    referenceDecode(acc, s + 4 + 6*i, in);
+                    memcpy(in->stream[k].accelerations[i], in->accelerations[i], sizeof(in->accelerations[i]));
+                }
+            }
+            break;
+    }
+}
+
+bool sameInputs(const RobotInputs& a, const RobotInputs& b) {
+    for (int i = 0; i < ROBOT_NUM_MOTORS; i++) {
+        if (a.step_counts[i] != b.step_counts[i] || fabs(a.velocities[i] - b.velocities[i]) > 1e-12) {
+            return false;
+        }
+    }
+    for (int i = 0; i < ROBOT_NUM_ACCELEROMETERS; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            if (fabs(a.accelerations[i][axis] - b.accelerations[i][axis]) > 1e-12) {
+                return false;
+            }
+        }
+    }
+    if (a.stream_count != b.stream_count) {
+        return false;
+    }
+    for (int k = 0; k < a.stream_count; k++) {
+        if (a.stream[k].teensy_time_us != b.stream[k].teensy_time_us) {
+            return false;
+        }
+        for (int i = 0; i < ROBOT_SNAPSHOT_ACCELEROMETERS; i++) {
+            for (int axis = 0; axis < 3; axis++) {
+                if (fabs(a.stream[k].accelerations[i][axis] - b.stream[k].accelerations[i][axis]) > 1e-12) {
+                    return false;
+                }
+            }
+        }
+    }
+    return a.runtime_us == b.runtime_us && a.teensy_time_us == b.teensy_time_us && a.device_id == b.device_id && a.firmware_version == b.firmware_version;
+}
+
+// Random valid payload, as the firmware would send it. Returns the number of responses
+int randomPayload(vector<uint8_t>* payload, RobotInputs* expected) {
+    vector<const RobotCommand*> responses;
+    for (const RobotCommand& c : kRobotCommands) {
+        if (c.response_bytes >= 0) {
+            responses.push_back(&c);
+        }
+    }
+    int n = 0;
+    payload->clear();
+    while (true) {
+        if (randomInt(0, 9) == 0) {
+            // Error codes carry no data and are skipped
+            const uint8_t errors[3] = {UnrecVal, SchedFull, PackFail};
+            uint8_t error = errors[randomInt(0, 2)];
+            if (payload->size() + 1 > TEENSY_MAX_PAYLOAD) {
+                break;
+            }
+            payload->push_back(error);
+            continue;
+        }
+        const RobotCommand& c = *responses[randomInt(0, responses.size() - 1)];
+        if (payload->size() + 1 + c.response_bytes > TEENSY_MAX_PAYLOAD || randomInt(0, 30) == 0) {
+            break;
+        }
+        payload->push_back(c.code);
+        size_t data = payload->size();
+        for (int k = 0; k < c.response_bytes; k++) {
+            payload->push_back(randomInt(0, 255));
+        }
+        referenceDecode(c, payload->data() + data, expected);
+        n++;
+    }
+    return n;
+}
+
+// Decode from an exactly-sized copy so that overreads are caught by the sanitizer
+int decodeExact(const vector<uint8_t>& payload, size_t len, RobotInputs* inputs) {
+    uint8_t* copy = new uint8_t[len > 0 ? len : 1];
+    if (len > 0) {
+        memcpy(copy, payload.data(), len);
+    }
+    int ret = DecodeRobotPayload(copy, len, inputs);
+    delete[] copy;
+    return ret;
+}
+
+int fail(const char* what, long iteration) {
+    printf("FAIL: %s (iteration %ld)\n", what, iteration);
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    long iterations = 200000;
+    unsigned seed = 1;
+    if (argc > 1) {
+        iterations = atol(argv[1]);
+    }
+    if (argc > 2) {
+        seed = atoi(argv[2]);
+    }
+    rng.seed(seed);
+
+    // Request encoding: the code and its data bytes, which are zero except for SetRaw(All)
+    double velocities[ROBOT_NUM_MOTORS] = {0.001, -0.002, 0.003, -0.004, 0.005, -0.006, 0.007};
+    for (int code = 0; code < 256; code++) {
+        const RobotCommand* c = FindRobotCommand(code);
+        int size = RobotRequestSize(code);
+        vector<uint8_t> out(size + 1, 0xAA);
+        if (EncodeRobotCommand(code, velocities, out.data()) != size || out[0] != code || out[size] != 0xAA) {
+            return fail("request encoding", code);
+        }
+        bool has_data = false;
+        for (int k = 1; k < size; k++) {
+            has_data |= out[k] != 0;
+        }
+        if (has_data != (c != nullptr && (c->kind == KIND_SET_VEL || c->kind == KIND_SET_VEL_ALL))) {
+            return fail("request data bytes", code);
+        }
+    }
+
+    long truncated = 0, noise_decoded = 0;
+    vector<uint8_t> payload;
+    for (long it = 0; it < iterations; it++) {
+        RobotInputs expected, decoded;
+        int n = randomPayload(&payload, &expected);
+        if (decodeExact(payload, payload.size(), &decoded) != n || !sameInputs(expected, decoded)) {
+            return fail("valid payload decoded incorrectly", it);
+        }
+
+        // Truncation: either rejected, or cut exactly on a response boundary
+        if (!payload.empty()) {
+            size_t len = randomInt(0, payload.size() - 1);
+            RobotInputs partial;
+            int ret = decodeExact(payload, len, &partial);
+            if (ret > n) {
+                return fail("truncated payload decoded too many responses", it);
+            }
+            truncated += (ret < 0);
+        }
+
+        // Bit flips: anything may come out, but only from within the payload
+        vector<uint8_t> mutated = payload;
+        for (int k = randomInt(1, 4); k > 0 && !mutated.empty(); k--) {
+            mutated[randomInt(0, mutated.size() - 1)] ^= 1 << randomInt(0, 7);
+        }
+        RobotInputs junk;
+        if (decodeExact(mutated, mutated.size(), &junk) > (int)mutated.size()) {
+            return fail("mutated payload decoded more responses than bytes", it);
+        }
+
+        // Noise
+        vector<uint8_t> noise(randomInt(0, TEENSY_MAX_PAYLOAD));
+        for (auto& b : noise) {
+            b = randomInt(0, 255);
+        }
+        noise_decoded += (decodeExact(noise, noise.size(), &junk) >= 0);
+    }
+
+    // Framed stream with noise between the frames
+    TeensyFrameParser parser;
+    long frames_sent = 0, frames_matched = 0;
+    for (long it = 0; it < iterations / 10; it++) {
+        RobotInputs expected, decoded;
+        int n = randomPayload(&payload, &expected);
+        if (payload.empty()) {
+            continue;
+        }
+        uint8_t frame[TEENSY_MAX_FRAME];
+        int frame_len = TeensyEncodeFrame(it & 0xFF, payload.data(), payload.size(), frame);
+        // Noise between frames. A stray 0xFF looks like a frame start and can cost the next frame
+        for (int k = randomInt(0, 3); k > 0; k--) {
+            parser.Feed(randomInt(0, 0xFF));
+        }
+        frames_sent++;
+        bool got = false;
+        for (int k = 0; k < frame_len; k++) {
+            if (parser.Feed(frame[k])) {
+                do {
+                    if (parser.seq == (it & 0xFF) && parser.len == (int)payload.size()) {
+                        got = DecodeRobotPayload(parser.payload, parser.len, &decoded) == n && sameInputs(expected, decoded);
+                    }
+                } while (parser.Next());
+            }
+        }
+        frames_matched += got;
+    }
+
+    printf("Payloads: %ld, truncations rejected: %ld, noise payloads accepted: %ld\n",
+           iterations, truncated, noise_decoded);
+    printf("Frames: %ld sent, %ld recovered, %u checksum errors\n",
+           frames_sent, frames_matched, parser.checksum_errors);
+    if (frames_matched < frames_sent * 0.99) {
+        return fail("too many frames lost in noise", frames_sent);
+    }
+    printf("PASS\n");
+    return 0;
+}
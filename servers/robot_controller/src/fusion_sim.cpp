@@ -0,0 +1,157 @@
+/*
+Simulation check of the star tracker fusion (AttitudeEstimator.cpp), with no hardware.
+
+A pointing error with a known drift is nulled by the robot in whole wheel and goniometer
+steps, as the tracking loop does from the fused estimate, with a square wave offset move
+on top. The estimator is given the step motion every tick, centroids (offset by a known
+centroid bias) at 100 Hz and 20 ms late, and plate solve fixes every 2 s and 0.5 s late,
+all with noise. Over the second half of the run the estimate must follow the true error,
+and at the end the drift and centroid bias must have been found. Then a slip of the wheels
+must restart the estimate at the next fix, and a measurement from before the motion history
+must be dropped.
+
+Usage: fusion_sim [seconds] [seed]
+Exits with 1 if a check fails.
+*/
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "AttitudeEstimator.h"
+#include "Globals.h"
+
+using namespace std;
+
+const long long TICK_NS = 1000000;
+const int CENTROID_TICKS = 10; // 100 Hz
+const int CENTROID_AGE_TICKS = 20;
+const int FIX_TICKS = 2000; // 0.5 Hz
+const int FIX_AGE_TICKS = 500;
+
+// The sky and the robot, in the sense of the estimator's error (target minus current)
+struct Truth {
+    double error[2] = {300, -200}; // arcsec
+    double drift[2] = {12, -5}; // arcsec/s
+    double bias[2] = {40, -25}; // arcsec
+    vector<double> history[2]; // The error at every tick, for the late measurements
+};
+
+int main(int argc, char* argv[]) {
+    double seconds = argc > 1 ? atof(argv[1]) : 60;
+    int seed = argc > 2 ? atoi(argv[2]) : 1;
+    mt19937 rng(seed);
+    normal_distribution<double> unit(0, 1);
+
+    AttitudeNoise noise;
+    AttitudeEstimator est;
+    est.Configure(noise);
+    Truth truth;
+    const double step_size[2] = {ARCSEC_PER_YAW_STEP, ARCSEC_PER_EL_STEP};
+    double command[2] = {0, 0}; // Motion asked for but not yet a whole step (arcsec)
+    double max_error[2] = {0, 0}, sum_sq[2] = {0, 0};
+    int num_compared = 0;
+
+    long long num_ticks = (long long)(seconds*1e9/TICK_NS);
+    long long t_ns = 0;
+    for (long long k = 0; k < num_ticks; k++) {
+        t_ns += TICK_NS;
+        // Null the estimate with a 0.1 s time constant, plus an offset move of 30 arcsec
+        // every 3 s, all in whole steps
+        double offset = ((k/3000) % 2) ? 30 : 0;
+        double last_offset = (((k - 1)/3000) % 2 && k > 0) ? 30 : 0;
+        double motion[2];
+        for (int axis = 0; axis < 2; axis++) {
+            double estimate = est.initialised() ? (axis == 0 ? est.az() : est.alt()) : 0;
+            command[axis] += -0.01*estimate + (offset - last_offset);
+            int steps = (int)lround(command[axis]/step_size[axis]);
+            motion[axis] = steps*step_size[axis];
+            command[axis] -= motion[axis];
+            truth.error[axis] += truth.drift[axis]*TICK_NS*1e-9 + motion[axis];
+            truth.history[axis].push_back(truth.error[axis]);
+        }
+        est.Predict(t_ns, motion[0], motion[1]);
+
+        if (k % CENTROID_TICKS == 5 && k >= CENTROID_AGE_TICKS) {
+            double z[2];
+            for (int axis = 0; axis < 2; axis++) {
+                z[axis] = truth.history[axis][k - CENTROID_AGE_TICKS] + truth.bias[axis] +
+                          noise.centroid_sigma*unit(rng);
+            }
+            est.Centroid(t_ns, z[0], z[1], CENTROID_AGE_TICKS*TICK_NS*1e-9);
+        }
+        if (k % FIX_TICKS == 1000 && k >= FIX_AGE_TICKS) {
+            double z[2];
+            for (int axis = 0; axis < 2; axis++) {
+                z[axis] = truth.history[axis][k - FIX_AGE_TICKS] + noise.fix_sigma*unit(rng);
+            }
+            est.Fix(t_ns, z[0], z[1], 0, FIX_AGE_TICKS*TICK_NS*1e-9);
+        }
+
+        if (k >= num_ticks/2) {
+            double estimate[2] = {est.az(), est.alt()};
+            for (int axis = 0; axis < 2; axis++) {
+                double d = estimate[axis] - truth.error[axis];
+                max_error[axis] = max(max_error[axis], fabs(d));
+                sum_sq[axis] += d*d;
+            }
+            num_compared++;
+        }
+    }
+
+    int fail = 0;
+    AttitudeAxisState state[2] = {est.az_state(), est.alt_state()};
+    const char* names[2] = {"az", "alt"};
+    printf("%.0f s: %d fixes, %d centroids, %d rejected, %d restarts\n", seconds, est.fixes(), est.centroids(),
+           est.rejected(), est.restarts());
+    printf("%4s %10s %10s %10s %10s %10s %10s %10s %10s\n", "axis", "rms err", "max err", "err sig", "drift", "true",
+           "bias", "true", "bias sig");
+    for (int axis = 0; axis < 2; axis++) {
+        double rms = sqrt(sum_sq[axis]/max(num_compared, 1));
+        printf("%4s %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n", names[axis], rms, max_error[axis],
+               state[axis].error_sigma, state[axis].drift, truth.drift[axis], state[axis].bias, truth.bias[axis],
+               state[axis].bias_sigma);
+        // The error is as good as the estimator claims: mostly the bias, from the fixes' noise
+        // averaged over a few fixes
+        fail |= rms > 2*state[axis].error_sigma || max_error[axis] > 5*state[axis].error_sigma;
+        fail |= fabs(state[axis].drift - truth.drift[axis]) > 1.0;
+        fail |= fabs(state[axis].bias - truth.bias[axis]) > max(3*state[axis].bias_sigma, 1.0);
+    }
+    fail |= est.restarts() != 0;
+
+    // A slip of the wheels the steps miss: the centroids are outliers until the next fix
+    // restarts the estimate from it
+    for (int axis = 0; axis < 2; axis++) {
+        truth.error[axis] += 200;
+    }
+    int rejected = est.rejected();
+    for (int k = 0; k < 5*CENTROID_TICKS; k += CENTROID_TICKS) {
+        t_ns += CENTROID_TICKS*TICK_NS;
+        est.Predict(t_ns, 0, 0);
+        est.Centroid(t_ns, truth.error[0] + truth.bias[0], truth.error[1] + truth.bias[1], 0);
+    }
+    int restart = est.Fix(t_ns, truth.error[0], truth.error[1], 0, 0);
+    printf("Slip: %d centroids rejected, fix returned %d, error %.3f %.3f after\n", est.rejected() - rejected,
+           restart, est.az() - truth.error[0], est.alt() - truth.error[1]);
+    fail |= est.rejected() - rejected != 5 || restart != 1 || est.restarts() != 1;
+    fail |= fabs(est.az() - truth.error[0]) > 1e-9 || fabs(est.alt() - truth.error[1]) > 1e-9;
+
+    // Measurements from before the motion history can't be brought up to now
+    AttitudeNoise patient = noise;
+    patient.max_age_s = 10;
+    AttitudeEstimator late;
+    late.Configure(patient);
+    for (int k = 1; k <= ATTITUDE_HISTORY + 1000; k++) {
+        late.Predict(k*TICK_NS, 0.01, 0);
+    }
+    double history_s = ATTITUDE_HISTORY*TICK_NS*1e-9;
+    long long now = (ATTITUDE_HISTORY + 1000)*TICK_NS;
+    int old_fix = late.Fix(now, 0, 0, 0, history_s + 0.5);
+    int old_centroid = late.Centroid(now, 0, 0, history_s + 0.5);
+    int recent_fix = late.Fix(now, 0, 0, 0, history_s - 0.5);
+    printf("Older than the history: fix %d, centroid %d; within it: fix %d\n", old_fix, old_centroid, recent_fix);
+    fail |= old_fix != -1 || old_centroid != -1 || recent_fix != 1 || late.rejected() != 2;
+
+    printf(fail ? "FAIL\n" : "PASS\n");
+    return fail;
+}
@@ -0,0 +1,139 @@
+/*
+Check of the kinematics (Kinematics.cpp), with no hardware.
+
+The default mixing is compared with the hand-coded formulas it replaced in
+UpdateBFFVelocityAngle and get_movement, forward*inverse is checked against the identity,
+a badly conditioned mixing (a Hilbert matrix) must be refused with the old mixing
+kept, and the time of one matrix-vector product in each direction printed.
+
+Usage: kinematics_check [mixing.csv]
+Exits with 1 if any check fails.
+*/
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include "Globals.h"
+#include "Kinematics.h"
+
+using namespace std;
+
+const double TOLERANCE = 1e-9;
+
+// The velocity mixing as it was hand-coded in UpdateBFFVelocityAngle
+void OldVelocities(const double *b, double *v) {
+    v[0] = -b[1] - b[5]*ROBOT_RADIUS;
+    v[1] = (-b[0]*sin(PI/3) + b[1]*cos(PI/3)) - b[5]*ROBOT_RADIUS;
+    v[2] = (b[0]*sin(PI/3) + b[1]*cos(PI/3)) - b[5]*ROBOT_RADIUS;
+    v[3] = -(b[2] + ACT_RADIUS*(COS30*b[3] - SIN30*b[4]));
+    v[4] = -(b[2] + ACT_RADIUS*b[4]);
+    v[5] = -(b[2] + ACT_RADIUS*(-COS30*b[3] - SIN30*b[4]));
+    v[6] = b[6];
+}
+
+// The movement as it was hand-coded in get_movement (mm and degrees: x, y, z, az, el)
+void OldMovement(const int *d, double *m) {
+    double mm_per_step = 295E-9*1000;
+    m[0] = -mm_per_step*COS30*(2.0/3)*d[1] + mm_per_step*COS30*(2.0/3)*d[2];
+    m[1] = -mm_per_step*(2.0/3)*d[0] + mm_per_step*(1.0/3)*d[1] + mm_per_step*(1.0/3)*d[2];
+    m[2] = (d[3] + d[4] + d[5])*39E-6/3;
+    m[3] = (d[0] + d[1] + d[2])*295E-9/ROBOT_RADIUS/ARCSEC_TO_RAD/3/3600.0;
+    m[4] = d[6]*0.090/3600.0;
+}
+
+int main(int argc, char *argv[]) {
+    int fail = 0;
+    Kinematics kinematics;
+    mt19937 rng(1);
+    uniform_real_distribution<double> uniform(-0.01, 0.01);
+    uniform_int_distribution<int> steps(-1000000, 1000000);
+
+    double error = kinematics.IdentityError();
+    printf("Default mixing: forward*inverse identity error %.3g\n", error);
+    fail |= error > TOLERANCE;
+
+    double velocity_error = 0, movement_error = 0;
+    for (int trial = 0; trial < 1000; trial++) {
+        KinematicsVector body;
+        for (int i = 0; i < KINEMATICS_AXES; i++) {
+            body[i] = uniform(rng);
+        }
+        double v[KINEMATICS_AXES], v_old[KINEMATICS_AXES];
+        kinematics.MotorVelocities(body, v);
+        OldVelocities(body.data(), v_old);
+        for (int i = 0; i < KINEMATICS_AXES; i++) {
+            velocity_error = max(velocity_error, fabs(v[i] - v_old[i]));
+        }
+        int d[KINEMATICS_AXES];
+        for (int i = 0; i < KINEMATICS_AXES; i++) {
+            d[i] = steps(rng);
+        }
+        KinematicsVector x = kinematics.BodyDisplacement(d);
+        double m[5] = {x[0]*1000, x[1]*1000, x[2]*1000, -x[5]/DEG_TO_RAD, x[6]/DEG_TO_RAD};
+        double m_old[5];
+        OldMovement(d, m_old);
+        for (int i = 0; i < 5; i++) {
+            movement_error = max(movement_error, fabs(m[i] - m_old[i]));
+        }
+    }
+    printf("Largest difference from the hand-coded formulas: %.3g m/s (or rad/s), %.3g mm (or deg)\n",
+           velocity_error, movement_error);
+    fail |= velocity_error > TOLERANCE || movement_error > TOLERANCE;
+
+    // A badly conditioned mixing is refused, keeping the old one
+    const char *hilbert_file = "/tmp/kinematics_check_hilbert.csv";
+    FILE *file = fopen(hilbert_file, "w");
+    if (file) {
+        for (int i = 0; i < KINEMATICS_AXES; i++) {
+            for (int j = 0; j < KINEMATICS_AXES; j++) {
+                fprintf(file, "%s%.17g", j ? "," : "", 1.0/(i + j + 1));
+            }
+            fprintf(file, "\n");
+        }
+        fclose(file);
+        Kinematics refused;
+        if (refused.LoadMixing(hilbert_file) == 0 || refused.mixing() != kinematics.mixing() ||
+                refused.IdentityError() > TOLERANCE) {
+            printf("A badly conditioned mixing was not refused\n");
+            fail = 1;
+        }
+        remove(hilbert_file);
+    }
+
+    if (argc > 1) {
+        Kinematics loaded;
+        if (loaded.LoadMixing(argv[1])) {
+            fail = 1;
+        } else {
+            error = loaded.IdentityError();
+            printf("%s: forward*inverse identity error %.3g\n", argv[1], error);
+            fail |= error > TOLERANCE;
+        }
+    }
+
+    // Time each direction, with the result kept so that it isn't optimised away
+    const int n = 1000000;
+    KinematicsVector body = KinematicsVector::Constant(0.001);
+    double v[KINEMATICS_AXES];
+    int d[KINEMATICS_AXES] = {1, 2, 3, 4, 5, 6, 7};
+    double sum = 0;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < n; i++) {
+        body[0] = i*1e-9;
+        kinematics.MotorVelocities(body, v);
+        sum += v[1];
+    }
+    auto middle = chrono::steady_clock::now();
+    for (int i = 0; i < n; i++) {
+        d[0] = i;
+        sum += kinematics.BodyDisplacement(d)[0];
+    }
+    auto end = chrono::steady_clock::now();
+    printf("%.1f ns per velocity mixing, %.1f ns per displacement (checksum %g)\n",
+           chrono::duration<double, nano>(middle - start).count()/n,
+           chrono::duration<double, nano>(end - middle).count()/n, sum);
+
+    printf(fail ? "FAIL\n" : "PASS\n");
+    return fail;
+}
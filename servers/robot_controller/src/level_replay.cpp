@@ -0,0 +1,397 @@
+/*
+Replay check of the levelling filters (LevelFilter.cpp) on recorded or simulated
+accelerometer data.
+
+With a recorded log, either a telemetry file (.tlm, e.g. the resonance log or a
+robot_ticks capture) or a CSV file (e.g. one converted by read_telemetry.py) with
+accelerometer0_x ... accelerometer2_z columns, every sample is fused with
+FuseThree and with the sort-based robust_mean it replaced, which must agree
+exactly. The pitch and roll are then filtered by the old 10-sample shift average
+and by each filter type, and the noise about a centred (zero lag) 101-sample mean
+and the lag behind it are printed, with the largest gain of each filter above
+0.15 times the sample rate, where the structural resonances are. Records of a log
+in which accelerometer_time_ns did not change repeat the last sample and are
+skipped; the sample rate is then taken from accelerometer_time_ns unless given.
+
+Without a file, a simulated tilt (steps and ramps, with noise and an occasional
+glitch on one accelerometer) is used instead, and the errors are relative to
+the true tilt.
+
+Usage: level_replay [file.tlm|file.csv|sim] [sample_hz] [cutoff_hz]
+Exits with 1 if the fusion disagrees with robust_mean.
+*/
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "LevelFilter.h"
+#include "telemetry.hpp"
+
+using namespace std;
+
+// The fusion used before LevelFilter.h, for comparison
+double robust_mean(double a, double b, double c) {
+    double vals_[3] = {a, b, c};
+    std::sort(vals_, vals_ + 3);
+    double threshold = 0.10;
+    if ((vals_[1] - vals_[0]) > std::max(threshold, (vals_[2] - vals_[1]) * 3)) {
+        return (vals_[1] + vals_[2]) / 2.0;
+    } else if ((vals_[2] - vals_[1]) > std::max(threshold, (vals_[1] - vals_[0]) * 3)) {
+        return (vals_[0] + vals_[1]) / 2.0;
+    }
+    return (vals_[0] + vals_[1] + vals_[2]) / 3.0;
+}
+
+// The shift average used before LevelFilter.h
+double shift_mean(double* arr, double x) {
+    for (int i = 1; i <= 9; i++) {
+        arr[i-1] = arr[i];
+    }
+    arr[9] = x;
+    double mean = 0;
+    for (int i = 0; i <= 9; i++) {
+        mean += arr[i]/10.0;
+    }
+    return mean;
+}
+
+struct Sample {
+    double acc[3][3];
+    double truth_pitch, truth_roll;
+};
+
+// Read the accelerometer columns of a CSV file. Returns 1 on error
+int readCsv(const char* filename, vector<Sample>* samples) {
+    ifstream in(filename);
+    string line;
+    if (!getline(in, line)) {
+        printf("Could not read %s\n", filename);
+        return 1;
+    }
+    vector<string> names;
+    stringstream header(line);
+    string name;
+    while (getline(header, name, ',')) {
+        names.push_back(name);
+    }
+    int columns[3][3];
+    const char* axes = "xyz";
+    for (int i = 0; i < 3; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            string want = "accelerometer" + to_string(i) + "_" + axes[axis];
+            auto it = find(names.begin(), names.end(), want);
+            if (it == names.end()) {
+                printf("No column %s in %s\n", want.c_str(), filename);
+                return 1;
+            }
+            columns[i][axis] = it - names.begin();
+        }
+    }
+    while (getline(in, line)) {
+        vector<double> values;
+        stringstream row(line);
+        string value;
+        while (getline(row, value, ',')) {
+            values.push_back(atof(value.c_str()));
+        }
+        if (values.size() < names.size()) {
+            continue;
+        }
+        Sample s = {};
+        for (int i = 0; i < 3; i++) {
+            for (int axis = 0; axis < 3; axis++) {
+                s.acc[i][axis] = values[columns[i][axis]];
+            }
+        }
+        s.truth_pitch = s.truth_roll = NAN;
+        samples->push_back(s);
+    }
+    return 0;
+}
+
+// Value of a telemetry field of the given type
+double fieldValue(const unsigned char* src, char type) {
+    switch (type) {
+        case telemetry::F64: { double v; memcpy(&v, src, 8); return v; }
+        case telemetry::F32: { float v; memcpy(&v, src, 4); return v; }
+        case telemetry::I64: { int64_t v; memcpy(&v, src, 8); return v; }
+        case telemetry::U64: { uint64_t v; memcpy(&v, src, 8); return v; }
+        case telemetry::I32: { int32_t v; memcpy(&v, src, 4); return v; }
+        case telemetry::U32: { uint32_t v; memcpy(&v, src, 4); return v; }
+        case telemetry::I16: { int16_t v; memcpy(&v, src, 2); return v; }
+        case telemetry::U16: { uint16_t v; memcpy(&v, src, 2); return v; }
+        case telemetry::I8: return (int8_t)src[0];
+        case telemetry::U8: return src[0];
+    }
+    return NAN;
+}
+
+// Read the accelerometer fields of a telemetry file. *sample_hz is set from
+// accelerometer_time_ns if the file has it. Returns 1 on error
+int readTlm(const char* filename, vector<Sample>* samples, double* sample_hz) {
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        printf("Could not read %s\n", filename);
+        return 1;
+    }
+    telemetry::FileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || strncmp(header.magic, "PYXTLM1", 8) != 0) {
+        printf("%s is not a telemetry file\n", filename);
+        fclose(file);
+        return 1;
+    }
+    vector<telemetry::FieldHeader> fields(header.num_fields);
+    if (fread(fields.data(), sizeof(telemetry::FieldHeader), header.num_fields, file) != header.num_fields) {
+        printf("Could not read the fields of %s\n", filename);
+        fclose(file);
+        return 1;
+    }
+    // Offset of each field in a record, after the timestamp
+    int columns[3][3] = {{-1, -1, -1}, {-1, -1, -1}, {-1, -1, -1}};
+    int time_column = -1;
+    vector<size_t> offsets;
+    size_t offset = sizeof(uint64_t);
+    const char* axes = "xyz";
+    for (size_t f = 0; f < fields.size(); f++) {
+        string name(fields[f].name, strnlen(fields[f].name, sizeof(fields[f].name)));
+        for (int i = 0; i < 3; i++) {
+            for (int axis = 0; axis < 3; axis++) {
+                if (name == "accelerometer" + to_string(i) + "_" + axes[axis]) {
+                    columns[i][axis] = f;
+                }
+            }
+        }
+        if (name == "accelerometer_time_ns") {
+            time_column = f;
+        }
+        offsets.push_back(offset);
+        offset += telemetry::fieldSize((telemetry::FieldType)fields[f].type);
+    }
+    if (offset != header.record_size) {
+        printf("Record size mismatch in %s\n", filename);
+        fclose(file);
+        return 1;
+    }
+    for (int i = 0; i < 3; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            if (columns[i][axis] < 0) {
+                printf("No field accelerometer%d_%c in %s\n", i, axes[axis], filename);
+                fclose(file);
+                return 1;
+            }
+        }
+    }
+
+    // A partially written final record is ignored
+    fseek(file, header.header_size, SEEK_SET);
+    vector<unsigned char> record(header.record_size);
+    double first_time = NAN, last_time = NAN;
+    while (fread(record.data(), header.record_size, 1, file) == 1) {
+        if (time_column >= 0) {
+            double t = fieldValue(&record[offsets[time_column]], fields[time_column].type);
+            if (t == last_time) {
+                continue;
+            }
+            if (std::isnan(first_time)) {
+                first_time = t;
+            }
+            last_time = t;
+        }
+        Sample s = {};
+        for (int i = 0; i < 3; i++) {
+            for (int axis = 0; axis < 3; axis++) {
+                int f = columns[i][axis];
+                s.acc[i][axis] = fieldValue(&record[offsets[f]], fields[f].type);
+            }
+        }
+        s.truth_pitch = s.truth_roll = NAN;
+        samples->push_back(s);
+    }
+    fclose(file);
+    if (time_column >= 0 && samples->size() > 1 && last_time > first_time) {
+        *sample_hz = 1e9*(samples->size() - 1)/(last_time - first_time);
+    }
+    return 0;
+}
+
+// Simulated tilt of a few tenths of a degree, in the leveller's frame
+void simulate(int n, double sample_hz, vector<Sample>* samples) {
+    mt19937 rng(1);
+    normal_distribution<double> noise(0, 0.02);
+    for (int k = 0; k < n; k++) {
+        double t = k / sample_hz;
+        double pitch = (fmod(t, 2.0) < 1.0 ? 0.3 : -0.2) + 0.1*sin(2*M_PI*0.7*t);
+        double roll = 0.2*fmod(t, 1.5);
+        double g[3] = {9.81*sin(pitch*M_PI/180), 9.81*cos(pitch*M_PI/180)*sin(roll*M_PI/180),
+                       9.81*cos(pitch*M_PI/180)*cos(roll*M_PI/180)};
+        Sample s;
+        // The raw axes of each accelerometer, as undone in UpdateTarget
+        for (int i = 0; i < 3; i++) {
+            s.acc[i][0] = (i == 0 ? -g[0] : i == 1 ? -g[1] : g[0]) + noise(rng);
+            s.acc[i][1] = (i == 0 ? -g[1] : i == 1 ? g[0] : g[1]) + noise(rng);
+            s.acc[i][2] = g[2] + noise(rng);
+        }
+        if (k % 500 == 250) {
+            s.acc[k % 3][0] += 1.0;
+        }
+        s.truth_pitch = pitch;
+        s.truth_roll = roll;
+        samples->push_back(s);
+    }
+}
+
+// Fused acceleration in the leveller's frame, as in UpdateTarget (no offsets)
+void fuse(const Sample& s, double (*fusion)(double, double, double), double* x, double* y, double* z) {
+    *x = fusion(-s.acc[0][0], s.acc[1][1], s.acc[2][0]);
+    *y = fusion(-s.acc[0][1], -s.acc[1][0], s.acc[2][1]);
+    *z = fusion(s.acc[0][2], s.acc[1][2], s.acc[2][2]);
+}
+
+double fuseThree(double a, double b, double c) {
+    return FuseThree(a, b, c);
+}
+
+// RMS of the difference to the reference, and the lag (samples) that minimises it
+void compare(const vector<double>& filtered, const vector<double>& reference, double* rms, int* lag) {
+    double best = INFINITY;
+    for (int shift = 0; shift <= 50; shift++) {
+        double sum = 0;
+        int n = 0;
+        for (size_t k = 100; k < filtered.size(); k++) {
+            if (!std::isnan(reference[k - shift])) {
+                double d = filtered[k] - reference[k - shift];
+                sum += d*d;
+                n++;
+            }
+        }
+        double r = sqrt(sum / std::max(n, 1));
+        if (shift == 0) {
+            *rms = r;
+        }
+        if (r < best) {
+            best = r;
+            *lag = shift;
+        }
+    }
+}
+
+// Largest gain of a filter for sine waves from 0.15 times the sample rate to Nyquist
+double stopbandGain(int type, double cutoff_hz, double sample_hz) {
+    double worst = 0;
+    for (double f = 0.15*sample_hz; f < 0.5*sample_hz; f += 0.005*sample_hz) {
+        LevelFilter filter;
+        filter.Configure(type, 10, cutoff_hz, sample_hz);
+        double peak = 0;
+        for (int k = 0; k < 400; k++) {
+            double y = filter.Update(sin(2*M_PI*f*k/sample_hz), 0, 1/sample_hz);
+            if (k >= 200) {
+                peak = std::max(peak, std::abs(y));
+            }
+        }
+        worst = std::max(worst, peak);
+    }
+    return worst;
+}
+
+bool endsWith(const string& s, const string& suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    string source = argc > 1 ? argv[1] : "sim";
+    double sample_hz = argc > 2 ? atof(argv[2]) : 0;
+    double cutoff_hz = argc > 3 ? atof(argv[3]) : 60;
+    double file_hz = 0;
+    vector<Sample> samples;
+    if (source == "sim") {
+        if (sample_hz <= 0) {
+            sample_hz = 1000;
+        }
+        simulate(20000, sample_hz, &samples);
+    } else if (endsWith(source, ".tlm")) {
+        if (readTlm(source.c_str(), &samples, &file_hz)) {
+            return 1;
+        }
+    } else if (readCsv(source.c_str(), &samples)) {
+        return 1;
+    }
+    if (sample_hz <= 0) {
+        sample_hz = file_hz > 0 ? file_hz : 1000;
+    }
+    size_t n = samples.size();
+    if (n < 300) {
+        printf("Too few samples (%zu)\n", n);
+        return 1;
+    }
+
+    // Fusion, which must match robust_mean exactly
+    vector<double> pitch(n), roll(n);
+    for (size_t k = 0; k < n; k++) {
+        double x, y, z, x0, y0, z0;
+        fuse(samples[k], fuseThree, &x, &y, &z);
+        fuse(samples[k], robust_mean, &x0, &y0, &z0);
+        if (x != x0 || y != y0 || z != z0) {
+            printf("FAIL: FuseThree differs from robust_mean at sample %zu\n", k);
+            return 1;
+        }
+        pitch[k] = atan(x/sqrt(z*z + y*y))*180.0/M_PI;
+        roll[k] = atan(y/z)*180/M_PI;
+    }
+
+    // Reference: the true tilt, or a centred mean of the recorded one
+    vector<double> ref_pitch(n), ref_roll(n);
+    for (size_t k = 0; k < n; k++) {
+        if (!std::isnan(samples[k].truth_pitch)) {
+            ref_pitch[k] = samples[k].truth_pitch;
+            ref_roll[k] = samples[k].truth_roll;
+        } else if (k < 50 || k + 50 >= n) {
+            ref_pitch[k] = ref_roll[k] = NAN;
+        } else {
+            double p = 0, r = 0;
+            for (size_t j = k - 50; j <= k + 50; j++) {
+                p += pitch[j];
+                r += roll[j];
+            }
+            ref_pitch[k] = p / 101;
+            ref_roll[k] = r / 101;
+        }
+    }
+
+    printf("%zu samples at %g Hz, cutoff %g Hz\n", n, sample_hz, cutoff_hz);
+    printf("%-16s %12s %10s %12s %10s %10s %10s\n", "filter", "pitch rms", "lag", "roll rms", "lag", "stopband", "ns/sample");
+    const char* names[4] = {"shift mean (old)", "mean", "biquad", "complementary"};
+    for (int type = -1; type <= LEVEL_FILTER_COMPLEMENTARY; type++) {
+        LevelFilter pitch_filter, roll_filter;
+        pitch_filter.Configure(type < 0 ? LEVEL_FILTER_MEAN : type, 10, cutoff_hz, sample_hz);
+        roll_filter.Configure(type < 0 ? LEVEL_FILTER_MEAN : type, 10, cutoff_hz, sample_hz);
+        double pitch_arr[10] = {0}, roll_arr[10] = {0};
+        vector<double> out_pitch(n), out_roll(n);
+        auto start = chrono::steady_clock::now();
+        for (size_t k = 0; k < n; k++) {
+            if (type < 0) {
+                out_pitch[k] = shift_mean(pitch_arr, pitch[k]);
+                out_roll[k] = shift_mean(roll_arr, roll[k]);
+            } else {
+                out_pitch[k] = pitch_filter.Update(pitch[k], 0, 1/sample_hz);
+                out_roll[k] = roll_filter.Update(roll[k], 0, 1/sample_hz);
+            }
+        }
+        double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / n;
+        double pitch_rms, roll_rms;
+        int pitch_lag, roll_lag;
+        compare(out_pitch, ref_pitch, &pitch_rms, &pitch_lag);
+        compare(out_roll, ref_roll, &roll_rms, &roll_lag);
+        double stopband = stopbandGain(type < 0 ? LEVEL_FILTER_MEAN : type, cutoff_hz, sample_hz);
+        printf("%-16s %12.5f %10d %12.5f %10d %10.3f %10.1f\n", names[type + 1], pitch_rms, pitch_lag, roll_rms, roll_lag,
+               stopband, ns);
+    }
+    printf("PASS\n");
+    return 0;
+}
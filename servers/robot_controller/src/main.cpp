@@ -7,8 +7,11 @@ robot controller are defined in the robotControllerServerFuncs.cpp file.
 #include <string>
 #include <fstream>
 #include <iostream>
+#include <sys/mman.h>
 #include "toml.hpp"
 #include "Globals.h"
+#include "LevelFilter.h"
+#include "Kinematics.h"
 
 namespace co = commander;
 using namespace std;
@@ -17,9 +20,6 @@ using namespace std;
 double g_roll_gain = -0.08;
 double g_pitch_gain = -0.08;
 
-double g_roll_target = 0;
-double g_pitch_target = 0;
-
 double g_z_acc_offset0 = 0;
 double g_x_acc_offset0 = 0;
 double g_y_acc_offset0 = 0;
@@ -30,6 +30,14 @@ double g_z_acc_offset2 = 0;
 double g_x_acc_offset2 = 0;
 double g_y_acc_offset2 = 0;
 
+int g_level_filter = LEVEL_FILTER_MEAN;
+int g_level_filter_length = 10;
+double g_level_cutoff_hz = 60;
+double g_level_rate_feedforward = 0;
+
+bool g_fusion_enabled = false;
+AttitudeNoise g_attitude_noise;
+
 // Main server function. Accepts one parameter: link to the camera config file.
 int main(int argc, char* argv[]) {
 
@@ -76,12 +84,12 @@ int main(int argc, char* argv[]) {
 
     // Add the roll and pitch target from the config file
     if (config["roll_target"].is_number()) {
-        g_roll_target = config["roll_target"].value_or(g_roll_target);
+        g_ctrl.roll_target = config["roll_target"].value_or(g_ctrl.roll_target);
     } else {
         cout << "Roll target not found in config file, using default value" << endl;
     }
     if (config["pitch_target"].is_number()) {
-        g_pitch_target = config["pitch_target"].value_or(g_pitch_target);
+        g_ctrl.pitch_target = config["pitch_target"].value_or(g_ctrl.pitch_target);
     } else {
         cout << "Pitch target not found in config file, using default value" << endl;
     }
@@ -131,6 +139,57 @@ int main(int argc, char* argv[]) {
         cout << "Y accelerometer offset not found in config file, using default value" << endl;
     }
 
+    // Levelling filter: "mean" of level_filter_length samples (the default), or "biquad" or
+    // "complementary" low-pass at level_cutoff_hz
+    string level_filter = config["level_filter"].value_or("mean");
+    g_level_filter = LevelFilterType(level_filter.c_str());
+    if (g_level_filter < 0) {
+        cout << "Unknown level_filter " << level_filter << ", using mean" << endl;
+        g_level_filter = LEVEL_FILTER_MEAN;
+    }
+    g_level_filter_length = config["level_filter_length"].value_or(g_level_filter_length);
+    g_level_cutoff_hz = config["level_cutoff_hz"].value_or(g_level_cutoff_hz);
+    g_level_rate_feedforward = config["level_rate_feedforward"].value_or(g_level_rate_feedforward);
+
+    // Fusion of the star tracker fixes and centroids with the step counts (see AttitudeEstimator.h)
+    g_fusion_enabled = config["fusion"].value_or(g_fusion_enabled);
+    AttitudeNoise &n = g_attitude_noise;
+    n.fix_sigma = config["fusion_fix_sigma"].value_or(n.fix_sigma);
+    n.centroid_sigma = config["fusion_centroid_sigma"].value_or(n.centroid_sigma);
+    n.error_walk = config["fusion_error_walk"].value_or(n.error_walk);
+    n.drift_walk = config["fusion_drift_walk"].value_or(n.drift_walk);
+    n.bias_walk = config["fusion_bias_walk"].value_or(n.bias_walk);
+    n.drift_sigma = config["fusion_drift_sigma"].value_or(n.drift_sigma);
+    n.bias_sigma = config["fusion_bias_sigma"].value_or(n.bias_sigma);
+    n.gate = config["fusion_gate"].value_or(n.gate);
+    n.max_age_s = config["fusion_max_age_s"].value_or(n.max_age_s);
+
+    // Real-time settings for the robot loop
+    g_loop_period_us = config["loop_period_us"].value_or(g_loop_period_us);
+    if (g_loop_period_us < 100) {
+        cout << "Loop period must be at least 100us, using 1000us" << endl;
+        g_loop_period_us = 1000;
+    }
+    g_loop_cpu = config["loop_cpu"].value_or(g_loop_cpu);
+    g_loop_priority = config["loop_priority"].value_or(g_loop_priority);
+
+    // Mixing between the body and motor velocities, from the geometry unless a file is given
+    string kinematics_file = config["kinematics_file"].value_or("");
+    if (!kinematics_file.empty() && g_kinematics.LoadMixing(kinematics_file)) {
+        cout << "Using the default kinematics" << endl;
+    }
+    cout << "Kinematics forward*inverse identity error: " << g_kinematics.IdentityError() << endl;
+
+    // Ring of the last tick_ring_s seconds of loop ticks, allocated before the memory is locked
+    g_tick_ring_s = config["tick_ring_s"].value_or(g_tick_ring_s);
+    InitTickRecorder(g_tick_ring_s);
+
+    // Lock all current and future memory, so that the robot loop never page faults
+    if (config["lock_memory"].value_or(true)) {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+            cout << "Could not lock memory: " << strerror(errno) << endl;
+        }
+    }
 
     // Retrieve port and IP
     string port = config["port"].value_or("4200");
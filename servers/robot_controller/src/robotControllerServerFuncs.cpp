@@ -16,7 +16,7 @@ void track(RobotDriver *driver) :
 
 robot_loop
 
-Includes the main state machine based on GLOBAL_SERVER_STATUS
+Includes the main state machine based on g_ctrl.mode
 
 3) The watchdog thread, which checks the robot loop is alive and restarts it if not
 
@@ -32,60 +32,43 @@ Includes the main state machine based on GLOBAL_SERVER_STATUS
 #include <pthread.h>
 #include <commander/commander.h>
 #include <time.h>
+#include <unistd.h>
 #include <vector>
+#include <atomic>
+#include <initializer_list>
+#include <algorithm>
 #include "Globals.h"
+#include "telemetry.hpp"
+#include "Kinematics.h"
 
 
 namespace co = commander;
 using namespace std;
 
-sched_param sch_params;
-
-string g_filename = "state_file.csv";
-// Status of 2 angles, 7 offsets and loop status. Initialised to zero.
-Status g_status = {0.0, 0.0, 
-                   {0, 0, 0, 0, 0, 0, 0}, // delta_motors
-                   ROBOT_IDLE, 0, ST_IDLE}; // loop_status and loop_counter
-std::mutex GLOB_STATUS_LOCK;
-
 std::thread robot_controller_thread;
 std::thread watchdog_thread;
 
 // For the watchdog thread
-int alive_counter = 1;
+std::atomic<int> alive_counter{1};
 int last_alive_counter = 0;
-
-// A convenience local global vor zero velocities;
-Velocities g_zero_vel = {
-    0.0, // velocity
-    0.0, // x
-    0.0, // y
-    0.0, // z
-    0.0, // roll
-    0.0, // yaw
-    0.0, // pitch
-    0.0  // el
-};
-Velocities g_vel = g_zero_vel;
-
-// Heading gain, plus gians and integral terms for yaw ane elevation control
-double h_gain = 0.0;
-double g_ygain = 0.0;
-double g_egain = 0.0;
-double g_yint = 0.0;
-double g_eint = 0.0;
-
-double g_esum = 0.0;
-double g_ysum = 0.0;
-
-double g_az = 0.0;
-double g_alt = 60.0;
-double g_posang = 0.0;
-double g_az_off = 0.0;
-double g_alt_off = 0.0;
-
-double g_yaw_target = 0.0;
-double g_el_target = 0.0;
+std::atomic<bool> disconnecting{false};
+
+// Send a command to the robot loop, which applies it at the start of its next tick.
+// Returns 0, or -1 if the loop has not kept up with the commands.
+int SendCommand(int type, std::initializer_list<double> args = {}, const string& text = "") {
+    ControlCommand cmd;
+    cmd.type = type;
+    int i = 0;
+    for (double arg : args) {
+        cmd.args[i++] = arg;
+    }
+    strncpy(cmd.text, text.c_str(), sizeof(cmd.text) - 1);
+    if (g_commands.Push(cmd) != 0) {
+        cout << "Robot command mailbox full, command " << type << " dropped" << endl;
+        return -1;
+    }
+    return 0;
+}
 
 struct LEDs {
     double LED1_x; 
@@ -102,28 +85,27 @@ struct Movements {
     double el;
 };
 
-// A heading is a coarse angle in degrees, which is used to control the robot's direction
-double g_heading = 0.0;
-
 // This is the watchdog thread that checks if the robot loop is alive (i.e. hasn't hung) and
 // restarts it if it has. 
 void watchdog() {
 	//start up robot thread procedure
+	// The robot loop sets its own CPU affinity and real-time priority.
 	robot_controller_thread = std::thread(robot_loop);
-    //sch_params.sched_priority = 90;
-    pthread_setschedparam(robot_controller_thread.native_handle(), SCHED_RR, &sch_params);
 	cout << "started\n";
 	usleep(1000000);
 		// inner loop, while not disconnecting, check robot thread active
 		// if not active, kill, restart
 		// sleep 100ms
-	while(GLOBAL_SERVER_STATUS!=ROBOT_DISCONNECT) {
+	while(!disconnecting) {
 		if (alive_counter==last_alive_counter) {
 			cout << "killing\n";
 			pthread_cancel(robot_controller_thread.native_handle());
 			robot_controller_thread.join();
+			// Keep the ticks before the hang for capture_dump
+			if (g_tick_recorder != nullptr) {
+				g_tick_recorder->freeze("watchdog");
+			}
 			robot_controller_thread = std::thread(robot_loop);
-			pthread_setschedparam(robot_controller_thread.native_handle(), SCHED_RR, &sch_params);
 		}
 		last_alive_counter = alive_counter;
 		usleep(100000);
@@ -155,174 +137,89 @@ struct RobotControlServer {
     }
 
 	/*
-	Start the robot loop in the 
+	Start the robot loop in the idle state (or return it to idle if it is already running).
+	All of the functions below pass their changes to the robot loop as commands, and read
+	its published status, so that they never wait for the loop or see a torn state.
 	*/
-	//TO CHANGE
     int start_robot_loop() {
-        // If the robot is not in IDLE state (which means the robot was started before),
-        // then we only reset the status to ROBOT_IDLE without starting another watchdog thread.
-        if (GLOBAL_SERVER_STATUS == ROBOT_TRANSLATE ||
-            GLOBAL_SERVER_STATUS == ROBOT_RESONANCE ||
-            GLOBAL_SERVER_STATUS == ROBOT_TRACK) {
-            // Reset the status to IDLE
-            GLOBAL_SERVER_STATUS = ROBOT_IDLE;
-            GLOBAL_STATUS_CHANGED = true;
+        SendCommand(CMD_START);
+        // If the watchdog is running, the robot was started before, and going to idle is all we need
+        if (watchdog_thread.joinable()) {
             return 0;
         }
-        // If the robot is in IDLE or DISCONNNECT status, we start the watchdog thread and set the status to ROBOT_IDLE.
-        GLOBAL_SERVER_STATUS = ROBOT_IDLE;
-        GLOBAL_STATUS_CHANGED = true;
+        disconnecting = false;
         watchdog_thread = std::thread(watchdog);
-        //sch_params.sched_priority = 90;
-        pthread_setschedparam(watchdog_thread.native_handle(), SCHED_RR, &sch_params);
         return 0;
     }
 
 
     int stop_robot_loop() {
-        // Set all the velocities to zero
-        g_vel = g_zero_vel;
-        g_ygain = 0;
-        g_egain=0;
-        h_gain = 0;
-        GLOBAL_SERVER_STATUS = ROBOT_TRANSLATE;
-        GLOBAL_STATUS_CHANGED = true;
-        return 0;
+        // Set all the velocities and gains to zero
+        return SendCommand(CMD_STOP);
     }
 
 
     void translate_robot(double vel, double x_val, double y_val, double z_val, double roll_val, double pitch_val, double yaw_val, double el_val) {
-        g_vel.velocity = vel;
-        g_vel.x = x_val;
-        g_vel.y = y_val;
-        g_vel.z = z_val;
-        g_vel.roll = roll_val;
-        g_vel.yaw = yaw_val;
-        g_vel.pitch = pitch_val;
-        g_vel.el = el_val;
-        GLOBAL_STATUS_CHANGED = true;
-        GLOBAL_SERVER_STATUS = ROBOT_TRANSLATE;
+        SendCommand(CMD_TRANSLATE, {vel, x_val, y_val, z_val, roll_val, pitch_val, yaw_val, el_val});
     }
 
     void resonance_robot(double vel, double x_val, double y_val, double z_val, double roll_val, double pitch_val, double yaw_val) {
-        g_vel.velocity = vel;
-        g_vel.x = x_val;
-        g_vel.y = y_val;
-        g_vel.z = z_val;
-        g_vel.roll = roll_val;
-        g_vel.yaw = yaw_val;
-        g_vel.pitch = pitch_val;
-        GLOBAL_STATUS_CHANGED = true;
-        GLOBAL_SERVER_STATUS = ROBOT_RESONANCE;
+        SendCommand(CMD_RESONANCE, {vel, x_val, y_val, z_val, roll_val, pitch_val, yaw_val});
     }
     
     void change_file(string file) {
-        g_filename = file;
+        SendCommand(CMD_FILE, {}, file);
     }
 
     void receive_ST_angles(double azimuth, double altitude, double pos_angle) {
-    	// Receives the star-tracker angles in arcseconds and stores them in 
-    	// global variables az, alt and pos
-	    g_az = 206265.0*azimuth;
-	    g_alt = 206265.0*altitude;
-	    g_posang = 206265.0*pos_angle;
-        //Edited by Qianhui: normalise tha azimuth and altitude angles to be within -180 degrees to 180 degrees
-        double az_offset_deg = g_az / 3600.0 ;
-        while (az_offset_deg > 180.0) az_offset_deg -= 360.0;
-        while (az_offset_deg < -180.0) az_offset_deg += 360.0;
-        g_az = az_offset_deg * 3600.0; // Convert back to arcseconds
-        // If the Star Tracker is in waiting state and the robot is tracking, set the robot velocity, set the 
-        // target step counts, and set the Star Tracker state to MOVING.
-        if ((g_status.st_status == ST_READY_TO_SLEW) && (GLOBAL_SERVER_STATUS == ROBOT_TRACK)) {    
-            // If we are less than 1800 arcsec away in both axes (0.5 degrees), we move to traking mode right away.
-            if ((std::abs(g_az) < 1800) && (std::abs(g_alt) < 1800))
-            {
-                std::lock_guard<std::mutex> lock(GLOB_STATUS_LOCK);
-                g_status.st_status = ST_SLEW_CLOSE; 
-                std::cout << "RobotControllerServer: Star Tracker angles are less than 0.5deg, moving to tracking mode.\n";
-                return;
-            }
-            // If we are more than 1800 arcsec away in either axis, slew at 1 degree/s.
-            // We need to know arcseconds per step for yaw.
-            double arcsec_per_yaw_step = 295E-9/ROBOT_RADIUS/ARCSEC_TO_RAD/3;
-            int current_yaw_steps = g_status.delta_motors[0] + g_status.delta_motors[1] + g_status.delta_motors[2];
-            g_yaw_target = current_yaw_steps + g_az / arcsec_per_yaw_step;
-            if (g_az > 1800)
-                g_vel.yaw = -3600;
-            else if (g_az < -1800)
-                g_vel.yaw = 3600; 
-            else
-                g_vel.yaw = 0.0;
-            
-            // We need to know arcseconds per step for elevation.
-            double arcsec_per_el_step = 0.090;
-            g_el_target = g_status.delta_motors[6] + g_alt / arcsec_per_el_step;
-            if (g_alt > 1800)
-                g_vel.el = -3600; 
-            else if (g_alt < -1800)
-                g_vel.el = 3600; 
-            else
-                g_vel.el = 0.0;
-
-            // Lock the mutex to ensure thread safety
-            std::lock_guard<std::mutex> lock(GLOB_STATUS_LOCK);
-            g_status.st_status = ST_SLEW_BLIND;
-            std::cout << "Yaw: current steps = " << current_yaw_steps
-                    << ", target steps = " << g_yaw_target << std::endl;
-            std::cout << "Elevation: current steps = " << g_status.delta_motors[6]
-                    << ", target steps = " << g_el_target << std::endl;
-            std::cout << "Current star tracker status is:" << g_status.st_status << std::endl;
-        }
+    	// Receives the star-tracker angles in radians. If the Star Tracker is waiting and the
+    	// robot is tracking, the robot loop starts the slew (see ReceiveSTAngles)
+        SendCommand(CMD_ST_ANGLES, {azimuth, altitude, pos_angle});
+    }
+
+    void receive_ST_fix(double azimuth, double altitude, double pos_angle, double age_s) {
+    	// Receives a plate solve fix in radians, taken age_s ago. With fusion on, the robot
+    	// loop fuses it with the centroids and step counts (see ReceiveSTFix)
+        SendCommand(CMD_ST_FIX, {azimuth, altitude, pos_angle, age_s});
+    }
+
+    void receive_ST_centroid(double azimuth, double altitude, double age_s) {
+    	// Receives a fine star tracker centroid offset in radians, taken age_s ago
+        SendCommand(CMD_ST_CENTROID, {azimuth, altitude, age_s});
+    }
+
+    void set_fusion(int on) {
+    	// Fuse the star tracker measurements with the step counts (1), or use each as it comes (0)
+        SendCommand(CMD_FUSION, {(double)on});
     }
 
     void set_gains(double y, double e, double yi, double ei) {
     	// Set the gains for tracking altitude (callled "e" or elevation)
     	// and azimuth (called "y" or yaw) 
         // Also set the sums to zero.
-	    g_ygain = y;
-	    g_egain = e;
-		g_yint = yi;
-		g_eint = ei;
-        g_esum = 0.0;
-        g_ysum = 0.0;
+        SendCommand(CMD_GAINS, {y, e, yi, ei});
     }
     
     void set_heading(double h, double gain) {
-        g_heading = 60*h; //!!! Why 60?
-        h_gain = gain;
+        SendCommand(CMD_HEADING, {h, gain});
     }
 
     void track_robot(double vel, double x_val, double y_val, double z_val, double roll_val, double pitch_val, double yaw_val, double el_val) {
-        g_vel.velocity = vel;
-        g_vel.velocity = vel;
-        g_vel.velocity = vel;
-        g_vel.x = x_val;
-        g_vel.y = y_val;
-        g_vel.z = z_val;
-        g_vel.roll = roll_val;
-        g_vel.yaw = yaw_val;
-        g_vel.pitch = pitch_val;
-        g_vel.el = el_val;
-        GLOBAL_STATUS_CHANGED = true;
-        GLOBAL_SERVER_STATUS = ROBOT_TRACK;
+        SendCommand(CMD_TRACK, {vel, x_val, y_val, z_val, roll_val, pitch_val, yaw_val, el_val});
     }
 
 	// Set everything to zero and stop threads.
     void disconnect() {
-        g_vel = g_zero_vel;
-        g_ygain = 0;
-	    g_egain = 0;
-        GLOBAL_SERVER_STATUS = ROBOT_DISCONNECT;
-        GLOBAL_STATUS_CHANGED = true;
-        watchdog_thread.join();
+        SendCommand(CMD_DISCONNECT);
+        disconnecting = true;
+        if (watchdog_thread.joinable()) {
+            watchdog_thread.join();
+        }
         return;
     }
 
 	void offset_targets(double azimuth, double altitude, double rollval, double pitchval) {
-		g_az_off += azimuth;
-		g_alt_off += altitude;
-		g_roll_target += rollval;
-		g_pitch_target += pitchval;
+		SendCommand(CMD_OFFSETS, {azimuth, altitude, rollval, pitchval});
 		return;
 	}
  
@@ -373,32 +270,26 @@ struct RobotControlServer {
     void set_st_state(int state) {
         // Set the Star Tracker state, which is used to control the robot's behaviour
         // when the Star Tracker is in different states.
-        std::lock_guard<std::mutex> lock(GLOB_STATUS_LOCK);
-        g_status.st_status = state;
+        SendCommand(CMD_ST_STATE, {(double)state});
     }
 
 	Status status(){
-        // Lock the global status mutex to ensure thread safety
-        std::lock_guard<std::mutex> lock(GLOB_STATUS_LOCK);
-        // Update the global status with the current loop status and counter
-        // Other parts of the status are already changed as they are updated in the robot loop.
-        g_status.loop_counter = loop_counter;
-        g_status.loop_status = GLOBAL_SERVER_STATUS;
-        // Unlock is automatic when going out of scope
-        return g_status;
+        // The status published by the robot loop at the end of its last tick
+        return g_status_snapshot.Read();
 	}
 
     void move_single_actuator(int actuator_index, double velocity) {
-        MoveSingleActuator(actuator_index, velocity);
+        SendCommand(CMD_MOVE_ACTUATOR, {(double)actuator_index, velocity});
     }
     void move_single_motor(int motor_index, double velocity) {
-        MoveSingleMotor(motor_index, velocity);
+        SendCommand(CMD_MOVE_MOTOR, {(double)motor_index, velocity});
     }
 
     int origin_delta_motors[7] = {0, 0, 0, 0, 0, 0, 0};
     void set_origin() {
+        Status s = g_status_snapshot.Read();
         for (int i = 0; i < 7; ++i) {
-            origin_delta_motors[i] = g_status.delta_motors[i];
+            origin_delta_motors[i] = s.delta_motors[i];
         }
         std::cout << "Origin set to current step counts." << std::endl;
     }
@@ -406,31 +297,19 @@ struct RobotControlServer {
     Movements get_movement() {
     // Calculate the culmulated movement of the robot in x, y, z, azimuth and elevation
         Movements m;
+        Status s = g_status_snapshot.Read();
 
-        // Use difference from origin
-        // calulate the total azimuth in degrees
-        double arcsec_per_yaw_step = 295E-9/ROBOT_RADIUS/ARCSEC_TO_RAD/3;
-        m.az = (g_status.delta_motors[0] - origin_delta_motors[0] +
-                g_status.delta_motors[1] - origin_delta_motors[1] +
-                g_status.delta_motors[2] - origin_delta_motors[2]) * arcsec_per_yaw_step/3600.0;
-        
-        // Calculate the total elevation in degrees
-        double arcsec_per_el_step = 0.090;
-        m.el = g_status.delta_motors[6] * arcsec_per_el_step/3600.0;
-
-        // Calculate the total movement in x, y, z in mm
-        double mm_per_step = 295E-9* 1000; //millieter/step
-        m.x = -mm_per_step *COS30 * (2.0/3)* (g_status.delta_motors[1] - origin_delta_motors[1]) +
-            mm_per_step * COS30 * (2.0/3) * (g_status.delta_motors[2] - origin_delta_motors[2]);
-
-        m.y = -mm_per_step * (2.0/3) * (g_status.delta_motors[0] - origin_delta_motors[0]) + 
-            mm_per_step * (1.0/3) * (g_status.delta_motors[1] - origin_delta_motors[1]) + 
-            mm_per_step * (1.0/3) * (g_status.delta_motors[2] - origin_delta_motors[2]);
-
-        double mm_per_step_z = 39E-6; // millimeter/step for z
-        m.z = (g_status.delta_motors[3]+
-            g_status.delta_motors[4] +
-            g_status.delta_motors[5]) * mm_per_step_z /3;
+        // Only the wheels are relative to the origin: z and el are absolute
+        int steps[KINEMATICS_AXES];
+        for (int i = 0; i < KINEMATICS_AXES; ++i) {
+            steps[i] = s.delta_motors[i] - (i < 3 ? origin_delta_motors[i] : 0);
+        }
+        KinematicsVector d = g_kinematics.BodyDisplacement(steps);
+        m.x = d[0]*1000;
+        m.y = d[1]*1000;
+        m.z = d[2]*1000;
+        m.az = -d[5]/DEG_TO_RAD;
+        m.el = d[6]/DEG_TO_RAD;
 
         // std::cout << "get_movement (mm or deg): x = " << m.x << ", y = " << m.y
         //         << ", z = " << m.z << ", az = " << m.az
@@ -439,16 +318,100 @@ struct RobotControlServer {
 }
 
     void set_el_90() {
-        // Reset the elevation to vertical by calling receive_ST_angles.
-        double arcsec_per_el_step = 0.090;
-        double el_angle = g_status.delta_motors[6] * arcsec_per_el_step * ARCSEC_TO_RAD;
-        GLOBAL_SERVER_STATUS = ROBOT_TRACK;
-        GLOBAL_STATUS_CHANGED = true;
-        g_status.st_status = ST_READY_TO_SLEW;
-        receive_ST_angles(0.0, -el_angle, 0.0);
-        std::cout << "Setting elevation to 90 degrees" << std::endl;
+        // Reset the elevation to vertical, by slewing the goniometer back to zero steps.
+        SendCommand(CMD_SET_EL_90);
 }
 
+    /*
+    System identification: excite one axis with a stepped sine, chirp or multisine, and
+    measure the gain and phase of a response at each frequency (see SysId.h). The robot
+    runs open loop while it does, and stops at the end. sysid_results can be called at any
+    time for the points measured so far.
+    */
+    string sysid(string excitation, string axis, string response, double amplitude,
+        double f_start, double f_stop, int num_freqs, double duration_s) {
+        int excitation_type = SysIdExcitationType(excitation.c_str());
+        int axis_index = SysIdAxis(axis.c_str());
+        int response_index = SysIdResponse(response.c_str());
+        if (excitation_type < 0) {
+            return "Unknown excitation " + excitation + " (stepped, chirp or multisine)";
+        }
+        if (axis_index < 0) {
+            return "Unknown axis " + axis + " (x, y, z, roll, pitch, yaw or el)";
+        }
+        if (response_index < 0) {
+            return "Unknown response " + response + " (acc_x, acc_y, acc_z, pitch or roll)";
+        }
+        if (SendCommand(CMD_SYSID, {(double)excitation_type, (double)axis_index, (double)response_index,
+            amplitude, f_start, f_stop, (double)num_freqs, duration_s}) != 0) {
+            return "Robot loop busy, try again";
+        }
+        return "System identification sent to the robot loop";
+    }
+
+    void sysid_stop() {
+        SendCommand(CMD_SYSID_STOP);
+    }
+
+    SysIdResults sysid_results() {
+        return g_sysid_snapshot.Read();
+    }
+
+    /*
+    The tick recorder keeps every robot loop tick of the last tick_ring_s seconds in memory.
+    It runs from the start of the loop, and freezes when a servo output saturates, the
+    watchdog restarts the loop or capture_trigger is called, keeping post_trigger_s seconds
+    after the trigger. capture_dump then writes it to a file.
+    */
+    string capture_start(double post_trigger_s) {
+        if (g_tick_recorder == nullptr) {
+            return "No tick recorder";
+        }
+        g_tick_recorder->start(std::max(0.0, post_trigger_s)*1e6/g_loop_period_us);
+        return "Capture started";
+    }
+
+    string capture_trigger() {
+        if (g_tick_recorder == nullptr) {
+            return "No tick recorder";
+        }
+        if (!g_tick_recorder->trigger("command")) {
+            return "Already triggered (" + g_tick_recorder->reason() + ")";
+        }
+        return "Capture triggered";
+    }
+
+    string capture_stop() {
+        if (g_tick_recorder == nullptr) {
+            return "No tick recorder";
+        }
+        g_tick_recorder->stop();
+        return "Capture stopped";
+    }
+
+    string capture_dump(string filename) {
+        if (g_tick_recorder == nullptr) {
+            return "No tick recorder";
+        }
+        if (g_tick_recorder->dump(filename)) {
+            return "Could not dump to " + filename + " (the capture must be frozen or stopped first)";
+        }
+        return "Dumped " + std::to_string(g_tick_recorder->size()) + " ticks to " + filename;
+    }
+
+    string capture_status() {
+        if (g_tick_recorder == nullptr) {
+            return "No tick recorder";
+        }
+        const char* states[4] = {"stopped", "running", "triggered", "frozen"};
+        string status = string(states[g_tick_recorder->state()]) + ", " +
+            std::to_string(g_tick_recorder->size()) + " ticks";
+        if (g_tick_recorder->state() == telemetry::Recorder::FROZEN) {
+            status += ", trigger: " + g_tick_recorder->reason();
+        }
+        return status;
+    }
+
 };
 
 // TODO: As this is hard to read, we should move the following to a separate file, and include it here.
@@ -476,7 +439,27 @@ namespace nlohmann {
             {"delta_motors", L.delta_motors},
             {"loop_status", L.loop_status},
             {"loop_counter", L.loop_counter},
-            {"st_status", L.st_status} 
+            {"st_status", L.st_status},
+            {"jitter_mean_us", L.jitter_mean_us},
+            {"jitter_max_us", L.jitter_max_us},
+            {"work_mean_us", L.work_mean_us},
+            {"work_max_us", L.work_max_us},
+            {"overruns", L.overruns},
+            {"clock_drift_ppm", L.clock_drift_ppm},
+            {"usb_latency_us", L.usb_latency_us},
+            {"usb_latency_max_us", L.usb_latency_max_us},
+            {"accel_dropped", L.accel_dropped},
+            {"fusion", L.fusion},
+            {"att_az", L.att_az},
+            {"att_alt", L.att_alt},
+            {"att_az_sigma", L.att_az_sigma},
+            {"att_alt_sigma", L.att_alt_sigma},
+            {"att_bias_az", L.att_bias_az},
+            {"att_bias_alt", L.att_bias_alt},
+            {"att_fixes", L.att_fixes},
+            {"att_centroids", L.att_centroids},
+            {"att_rejected", L.att_rejected},
+            {"att_restarts", L.att_restarts}
             };
         }
 
@@ -487,6 +470,62 @@ namespace nlohmann {
             j.at("loop_status").get_to(L.loop_status);
             j.at("loop_counter").get_to(L.loop_counter);
             j.at("st_status").get_to(L.st_status);
+            j.at("jitter_mean_us").get_to(L.jitter_mean_us);
+            j.at("jitter_max_us").get_to(L.jitter_max_us);
+            j.at("work_mean_us").get_to(L.work_mean_us);
+            j.at("work_max_us").get_to(L.work_max_us);
+            j.at("overruns").get_to(L.overruns);
+            j.at("clock_drift_ppm").get_to(L.clock_drift_ppm);
+            j.at("usb_latency_us").get_to(L.usb_latency_us);
+            j.at("usb_latency_max_us").get_to(L.usb_latency_max_us);
+            j.at("accel_dropped").get_to(L.accel_dropped);
+            j.at("fusion").get_to(L.fusion);
+            j.at("att_az").get_to(L.att_az);
+            j.at("att_alt").get_to(L.att_alt);
+            j.at("att_az_sigma").get_to(L.att_az_sigma);
+            j.at("att_alt_sigma").get_to(L.att_alt_sigma);
+            j.at("att_bias_az").get_to(L.att_bias_az);
+            j.at("att_bias_alt").get_to(L.att_bias_alt);
+            j.at("att_fixes").get_to(L.att_fixes);
+            j.at("att_centroids").get_to(L.att_centroids);
+            j.at("att_rejected").get_to(L.att_rejected);
+            j.at("att_restarts").get_to(L.att_restarts);
+        }
+    };
+
+    template <>
+    struct adl_serializer<SysIdResults> {
+        static void to_json(json& j, const SysIdResults& r) {
+            const char* states[3] = {"idle", "running", "done"};
+            json points = json::array();
+            for (int k = 0; k < r.num_points; k++) {
+                points.push_back({{"freq_hz", r.points[k].freq_hz}, {"gain", r.points[k].gain},
+                    {"phase_deg", r.points[k].phase_deg}, {"samples", r.points[k].samples}});
+            }
+            j = json{{"state", states[r.state]},
+            {"excitation", r.config.excitation},
+            {"axis", r.config.axis},
+            {"response", r.config.response},
+            {"amplitude", r.config.amplitude},
+            {"num_freqs", r.config.num_freqs},
+            {"points", points}
+            };
+        }
+
+        static void from_json(const json& j, SysIdResults& r) {
+            j.at("excitation").get_to(r.config.excitation);
+            j.at("axis").get_to(r.config.axis);
+            j.at("response").get_to(r.config.response);
+            j.at("amplitude").get_to(r.config.amplitude);
+            j.at("num_freqs").get_to(r.config.num_freqs);
+            const json& points = j.at("points");
+            r.num_points = std::min((int)points.size(), SYSID_MAX_FREQS);
+            for (int k = 0; k < r.num_points; k++) {
+                points[k].at("freq_hz").get_to(r.points[k].freq_hz);
+                points[k].at("gain").get_to(r.points[k].gain);
+                points[k].at("phase_deg").get_to(r.points[k].phase_deg);
+                points[k].at("samples").get_to(r.points[k].samples);
+            }
         }
     };
 
@@ -518,8 +557,11 @@ COMMANDER_REGISTER(m)
         .def("start", &RobotControlServer::start_robot_loop, "A function that starts the robot control loop (in idle)")
         .def("translate", &RobotControlServer::translate_robot, "A function that translates the robot")
         .def("resonance", &RobotControlServer::resonance_robot, "A function that tests robot resonances")
-        .def("file", &RobotControlServer::change_file, "Change the name of the log file (unused).")
+        .def("file", &RobotControlServer::change_file, "Change the name of the binary resonance log file [filename].")
         .def("receive_ST_angles", &RobotControlServer::receive_ST_angles, "Store the current angle offsets from the Star Tracker.")
+        .def("receive_ST_fix", &RobotControlServer::receive_ST_fix, "Receive a plate solve fix [azimuth, altitude, position angle (radians), age (s)].")
+        .def("receive_ST_centroid", &RobotControlServer::receive_ST_centroid, "Receive a fine star tracker centroid offset [azimuth, altitude (radians), age (s)].")
+        .def("set_fusion", &RobotControlServer::set_fusion, "Fuse the star tracker fixes and centroids with the step counts [1/0].")
         .def("track", &RobotControlServer::track_robot, "Level the robot, and track the star, depending on star tracker state.")
         .def("set_gains", &RobotControlServer::set_gains, "Set the gains for tracking alt/az, i.e. el/yaw")
         .def("set_heading", &RobotControlServer::set_heading, "UNUSED - manual control only")
@@ -527,11 +569,19 @@ COMMANDER_REGISTER(m)
 		.def("receive_AlignmentError", &RobotControlServer::receive_AlignmentError, "Receive the Alignment offset [vertical, hortizontal].")
         .def("update_offsets", &RobotControlServer::offset_targets, "Offset the azimuth and altitude, roll, pitch.")
         .def("disconnect", &RobotControlServer::disconnect, "Disconnect from the robot controller and stop all threads.")
-		.def("status", &RobotControlServer::status, "Get the status of all axes including roll and pitch.")
+		.def("status", &RobotControlServer::status, "Get the status of all axes including roll and pitch, and the loop timing (us).")
         .def("set_st", &RobotControlServer::set_st_state, "Set the Star Tracker state.")
         .def("move_actuator", &RobotControlServer::move_single_actuator, "Move a single actuator [index 0/1/2, velocity m/s].")
         .def("move_motor", &RobotControlServer::move_single_motor, "Move a single motor [index 0/1/2, velocity m/s].")
         .def("set_origin", &RobotControlServer::set_origin, "Set the current step counts as origin for the robot movement.")
         .def("get_movement", &RobotControlServer::get_movement, "Get the culmulated movement of the robot in x, y, z (mm), azimuth and elevation (deg).")
-        .def("set_el_90", &RobotControlServer::set_el_90, "Align the elevation to vertical by moving the goniometer to zero step count.");
+        .def("set_el_90", &RobotControlServer::set_el_90, "Align the elevation to vertical by moving the goniometer to zero step count.")
+        .def("sysid", &RobotControlServer::sysid, "Measure a frequency response [excitation stepped/chirp/multisine, axis x..el, response acc_x/acc_y/acc_z/pitch/roll, amplitude mm/s or arcsec/s, f_start, f_stop, num_freqs, duration_s].")
+        .def("sysid_stop", &RobotControlServer::sysid_stop, "Stop the system identification, keeping the points measured.")
+        .def("sysid_results", &RobotControlServer::sysid_results, "Gain and phase of each frequency measured by sysid.")
+        .def("capture_start", &RobotControlServer::capture_start, "Restart the tick recorder, keeping [post_trigger_s] seconds after a trigger.")
+        .def("capture_trigger", &RobotControlServer::capture_trigger, "Trigger the tick recorder, which freezes post_trigger_s seconds later.")
+        .def("capture_stop", &RobotControlServer::capture_stop, "Stop the tick recorder now.")
+        .def("capture_dump", &RobotControlServer::capture_dump, "Write the frozen tick recorder to [filename] (.tlm, or CSV if it ends in .csv).")
+        .def("capture_status", &RobotControlServer::capture_status, "Tick recorder state, number of ticks and trigger reason.");
 }
@@ -6,20 +6,43 @@ TODO: Find if everything here is actually needed, and if not, remove it. The cod
 */
 #include "SerialPort.h"
 #include "Globals.h"
+#include "telemetry.hpp"
+#include "LevelFilter.h"
+#include "Kinematics.h"
 #include <iostream>
 #include <cmath>
 #include <fstream>
 #include <algorithm>
 #include <fstream>
 #include <string>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
 
 using std::chrono::steady_clock;
 using std::chrono::duration_cast;
 using std::chrono::microseconds;
 
-int GLOBAL_SERVER_STATUS = 1;
 int loop_counter = 0;
-bool GLOBAL_STATUS_CHANGED = false;
+
+// The control state, owned by the robot loop thread, with its commands and published status
+ControlState g_ctrl;
+Mailbox<ControlCommand, COMMAND_MAILBOX_SIZE> g_commands;
+SeqlockSnapshot<Status> g_status_snapshot;
+Status g_status;
+
+// A convenience local global for zero velocities
+const Velocities g_zero_vel = {
+    0.0, // velocity
+    0.0, // x
+    0.0, // y
+    0.0, // z
+    0.0, // roll
+    0.0, // yaw
+    0.0, // pitch
+    0.0  // el
+};
 
 // A pointer to the teensy port, which is used to communicate with the Teensy
 Comms::SerialPort *teensy_port=nullptr;
@@ -45,44 +68,83 @@ struct Leveller {
 };
 
 Leveller leveller;
-double pitch_estimate_arr_[10] = {0.0};
-double roll_estimate_arr_[10] = {0.0};
+
+// Filters of the pitch and roll estimates (degrees), configured in robot_loop, and the
+// commanded roll and pitch rates (degrees/s) that the complementary filter follows
+LevelFilter pitch_filter_, roll_filter_;
+double level_roll_rate_ = 0.0, level_pitch_rate_ = 0.0;
+long long leveller_sample_ns_ = 0; // Time of the sample last passed to the leveller
 double pitch_estimate_filtered_ = 0.0;
 double roll_estimate_filtered_ = 0.0;
 
 bool resonance_enable_flag = true; 
+double resonance_f_ = 0.5; // Frequency of the resonance test in Hz, reset by the resonance command
+long long resonance_pause_end_ns_ = 0; // End of the pause between frequencies (0 if not paused)
+
+// System identification, run by sysid() and fed the response by UpdateTarget
+SysId sysid_;
+SeqlockSnapshot<SysIdResults> g_sysid_snapshot;
 
-void PassAccelBytesToLeveller() {
-	leveller.acc0_latest_measurements_.x = AccelerationBytesToPhysicalDouble(teensy_port->accelerometer0_in_.x[0],teensy_port->accelerometer0_in_.x[1]);
-	leveller.acc0_latest_measurements_.y = AccelerationBytesToPhysicalDouble(teensy_port->accelerometer0_in_.y[0],teensy_port->accelerometer0_in_.y[1]);
-	leveller.acc0_latest_measurements_.z = -AccelerationBytesToPhysicalDouble(teensy_port->accelerometer0_in_.z[0],teensy_port->accelerometer0_in_.z[1]);
-	leveller.acc1_latest_measurements_.x = AccelerationBytesToPhysicalDouble(teensy_port->accelerometer1_in_.x[0],teensy_port->accelerometer1_in_.x[1]);
-	leveller.acc1_latest_measurements_.y = AccelerationBytesToPhysicalDouble(teensy_port->accelerometer1_in_.y[0],teensy_port->accelerometer1_in_.y[1]);
-	leveller.acc1_latest_measurements_.z = -AccelerationBytesToPhysicalDouble(teensy_port->accelerometer1_in_.z[0],teensy_port->accelerometer1_in_.z[1]);
-	leveller.acc2_latest_measurements_.x = AccelerationBytesToPhysicalDouble(teensy_port->accelerometer2_in_.x[0],teensy_port->accelerometer2_in_.x[1]);
-	leveller.acc2_latest_measurements_.y = AccelerationBytesToPhysicalDouble(teensy_port->accelerometer2_in_.y[0],teensy_port->accelerometer2_in_.y[1]);
-	leveller.acc2_latest_measurements_.z = -AccelerationBytesToPhysicalDouble(teensy_port->accelerometer2_in_.z[0],teensy_port->accelerometer2_in_.z[1]);
+// Fused star tracker estimate, fed the robot's motion by UpdateAttitude and the star tracker
+// measurements by ReceiveSTFix and ReceiveSTCentroid. The step counts it last saw, to take
+// the motion from (last_steps_valid_ is false until the first).
+AttitudeEstimator attitude_;
+int last_yaw_steps_ = 0, last_el_steps_ = 0;
+bool last_steps_valid_ = false;
+
+long long MonotonicNs();
+
+void PassAccelToLeveller(const double (*acc)[3]) {
+	leveller.acc0_latest_measurements_.x = acc[0][0];
+	leveller.acc0_latest_measurements_.y = acc[0][1];
+	leveller.acc0_latest_measurements_.z = -acc[0][2];
+	leveller.acc1_latest_measurements_.x = acc[1][0];
+	leveller.acc1_latest_measurements_.y = acc[1][1];
+	leveller.acc1_latest_measurements_.z = -acc[1][2];
+	leveller.acc2_latest_measurements_.x = acc[2][0];
+	leveller.acc2_latest_measurements_.y = acc[2][1];
+	leveller.acc2_latest_measurements_.z = -acc[2][2];
 }
 
 void UpdateStepCounts(){
-	// Using BytesToInt from Decode.cpp, we convert the step counts from the Teensy to integers.
-	// This is very painful - code should be refactored to use a loop in the future!!!
 	// Update the step counts in the g_status struct.
-	std::lock_guard<std::mutex> lock(GLOB_STATUS_LOCK);
-	g_status.delta_motors[0] = BytesToInt(teensy_port->step_count0_in_[0], teensy_port->step_count0_in_[1],
-							  teensy_port->step_count0_in_[2], teensy_port->step_count0_in_[3]);
-	g_status.delta_motors[1] = BytesToInt(teensy_port->step_count1_in_[0], teensy_port->step_count1_in_[1],
-							  teensy_port->step_count1_in_[2], teensy_port->step_count1_in_[3]);
-	g_status.delta_motors[2] = BytesToInt(teensy_port->step_count2_in_[0], teensy_port->step_count2_in_[1],
-							  teensy_port->step_count2_in_[2], teensy_port->step_count2_in_[3]);
-	g_status.delta_motors[3] = BytesToInt(teensy_port->step_count3_in_[0], teensy_port->step_count3_in_[1],
-							  teensy_port->step_count3_in_[2], teensy_port->step_count3_in_[3]);
-	g_status.delta_motors[4] = BytesToInt(teensy_port->step_count4_in_[0], teensy_port->step_count4_in_[1],
-							  teensy_port->step_count4_in_[2], teensy_port->step_count4_in_[3]);
-	g_status.delta_motors[5] = BytesToInt(teensy_port->step_count5_in_[0], teensy_port->step_count5_in_[1],
-							  teensy_port->step_count5_in_[2], teensy_port->step_count5_in_[3]);
-	g_status.delta_motors[6] = BytesToInt(teensy_port->step_count6_in_[0], teensy_port->step_count6_in_[1],
-							  teensy_port->step_count6_in_[2], teensy_port->step_count6_in_[3]);
+	for (int i = 0; i < ROBOT_NUM_MOTORS; i++) {
+		g_status.delta_motors[i] = teensy_port->inputs_.step_counts[i];
+	}
+}
+
+// Advance the fused estimate by the motion since the last tick, from the step counts, and
+// with fusion on, steer by it. Called after UpdateStepCounts.
+void UpdateAttitude() {
+	int yaw_steps = g_status.delta_motors[0] + g_status.delta_motors[1] + g_status.delta_motors[2];
+	int el_steps = g_status.delta_motors[6];
+	if (!last_steps_valid_) {
+		last_yaw_steps_ = yaw_steps;
+		last_el_steps_ = el_steps;
+		last_steps_valid_ = true;
+	}
+	// More steps reduce the error (see ReceiveSTAngles)
+	attitude_.Predict(MonotonicNs(), -(yaw_steps - last_yaw_steps_)*ARCSEC_PER_YAW_STEP,
+		-(el_steps - last_el_steps_)*ARCSEC_PER_EL_STEP);
+	last_yaw_steps_ = yaw_steps;
+	last_el_steps_ = el_steps;
+
+	if (g_ctrl.fusion && attitude_.initialised()) {
+		g_ctrl.az = attitude_.az();
+		g_ctrl.alt = attitude_.alt();
+	}
+	AttitudeAxisState az = attitude_.az_state(), alt = attitude_.alt_state();
+	g_status.fusion = g_ctrl.fusion;
+	g_status.att_az = az.error;
+	g_status.att_alt = alt.error;
+	g_status.att_az_sigma = az.error_sigma;
+	g_status.att_alt_sigma = alt.error_sigma;
+	g_status.att_bias_az = az.bias;
+	g_status.att_bias_alt = alt.bias;
+	g_status.att_fixes = attitude_.fixes();
+	g_status.att_centroids = attitude_.centroids();
+	g_status.att_rejected = attitude_.rejected();
+	g_status.att_restarts = attitude_.restarts();
 }
 
 //saving readings to a file for measuring offsets
@@ -97,56 +159,24 @@ void UpdateStepCounts(){
 //     }
 // }
 
-// Check the three accelerometer readings and drop out anyone that is too different from the others
-// Return the mean value of the remaining accelerometers
-double robust_mean(double a, double b, double c, double acc_offset0, double acc_offset1, double acc_offset2) {
-	// save_abc_to_file(a, b, c, "/tmp/testAcc_values.txt");
-	a -= acc_offset0;
-	b -= acc_offset1;
-	c -= acc_offset2;
-	double vals_[3] = {a, b, c};
-	// sort a, b, c from smallest to largest
-	std::sort(vals_, vals_ + 3);
-	// std::cout << " All accelerometer values: " << vals_[0] << ',' << vals_[1] << ',' << vals_[2] << std::endl;
-	// std::cout << " All accelerometer values after offset correction: " << vals_[0] << ',' << vals_[1] << ',' << vals_[2] << std::endl;
-	
-	double threshold = 0.10; //0.1 rad/s in x & y axis, 0.1g in z axis
-	// Check if there is any outlier
-    if ((vals_[1] - vals_[0]) > std::max(threshold, (vals_[2] - vals_[1]) * 3)) {
-        // vals_[0] is an outlier
-		// std::cout << "The smallest is an outlier" << std::endl;
-        return (vals_[1] + vals_[2]) / 2.0;
-    }
-    else if ((vals_[2] - vals_[1]) > std::max(threshold, (vals_[1] - vals_[0]) * 3)) {
-        // vals_[2] is an outlier
-		// std::cout << "The biggest is an outlier" << std::endl;
-        return (vals_[0] + vals_[1]) / 2.0;
-    }
-    // No outliers or all three are very different
-    else {
-		// std::cout << "No outlier" << std::endl;
-        return (vals_[0] + vals_[1] + vals_[2]) / 3.0;
-    }
-}
-
-// Update the target for the levelling control loop.
-void UpdateTarget() {
+// Update the target for the levelling control loop, from a sample taken at sample_ns.
+void UpdateTarget(long long sample_ns) {
 	Doubles acc_estimate_;
 	// Combine the accelerations. Ideally the accelerometers should also be calibrated
 	// against each other with the zero positions stored in the toml file.
 	// !!! Qianhui !!!
-	acc_estimate_.x = robust_mean(-1*leveller.acc0_latest_measurements_.x,
-								   1*leveller.acc1_latest_measurements_.y,
-								   leveller.acc2_latest_measurements_.x, g_x_acc_offset0, g_x_acc_offset1, g_x_acc_offset2);
+	acc_estimate_.x = FuseThree(-1*leveller.acc0_latest_measurements_.x - g_x_acc_offset0,
+								 1*leveller.acc1_latest_measurements_.y - g_x_acc_offset1,
+								 leveller.acc2_latest_measurements_.x - g_x_acc_offset2);
 
-	acc_estimate_.y = robust_mean(-1*leveller.acc0_latest_measurements_.y,
-								   -1*leveller.acc1_latest_measurements_.x,
-								   leveller.acc2_latest_measurements_.y, g_y_acc_offset0, g_y_acc_offset1, g_y_acc_offset2);
+	acc_estimate_.y = FuseThree(-1*leveller.acc0_latest_measurements_.y - g_y_acc_offset0,
+								 -1*leveller.acc1_latest_measurements_.x - g_y_acc_offset1,
+								 leveller.acc2_latest_measurements_.y - g_y_acc_offset2);
 
 	//We flip the sign on the z component so that gravity is measured downwards
-	acc_estimate_.z = robust_mean(leveller.acc0_latest_measurements_.z,
-								  leveller.acc1_latest_measurements_.z,
-								  leveller.acc2_latest_measurements_.z, g_z_acc_offset0, g_z_acc_offset1, g_z_acc_offset2);
+	acc_estimate_.z = FuseThree(leveller.acc0_latest_measurements_.z - g_z_acc_offset0,
+								leveller.acc1_latest_measurements_.z - g_z_acc_offset1,
+								leveller.acc2_latest_measurements_.z - g_z_acc_offset2);
 
 
 	// acc_estimate_.x = (-1*leveller.acc0_latest_measurements_.x+1*leveller.acc1_latest_measurements_.y
@@ -160,28 +190,51 @@ void UpdateTarget() {
     //                    +leveller.acc1_latest_measurements_.z
     //                    +leveller.acc2_latest_measurements_.z)/3.0;
 	
-					   // Here we average the last 10 measurements.
-	for(int i = 1; i <= 9; i++) {
-        pitch_estimate_arr_[i-1] = pitch_estimate_arr_[i];
-        roll_estimate_arr_[i-1] = roll_estimate_arr_[i];
-    }
-
-    pitch_estimate_arr_[9] =   atan(acc_estimate_.x/sqrt(acc_estimate_.z*acc_estimate_.z+
-                                                  acc_estimate_.y*acc_estimate_.y))*180.0/PI;
-    roll_estimate_arr_[9] = atan(acc_estimate_.y/acc_estimate_.z)*180/PI;
+    double pitch = atan(acc_estimate_.x/sqrt(acc_estimate_.z*acc_estimate_.z+
+                                           acc_estimate_.y*acc_estimate_.y))*180.0/PI;
+    double roll = atan(acc_estimate_.y/acc_estimate_.z)*180/PI;
 
-    pitch_estimate_filtered_ = 0.0;
-    roll_estimate_filtered_ = 0.0;
+	// Filter, with the time since the last sample for the complementary filter
+	double dt = 1e-9*(sample_ns - leveller_sample_ns_);
+	leveller_sample_ns_ = sample_ns;
+	// Response for the system identification, at the time of the sample
+	if (sysid_.running()) {
+		double response[5] = {acc_estimate_.x, acc_estimate_.y, acc_estimate_.z, pitch, roll};
+		sysid_.AddSample(sample_ns, response[sysid_.results().config.response]);
+	}
 
-    for(int i = 0; i <= 9; i++) {
-        pitch_estimate_filtered_ += pitch_estimate_arr_[i]/10.0;
-        roll_estimate_filtered_ += roll_estimate_arr_[i]/10.0;
-    }
+    pitch_estimate_filtered_ = pitch_filter_.Update(pitch, g_level_rate_feedforward*level_pitch_rate_, dt);
+    roll_estimate_filtered_ = roll_filter_.Update(roll, g_level_rate_feedforward*level_roll_rate_, dt);
     //last_actuator_velocity_target_ = actuator_velocity_target_;
 	//pitch_estimate_filtered_ = pitch_estimate_filtered_ - pitch_target_;
     //roll_estimate_filtered_ = roll_estimate_filtered_ - roll_target_;
 }
 
+// Firmware version 4 onwards answers one Snapshot and takes one SetRawAll per tick,
+// in place of 17 per-item requests. Older firmware gets the per-item commands.
+#define SNAPSHOT_FIRMWARE_VERSION 4
+bool use_snapshot = false;
+
+// Firmware version 5 onwards also streams timestamped accelerometer samples (AccStream),
+// so the leveller sees every sample at its own time rather than the latest one per tick.
+#define STREAM_FIRMWARE_VERSION 5
+bool use_stream = false;
+
+// Pass the accelerometer samples that arrived since the last ReadMessage() through the
+// leveller, each at its host time. Without the stream the latest readings are taken as
+// a sample at the current time.
+void UpdateLeveller() {
+	if (!use_stream) {
+		PassAccelToLeveller(teensy_port->inputs_.accelerations);
+		UpdateTarget(MonotonicNs());
+		return;
+	}
+	for (int k = 0; k < teensy_port->num_new_samples_; k++) {
+		PassAccelToLeveller(teensy_port->new_samples_[k].accelerations);
+		UpdateTarget(teensy_port->new_sample_ns_[k]);
+	}
+}
+
 //Pull all of the accelerations from the device (42 Bytes of return data)
 void RequestAccelerations() {
     teensy_port->Request(Acc0Wr);
@@ -203,39 +256,36 @@ void RequestStepCounts() {
 	teensy_port->Request(Step6Wr);
 }
 
+//Pull the accelerations and step counts, as one Snapshot if the firmware has it.
+//With SetRawAll a tick is 16 bytes of requests and 51 of return data, rather than 51 and 56
+//(plus 1 and 68 for the AccStream)
+void RequestSensors() {
+	if (use_snapshot) {
+		teensy_port->Request(Snapshot);
+		if (use_stream) {
+			teensy_port->Request(AccStream);
+		}
+	} else {
+		RequestAccelerations();
+		RequestStepCounts();
+	}
+}
+
+static_assert(ROBOT_NUM_MOTORS == KINEMATICS_AXES, "The kinematics mixes one body axis per motor");
+
 void UpdateBFFVelocityAngle(double x, double y, double z, double r, double p, double s, double e) {
 	// Set the motor velocities, based on x,y,z, roll, pitch, yaw.
 	// Units are SI (m/s and rad/s)
-    Doubles motor_velocity_target_;
-    Doubles actuator_velocity_target_;
-    motor_velocity_target_.x = -y - s * ROBOT_RADIUS;                     	//Motor 0
-    motor_velocity_target_.y = ( -x * sin(PI / 3) + y * cos(PI / 3)) - s *  ROBOT_RADIUS;   //Motor 1
-    motor_velocity_target_.z = (x * sin(PI / 3) + y * cos(PI / 3)) - s * ROBOT_RADIUS;   //Motor 2
- 	actuator_velocity_target_.x = z + ACT_RADIUS*(  COS30*r - SIN30*p); //Actuator 0
-    actuator_velocity_target_.y = z + ACT_RADIUS*p;                     //Actuator 1
-    actuator_velocity_target_.z = z + ACT_RADIUS*(- COS30*r - SIN30*p);
-	// The function below converts m/s to 15mm/s (the max speed) divided by 2^15 (the largest signed 2 byte int).
-    PhysicalDoubleToVelocityBytes(motor_velocity_target_.x,
-                                  &teensy_port->motor_velocities_out_.x[0],
-                                  &teensy_port->motor_velocities_out_.x[1]);
-    PhysicalDoubleToVelocityBytes(motor_velocity_target_.y,
-                                  &teensy_port->motor_velocities_out_.y[0],
-                                  &teensy_port->motor_velocities_out_.y[1]);
-    PhysicalDoubleToVelocityBytes(motor_velocity_target_.z,
-                                  &teensy_port->motor_velocities_out_.z[0],
-                                  &teensy_port->motor_velocities_out_.z[1]);
-    PhysicalDoubleToVelocityBytes(-actuator_velocity_target_.x,
-								  &teensy_port->actuator_velocities_out_.x[0],
-								  &teensy_port->actuator_velocities_out_.x[1]);
-	PhysicalDoubleToVelocityBytes(-actuator_velocity_target_.y,
-								  &teensy_port->actuator_velocities_out_.y[0],
-								  &teensy_port->actuator_velocities_out_.y[1]);
-	PhysicalDoubleToVelocityBytes(-actuator_velocity_target_.z,
-								  &teensy_port->actuator_velocities_out_.z[0],
-								  &teensy_port->actuator_velocities_out_.z[1]);
-	PhysicalDoubleToVelocityBytes(e,
-								  &teensy_port->goniometer_velocity_out_[0],
-								  &teensy_port->goniometer_velocity_out_[1]);
+	// The codec converts m/s to 15mm/s (the max speed) divided by 2^15 (the largest signed 2 byte int).
+	KinematicsVector body;
+	body << x, y, z, r, p, s, e;
+	g_kinematics.MotorVelocities(body, teensy_port->velocities_out_);
+	level_roll_rate_ = r/DEG_TO_RAD;
+	level_pitch_rate_ = p/DEG_TO_RAD;
+	if (use_snapshot) {
+		teensy_port->Request(SetRawAll);
+		return;
+	}
 	teensy_port->Request(SetRaw0);
     teensy_port->Request(SetRaw1);
     teensy_port->Request(SetRaw2);
@@ -258,20 +308,11 @@ void MoveSingleActuator(int actuator_index, double velocity) {
         return;
     }
 
-    // Convert to bytes and queue the request for each actuator
-    PhysicalDoubleToVelocityBytes(actuator_velocities[0],
-            &teensy_port->actuator_velocities_out_.x[0],
-            &teensy_port->actuator_velocities_out_.x[1]);
-    teensy_port->Request(SetRaw3);
-	PhysicalDoubleToVelocityBytes(actuator_velocities[1],
-            &teensy_port->actuator_velocities_out_.y[0],
-            &teensy_port->actuator_velocities_out_.y[1]);
-    teensy_port->Request(SetRaw4);
-	PhysicalDoubleToVelocityBytes(actuator_velocities[2],
-            &teensy_port->actuator_velocities_out_.z[0],
-            &teensy_port->actuator_velocities_out_.z[1]);
-    teensy_port->Request(SetRaw5);
-    
+    // Queue the request for each actuator
+    for (int i = 0; i < 3; i++) {
+        teensy_port->velocities_out_[3 + i] = actuator_velocities[i];
+        teensy_port->Request(SetRaw3 + i);
+    }
 
     teensy_port->SendAllRequests();
 }
@@ -288,48 +329,296 @@ void MoveSingleMotor(int motor_index, double velocity) {
         return;
     }
 
-    // Convert to bytes and queue the request for each actuator
-    PhysicalDoubleToVelocityBytes(motor_velocities[0],
-            &teensy_port->motor_velocities_out_.x[0],
-            &teensy_port->motor_velocities_out_.x[1]);
-    teensy_port->Request(SetRaw0);
-	PhysicalDoubleToVelocityBytes(motor_velocities[1],
-            &teensy_port->motor_velocities_out_.y[0],
-            &teensy_port->motor_velocities_out_.y[1]);
-    teensy_port->Request(SetRaw1);
-	PhysicalDoubleToVelocityBytes(motor_velocities[2],
-            &teensy_port->motor_velocities_out_.z[0],
-            &teensy_port->motor_velocities_out_.z[1]);
-    teensy_port->Request(SetRaw2);
-    
+    // Queue the request for each motor
+    for (int i = 0; i < 3; i++) {
+        teensy_port->velocities_out_[i] = motor_velocities[i];
+        teensy_port->Request(SetRaw0 + i);
+    }
 
     teensy_port->SendAllRequests();
 }
 
-bool stabiliser_file_open_flag_ = false;
-void LogSteps(int t_step, std::string filename, double f) {
-	std::ofstream output; 
-	output.open(filename ,std::ios::out);
-	
-	if(!stabiliser_file_open_flag_){
-		//Create a new file and write the state to it
-		output << "time" << ',' << "freq" << ',' 
-			//<< "M0_steps" << ',' << "M1_steps" << ',' << "M2_steps" << ',' 
-			//<< "LA0_steps" << ',' << "LA1_steps" << ',' << "LA2_steps" << ',' 
-			<< "accelerometer0_x" << ',' << "accelerometer0_y" << ',' << "accelerometer0_z" << ','
-			   << "accelerometer1_x" << ',' << "accelerometer1_y" << ',' << "accelerometer1_z" << ','
-			   << "accelerometer2_x" << ',' << "accelerometer2_y" << ',' << "accelerometer2_z" 
-			   << '\n';
-		//Set the flag to say that the leveller state file is already open for this run
-		stabiliser_file_open_flag_ = true;
+// Receives the star-tracker angles (radians) and stores them in arcseconds. If the
+// Star Tracker is in waiting state and the robot is tracking, set the robot velocity,
+// set the target step counts, and set the Star Tracker state to MOVING.
+void ReceiveSTAngles(double azimuth, double altitude, double pos_angle) {
+	g_ctrl.az = 206265.0*azimuth;
+	g_ctrl.alt = 206265.0*altitude;
+	g_ctrl.posang = 206265.0*pos_angle;
+	//Edited by Qianhui: normalise tha azimuth and altitude angles to be within -180 degrees to 180 degrees
+	double az_offset_deg = g_ctrl.az / 3600.0 ;
+	while (az_offset_deg > 180.0) az_offset_deg -= 360.0;
+	while (az_offset_deg < -180.0) az_offset_deg += 360.0;
+	g_ctrl.az = az_offset_deg * 3600.0; // Convert back to arcseconds
+	if ((g_status.st_status != ST_READY_TO_SLEW) || (g_ctrl.mode != ROBOT_TRACK)) {
+		return;
+	}
+	// If we are less than 1800 arcsec away in both axes (0.5 degrees), we move to traking mode right away.
+	if ((std::abs(g_ctrl.az) < 1800) && (std::abs(g_ctrl.alt) < 1800)) {
+		g_status.st_status = ST_SLEW_CLOSE;
+		std::cout << "RobotControllerServer: Star Tracker angles are less than 0.5deg, moving to tracking mode.\n";
+		return;
+	}
+	// If we are more than 1800 arcsec away in either axis, slew at 1 degree/s.
+	int current_yaw_steps = g_status.delta_motors[0] + g_status.delta_motors[1] + g_status.delta_motors[2];
+	g_ctrl.yaw_target = current_yaw_steps + g_ctrl.az / ARCSEC_PER_YAW_STEP;
+	if (g_ctrl.az > 1800)
+		g_ctrl.vel.yaw = -3600;
+	else if (g_ctrl.az < -1800)
+		g_ctrl.vel.yaw = 3600;
+	else
+		g_ctrl.vel.yaw = 0.0;
+
+	g_ctrl.el_target = g_status.delta_motors[6] + g_ctrl.alt / ARCSEC_PER_EL_STEP;
+	if (g_ctrl.alt > 1800)
+		g_ctrl.vel.el = -3600;
+	else if (g_ctrl.alt < -1800)
+		g_ctrl.vel.el = 3600;
+	else
+		g_ctrl.vel.el = 0.0;
+
+	g_status.st_status = ST_SLEW_BLIND;
+	std::cout << "Yaw: current steps = " << current_yaw_steps
+			<< ", target steps = " << g_ctrl.yaw_target << std::endl;
+	std::cout << "Elevation: current steps = " << g_status.delta_motors[6]
+			<< ", target steps = " << g_ctrl.el_target << std::endl;
+	std::cout << "Current star tracker status is:" << g_status.st_status << std::endl;
+}
+
+// Receives a plate solve fix (radians) taken age_s ago. With fusion on, it goes into the
+// fused estimate, which is then used as the star tracker angles (including for the slew);
+// otherwise it is used as it is, as in ReceiveSTAngles.
+void ReceiveSTFix(double azimuth, double altitude, double pos_angle, double age_s) {
+	if (!g_ctrl.fusion) {
+		ReceiveSTAngles(azimuth, altitude, pos_angle);
+		return;
+	}
+	double az = std::remainder(206265.0*azimuth, 360.0*3600.0);
+	if (attitude_.Fix(MonotonicNs(), az, 206265.0*altitude, 206265.0*pos_angle, age_s) < 0) {
+		std::cout << "Star tracker fix " << age_s << "s old dropped\n";
+		return;
+	}
+	ReceiveSTAngles(attitude_.az()/206265.0, attitude_.alt()/206265.0, pos_angle);
+}
+
+// Receives a fine star tracker centroid offset (radians) taken age_s ago. With fusion on,
+// it goes into the fused estimate; otherwise it is used as it is, as in ReceiveSTAngles.
+void ReceiveSTCentroid(double azimuth, double altitude, double age_s) {
+	if (!g_ctrl.fusion) {
+		ReceiveSTAngles(azimuth, altitude, 0.0);
+		return;
+	}
+	attitude_.Centroid(MonotonicNs(), 206265.0*azimuth, 206265.0*altitude, age_s);
+}
+
+void SetMode(int mode) {
+	if (mode != ROBOT_SYSID) {
+		sysid_.Stop();
+	}
+	g_ctrl.mode = mode;
+	g_ctrl.mode_changed = true;
+}
+
+void SetVelocities(const double* args, bool with_el) {
+	g_ctrl.vel.velocity = args[0];
+	g_ctrl.vel.x = args[1];
+	g_ctrl.vel.y = args[2];
+	g_ctrl.vel.z = args[3];
+	g_ctrl.vel.roll = args[4];
+	g_ctrl.vel.pitch = args[5];
+	g_ctrl.vel.yaw = args[6];
+	if (with_el) {
+		g_ctrl.vel.el = args[7];
+	}
+}
+
+// Apply a command from the commander server. Called from the robot loop only, so the
+// control state is never changed part way through a tick.
+void ApplyCommand(const ControlCommand& cmd) {
+	const double* a = cmd.args;
+	switch (cmd.type) {
+		case CMD_START:
+			SetMode(ROBOT_IDLE);
+			break;
+		case CMD_STOP:
+		case CMD_DISCONNECT:
+			g_ctrl.vel = g_zero_vel;
+			g_ctrl.ygain = 0;
+			g_ctrl.egain = 0;
+			if (cmd.type == CMD_STOP) {
+				g_ctrl.h_gain = 0;
+			}
+			SetMode(cmd.type == CMD_STOP ? ROBOT_TRANSLATE : ROBOT_DISCONNECT);
+			break;
+		case CMD_TRANSLATE:
+			SetVelocities(a, true);
+			SetMode(ROBOT_TRANSLATE);
+			break;
+		case CMD_RESONANCE:
+			SetVelocities(a, false);
+			resonance_f_ = 0.5;
+			resonance_pause_end_ns_ = 0;
+			SetMode(ROBOT_RESONANCE);
+			break;
+		case CMD_TRACK:
+			SetVelocities(a, true);
+			SetMode(ROBOT_TRACK);
+			break;
+		case CMD_ST_ANGLES:
+			ReceiveSTAngles(a[0], a[1], a[2]);
+			break;
+		case CMD_ST_FIX:
+			ReceiveSTFix(a[0], a[1], a[2], a[3]);
+			break;
+		case CMD_ST_CENTROID:
+			ReceiveSTCentroid(a[0], a[1], a[2]);
+			break;
+		case CMD_FUSION:
+			// Start the estimate afresh, from the next fix or centroid
+			g_ctrl.fusion = (a[0] != 0);
+			attitude_.Reset();
+			std::cout << "Star tracker fusion " << (g_ctrl.fusion ? "on" : "off") << std::endl;
+			break;
+		case CMD_GAINS:
+			// Also set the sums to zero.
+			g_ctrl.ygain = a[0];
+			g_ctrl.egain = a[1];
+			g_ctrl.yint = a[2];
+			g_ctrl.eint = a[3];
+			g_ctrl.esum = 0.0;
+			g_ctrl.ysum = 0.0;
+			break;
+		case CMD_HEADING:
+			g_ctrl.heading = 60*a[0]; //!!! Why 60?
+			g_ctrl.h_gain = a[1];
+			break;
+		case CMD_OFFSETS:
+			g_ctrl.az_off += a[0];
+			g_ctrl.alt_off += a[1];
+			g_ctrl.roll_target += a[2];
+			g_ctrl.pitch_target += a[3];
+			break;
+		case CMD_ST_STATE:
+			g_status.st_status = (int)a[0];
+			break;
+		case CMD_MOVE_ACTUATOR:
+			MoveSingleActuator((int)a[0], a[1]);
+			break;
+		case CMD_MOVE_MOTOR:
+			MoveSingleMotor((int)a[0], a[1]);
+			break;
+		case CMD_FILE:
+			strncpy(g_ctrl.filename, cmd.text, sizeof(g_ctrl.filename) - 1);
+			break;
+		case CMD_SET_EL_90: {
+			// Reset the elevation to vertical, by slewing back to zero steps.
+			double el_angle = g_status.delta_motors[6] * ARCSEC_PER_EL_STEP * ARCSEC_TO_RAD;
+			SetMode(ROBOT_TRACK);
+			g_status.st_status = ST_READY_TO_SLEW;
+			ReceiveSTAngles(0.0, -el_angle, 0.0);
+			std::cout << "Setting elevation to 90 degrees" << std::endl;
+			break;
+		}
+		case CMD_SYSID: {
+			SysIdConfig config;
+			config.excitation = (int)a[0];
+			config.axis = (int)a[1];
+			config.response = (int)a[2];
+			config.amplitude = a[3];
+			config.f_start = a[4];
+			config.f_stop = a[5];
+			config.num_freqs = (int)a[6];
+			config.duration_s = a[7];
+			// The excitation is held for a tick, so keep well below the loop's Nyquist frequency
+			if (config.f_stop > 0.25e6/g_loop_period_us) {
+				std::cout << "System identification needs f_stop below " << 0.25e6/g_loop_period_us << " Hz" << std::endl;
+				break;
+			}
+			if (sysid_.Start(config, MonotonicNs()) == 0) {
+				g_ctrl.vel = g_zero_vel;
+				SetMode(ROBOT_SYSID);
+			}
+			break;
+		}
+		case CMD_SYSID_STOP:
+			sysid_.Stop();
+			break;
+		default:
+			std::cout << "Unknown robot command " << cmd.type << std::endl;
+			break;
 	}
-	output << t_step << ',' << f << ',' << g_status.delta_motors[0] << ',' << g_status.delta_motors[1] << ','  << g_status.delta_motors[2] << ',' 
-			   << g_status.delta_motors[3] << ',' << g_status.delta_motors[4] << ',' << g_status.delta_motors[5] << ',' 
-			   << leveller.acc0_latest_measurements_.x << ',' << leveller.acc0_latest_measurements_.y << ',' << leveller.acc0_latest_measurements_.z << ','
-			   << leveller.acc1_latest_measurements_.x << ',' << leveller.acc1_latest_measurements_.y << ',' << leveller.acc1_latest_measurements_.z << ','
-		 	   << leveller.acc2_latest_measurements_.x << ',' << leveller.acc2_latest_measurements_.y << ',' << leveller.acc2_latest_measurements_.z 
-			   <<'\n';
-	output.close();
+}
+
+// Binary log of the resonance tests (read with libs/telemetry/read_telemetry.py)
+telemetry::Logger resonance_log("resonance", {
+	{"time", telemetry::I64}, {"freq", telemetry::F64},
+	{"M0_steps", telemetry::I32}, {"M1_steps", telemetry::I32}, {"M2_steps", telemetry::I32},
+	{"LA0_steps", telemetry::I32}, {"LA1_steps", telemetry::I32}, {"LA2_steps", telemetry::I32},
+	{"EL_steps", telemetry::I32},
+	{"accelerometer0_x", telemetry::F64}, {"accelerometer0_y", telemetry::F64}, {"accelerometer0_z", telemetry::F64},
+	{"accelerometer1_x", telemetry::F64}, {"accelerometer1_y", telemetry::F64}, {"accelerometer1_z", telemetry::F64},
+	{"accelerometer2_x", telemetry::F64}, {"accelerometer2_y", telemetry::F64}, {"accelerometer2_z", telemetry::F64},
+	{"accelerometer_time_ns", telemetry::I64}});
+std::string resonance_log_failed_filename;
+
+void LogSteps(long t_step, const char* filename, double f) {
+	// Open the log the first time through, or when the filename has been changed
+	if (resonance_log.filename() != filename || !resonance_log.isOpen()) {
+		if (filename == resonance_log_failed_filename) {
+			return;
+		}
+		if (resonance_log.open(filename)) {
+			resonance_log_failed_filename = filename;
+			return;
+		}
+	}
+	resonance_log.log(t_step, f, g_status.delta_motors[0], g_status.delta_motors[1], g_status.delta_motors[2],
+			   g_status.delta_motors[3], g_status.delta_motors[4], g_status.delta_motors[5], g_status.delta_motors[6],
+			   leveller.acc0_latest_measurements_.x, leveller.acc0_latest_measurements_.y, leveller.acc0_latest_measurements_.z,
+			   leveller.acc1_latest_measurements_.x, leveller.acc1_latest_measurements_.y, leveller.acc1_latest_measurements_.z,
+			   leveller.acc2_latest_measurements_.x, leveller.acc2_latest_measurements_.y, leveller.acc2_latest_measurements_.z,
+			   leveller_sample_ns_);
+}
+
+// Flight recorder of the loop ticks, made by InitTickRecorder (see Globals.h)
+telemetry::Recorder* g_tick_recorder = nullptr;
+double g_tick_ring_s = 30;
+
+int InitTickRecorder(double seconds) {
+	size_t num_records = std::max(1.0, seconds*1e6/g_loop_period_us);
+	delete g_tick_recorder;
+	g_tick_recorder = new telemetry::Recorder("robot_ticks", {
+		{"loop_counter", telemetry::U32}, {"mode", telemetry::U8}, {"st_status", telemetry::U8},
+		{"late_us", telemetry::F32}, {"work_us", telemetry::F32},
+		{"accelerometer0_x", telemetry::F32}, {"accelerometer0_y", telemetry::F32}, {"accelerometer0_z", telemetry::F32},
+		{"accelerometer1_x", telemetry::F32}, {"accelerometer1_y", telemetry::F32}, {"accelerometer1_z", telemetry::F32},
+		{"accelerometer2_x", telemetry::F32}, {"accelerometer2_y", telemetry::F32}, {"accelerometer2_z", telemetry::F32},
+		{"accelerometer_time_ns", telemetry::I64},
+		{"M0_steps", telemetry::I32}, {"M1_steps", telemetry::I32}, {"M2_steps", telemetry::I32},
+		{"LA0_steps", telemetry::I32}, {"LA1_steps", telemetry::I32}, {"LA2_steps", telemetry::I32},
+		{"EL_steps", telemetry::I32},
+		{"M0_vel", telemetry::F32}, {"M1_vel", telemetry::F32}, {"M2_vel", telemetry::F32},
+		{"LA0_vel", telemetry::F32}, {"LA1_vel", telemetry::F32}, {"LA2_vel", telemetry::F32},
+		{"EL_vel", telemetry::F32},
+		{"roll_error", telemetry::F32}, {"pitch_error", telemetry::F32},
+		{"az", telemetry::F32}, {"alt", telemetry::F32}, {"az_off", telemetry::F32}, {"alt_off", telemetry::F32},
+		{"esum", telemetry::F64}, {"ysum", telemetry::F64}}, num_records);
+	std::cout << "Tick recorder holds " << num_records << " ticks (" << seconds << " s)" << std::endl;
+	return 0;
+}
+
+// Record this tick: timing (ns), the latest sensors, the velocities sent and the servo errors (arcsec)
+void RecordTick(long long late_ns, long long work_ns) {
+	const double *v = teensy_port->velocities_out_;
+	const int *steps = g_status.delta_motors;
+	g_tick_recorder->record(loop_counter, g_ctrl.mode, g_status.st_status, 0.001*late_ns, 0.001*work_ns,
+		leveller.acc0_latest_measurements_.x, leveller.acc0_latest_measurements_.y, leveller.acc0_latest_measurements_.z,
+		leveller.acc1_latest_measurements_.x, leveller.acc1_latest_measurements_.y, leveller.acc1_latest_measurements_.z,
+		leveller.acc2_latest_measurements_.x, leveller.acc2_latest_measurements_.y, leveller.acc2_latest_measurements_.z,
+		leveller_sample_ns_, steps[0], steps[1], steps[2], steps[3], steps[4], steps[5], steps[6],
+		v[0], v[1], v[2], v[3], v[4], v[5], v[6],
+		g_ctrl.roll_target - g_status.roll, g_ctrl.pitch_target - g_status.pitch,
+		g_ctrl.az, g_ctrl.alt, g_ctrl.az_off, g_ctrl.alt_off, g_ctrl.esum, g_ctrl.ysum);
 }
 
 // Manual translation of robot, for coarse positioning.
@@ -337,21 +626,20 @@ void translate() {
 	Doubles velocity_target;
 	Doubles angle_target;
 	teensy_port->ReadMessage();
-	PassAccelBytesToLeveller(); 
-	UpdateTarget(); 	
+	UpdateLeveller();
 	UpdateStepCounts();
+	UpdateAttitude();
 	
 	// These should convert velocities from mm/s and arcsec/sec to m/s and rad/s.
-	double elevation_target = ARCSEC_TO_RAD*g_vel.el;
-	velocity_target.x = 0.001*g_vel.velocity*g_vel.x;
-	velocity_target.y = 0.001*g_vel.velocity*g_vel.y;
-	velocity_target.z = 0.001*g_vel.velocity*g_vel.z;
-	angle_target.x = ARCSEC_TO_RAD*g_vel.roll; 
-	angle_target.y = ARCSEC_TO_RAD*g_vel.pitch; 
-	angle_target.z = ARCSEC_TO_RAD*g_vel.yaw;
+	double elevation_target = ARCSEC_TO_RAD*g_ctrl.vel.el;
+	velocity_target.x = 0.001*g_ctrl.vel.velocity*g_ctrl.vel.x;
+	velocity_target.y = 0.001*g_ctrl.vel.velocity*g_ctrl.vel.y;
+	velocity_target.z = 0.001*g_ctrl.vel.velocity*g_ctrl.vel.z;
+	angle_target.x = ARCSEC_TO_RAD*g_ctrl.vel.roll; 
+	angle_target.y = ARCSEC_TO_RAD*g_ctrl.vel.pitch; 
+	angle_target.z = ARCSEC_TO_RAD*g_ctrl.vel.yaw;
 	
-	RequestAccelerations();
-	RequestStepCounts();
+	RequestSensors();
 
 	//As a stress on the messaging, we update the velocity to the same value each time (this is a more realistic version of the system)
 	UpdateBFFVelocityAngle(velocity_target.x, velocity_target.y, velocity_target.z, angle_target.x, angle_target.y, angle_target.z, elevation_target);
@@ -360,16 +648,46 @@ void translate() {
 	last_stabiliser_timepoint = global_timepoint;
 
 	// Update the status. 
-	std::lock_guard<std::mutex> lock(GLOB_STATUS_LOCK);
 	g_status.roll = 3600*roll_estimate_filtered_;
 	g_status.pitch = 3600*pitch_estimate_filtered_;
 }
 
+// System identification: the excitation on one axis, open loop (no levelling), with the
+// response demodulated in UpdateTarget. The robot is stopped when it is done.
+void sysid() {
+	teensy_port->ReadMessage();
+	UpdateLeveller();
+	UpdateStepCounts();
+	UpdateAttitude();
+
+	// x, y, z (mm/s), roll, pitch, yaw, el (arcsec/s), as for translate
+	double v[7] = {0, 0, 0, 0, 0, 0, 0};
+	v[sysid_.results().config.axis] = sysid_.Excitation(MonotonicNs());
+
+	RequestSensors();
+	UpdateBFFVelocityAngle(0.001*v[0], 0.001*v[1], 0.001*v[2],
+		ARCSEC_TO_RAD*v[3], ARCSEC_TO_RAD*v[4], ARCSEC_TO_RAD*v[5], ARCSEC_TO_RAD*v[6]);
+	teensy_port->SendAllRequests();
+
+	g_status.roll = 3600*roll_estimate_filtered_;
+	g_status.pitch = 3600*pitch_estimate_filtered_;
+	if (!sysid_.running()) {
+		std::cout << "System identification done, " << sysid_.results().num_points << " points\n";
+		g_ctrl.vel = g_zero_vel;
+		SetMode(ROBOT_TRANSLATE);
+	}
+}
+
+// Set by saturation() when it clamps, so that track() can trigger the tick recorder
+bool saturated_ = false;
+
 double saturation(double val) {
     if (val > 5000.0) {
+        saturated_ = true;
         return 5000.0;
     }
     if (val < -5000.0) {
+        saturated_ = true;
         return -5000.0;
     }
     return val;
@@ -378,7 +696,7 @@ double saturation(double val) {
 void track() {
 	// Main tracking function, including bothleveling and tracking. 
 	// This is called in the main loop when we are in ST_TRACKING or ST_MOVING.
-	// Track the star, based on the g_az and g_alt offsets received previously from
+	// Track the star, based on the g_ctrl.az and g_ctrl.alt offsets received previously from
 	// the star tracker. This supercedes much of the machinery in the RobotDriver.
 	Doubles velocity_target;
 	Doubles angle_target;
@@ -388,39 +706,38 @@ void track() {
 	// Here we get the latest data (i.e. accelerometers) from the Teensy.
 	teensy_port->ReadMessage();
 
-	// Send the raw data to the leveller object, so that it can compute acclerations.
-	PassAccelBytesToLeveller();
-	
-	// Update our pitch and roll targets (internally in degrees)
-	UpdateTarget();
+	// Send the new accelerometer samples to the leveller, which updates our pitch and
+	// roll targets (internally in degrees)
+	UpdateLeveller();
 
-	// Update the step counts from the Teensy.
+	// Update the step counts from the Teensy, and with them the fused star tracker angles.
 	UpdateStepCounts();
+	UpdateAttitude();
 	
 	// Now that we have updated steps, if we are in ST_SLEW_BLIND, lets see if we are close enough to the target.
 	if (g_status.st_status == ST_SLEW_BLIND) {
 		// First check elevation. !!! Qianhui check signs. Also we should stop when we are close enough to the target.
-		if ( (g_vel.el > 0.0) && (g_status.delta_motors[6] <= g_el_target) ) {
+		if ( (g_ctrl.vel.el > 0.0) && (g_status.delta_motors[6] <= g_ctrl.el_target) ) {
 			// Print out the current elevation target and delta_motors[6] for debugging.
-			std::cout << "Elevation target: " << g_el_target << ", current steps: " << g_status.delta_motors[6] << '\n';
+			std::cout << "Elevation target: " << g_ctrl.el_target << ", current steps: " << g_status.delta_motors[6] << '\n';
 			// Set the elevation velocity to zero.	
-			g_vel.el = 0.0;	
-		} else if ( (g_vel.el < 0.0) && (g_status.delta_motors[6] >= g_el_target) ) {
-			g_vel.el = 0.0;
+			g_ctrl.vel.el = 0.0;	
+		} else if ( (g_ctrl.vel.el < 0.0) && (g_status.delta_motors[6] >= g_ctrl.el_target) ) {
+			g_ctrl.vel.el = 0.0;
 		}
 		// Now check yaw.
 		double current_yaw_steps = g_status.delta_motors[0] + g_status.delta_motors[1] + g_status.delta_motors[2];
-		if ( (g_vel.yaw > 0.0) && (current_yaw_steps <= g_yaw_target) ) {
-			g_vel.yaw = 0.0;
-		} else if ( (g_vel.yaw < 0.0) && (current_yaw_steps >= g_yaw_target) ) {
-			g_vel.yaw = 0.0;
+		if ( (g_ctrl.vel.yaw > 0.0) && (current_yaw_steps <= g_ctrl.yaw_target) ) {
+			g_ctrl.vel.yaw = 0.0;
+		} else if ( (g_ctrl.vel.yaw < 0.0) && (current_yaw_steps >= g_ctrl.yaw_target) ) {
+			g_ctrl.vel.yaw = 0.0;
 		}
 		// If both velocities have been set to zero, we are done with our big movement.
 		// Set integral term sums to zero!
-		if ( (g_vel.el == 0.0) && (g_vel.yaw == 0.0) ) {
+		if ( (g_ctrl.vel.el == 0.0) && (g_ctrl.vel.yaw == 0.0) ) {
 			g_status.st_status = ST_SLEW_CLOSE;
-			g_ysum = 0.0;
-			g_esum = 0.0;
+			g_ctrl.ysum = 0.0;
+			g_ctrl.esum = 0.0;
 		}
 	}
 
@@ -428,34 +745,39 @@ void track() {
 	// in arcseconds. 
 	g_status.roll = 3600*roll_estimate_filtered_;
 	g_status.pitch = 3600*pitch_estimate_filtered_;
-	roll_error = g_roll_target - g_status.roll;
-	pitch_error = g_pitch_target - g_status.pitch;
+	roll_error = g_ctrl.roll_target - g_status.roll;
+	pitch_error = g_ctrl.pitch_target - g_status.pitch;
 
 	// the constant on the following line is arc-seconds per radian.
 	if (g_status.st_status == ST_SLEW_CLOSE) is_tracking = 1.0;
-	double elevation_target = ARCSEC_TO_RAD*saturation(g_vel.el + 
-		is_tracking*(g_egain*(g_alt+g_alt_off) + g_eint*g_esum));
-	velocity_target.x = 0.001*g_vel.velocity*g_vel.x;
-	velocity_target.y = 0.001*g_vel.velocity*g_vel.y;
-	velocity_target.z = 0.001*g_vel.velocity*g_vel.z;
+	saturated_ = false;
+	double elevation_target = ARCSEC_TO_RAD*saturation(g_ctrl.vel.el + 
+		is_tracking*(g_ctrl.egain*(g_ctrl.alt+g_ctrl.alt_off) + g_ctrl.eint*g_ctrl.esum));
+	velocity_target.x = 0.001*g_ctrl.vel.velocity*g_ctrl.vel.x;
+	velocity_target.y = 0.001*g_ctrl.vel.velocity*g_ctrl.vel.y;
+	velocity_target.z = 0.001*g_ctrl.vel.velocity*g_ctrl.vel.z;
 	
 	// Create velocities for pitch and roll, based on a proportional server and our
 	// errors. Convert to radians/s.
-	angle_target.x = ARCSEC_TO_RAD*saturation(g_vel.roll + g_roll_gain*roll_error);
-	angle_target.y = ARCSEC_TO_RAD*saturation(g_vel.pitch + g_pitch_gain*pitch_error);
+	angle_target.x = ARCSEC_TO_RAD*saturation(g_ctrl.vel.roll + g_roll_gain*roll_error);
+	angle_target.y = ARCSEC_TO_RAD*saturation(g_ctrl.vel.pitch + g_pitch_gain*pitch_error);
 	
 	// Create a yaw velocity based on the target yaw velocity "yaw" and a PI servo loop
-	// based on the g_az. 
-	angle_target.z = ARCSEC_TO_RAD*saturation(g_vel.yaw + 
-		is_tracking*(g_ygain*(g_az + g_az_off) + g_yint*g_ysum) + h_gain*g_heading);
+	// based on the g_ctrl.az. 
+	angle_target.z = ARCSEC_TO_RAD*saturation(g_ctrl.vel.yaw + 
+		is_tracking*(g_ctrl.ygain*(g_ctrl.az + g_ctrl.az_off) + g_ctrl.yint*g_ctrl.ysum) + g_ctrl.h_gain*g_ctrl.heading);
 	
+	// Keep what led up to a saturated servo output
+	if (saturated_ && g_tick_recorder != nullptr) {
+		g_tick_recorder->trigger("saturation");
+	}
+
 	// This is an integral term, i.e. a sum.
-	g_esum += 0.001*(g_alt + g_alt_off);
-	g_ysum += 0.001*(g_az + g_az_off);
+	g_ctrl.esum += 1e-6*g_loop_period_us*(g_ctrl.alt + g_ctrl.alt_off);
+	g_ctrl.ysum += 1e-6*g_loop_period_us*(g_ctrl.az + g_ctrl.az_off);
 				
-	// This requests accelerations and step counts (other parts commented out)
-	RequestAccelerations();
-	RequestStepCounts();
+	// This requests accelerations and step counts
+	RequestSensors();
 
 	//This sends all velocities to the teensy queue of requests.
 	UpdateBFFVelocityAngle(velocity_target.x, velocity_target.y, velocity_target.z, angle_target.x, angle_target.y, angle_target.z, elevation_target);
@@ -469,32 +791,45 @@ void track() {
 // This function makes a periodic change to the robot velocity of amplitude
 // "velocity" or 0.001 * "velocity" in order to test resonances. It is an update
 // to the original resonance function, which was not working correctly (why?)
-
+// The frequency steps up by 0.5 Hz every 5 s, with a 5 s pause at rest between frequencies
+// that the loop keeps ticking through. For gain and phase measurements use sysid() instead.
 void unambig() {	
-	double f = 0.5; // Frequency in Hz. This has to be a global and an input!!!
+	if (resonance_pause_end_ns_ != 0) {
+		if (MonotonicNs() < resonance_pause_end_ns_) {
+			return;
+		}
+		// Restart the time base for the next frequency
+		resonance_pause_end_ns_ = 0;
+		time_point_start = steady_clock::now();
+		time_point_current = steady_clock::now();
+		last_stabiliser_timepoint = duration_cast<microseconds>(time_point_current-time_point_start).count();
+		global_timepoint = duration_cast<microseconds>(time_point_current-time_point_start).count();
+		last_resonance_timepoint = global_timepoint;
+	}
+	double f = resonance_f_;
 	Doubles velocity_target;
 	Doubles angle_target;
-	velocity_target.x = 0.001*g_vel.velocity*g_vel.x*sin(2*3.14159265*f*global_timepoint*0.000001);
-	velocity_target.y = 0.001*g_vel.velocity*g_vel.y*sin(2*3.14159265*f*global_timepoint*0.000001);
-	velocity_target.z = 0.001*g_vel.velocity*g_vel.z*sin(2*3.14159265*f*global_timepoint*0.000001);
-	angle_target.x = 0.001*g_vel.roll*sin(2*3.14159265*f*global_timepoint*0.000001);
-	angle_target.y = 0.001*g_vel.pitch*sin(2*3.14159265*f*global_timepoint*0.000001);
-	angle_target.z = 0.001*g_vel.yaw*sin(2*3.14159265*f*global_timepoint*0.000001);
+	velocity_target.x = 0.001*g_ctrl.vel.velocity*g_ctrl.vel.x*sin(2*3.14159265*f*global_timepoint*0.000001);
+	velocity_target.y = 0.001*g_ctrl.vel.velocity*g_ctrl.vel.y*sin(2*3.14159265*f*global_timepoint*0.000001);
+	velocity_target.z = 0.001*g_ctrl.vel.velocity*g_ctrl.vel.z*sin(2*3.14159265*f*global_timepoint*0.000001);
+	angle_target.x = 0.001*g_ctrl.vel.roll*sin(2*3.14159265*f*global_timepoint*0.000001);
+	angle_target.y = 0.001*g_ctrl.vel.pitch*sin(2*3.14159265*f*global_timepoint*0.000001);
+	angle_target.z = 0.001*g_ctrl.vel.yaw*sin(2*3.14159265*f*global_timepoint*0.000001);
 	
 	if(global_timepoint-last_stabiliser_timepoint > 1000) {
 		if (f>100) {
 			teensy_port->Request(STOP);
-			g_vel = g_zero_vel;
+			g_ctrl.vel = g_zero_vel;
 			resonance_enable_flag = false;
 			std::cout << global_timepoint*0.000001 << '\n';
 		}	
 		if(resonance_enable_flag) {
             teensy_port->ReadMessage();	
-			RequestAccelerations();
-			RequestStepCounts();
+			UpdateLeveller();
+			RequestSensors();
 			//As a stress on the messaging, we update the velocity to the same value each time (this is a more realistic version of the system)
-			UpdateBFFVelocityAngle(velocity_target.x, velocity_target.y, velocity_target.z, angle_target.x, angle_target.y, angle_target.z, g_vel.el);
-			LogSteps(global_timepoint, g_filename, f);
+			UpdateBFFVelocityAngle(velocity_target.x, velocity_target.y, velocity_target.z, angle_target.x, angle_target.y, angle_target.z, g_ctrl.vel.el);
+			LogSteps(global_timepoint, g_ctrl.filename, f);
 		}
 		if (global_timepoint-last_stabiliser_timepoint > 1500) {
 		    last_stabiliser_timepoint = global_timepoint;
@@ -502,30 +837,89 @@ void unambig() {
 		    last_stabiliser_timepoint += 1000;
 		}
 		if (global_timepoint-last_resonance_timepoint > 5000000 && sin(2*3.14159265*f*global_timepoint*0.000001)<0.01) {
+			// Stop, keeping the amplitudes for the next frequency, and pause
 			teensy_port->Request(STOP);
-			g_vel = g_zero_vel;
 			teensy_port->SendAllRequests();
-			sleep(5);
-			f = f + 0.5;
-			std::cout << f << '\n';
-			time_point_start = steady_clock::now();
-			time_point_current = steady_clock::now();
-			last_stabiliser_timepoint = duration_cast<microseconds>(time_point_current-time_point_start).count();
-			global_timepoint = duration_cast<microseconds>(time_point_current-time_point_start).count();
-			last_resonance_timepoint = global_timepoint;
+			resonance_pause_end_ns_ = MonotonicNs() + 5000000000LL;
+			resonance_f_ += 0.5;
+			std::cout << resonance_f_ << '\n';
+			return;
 		}
 		teensy_port->SendAllRequests();
 
 	}
 }
  
+// Real-time settings, which main.cpp may overwrite from the toml file
+long g_loop_period_us = 1000;
+int g_loop_cpu = -1;
+int g_loop_priority = 80;
+
+long long TimespecToNs(const timespec& t) {
+	return 1000000000LL*t.tv_sec + t.tv_nsec;
+}
+
+timespec NsToTimespec(long long ns) {
+	timespec t;
+	t.tv_sec = ns/1000000000LL;
+	t.tv_nsec = ns%1000000000LL;
+	return t;
+}
+
+long long MonotonicNs() {
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return TimespecToNs(t);
+}
+
+// Pin the calling thread to g_loop_cpu and make it SCHED_FIFO at g_loop_priority.
+// Failure (e.g. no rtprio limit for this user) is reported, and the loop runs anyway.
+void SetupRealtimeThread() {
+	if (g_loop_cpu >= 0) {
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		CPU_SET(g_loop_cpu, &cpuset);
+		int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+		if (ret != 0) {
+			std::cout << "Could not pin robot loop to CPU " << g_loop_cpu << ": " << strerror(ret) << std::endl;
+		}
+	}
+	if (g_loop_priority > 0) {
+		sched_param sch_params;
+		sch_params.sched_priority = g_loop_priority;
+		int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sch_params);
+		if (ret != 0) {
+			std::cout << "Could not set SCHED_FIFO priority " << g_loop_priority << ": " << strerror(ret) << std::endl;
+		}
+	}
+}
+
 /*
-This is the main robot loop, that has an interior loop that is run about every 
-milli-second, which is forked as a thread from the RobotControlServer's start_robot_loop 
+This is the main robot loop, that has an interior loop that is run every g_loop_period_us
+(1 ms by default), which is forked as a thread from the RobotControlServer's start_robot_loop.
+Each tick sleeps until an absolute deadline, so the time spent in the loop body does not
+add to the period. Commands from the commander server are applied at the start of each
+tick, and the status is published at the end; timing statistics are updated once a second.
 */
 int robot_loop() {
     // Initialise the communication port to the Teensy
     teensy_port = new Comms::SerialPort(128);
+	use_snapshot = (teensy_port->device_firmware_v_ >= SNAPSHOT_FIRMWARE_VERSION);
+	std::cout << (use_snapshot ? "Using the Snapshot protocol\n" : "Using the per-item protocol (old firmware)\n");
+	use_stream = (teensy_port->device_firmware_v_ >= STREAM_FIRMWARE_VERSION);
+	if (use_stream) {
+		std::cout << "Using the accelerometer stream\n";
+	}
+
+	// The leveller filters run at the accelerometer sample rate
+	double level_sample_hz = 1e6/(use_stream ? ROBOT_STREAM_PERIOD_US : g_loop_period_us);
+	pitch_filter_.Configure(g_level_filter, g_level_filter_length, g_level_cutoff_hz, level_sample_hz);
+	roll_filter_.Configure(g_level_filter, g_level_filter_length, g_level_cutoff_hz, level_sample_hz);
+
+	// The fused star tracker estimate starts afresh, from the step counts of this loop
+	attitude_.Configure(g_attitude_noise);
+	g_ctrl.fusion = g_fusion_enabled;
+	last_steps_valid_ = false;
 
 	// Reset the loop counter
 	loop_counter = 0;
@@ -537,25 +931,45 @@ int robot_loop() {
 	last_stabiliser_timepoint = duration_cast<microseconds>(time_point_current-time_point_start).count();
     last_resonance_timepoint = duration_cast<microseconds>(time_point_current-time_point_start).count();
 
+	SetupRealtimeThread();
+
+	// Start the tick recorder, keeping half the ring after a trigger. A capture frozen
+	// before a restart by the watchdog is left for capture_dump.
+	if (g_tick_recorder != nullptr && g_tick_recorder->state() == telemetry::Recorder::STOPPED) {
+		g_tick_recorder->start(g_tick_ring_s*5e5/g_loop_period_us);
+	}
+
+	// Timing statistics since they were last published, and the next deadline
+	long long period_ns = 1000LL*g_loop_period_us;
+	long long ticks_per_publish = std::max(1LL, 1000000000LL/period_ns);
+	long long n_ticks = 0, late_sum = 0, late_max = 0, work_sum = 0, work_max = 0;
+	int overruns = 0;
+	long long deadline_ns = MonotonicNs();
+
 	bool closed_loop_enable_flag = true;
 	time_point_start = steady_clock::now();
 	while(closed_loop_enable_flag) {
-		//Boolean to store if we have done anything on this loop and wait a little bit if we haven't
+		long long wake_ns = MonotonicNs();
 		alive_counter++;
+
+		// Apply the commands that arrived since the last tick
+		ControlCommand cmd;
+		while (g_commands.Pop(&cmd)) {
+			ApplyCommand(cmd);
+		}
 		
-		if (GLOBAL_STATUS_CHANGED) {
+		if (g_ctrl.mode_changed) {
 			time_point_start = steady_clock::now();
 			time_point_current = steady_clock::now();
             last_stabiliser_timepoint = duration_cast<microseconds>(time_point_current-time_point_start).count();
  			resonance_enable_flag = true;
-			GLOBAL_STATUS_CHANGED = false;
+			g_ctrl.mode_changed = false;
 		}
 		time_point_current = steady_clock::now();
 		global_timepoint = duration_cast<microseconds>(time_point_current-time_point_start).count();
 
-		switch(GLOBAL_SERVER_STATUS) {
+		switch(g_ctrl.mode) {
 			case ROBOT_IDLE:
-				usleep(10);
 				break;
 			case ROBOT_TRANSLATE:
 				translate();
@@ -566,19 +980,67 @@ int robot_loop() {
 			case ROBOT_TRACK:
 				track();
 				break;
+			case ROBOT_SYSID:
+				sysid();
+				break;
 			case ROBOT_DISCONNECT:
 			    std::cout << "disconnecting\n";
 			    translate();
 			    closed_loop_enable_flag = false;
 			default:
-			    usleep(10);
 				break;
 		}
-		usleep(duration_cast<microseconds>(time_point_current-steady_clock::now()).count() + 1000);
+
+		// Timing of this tick
+		long long done_ns = MonotonicNs();
+		long long late_ns = wake_ns - deadline_ns;
+		long long work_ns = done_ns - wake_ns;
+		n_ticks++;
+		late_sum += late_ns;
+		late_max = std::max(late_max, late_ns);
+		work_sum += work_ns;
+		work_max = std::max(work_max, work_ns);
+
+		// Next deadline. If the loop body ran past it, skip the missed ticks
+		// rather than running them back to back, keeping the phase.
+		deadline_ns += period_ns;
+		if (done_ns >= deadline_ns) {
+			long long missed = (done_ns - deadline_ns)/period_ns + 1;
+			overruns += missed;
+			deadline_ns += missed*period_ns;
+		}
+
+		if (g_tick_recorder != nullptr) {
+			RecordTick(late_ns, work_ns);
+		}
+
+		if (n_ticks >= ticks_per_publish) {
+			g_status.jitter_mean_us = 0.001*late_sum/n_ticks;
+			g_status.jitter_max_us = 0.001*late_max;
+			g_status.work_mean_us = 0.001*work_sum/n_ticks;
+			g_status.work_max_us = 0.001*work_max;
+			g_status.overruns = overruns;
+			g_status.clock_drift_ppm = teensy_port->clock_sync_.drift_ppm();
+			g_status.usb_latency_us = teensy_port->clock_sync_.latency_us();
+			g_status.usb_latency_max_us = teensy_port->clock_sync_.latency_max_us();
+			g_status.accel_dropped = teensy_port->samples_dropped_;
+			n_ticks = late_sum = late_max = work_sum = work_max = 0;
+		}
+
+		// Publish the status for the commander server
+		g_status.loop_counter = loop_counter;
+		g_status.loop_status = g_ctrl.mode;
+		g_status_snapshot.Publish(g_status);
+		if (sysid_.TakeChanged()) {
+			g_sysid_snapshot.Publish(sysid_.results());
+		}
+
+		timespec deadline = NsToTimespec(deadline_ns);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
 		loop_counter++;
-		
 	}
 	teensy_port->ClosePort();
     delete teensy_port;
+	resonance_log.close();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,105 @@
+/*
+Simulation check of the system identification (SysId.cpp), with no hardware.
+
+A resonant plant, from a velocity to an acceleration,
+    G(s) = s*w^2/(s^2 + 2*zeta*w*s + w^2),
+is driven by each excitation type as the robot loop would: the excitation is held for
+each loop tick, and the response (plus noise, and gravity as on a vertical accelerometer)
+is sampled once per tick. The measured gain and phase are compared with G times the zero
+order hold, and the largest errors printed for each excitation.
+
+Usage: sysid_sim [resonance_hz] [zeta] [noise]
+Exits with 1 if an error is more than 5% in gain or 5 degrees in phase.
+*/
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include "SysId.h"
+
+using namespace std;
+
+const double TICK_S = 0.001;
+
+// Expected response: the plant times the zero order hold of one tick
+complex<double> Expected(double f, double f_res, double zeta) {
+    double w = 2*M_PI*f_res;
+    complex<double> s(0, 2*M_PI*f);
+    complex<double> plant = s*w*w/(s*s + 2*zeta*w*s + w*w);
+    complex<double> hold = (1.0 - exp(-s*TICK_S))/(s*TICK_S);
+    return plant*hold;
+}
+
+// Run one identification, returning 1 if it is outside the tolerances
+int Run(const SysIdConfig& config, double f_res, double zeta, double noise_rms, double tolerance) {
+    SysId sysid;
+    if (sysid.Start(config, 0)) {
+        return 1;
+    }
+    mt19937 rng(1);
+    normal_distribution<double> noise(0, noise_rms);
+    double w = 2*M_PI*f_res;
+    double x = 0, v = 0; // Plant state: filtered velocity and its derivative
+    const int substeps = 100;
+    double dt = TICK_S/substeps;
+    long long tick = 0;
+    while (sysid.running()) {
+        long long t_ns = tick*1000000LL;
+        sysid.AddSample(t_ns, 9.81 + v + noise(rng));
+        double u = sysid.Excitation(t_ns);
+        for (int i = 0; i < substeps; i++) {
+            // Semi-implicit Euler is stable for this, and accurate at 100 kHz
+            v += dt*(w*w*(u - x) - 2*zeta*w*v);
+            x += dt*v;
+        }
+        tick++;
+    }
+    const SysIdResults& r = sysid.results();
+    double max_gain_err = 0, max_phase_err = 0;
+    printf("%10s %10s %10s %10s %10s %8s\n", "freq_hz", "gain", "expected", "phase", "expected", "samples");
+    for (int k = 0; k < r.num_points; k++) {
+        const SysIdPoint& p = r.points[k];
+        complex<double> h = Expected(p.freq_hz, f_res, zeta);
+        double phase = arg(h)*180/M_PI;
+        double phase_err = remainder(p.phase_deg - phase, 360.0);
+        printf("%10.3f %10.4f %10.4f %10.2f %10.2f %8d\n", p.freq_hz, p.gain, abs(h), p.phase_deg, phase, p.samples);
+        max_gain_err = max(max_gain_err, fabs(p.gain/abs(h) - 1));
+        max_phase_err = max(max_phase_err, fabs(phase_err));
+    }
+    printf("%.1f s, largest errors %.2f%% in gain, %.2f degrees in phase\n\n",
+           tick*TICK_S, 100*max_gain_err, max_phase_err);
+    return max_gain_err > tolerance || max_phase_err > 100*tolerance;
+}
+
+int main(int argc, char* argv[]) {
+    double f_res = argc > 1 ? atof(argv[1]) : 20;
+    double zeta = argc > 2 ? atof(argv[2]) : 0.2;
+    double noise_rms = argc > 3 ? atof(argv[3]) : 0.002;
+    printf("Plant resonance %g Hz, zeta %g, noise %g rms\n\n", f_res, zeta, noise_rms);
+
+    SysIdConfig config;
+    config.amplitude = 0.01;
+    config.f_start = 1;
+    config.f_stop = 50;
+    config.num_freqs = 12;
+    int fail = 0;
+
+    printf("Stepped sine\n");
+    config.excitation = SYSID_STEPPED_SINE;
+    config.duration_s = 1;
+    fail |= Run(config, f_res, zeta, noise_rms, 0.05);
+
+    printf("Chirp\n");
+    config.excitation = SYSID_CHIRP;
+    config.duration_s = 60;
+    fail |= Run(config, f_res, zeta, noise_rms, 0.05);
+
+    printf("Multisine\n");
+    config.excitation = SYSID_MULTISINE;
+    config.duration_s = 10;
+    fail |= Run(config, f_res, zeta, noise_rms, 0.05);
+
+    printf(fail ? "FAIL\n" : "PASS\n");
+    return fail;
+}
@@ -22,6 +22,9 @@ extern double GLOB_SC_WINDOW_ALPHA; // Alpha parameter for fading memory
 extern double GLOB_SC_GD; // Group delay estimate
 extern double GLOB_SC_V2SNR; // V2 SNR estimate
 
+// Trial delays (um) of each row of the fringe envelope
+extern Eigen::ArrayXcd GLOB_SC_DELAYS;
+
 /* 
 Calculates the matrix of all trial delays vs wavelengths (10) and polarisations (2)
 Inputs:
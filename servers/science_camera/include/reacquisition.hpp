@@ -0,0 +1,132 @@
+#ifndef _SC_REACQUISITION_
+#define _SC_REACQUISITION_
+
+/* Fringe reacquisition planning for the group delay servo */
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <vector>
+
+/*
+Sign convention: a positive trial delay means the fringe packet lies at a LOWER
+SDC position (CA.SDCpos), as a positive CA.moveSDC step count decreases SDCpos.
+A delay d (um) seen at SDC position s therefore corresponds to the absolute
+position s - d/step_um.
+*/
+
+#define REACQ_SAWTOOTH 0 // Legacy expanding +/- sawtooth about the lock position
+#define REACQ_PLANNER 1 // Evidence based planner
+
+// Parameters for the reacquisition planner
+struct ReacqParams {
+    int mode = REACQ_PLANNER; // REACQ_SAWTOOTH or REACQ_PLANNER
+    double step_um = 0.02; // SDC step size in microns
+    int stepsize = 250; // Sawtooth step size (steps)
+    int range = 20000; // Maximum excursion from the lock position to search (steps)
+    double prior_sigma = 3000; // Width of the prior on the fringe position about the lock position (steps)
+    double weak_snr = 10; // Mean normalised envelope amplitude worth going back to
+    int min_coverage = 3; // Frames a bin must be seen in before it counts as explored
+    int history_len = 64; // Number of envelope peaks kept for the cluster fit
+    int fast_period = 100; // Stage period for jumps over explored delays (us per step)
+    int scan_period = 200; // Stage period when scanning unexplored delays (us per step)
+    int tolerance = 10; // Steps from a destination at which a move counts as done
+    double move_timeout = 5.0; // Seconds before giving up on reaching a destination
+};
+
+// One past envelope peak
+struct ReacqPeak {
+    double position; // Absolute SDC position of the peak (steps)
+    double snr; // V2 SNR of the frame
+    double time; // Time of the frame (s)
+};
+
+class ReacqPlanner {
+public:
+    /*
+    Inputs:
+        params - planner parameters
+        delays_um - trial delays of the fringe envelope (um), as used in calcTrialDelayMat
+    */
+    ReacqPlanner(const ReacqParams& params, const Eigen::ArrayXd& delays_um);
+
+    /*
+    Start a new reacquisition about the last locked position
+    Inputs:
+        lock_step - SDC position when the fringes were lost
+        time - current time (s)
+    */
+    void start(int32_t lock_step, double time);
+
+    // End the reacquisition (fringes found or servo stopped)
+    void stop();
+
+    bool active() const { return active_; }
+
+    /*
+    Add one frame of fringe envelope data.
+    Inputs:
+        sdc_step - SDC position for this frame
+        envelope - fringe envelope amplitude per trial delay (e.g. GLOB_SC_DELAY_AVE)
+        snr - V2 SNR of the frame (envelope peak/noise)
+        time - time of the frame (s)
+    */
+    void addMeasurement(int32_t sdc_step, const Eigen::MatrixXd& envelope, double snr, double time);
+
+    /*
+    Decide whether a new stage move is needed.
+    Inputs:
+        sdc_step - current SDC position
+        time - current time (s)
+    Outputs:
+        dest - absolute destination (SDCpos units)
+        period - stage period to use (us per step)
+        Returns true if a new move should be sent
+    */
+    bool nextMove(int32_t sdc_step, double time, int32_t& dest, int& period);
+
+    // Number of moves planned since start()
+    int numMoves() const { return num_moves_; }
+
+    // Most likely fringe position from the peak history (valid if returns true)
+    bool fitLikelyPosition(double& position) const;
+
+    ReacqParams params;
+
+private:
+    bool nextSawtooth(int32_t sdc_step, int32_t& dest, int& period);
+    bool nextPlanned(int32_t sdc_step, int32_t& dest, int& period);
+    int binIndex(double position) const;
+    double binCentre(int b) const;
+    bool isExplored(int b) const { return coverage_[b] >= params.min_coverage; }
+    void setMove(int32_t dest, double time);
+
+    Eigen::ArrayXd delays_steps_; // Trial delays converted to SDC steps
+    double window_; // Half width of the delay window (steps)
+    int bin_width_; // Width of an evidence bin (steps)
+    int num_bins_;
+
+    bool active_ = false;
+    int32_t lock_step_ = 0;
+    double start_time_ = 0;
+
+    // Evidence grid over absolute SDC position, centred on the lock position
+    std::vector<float> coverage_; // Samples per bin
+    std::vector<float> evidence_; // Sum of normalised envelope amplitude per bin
+    std::vector<char> visited_; // Bins we have already centred on as candidates
+
+    // Ring buffer of envelope peaks
+    std::vector<ReacqPeak> history_;
+    int history_next_ = 0;
+    int history_count_ = 0;
+
+    // Current move
+    bool moving_ = false;
+    int32_t dest_ = 0;
+    double move_time_ = 0;
+    double last_time_ = 0;
+    int num_moves_ = 0;
+    int sawtooth_stage_ = 0;
+    int32_t sawtooth_pre_step_ = 0;
+};
+
+#endif // _SC_REACQUISITION_
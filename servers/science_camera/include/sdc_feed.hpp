@@ -0,0 +1,72 @@
+#ifndef _SC_SDCFEED_
+#define _SC_SDCFEED_
+
+/* Asynchronous SDC (fine delay stage) position feed and move queue */
+
+#include <commander/client/socket.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/*
+A background thread owning its own chief aux socket, which polls CA.SDCpos at
+a fixed period and sends any queued CA.moveSDC request straight away. The
+camera callback only reads the latest position and queues moves, so it never
+blocks on a round trip to the chief aux server.
+*/
+class SDCFeed {
+public:
+    /*
+    Inputs:
+        CA_TCP - chief aux server address
+        poll_period_ms - period between CA.SDCpos requests
+    */
+    SDCFeed(std::string CA_TCP, int poll_period_ms);
+    ~SDCFeed();
+
+    // Latest SDC position (CA.SDCpos units), 0 until the first poll returns
+    int32_t position() const { return position_.load(std::memory_order_acquire); }
+
+    // Whether a position has been received yet
+    bool valid() const { return update_ns_.load(std::memory_order_acquire) != 0; }
+
+    // Seconds since the position was last updated
+    double age() const;
+
+    /*
+    Queue a relative move (CA.moveSDC units). Replaces any move not yet sent.
+    Inputs:
+        num_steps - steps to move
+        period - stage period (us per step)
+    */
+    void move(int32_t num_steps, uint16_t period);
+
+    /*
+    Queue a move to an absolute SDCpos position, relative to the latest
+    position. Positive CA.moveSDC steps decrease SDCpos.
+    Output:
+        returns 1 (and moves nothing) if no position has been received yet
+    */
+    int moveTo(int32_t dest, uint16_t period);
+
+private:
+    void run();
+
+    commander::client::Socket socket_;
+    int poll_period_ms_;
+    std::atomic<int32_t> position_{0};
+    std::atomic<int64_t> update_ns_{0};
+
+    std::mutex lock_;
+    std::condition_variable wake_;
+    bool move_pending_ = false;
+    int32_t move_steps_ = 0;
+    uint16_t move_period_ = 0;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+#endif // _SC_SDCFEED_
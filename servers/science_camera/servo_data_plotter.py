@@ -1,23 +1,19 @@
-#Simple script to plot the GD servo data
+#Simple script to plot the GD servo data (binary telemetry written by SciCamServer)
 
-import csv
-import numpy as np
+import os
+import sys
 import matplotlib.pyplot as plt
 
-file = open("GD_servo_data_3.txt")
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "libs", "telemetry"))
+from read_telemetry import read_telemetry
 
-csvreader = csv.reader(file)
+filename = sys.argv[1] if len(sys.argv) > 1 else "GD_servo_data.tlm"
 
-rows = []
+data, header = read_telemetry(filename)
 
-for row in csvreader:
-    rows.append(row)
-    
-data = np.array(rows).astype(float)
+t = data["time"] - data["time"][0]
 
-cum_steps = np.cumsum(data[:,1])
-
-plt.plot(data[:,1]*20/1000)
+plt.plot(t, data["sdc_step"]*20/1000)
+plt.xlabel("Time (s)")
+plt.ylabel("SDC position (um)")
 plt.show()
-
-
@@ -8,6 +8,9 @@
 #include "globals.h"
 #include "setup.hpp"
 #include "group_delay.hpp"
+#include "telemetry.hpp"
+#include "reacquisition.hpp"
+#include "sdc_feed.hpp"
 #include <Eigen/Dense>
 #include <chrono>
 #include <ctime>
@@ -58,13 +61,42 @@ int GLOB_SC_PRINT_COUNTER = 0; // Counter for printing
 int GLOB_SC_REACQ_FLAG = 0; // Start reacquisition?
 int GLOB_SC_REACQ_STAGE = 0; // How many reacuisition "sawtooths" have we done?
 int GLOB_SC_REACQ_CUR_STEP; // Current reaquisition step count
-int GLOB_SC_REACQ_PRE_STEP = 0; // Previous aquisition step count
+int GLOB_SC_REACQ_PRE_STEP = 0; // Step count when the fringes were lost
 int GLOB_SC_REACQ_STEPSIZE; // Reacquisition step size
 double GLOB_SC_REACQ_THRESHOLD; // Minimum threshold required to begin acquisition
+ReacqPlanner* GLOB_SC_REACQ; // Reacquisition planner
+SDCFeed* SDC_FEED; // Asynchronous SDC position feed and move queue
+
+// Binary log of every servo correction (read with libs/telemetry/read_telemetry.py)
+telemetry::Logger GLOB_SC_SERVO_LOG("gd_servo", {{"gd", telemetry::F64}, {"sdc_step", telemetry::I32},
+                                                 {"v2snr", telemetry::F64}, {"period", telemetry::U16}});
 
 // Timer
 std::chrono::time_point<std::chrono::system_clock> GLOB_SC_PREVIOUS = std::chrono::system_clock::now();
 
+/*
+One frame of reacquisition: pass the current fringe envelope to the planner and
+send any move it asks for through the SDC feed.
+Inputs:
+    time - current time (s)
+*/
+void reacquisitionStep(double time){
+    // The envelope is recorded against the stage position, so wait for the first one
+    if (!SDC_FEED->valid()){
+        return;
+    }
+    GLOB_SC_REACQ->addMeasurement(GLOB_SC_REACQ_CUR_STEP, GLOB_SC_DELAY_AVE, GLOB_SC_V2SNR, time);
+    int32_t dest_step;
+    int period;
+    if (GLOB_SC_REACQ->nextMove(GLOB_SC_REACQ_CUR_STEP, time, dest_step, period)){
+        SDC_FEED->moveTo(dest_step, period);
+        pthread_mutex_lock(&GLOB_SC_FLAG_LOCK);
+        GLOB_SC_REACQ_STAGE = GLOB_SC_REACQ->numMoves();
+        pthread_mutex_unlock(&GLOB_SC_FLAG_LOCK);
+        std::cout << "Reacq move " << GLOB_SC_REACQ_STAGE << " to " << dest_step << std::endl;
+    }
+}
+
 /*
 Callback function to do various science camera tasks:
 - Darks
@@ -164,6 +196,10 @@ int GroupDelayCallback (unsigned short* data){
         
         // Otherwise, let's servo!
         } else if (GLOB_SC_SERVO_FLAG){
+            double now = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+            // Latest stage position from the asynchronous feed (no round trip to the chief aux)
+            GLOB_SC_REACQ_CUR_STEP = SDC_FEED->position();
+
             // If we have a high SNR
             if (GLOB_SC_V2SNR > GLOB_SC_REACQ_THRESHOLD){
 
@@ -172,38 +208,15 @@ int GroupDelayCallback (unsigned short* data){
                 if (GLOB_SC_REACQ_FLAG){
                     // If we are high enough to state we have found fringes again, end!
                     if (GLOB_SC_V2SNR > GLOB_SC_V2SNR_THRESHOLD){
-                        std::cout << "Ending Reacq" << std::endl;
+                        std::cout << "Ending Reacq after " << GLOB_SC_REACQ->numMoves() << " moves" << std::endl;
+                        GLOB_SC_REACQ->stop();
                         pthread_mutex_lock(&GLOB_SC_FLAG_LOCK);
                         GLOB_SC_REACQ_FLAG = 0;
                         GLOB_SC_REACQ_STAGE = 0;
                         pthread_mutex_unlock(&GLOB_SC_FLAG_LOCK);
                     // Otherwise, keep scanning for reacqisition
                     } else {
-                        GLOB_SC_REACQ_CUR_STEP = CA_SOCKET->send<int32_t>("CA.SDCpos"); // Get position
-                        // What position are we aiming for now?
-                        int32_t dest_step = GLOB_SC_REACQ_PRE_STEP + (2*(GLOB_SC_REACQ_STAGE%2)-1)*(GLOB_SC_REACQ_STAGE+1)*GLOB_SC_REACQ_STEPSIZE;
-                        std::cout << dest_step << std::endl;
-                        // A check as the current and destination steps may be slightly out
-                        // If we are at the destination, change to the next sawtooth motion
-                        if (abs(GLOB_SC_REACQ_CUR_STEP - dest_step) < 10){
-                            pthread_mutex_lock(&GLOB_SC_FLAG_LOCK);
-                            GLOB_SC_REACQ_STAGE += 1;
-                            pthread_mutex_unlock(&GLOB_SC_FLAG_LOCK);
-                            // Sawtooth movement
-                            if (GLOB_SC_REACQ_STAGE%2 == 0){
-                                // Move N steps forward quickly
-                                int32_t num_steps = static_cast<int32_t>((GLOB_SC_REACQ_STAGE+1)*GLOB_SC_REACQ_STEPSIZE);
-                                std::string result = CA_SOCKET->send<std::string>("CA.moveSDC", num_steps, 100);
-                            } else {
-                                // Scan N steps backwards slowly
-                                int32_t num_steps = static_cast<int32_t>(-(GLOB_SC_REACQ_STAGE+1)*GLOB_SC_REACQ_STEPSIZE);
-                                std::string result = CA_SOCKET->send<std::string>("CA.moveSDC", num_steps, GLOB_SC_SCAN_PERIOD);                     
-                            }
-                            pthread_mutex_lock(&GLOB_SC_FLAG_LOCK);
-                            GLOB_SC_REACQ_PRE_STEP = GLOB_SC_REACQ_CUR_STEP;
-                            pthread_mutex_unlock(&GLOB_SC_FLAG_LOCK);
-                        }
-                        
+                        reacquisitionStep(now);
                     }
                  /////////////////// END REACQUISITION /////////////////////////
 
@@ -218,63 +231,29 @@ int GroupDelayCallback (unsigned short* data){
                     if (period < 100){
                         period = 100;
                     }
-                    // Set step count
-                    GLOB_SC_REACQ_CUR_STEP = CA_SOCKET->send<int32_t>("CA.SDCpos");
                     // Send to stage
-                    std::string result = CA_SOCKET->send<std::string>("CA.moveSDC", num_steps, period);
+                    SDC_FEED->move(num_steps, period);
                     
-                    // Send data to file
-                    std::ofstream myfile;
-                    myfile.open ("GD_servo_data.txt",std::ios_base::app);
-                    myfile << GLOB_SC_GD << "," << GLOB_SC_REACQ_CUR_STEP << "\n";
-                    myfile.close();
+                    // Send data to the telemetry log
+                    GLOB_SC_SERVO_LOG.log(GLOB_SC_GD, GLOB_SC_REACQ_CUR_STEP, GLOB_SC_V2SNR, period);
                 }
 
             // Otherwise, we have our SNR dropped low and so need to reacquire    
             } else if (GLOB_SC_V2SNR <= GLOB_SC_REACQ_THRESHOLD){
                 /////////////////// REACQUISITION /////////////////////////
-                // Are we already reacquiring?
-                if (GLOB_SC_REACQ_FLAG){
-                    GLOB_SC_REACQ_CUR_STEP = CA_SOCKET->send<int32_t>("CA.SDCpos"); // Get position
-                    // What position are we aiming for now?
-                    int32_t dest_step = GLOB_SC_REACQ_PRE_STEP + (2*(GLOB_SC_REACQ_STAGE%2)-1)*(GLOB_SC_REACQ_STAGE+1)*GLOB_SC_REACQ_STEPSIZE;
-                    std::cout << dest_step << std::endl;
-                    // A check as the current and destination steps may be slightly out
-                    // If we are at the destination, change to the next sawtooth motion
-                    if (abs(GLOB_SC_REACQ_CUR_STEP - dest_step) < 10){
-                        pthread_mutex_lock(&GLOB_SC_FLAG_LOCK);
-                        GLOB_SC_REACQ_STAGE += 1;
-                        pthread_mutex_unlock(&GLOB_SC_FLAG_LOCK);
-                        // Sawtooth movement
-                        if (GLOB_SC_REACQ_STAGE%2 == 0){
-                            // Move N steps forward quickly
-                            int32_t num_steps = static_cast<int32_t>((GLOB_SC_REACQ_STAGE+1)*GLOB_SC_REACQ_STEPSIZE);
-                            std::string result = CA_SOCKET->send<std::string>("CA.moveSDC", num_steps, 100);
-                        } else {
-                            // Scan N steps backwards slowly
-                            int32_t num_steps = static_cast<int32_t>(-(GLOB_SC_REACQ_STAGE+1)*GLOB_SC_REACQ_STEPSIZE);
-                            std::string result = CA_SOCKET->send<std::string>("CA.moveSDC", num_steps, GLOB_SC_SCAN_PERIOD);              
-                        }
-                        pthread_mutex_lock(&GLOB_SC_FLAG_LOCK);
-                        GLOB_SC_REACQ_PRE_STEP = GLOB_SC_REACQ_CUR_STEP;
-                        pthread_mutex_unlock(&GLOB_SC_FLAG_LOCK);
-                    }
-
-                // Otherwise, start the reacquisition sequence
-                } else{
-                    std::cout << "Starting Reacq" << std::endl;   
-                    GLOB_SC_REACQ_CUR_STEP = CA_SOCKET->send<int32_t>("CA.SDCpos"); // Get position
+                // If we are not already reacquiring, start the reacquisition about the last
+                // position (once the SDC feed has one)
+                if (!GLOB_SC_REACQ_FLAG && SDC_FEED->valid()){
+                    std::cout << "Starting Reacq" << std::endl;
+                    GLOB_SC_REACQ->start(GLOB_SC_REACQ_CUR_STEP, now);
                     // Setup flags
                     pthread_mutex_lock(&GLOB_SC_FLAG_LOCK);
                     GLOB_SC_REACQ_FLAG = 1;
                     GLOB_SC_REACQ_STAGE = 0;
                     GLOB_SC_REACQ_PRE_STEP = GLOB_SC_REACQ_CUR_STEP;
                     pthread_mutex_unlock(&GLOB_SC_FLAG_LOCK);
-                    // Move N steps forward
-                    int32_t num_steps = static_cast<int32_t>((GLOB_SC_REACQ_STAGE+1)*GLOB_SC_REACQ_STEPSIZE);
-                    std::string result = CA_SOCKET->send<std::string>("CA.moveSDC", num_steps, 100);
-                    cout << result << endl;
                 }
+                reacquisitionStep(now);
                 /////////////////// END REACQUISITION /////////////////////////
             }  
         }
@@ -313,6 +292,10 @@ struct SciCam: QHYCameraServer{
 
         P2VM_file = config["ScienceCamera"]["P2VM_file"].value_or("config/P2VM_calibration.csv");
 
+        // Servo telemetry, one file per server run
+        std::string servo_log = config["ScienceCamera"]["servo_log_prefix"].value_or("data/GD_servo_data");
+        GLOB_SC_SERVO_LOG.open(telemetry::timestampedFilename(servo_log));
+
         // Turn into a TCPString
         std::string CA_TCP = "tcp://" + IP + ":" + CA_port;
         std::string TS_TCP = "tcp://" + TS_IP + ":" + TS_port;
@@ -343,6 +326,18 @@ struct SciCam: QHYCameraServer{
         // Calculate the trial delay matrix
         calcTrialDelayMat(numDelays,delaySize);
 
+        // Reacquisition planner and the asynchronous SDC feed
+        ReacqParams reacq_params;
+        std::string reacq_mode = config["ScienceCamera"]["reacq_mode"].value_or("planner");
+        reacq_params.mode = (reacq_mode == "sawtooth") ? REACQ_SAWTOOTH : REACQ_PLANNER;
+        reacq_params.stepsize = GLOB_SC_REACQ_STEPSIZE;
+        reacq_params.scan_period = GLOB_SC_SCAN_PERIOD;
+        reacq_params.range = config["ScienceCamera"]["reacq_range"].value_or(20000);
+        reacq_params.prior_sigma = config["ScienceCamera"]["reacq_prior_sigma"].value_or(3000.0);
+        reacq_params.weak_snr = config["ScienceCamera"]["reacq_weak_snr"].value_or(0.5*GLOB_SC_REACQ_THRESHOLD);
+        GLOB_SC_REACQ = new ReacqPlanner(reacq_params, GLOB_SC_DELAYS.real());
+        SDC_FEED = new SDCFeed(CA_TCP, config["ScienceCamera"]["SDC_poll_period"].value_or(20));
+
         // Set the wavelength offsets
         for(int k=0;k<6;k++){
             GLOB_SC_CAL.wave_offset[k] = config["ScienceCamera"]["wave_offsets"][k].value_or(0); 
@@ -356,6 +351,8 @@ struct SciCam: QHYCameraServer{
     }
 
     ~SciCam(){
+        delete SDC_FEED;
+        delete GLOB_SC_REACQ;
         delete CA_SOCKET;
         delete TS_SOCKET;
     }
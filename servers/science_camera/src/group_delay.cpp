@@ -20,7 +20,7 @@ double GLOB_SC_GD = 0.0;
 double GLOB_SC_V2SNR = 0.0;
 
 // Current delays
-Eigen::ArrayXcd delays;
+Eigen::ArrayXcd GLOB_SC_DELAYS;
 
 // Functions to take the median of an array 
 template<typename Derived>
@@ -54,11 +54,11 @@ int calcTrialDelayMat(int numDelays, double delaySize){
 
     double edge = static_cast<double>(numDelays)*delaySize*0.5;
 
-    delays = Eigen::ArrayXcd::LinSpaced(numDelays, -edge, edge);
+    GLOB_SC_DELAYS = Eigen::ArrayXcd::LinSpaced(numDelays, -edge, edge);
 
     for(int k=0;k<numDelays;k++){
         for(int l=0;l<10;l++){
-            Cd num = 2*kPi*I*delays(k)/GLOB_SC_CAL.wavelengths[l];
+            Cd num = 2*kPi*I*GLOB_SC_DELAYS(k)/GLOB_SC_CAL.wavelengths[l];
             phasors(k,l) = num;
             phasors(k,l+10) = num;
         }
@@ -168,7 +168,7 @@ int calcGroupDelay(unsigned short* data){
     GLOB_SC_V2SNR = abs(maxAmp)/noise;
 
     // Estimate group delay
-    GLOB_SC_GD = delays(maxRow,maxCol).real();
+    GLOB_SC_GD = GLOB_SC_DELAYS(maxRow,maxCol).real();
 
     return 0;
 }
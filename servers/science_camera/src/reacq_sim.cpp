@@ -0,0 +1,165 @@
+/*
+Offline simulator for the fringe reacquisition planner.
+
+Simulates a loss of lock (the fringe packet jumps by a random offset from the
+last locked SDC position and then random walks), a stage with finite speed, a
+position feed that is only updated every poll period, and noisy synthetic
+fringe envelopes at the camera frame rate. Each trial is run with both the
+legacy sawtooth and the planner, and the time to relock is reported.
+
+Usage:
+    reacq_sim [num_trials] [jump_sigma (steps)] [seed]
+*/
+
+#include "reacquisition.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// Simulation parameters
+struct SimParams {
+    int num_delays = 1000; // Trial delays
+    double delay_size = 0.03; // Trial delay spacing (um)
+    double fps = 200; // Camera frame rate
+    double poll_period = 0.02; // SDC position feed period (s)
+    double coherence = 2.0; // Half width of the fringe envelope (um)
+    double fringe_snr = 60; // Envelope peak when on the fringes
+    double lock_snr = 30; // SNR at which we count the fringes as found
+    double jump_sigma = 3000; // Std of the fringe jump on loss of lock (steps)
+    double drift = 50; // Random walk of the fringe position (steps/sqrt(s))
+    double timeout = 120; // Give up after this long (s)
+};
+
+struct TrialResult {
+    bool found;
+    double time;
+    int moves;
+};
+
+/*
+Run one reacquisition trial.
+Inputs:
+    sim - simulation parameters
+    params - planner parameters
+    delays_um - trial delays
+    jump - fringe jump from the lock position (steps)
+    seed - noise seed (the same for both modes)
+Output:
+    Time to relock and number of moves
+*/
+TrialResult runTrial(const SimParams& sim, const ReacqParams& params, const Eigen::ArrayXd& delays_um,
+                     double jump, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::exponential_distribution<double> noise(1.0);
+    std::normal_distribution<double> gauss(0.0, 1.0);
+
+    ReacqPlanner planner(params, delays_um);
+    const double dt = 1.0/sim.fps;
+    const int32_t lock_step = 0;
+
+    double pos = lock_step; // True stage position
+    double stage_dest = pos;
+    double stage_speed = 0; // Steps per second
+    double feed_pos = pos; // Last position reported by the feed
+    double last_poll = 0;
+    double fringe = lock_step + jump; // True fringe position
+
+    Eigen::MatrixXd envelope(delays_um.size(), 1);
+    planner.start(lock_step, 0.0);
+
+    for (double t = 0; t < sim.timeout; t += dt) {
+        // Move the stage and the fringes
+        double step = stage_speed*dt;
+        if (std::abs(stage_dest - pos) <= step) {
+            pos = stage_dest;
+        } else {
+            pos += std::copysign(step, stage_dest - pos);
+        }
+        fringe += sim.drift*std::sqrt(dt)*gauss(rng);
+        if (t - last_poll >= sim.poll_period) {
+            feed_pos = pos;
+            last_poll = t;
+        }
+
+        // Synthetic envelope: fringe delay seen at the current position, plus exponential noise
+        double d0 = (pos - fringe)*params.step_um;
+        for (Eigen::Index k = 0; k < delays_um.size(); k++) {
+            double x = (delays_um(k) - d0)/sim.coherence;
+            double signal = (std::abs(x) < 4) ? sim.fringe_snr*std::exp(-x*x) : 0.0;
+            envelope(k) = signal + noise(rng);
+        }
+        double snr = envelope.maxCoeff();
+        if (snr > sim.lock_snr) {
+            return {true, t, planner.numMoves()};
+        }
+
+        int32_t feed_step = static_cast<int32_t>(std::lround(feed_pos));
+        planner.addMeasurement(feed_step, envelope, snr, t);
+        int32_t dest;
+        int period;
+        if (planner.nextMove(feed_step, t, dest, period)) {
+            // As SDCFeed::moveTo: relative to the (stale) feed position
+            stage_dest = pos + (dest - feed_step);
+            stage_speed = 1e6/period;
+        }
+    }
+    return {false, sim.timeout, planner.numMoves()};
+}
+
+double percentile(std::vector<double> v, double p) {
+    if (v.empty()) {
+        return 0;
+    }
+    std::sort(v.begin(), v.end());
+    size_t i = static_cast<size_t>(p*(v.size() - 1));
+    return v[i];
+}
+
+int main(int argc, char* argv[]) {
+    SimParams sim;
+    int num_trials = 50;
+    unsigned seed = 1;
+    if (argc > 1) num_trials = atoi(argv[1]);
+    if (argc > 2) sim.jump_sigma = atof(argv[2]);
+    if (argc > 3) seed = atoi(argv[3]);
+
+    double edge = sim.num_delays*sim.delay_size*0.5;
+    Eigen::ArrayXd delays_um = Eigen::ArrayXd::LinSpaced(sim.num_delays, -edge, edge);
+
+    ReacqParams params;
+    params.weak_snr = 12;
+
+    std::mt19937 rng(seed);
+    std::normal_distribution<double> jump_dist(0.0, sim.jump_sigma);
+    std::vector<double> jumps;
+    std::vector<unsigned> seeds;
+    for (int i = 0; i < num_trials; i++) {
+        jumps.push_back(std::clamp(jump_dist(rng), -0.9*params.range, 0.9*params.range));
+        seeds.push_back(rng());
+    }
+
+    std::cout << "Trials: " << num_trials << ", jump sigma: " << sim.jump_sigma << " steps, frame rate: "
+              << sim.fps << " Hz" << std::endl;
+    const char* names[2] = {"sawtooth", "planner"};
+    for (int mode : {REACQ_SAWTOOTH, REACQ_PLANNER}) {
+        params.mode = mode;
+        std::vector<double> times;
+        int found = 0;
+        double moves = 0;
+        for (int i = 0; i < num_trials; i++) {
+            TrialResult r = runTrial(sim, params, delays_um, jumps[i], seeds[i]);
+            times.push_back(r.time);
+            found += r.found;
+            moves += r.moves;
+        }
+        std::cout << names[mode] << ": found " << found << "/" << num_trials
+                  << ", relock time median " << percentile(times, 0.5)
+                  << " s, 90% " << percentile(times, 0.9)
+                  << " s, max " << percentile(times, 1.0)
+                  << " s, mean moves " << moves/num_trials << std::endl;
+    }
+    return 0;
+}
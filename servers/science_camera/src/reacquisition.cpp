@@ -0,0 +1,275 @@
+// Fringe reacquisition planner
+
+#include "reacquisition.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+ReacqPlanner::ReacqPlanner(const ReacqParams& params_in, const Eigen::ArrayXd& delays_um)
+    : params(params_in) {
+    delays_steps_ = delays_um/params.step_um;
+    window_ = delays_steps_.abs().maxCoeff();
+    bin_width_ = std::max(1, static_cast<int>(window_/4));
+    num_bins_ = 2*params.range/bin_width_ + 1;
+    coverage_.assign(num_bins_, 0);
+    evidence_.assign(num_bins_, 0);
+    visited_.assign(num_bins_, 0);
+    history_.resize(params.history_len);
+}
+
+/*
+Start a new reacquisition about the last locked position
+Inputs:
+    lock_step - SDC position when the fringes were lost
+    time - current time (s)
+*/
+void ReacqPlanner::start(int32_t lock_step, double time) {
+    lock_step_ = lock_step;
+    start_time_ = time;
+    last_time_ = time;
+    std::fill(coverage_.begin(), coverage_.end(), 0);
+    std::fill(evidence_.begin(), evidence_.end(), 0);
+    std::fill(visited_.begin(), visited_.end(), 0);
+    history_next_ = 0;
+    history_count_ = 0;
+    moving_ = false;
+    num_moves_ = 0;
+    sawtooth_stage_ = 0;
+    sawtooth_pre_step_ = lock_step;
+    active_ = true;
+}
+
+void ReacqPlanner::stop() {
+    active_ = false;
+    moving_ = false;
+}
+
+int ReacqPlanner::binIndex(double position) const {
+    double offset = position - (lock_step_ - params.range);
+    if (offset < 0) {
+        return -1;
+    }
+    int b = static_cast<int>(offset/bin_width_);
+    return b < num_bins_ ? b : -1;
+}
+
+double ReacqPlanner::binCentre(int b) const {
+    return lock_step_ - params.range + (b + 0.5)*bin_width_;
+}
+
+/*
+Add one frame of fringe envelope data. Each bin of absolute SDC position inside
+the delay window gets one coverage count and the mean normalised envelope
+amplitude (peak normalised to the SNR) of its samples.
+*/
+void ReacqPlanner::addMeasurement(int32_t sdc_step, const Eigen::MatrixXd& envelope, double snr, double time) {
+    if (!active_) {
+        return;
+    }
+    last_time_ = time;
+
+    Eigen::Index max_row, max_col;
+    double max_amp = envelope.maxCoeff(&max_row, &max_col);
+    double scale = max_amp > 0 ? snr/max_amp : 0.0;
+
+    // Delays are monotonic, so consecutive samples fall in the same bin
+    int cur_bin = -1;
+    double sum = 0;
+    int count = 0;
+    for (Eigen::Index k = 0; k < delays_steps_.size(); k++) {
+        int b = binIndex(sdc_step - delays_steps_(k));
+        if (b != cur_bin) {
+            if (cur_bin >= 0 && count > 0) {
+                coverage_[cur_bin] += 1;
+                evidence_[cur_bin] += sum/count;
+            }
+            cur_bin = b;
+            sum = 0;
+            count = 0;
+        }
+        sum += envelope(k)*scale;
+        count++;
+    }
+    if (cur_bin >= 0 && count > 0) {
+        coverage_[cur_bin] += 1;
+        evidence_[cur_bin] += sum/count;
+    }
+
+    // Keep the envelope peak for the cluster fit
+    if (!history_.empty()) {
+        history_[history_next_] = {sdc_step - delays_steps_(max_row), snr, time};
+        history_next_ = (history_next_ + 1) % history_.size();
+        history_count_ = std::min(history_count_ + 1, static_cast<int>(history_.size()));
+    }
+}
+
+/*
+Fit the most likely fringe position from the recent envelope peaks: the SNR
+weighted mean of the peaks above weak_snr, provided there are at least three
+and they agree to within half the delay window.
+*/
+bool ReacqPlanner::fitLikelyPosition(double& position) const {
+    double sum_w = 0, sum_wx = 0, sum_wxx = 0;
+    int n = 0;
+    for (int i = 0; i < history_count_; i++) {
+        const ReacqPeak& p = history_[i];
+        if (p.snr >= params.weak_snr) {
+            sum_w += p.snr;
+            sum_wx += p.snr*p.position;
+            sum_wxx += p.snr*p.position*p.position;
+            n++;
+        }
+    }
+    if (n < 3 || sum_w <= 0) {
+        return false;
+    }
+    double mean = sum_wx/sum_w;
+    double var = sum_wxx/sum_w - mean*mean;
+    if (var > 0.25*window_*window_) {
+        return false;
+    }
+    position = mean;
+    return true;
+}
+
+void ReacqPlanner::setMove(int32_t dest, double time) {
+    moving_ = true;
+    dest_ = dest;
+    move_time_ = time;
+    num_moves_++;
+}
+
+/*
+Decide whether a new stage move is needed. A strong candidate from the peak
+history interrupts any move in progress; otherwise we wait for the current
+move to finish (or time out) before planning the next.
+*/
+bool ReacqPlanner::nextMove(int32_t sdc_step, double time, int32_t& dest, int& period) {
+    if (!active_) {
+        return false;
+    }
+
+    if (params.mode == REACQ_PLANNER) {
+        double likely;
+        if (fitLikelyPosition(likely)) {
+            int b = binIndex(likely);
+            if (b >= 0 && !visited_[b]) {
+                visited_[b] = 1;
+                dest = static_cast<int32_t>(std::lround(likely));
+                period = params.scan_period;
+                setMove(dest, time);
+                return true;
+            }
+        }
+    }
+
+    if (moving_) {
+        if (std::abs(sdc_step - dest_) <= params.tolerance || time - move_time_ > params.move_timeout) {
+            moving_ = false;
+        } else {
+            return false;
+        }
+    }
+
+    bool ret;
+    if (params.mode == REACQ_SAWTOOTH) {
+        ret = nextSawtooth(sdc_step, dest, period);
+    } else {
+        ret = nextPlanned(sdc_step, dest, period);
+    }
+    if (ret) {
+        setMove(dest, time);
+    }
+    return ret;
+}
+
+/*
+Legacy expanding sawtooth: quickly jump (N+1) step sizes down in SDCpos, then
+scan back slowly, growing by one step size each time.
+*/
+bool ReacqPlanner::nextSawtooth(int32_t sdc_step, int32_t& dest, int& period) {
+    if (num_moves_ > 0) {
+        sawtooth_stage_++;
+        sawtooth_pre_step_ = sdc_step;
+    }
+    int32_t length = (sawtooth_stage_ + 1)*params.stepsize;
+    if (sawtooth_stage_%2 == 0) {
+        dest = sawtooth_pre_step_ - length;
+        period = params.fast_period;
+    } else {
+        dest = sawtooth_pre_step_ + length;
+        period = params.scan_period;
+    }
+    return true;
+}
+
+/*
+Evidence based planning:
+1) Go back to any explored bin whose mean normalised amplitude is above
+   weak_snr and which we have not centred on yet.
+2) Otherwise move just far enough to bring the cheapest unexplored bin into the
+   delay window, where the cost is the prior (Gaussian about the lock position)
+   plus the travel distance.
+3) If everything within range has been explored, start again.
+*/
+bool ReacqPlanner::nextPlanned(int32_t sdc_step, int32_t& dest, int& period) {
+    int best = -1;
+    double best_val = params.weak_snr;
+    for (int b = 0; b < num_bins_; b++) {
+        if (isExplored(b) && !visited_[b]) {
+            double mean = evidence_[b]/coverage_[b];
+            if (mean >= best_val) {
+                best_val = mean;
+                best = b;
+            }
+        }
+    }
+    if (best >= 0) {
+        visited_[best] = 1;
+        dest = static_cast<int32_t>(std::lround(binCentre(best)));
+        period = params.scan_period;
+        return true;
+    }
+
+    best = -1;
+    double best_cost = 0;
+    for (int b = 0; b < num_bins_; b++) {
+        if (isExplored(b)) {
+            continue;
+        }
+        double c = binCentre(b);
+        double prior = (c - lock_step_)/params.prior_sigma;
+        double cost = 0.5*prior*prior + std::abs(c - sdc_step)/params.prior_sigma;
+        if (best < 0 || cost < best_cost) {
+            best_cost = cost;
+            best = b;
+        }
+    }
+    if (best < 0) {
+        std::fill(coverage_.begin(), coverage_.end(), 0);
+        std::fill(evidence_.begin(), evidence_.end(), 0);
+        std::fill(visited_.begin(), visited_.end(), 0);
+        return false;
+    }
+
+    double c = binCentre(best);
+    double distance = c - sdc_step;
+    double reach = window_ - bin_width_;
+    // Already in the window: stay put until it has been seen enough
+    if (std::abs(distance) <= reach) {
+        return false;
+    }
+    dest = static_cast<int32_t>(std::lround(c - std::copysign(reach, distance)));
+
+    // Jump quickly if most of the way has already been explored
+    int b0 = binIndex(std::min<double>(sdc_step, dest));
+    int b1 = binIndex(std::max<double>(sdc_step, dest));
+    if (b0 < 0) b0 = 0;
+    if (b1 < 0) b1 = num_bins_ - 1;
+    int explored = 0;
+    for (int b = b0; b <= b1; b++) {
+        explored += isExplored(b);
+    }
+    period = (2*explored > b1 - b0 + 1) ? params.fast_period : params.scan_period;
+    return true;
+}
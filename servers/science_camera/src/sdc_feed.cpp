@@ -0,0 +1,84 @@
+// Asynchronous SDC position feed
+
+#include "sdc_feed.hpp"
+#include <chrono>
+#include <iostream>
+
+static int64_t steadyNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+SDCFeed::SDCFeed(std::string CA_TCP, int poll_period_ms)
+    : socket_(CA_TCP), poll_period_ms_(poll_period_ms) {
+    thread_ = std::thread(&SDCFeed::run, this);
+}
+
+SDCFeed::~SDCFeed() {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stopping_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+}
+
+double SDCFeed::age() const {
+    return (steadyNs() - update_ns_.load(std::memory_order_acquire))*1e-9;
+}
+
+void SDCFeed::move(int32_t num_steps, uint16_t period) {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        move_pending_ = true;
+        move_steps_ = num_steps;
+        move_period_ = period;
+    }
+    wake_.notify_one();
+}
+
+int SDCFeed::moveTo(int32_t dest, uint16_t period) {
+    // Without a position, the move would be relative to 0 rather than to the stage
+    if (!valid()) {
+        std::cout << "SDC feed: no position yet, not moving to " << dest << std::endl;
+        return 1;
+    }
+    move(position() - dest, period);
+    return 0;
+}
+
+/*
+Feed thread: send a queued move as soon as it arrives, otherwise poll the
+position every poll_period_ms.
+*/
+void SDCFeed::run() {
+    std::unique_lock<std::mutex> guard(lock_);
+    while (!stopping_) {
+        if (move_pending_) {
+            int32_t num_steps = move_steps_;
+            uint16_t period = move_period_;
+            move_pending_ = false;
+            guard.unlock();
+            try {
+                socket_.send<std::string>("CA.moveSDC", num_steps, period);
+            } catch (std::exception& e) {
+                std::cout << "SDC feed: moveSDC failed: " << e.what() << std::endl;
+            }
+            guard.lock();
+            continue;
+        }
+
+        guard.unlock();
+        try {
+            int32_t pos = socket_.send<int32_t>("CA.SDCpos");
+            position_.store(pos, std::memory_order_release);
+            update_ns_.store(steadyNs(), std::memory_order_release);
+        } catch (std::exception& e) {
+            std::cout << "SDC feed: SDCpos failed: " << e.what() << std::endl;
+        }
+        guard.lock();
+
+        wake_.wait_for(guard, std::chrono::milliseconds(poll_period_ms_),
+                       [this]{ return stopping_ || move_pending_; });
+    }
+}